@@ -21,6 +21,8 @@
 #include <config.h>
 #endif
 
+#include <assert.h>
+
 #include <rdr/BufferedInStream.h>
 #include <rdr/Exception.h>
 
@@ -30,7 +32,7 @@ static const size_t DEFAULT_BUF_SIZE = 8192;
 static const size_t MAX_BUF_SIZE = 4 * 1024 * 1024;
 
 BufferedInStream::BufferedInStream()
-  : bufSize(DEFAULT_BUF_SIZE), offset(0)
+  : bufSize(DEFAULT_BUF_SIZE), offset(0), retainCount(0)
 {
   ptr = end = start = new U8[bufSize];
   gettimeofday(&lastSizeCheck, NULL);
@@ -40,6 +42,11 @@ BufferedInStream::BufferedInStream()
 BufferedInStream::~BufferedInStream()
 {
   delete [] start;
+
+  while (!retiredBuffers.empty()) {
+    delete [] retiredBuffers.front().data;
+    retiredBuffers.pop_front();
+  }
 }
 
 size_t BufferedInStream::pos()
@@ -47,6 +54,72 @@ size_t BufferedInStream::pos()
   return offset + ptr - start;
 }
 
+const U8* BufferedInStream::retain(size_t length)
+{
+  const U8* data;
+
+  if (length > avail())
+    throw Exception("BufferedInStream buffer underrun");
+
+  // Nothing to hold on to, and ptr might be just past the end of the
+  // buffer
+  if (length == 0)
+    return NULL;
+
+  data = ptr;
+  ptr += length;
+
+  retainCount++;
+
+  return data;
+}
+
+void BufferedInStream::release(const U8* data)
+{
+  std::list<RetiredBuffer>::iterator iter;
+
+  if (data == NULL)
+    return;
+
+  if ((data >= start) && (data < start + bufSize)) {
+    assert(retainCount > 0);
+    retainCount--;
+    return;
+  }
+
+  for (iter = retiredBuffers.begin(); iter != retiredBuffers.end(); ++iter) {
+    if ((data < iter->data) || (data >= iter->data + iter->size))
+      continue;
+
+    assert(iter->retainCount > 0);
+    iter->retainCount--;
+    if (iter->retainCount == 0) {
+      delete [] iter->data;
+      retiredBuffers.erase(iter);
+    }
+    return;
+  }
+
+  throw Exception("BufferedInStream: released data that was not retained");
+}
+
+void BufferedInStream::retireBuffer()
+{
+  RetiredBuffer buffer;
+
+  if (retainCount == 0) {
+    delete [] start;
+    return;
+  }
+
+  buffer.data = start;
+  buffer.size = bufSize;
+  buffer.retainCount = retainCount;
+  retiredBuffers.push_back(buffer);
+
+  retainCount = 0;
+}
+
 bool BufferedInStream::overrun(size_t needed)
 {
   struct timeval now;
@@ -66,7 +139,7 @@ bool BufferedInStream::overrun(size_t needed)
 
     newBuffer = new U8[newSize];
     memcpy(newBuffer, ptr, end - ptr);
-    delete [] start;
+    retireBuffer();
     bufSize = newSize;
 
     offset += ptr - start;
@@ -83,6 +156,7 @@ bool BufferedInStream::overrun(size_t needed)
   // Time to shrink an excessive buffer?
   gettimeofday(&now, NULL);
   if ((avail() == 0) && (bufSize > DEFAULT_BUF_SIZE) &&
+      (retainCount == 0) &&
       ((now.tv_sec < lastSizeCheck.tv_sec) ||
        (now.tv_sec > (lastSizeCheck.tv_sec + 5)))) {
     if (peakUsage < (bufSize / 2)) {
@@ -104,11 +178,25 @@ bool BufferedInStream::overrun(size_t needed)
 
   // Do we need to shuffle things around?
   if ((bufSize - (ptr - start)) < needed) {
-    memmove(start, ptr, end - ptr);
-
-    offset += ptr - start;
-    end -= ptr - start;
-    ptr = start;
+    if (retainCount != 0) {
+      U8* newBuffer;
+
+      // Someone is still using the data at the start of the buffer,
+      // so move what's left to a fresh buffer instead
+      newBuffer = new U8[bufSize];
+      memcpy(newBuffer, ptr, end - ptr);
+      retireBuffer();
+
+      offset += ptr - start;
+      end = newBuffer + (end - ptr);
+      ptr = start = newBuffer;
+    } else {
+      memmove(start, ptr, end - ptr);
+
+      offset += ptr - start;
+      end -= ptr - start;
+      ptr = start;
+    }
   }
 
   while (avail() < needed) {
@@ -26,6 +26,8 @@
 
 #include <sys/time.h>
 
+#include <list>
+
 #include <rdr/InStream.h>
 
 namespace rdr {
@@ -37,16 +39,36 @@ namespace rdr {
 
     virtual size_t pos();
 
+    // retain() returns a pointer to the next length bytes and skips
+    // past them, without copying. The data is left untouched, even as
+    // more data is read, until release() is called with the same
+    // pointer. hasData() must have been called first. A length of zero
+    // gives NULL, which is fine to pass to release().
+    const U8* retain(size_t length);
+    void release(const U8* data);
+
   private:
     virtual bool fillBuffer(size_t maxSize) = 0;
 
     virtual bool overrun(size_t needed);
 
+    void retireBuffer();
+
   private:
     size_t bufSize;
     size_t offset;
     U8* start;
 
+    // Outstanding retain() calls for the current buffer, and older
+    // buffers that are only kept around because of retain()
+    size_t retainCount;
+    struct RetiredBuffer {
+      U8* data;
+      size_t size;
+      size_t retainCount;
+    };
+    std::list<RetiredBuffer> retiredBuffers;
+
     struct timeval lastSizeCheck;
     size_t peakUsage;
 
@@ -33,6 +33,7 @@
 #else
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <unistd.h>
 #endif
 
@@ -46,16 +47,45 @@
 
 using namespace rdr;
 
+// Anything beyond this is more than we should ever need, so such
+// descriptors are simply closed
+static const size_t maxReceivedFds = 4;
+
 FdInStream::FdInStream(int fd_, bool closeWhenDone_)
-  : fd(fd_), closeWhenDone(closeWhenDone_)
+  : fd(fd_), closeWhenDone(closeWhenDone_), acceptFds(false)
 {
 }
 
 FdInStream::~FdInStream()
 {
+  while (!receivedFds.empty())
+    close(takeFd());
+
   if (closeWhenDone) close(fd);
 }
 
+void FdInStream::setAcceptFds(bool enable)
+{
+#ifdef WIN32
+  if (enable)
+    throw Exception("Passing file descriptors is not supported");
+#endif
+  acceptFds = enable;
+}
+
+int FdInStream::takeFd()
+{
+  int result;
+
+  if (receivedFds.empty())
+    return -1;
+
+  result = receivedFds.front();
+  receivedFds.pop_front();
+
+  return result;
+}
+
 
 bool FdInStream::fillBuffer(size_t maxSize)
 {
@@ -98,6 +128,12 @@ size_t FdInStream::readFd(void* buf, size_t len)
     return 0;
 
   do {
+#ifndef WIN32
+    if (acceptFds) {
+      n = readWithFds(buf, len);
+      continue;
+    }
+#endif
     n = ::recv(fd, (char*)buf, len, 0);
   } while (n < 0 && errno == EINTR);
 
@@ -108,3 +144,61 @@ size_t FdInStream::readFd(void* buf, size_t len)
 
   return n;
 }
+
+#ifndef WIN32
+int FdInStream::readWithFds(void* buf, size_t len)
+{
+  struct msghdr msg;
+  struct iovec iov;
+  union {
+    struct cmsghdr align;
+    char buf[CMSG_SPACE(sizeof(int) * maxReceivedFds)];
+  } control;
+  struct cmsghdr* cmsg;
+  int flags;
+  int n;
+
+  iov.iov_base = buf;
+  iov.iov_len = len;
+
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control.buf;
+  msg.msg_controllen = sizeof(control.buf);
+
+  flags = 0;
+#ifdef MSG_CMSG_CLOEXEC
+  flags |= MSG_CMSG_CLOEXEC;
+#endif
+
+  n = recvmsg(fd, &msg, flags);
+  if (n < 0)
+    return n;
+
+  for (cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL;
+       cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+    size_t count;
+
+    if ((cmsg->cmsg_level != SOL_SOCKET) ||
+        (cmsg->cmsg_type != SCM_RIGHTS))
+      continue;
+
+    count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+    for (size_t i = 0; i < count; i++) {
+      int newFd;
+
+      memcpy(&newFd, CMSG_DATA(cmsg) + i * sizeof(int), sizeof(int));
+
+      if (receivedFds.size() >= maxReceivedFds) {
+        close(newFd);
+        continue;
+      }
+
+      receivedFds.push_back(newFd);
+    }
+  }
+
+  return n;
+}
+#endif
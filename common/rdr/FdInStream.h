@@ -23,6 +23,8 @@
 #ifndef __RDR_FDINSTREAM_H__
 #define __RDR_FDINSTREAM_H__
 
+#include <list>
+
 #include <rdr/BufferedInStream.h>
 
 namespace rdr {
@@ -36,13 +38,24 @@ namespace rdr {
 
     int getFd() { return fd; }
 
+    // setAcceptFds() makes the stream pick up file descriptors that
+    // are passed along with the data (Unix domain sockets only).
+    // takeFd() then returns them in the order they arrived, or -1 if
+    // there are none. The caller becomes responsible for closing them.
+    void setAcceptFds(bool enable);
+    int takeFd();
+
   private:
     virtual bool fillBuffer(size_t maxSize);
 
     size_t readFd(void* buf, size_t len);
+    int readWithFds(void* buf, size_t len);
 
     int fd;
     bool closeWhenDone;
+
+    bool acceptFds;
+    std::list<int> receivedFds;
   };
 
 } // end of namespace rdr
@@ -35,6 +35,7 @@
 #include <unistd.h>
 #include <sys/time.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <netinet/in.h>
 #include <netinet/tcp.h>
 #endif
@@ -51,14 +52,54 @@
 
 using namespace rdr;
 
+#ifndef WIN32
+static int sendWithFd(int sock, const void* data, size_t length, int fd)
+{
+  struct msghdr msg;
+  struct iovec iov;
+  union {
+    struct cmsghdr align;
+    char buf[CMSG_SPACE(sizeof(int))];
+  } control;
+  struct cmsghdr* cmsg;
+  int flags;
+
+  iov.iov_base = (void*)data;
+  iov.iov_len = length;
+
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control.buf;
+  msg.msg_controllen = sizeof(control.buf);
+
+  cmsg = CMSG_FIRSTHDR(&msg);
+  cmsg->cmsg_level = SOL_SOCKET;
+  cmsg->cmsg_type = SCM_RIGHTS;
+  cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+  memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+
+  flags = 0;
+#ifdef MSG_DONTWAIT
+  flags |= MSG_DONTWAIT;
+#endif
+
+  return sendmsg(sock, &msg, flags);
+}
+#endif
+
 FdOutStream::FdOutStream(int fd_)
-  : fd(fd_)
+  : fd(fd_), pendingFd(-1)
 {
   gettimeofday(&lastWrite, NULL);
 }
 
 FdOutStream::~FdOutStream()
 {
+#ifndef WIN32
+  if (pendingFd != -1)
+    close(pendingFd);
+#endif
 }
 
 unsigned FdOutStream::getIdleTime()
@@ -76,6 +117,35 @@ void FdOutStream::cork(bool enable)
 #endif
 }
 
+bool FdOutStream::setLowWaterMark(size_t size)
+{
+#ifdef TCP_NOTSENT_LOWAT
+  int value = size;
+  return setsockopt(fd, IPPROTO_TCP, TCP_NOTSENT_LOWAT,
+                    (char *)&value, sizeof(value)) == 0;
+#else
+  return false;
+#endif
+}
+
+void FdOutStream::sendFd(int fd_)
+{
+#ifdef WIN32
+  throw Exception("Passing file descriptors is not supported");
+#else
+  int newFd;
+
+  // Our own copy, as the caller might close it before it is sent
+  newFd = dup(fd_);
+  if (newFd < 0)
+    throw SystemException("dup", errno);
+
+  if (pendingFd != -1)
+    close(pendingFd);
+  pendingFd = newFd;
+#endif
+}
+
 bool FdOutStream::flushBuffer()
 {
   size_t n = writeFd((const void*) sentUpTo, ptr - sentUpTo);
@@ -121,6 +191,12 @@ size_t FdOutStream::writeFd(const void* data, size_t length)
     // select only guarantees that you can write SO_SNDLOWAT without
     // blocking, which is normally 1. Use MSG_DONTWAIT to avoid
     // blocking, when possible.
+#ifndef WIN32
+    if (pendingFd != -1) {
+      n = sendWithFd(fd, data, length, pendingFd);
+      continue;
+    }
+#endif
 #ifndef MSG_DONTWAIT
     n = ::send(fd, (const char*)data, length, 0);
 #else
@@ -131,6 +207,14 @@ size_t FdOutStream::writeFd(const void* data, size_t length)
   if (n < 0)
     throw SystemException("write", errno);
 
+#ifndef WIN32
+  // The descriptor has been handed over along with this data
+  if (pendingFd != -1) {
+    close(pendingFd);
+    pendingFd = -1;
+  }
+#endif
+
   gettimeofday(&lastWrite, NULL);
 
   return n;
@@ -43,10 +43,21 @@ namespace rdr {
 
     virtual void cork(bool enable);
 
+    // setLowWaterMark() makes the socket writable only once less than
+    // the given amount is left waiting to be sent (TCP only). Returns
+    // false if not supported.
+    bool setLowWaterMark(size_t size);
+
+    // sendFd() passes a copy of the given file descriptor along with
+    // the data that is sent next (Unix domain sockets only). It will
+    // arrive no later than any data written after this call.
+    void sendFd(int fd);
+
   private:
     virtual bool flushBuffer();
     size_t writeFd(const void* data, size_t length);
     int fd;
+    int pendingFd;
     struct timeval lastWrite;
   };
 
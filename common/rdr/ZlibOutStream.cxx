@@ -75,6 +75,16 @@ void ZlibOutStream::setCompressionLevel(int level)
   newLevel = level;
 }
 
+void ZlibOutStream::reset()
+{
+  // Anything still buffered belongs to the old history
+  if (ptr != start)
+    flush();
+
+  if (deflateReset(zs) != Z_OK)
+    throw Exception("ZlibOutStream: deflateReset failed");
+}
+
 size_t ZlibOutStream::length()
 {
   return offset + ptr - start;
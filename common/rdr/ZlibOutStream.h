@@ -40,6 +40,9 @@ namespace rdr {
 
     void setUnderlying(OutStream* os);
     void setCompressionLevel(int level=-1);
+    // reset() discards the compression history so that the following
+    // data can be decompressed without any of the preceding data
+    void reset();
     void flush();
     size_t length();
     virtual void cork(bool enable);
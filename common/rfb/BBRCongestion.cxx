@@ -0,0 +1,234 @@
+/* Copyright (C) 2026 TigerVNC Team
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ * USA.
+ */
+
+/*
+ * The model has two parts. The bottleneck bandwidth is the highest
+ * delivery rate seen over the last few round trips, and the
+ * propagation delay is the lowest round trip time seen over the last
+ * ten seconds. Their product is the amount of data the connection can
+ * hold without building a queue, and the window is kept at a multiple
+ * of that.
+ *
+ * We cannot pace our data like TCP BBR does, so the gains are applied
+ * to the window directly. Otherwise the states are the same: a startup
+ * phase that grows quickly until the bandwidth stops increasing, a
+ * drain phase to get rid of the queue that startup caused, and then a
+ * steady state that periodically probes for more bandwidth, and for a
+ * lower delay by briefly closing the window.
+ */
+
+#include <limits.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include <rfb/BBRCongestion.h>
+#include <rfb/LogWriter.h>
+#include <rfb/util.h>
+
+// Debug output on what the congestion control is up to
+#undef CONGESTION_DEBUG
+
+using namespace rfb;
+
+static LogWriter vlog("BBRCongestion");
+
+// Same lower limit as the default algorithm
+static const unsigned MINIMUM_WINDOW = 4096;
+
+// How long a propagation delay measurement is trusted
+static const unsigned RTPROP_EXPIRY = 10000;
+
+// How long to keep the window closed when probing the delay
+static const unsigned PROBE_RTT_TIME = 200;
+
+// Gains in thousandths. Startup grows by 2/ln(2), which is the lowest
+// gain that still doubles the delivery rate every round trip.
+static const unsigned STARTUP_GAIN = 2885;
+static const unsigned DRAIN_GAIN = 1000 * 1000 / STARTUP_GAIN;
+
+static const int CYCLE_LENGTH = 8;
+static const unsigned cycleGains[CYCLE_LENGTH] = {
+  1250, 750, 1000, 1000, 1000, 1000, 1000, 1000
+};
+
+#ifdef CONGESTION_DEBUG
+static const char* stateNames[] = { "Startup", "Drain", "ProbeBW", "ProbeRTT" };
+#endif
+
+BBRCongestion::BBRCongestion() :
+  state(Startup), bandwidthIndex(0), btlBw(0), rtProp(-1),
+  rtPropExpired(false), fullBw(0), fullBwRounds(0), filledPipe(false),
+  cycleIndex(0)
+{
+  memset(bandwidthSamples, 0, sizeof(bandwidthSamples));
+  gettimeofday(&rtPropStamp, NULL);
+  gettimeofday(&probeRTTStart, NULL);
+}
+
+BBRCongestion::~BBRCongestion()
+{
+}
+
+size_t BBRCongestion::getBandwidth()
+{
+  if (btlBw == 0)
+    return Congestion::getBandwidth();
+
+  return btlBw;
+}
+
+void BBRCongestion::adjustWindow()
+{
+  unsigned long long window;
+  unsigned gain;
+
+  updateModel();
+  updateState();
+
+  inSlowStart = (state == Startup);
+
+  // Nothing to base a model on yet, so just grow like slow start
+  if (btlBw == 0) {
+    congWindow *= 2;
+    return;
+  }
+
+  switch (state) {
+  case Startup:
+    gain = STARTUP_GAIN;
+    break;
+  case Drain:
+    gain = DRAIN_GAIN;
+    break;
+  case ProbeBW:
+    gain = cycleGains[cycleIndex];
+    break;
+  default:
+    congWindow = MINIMUM_WINDOW;
+    return;
+  }
+
+  // We add a bit extra so that delayed responses don't leave the
+  // connection idle when we're close to the estimate
+  window = btlBw * rtProp / 1000 * gain / 1000 + MINIMUM_WINDOW;
+  if (window > UINT_MAX)
+    window = UINT_MAX;
+
+  congWindow = window;
+}
+
+void BBRCongestion::updateModel()
+{
+  struct timeval now;
+  unsigned elapsed, delivered;
+  unsigned long long sample;
+  int i;
+
+  gettimeofday(&now, NULL);
+
+  rtPropExpired = msBetween(&rtPropStamp, &now) > RTPROP_EXPIRY;
+  if ((minRTT <= rtProp) || rtPropExpired) {
+    rtProp = minRTT;
+    rtPropStamp = now;
+  }
+
+  // The kernel's measurement is more precise than what we can
+  // calculate from how far the client has gotten
+  if (deliveryRate != 0)
+    sample = deliveryRate;
+  else {
+    elapsed = msBetween(&lastAdjustment, &now);
+    if (elapsed == 0)
+      return;
+    delivered = ackedPosition - adjustmentAcked;
+    sample = (unsigned long long)delivered * 1000 / elapsed;
+  }
+
+  // If we didn't fill the window then the rate says more about us
+  // than about the connection, so only use it if it is an improvement
+  if ((minCongestedRTT == (unsigned)-1) && (sample <= btlBw))
+    return;
+
+  bandwidthSamples[bandwidthIndex] = sample;
+  bandwidthIndex = (bandwidthIndex + 1) % bandwidthRounds;
+
+  btlBw = 0;
+  for (i = 0; i < bandwidthRounds; i++)
+    btlBw = __rfbmax(btlBw, bandwidthSamples[i]);
+}
+
+void BBRCongestion::updateState()
+{
+  State oldState;
+
+  oldState = state;
+
+  switch (state) {
+  case Startup:
+    // The connection is considered full when the bandwidth stops
+    // increasing, but only rounds where we actually filled the
+    // window count
+    if (btlBw >= fullBw * 5 / 4) {
+      fullBw = btlBw;
+      fullBwRounds = 0;
+    } else if (minCongestedRTT != (unsigned)-1) {
+      fullBwRounds++;
+      if (fullBwRounds >= 3) {
+        filledPipe = true;
+        state = Drain;
+      }
+    }
+    break;
+  case Drain:
+    // Wait for the queue that startup created to go away
+    if (getInFlight() <= btlBw * rtProp / 1000) {
+      state = ProbeBW;
+      cycleIndex = 0;
+    }
+    break;
+  case ProbeBW:
+    cycleIndex = (cycleIndex + 1) % CYCLE_LENGTH;
+    break;
+  case ProbeRTT:
+    if (msSince(&probeRTTStart) >= __rfbmax(PROBE_RTT_TIME, rtProp)) {
+      gettimeofday(&rtPropStamp, NULL);
+      if (filledPipe)
+        state = ProbeBW;
+      else
+        state = Startup;
+      cycleIndex = 0;
+    }
+    break;
+  }
+
+  // A queue may have been hiding the real propagation delay for too
+  // long, so briefly close the window to get a new measurement
+  if (rtPropExpired && (state != ProbeRTT)) {
+    state = ProbeRTT;
+    gettimeofday(&probeRTTStart, NULL);
+  }
+
+#ifdef CONGESTION_DEBUG
+  if (state != oldState)
+    vlog.debug("%s -> %s, bandwidth %g Mbps, delay %u ms",
+               stateNames[oldState], stateNames[state],
+               btlBw * 8.0 / 1000000.0, rtProp);
+#else
+  (void)oldState;
+#endif
+}
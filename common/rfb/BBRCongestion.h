@@ -0,0 +1,77 @@
+/* Copyright (C) 2026 TigerVNC Team
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ * USA.
+ */
+
+//
+// BBRCongestion is a congestion control that models the connection as
+// a bottleneck bandwidth and a round trip propagation delay, in the
+// spirit of TCP BBR, rather than reacting to increased delay like
+// Vegas does.
+//
+
+#ifndef __RFB_BBRCONGESTION_H__
+#define __RFB_BBRCONGESTION_H__
+
+#include <sys/time.h>
+
+#include <rfb/Congestion.h>
+
+namespace rfb {
+
+  class BBRCongestion : public Congestion {
+  public:
+    BBRCongestion();
+    virtual ~BBRCongestion();
+
+    virtual const char* getName() { return "BBR"; }
+
+    virtual size_t getBandwidth();
+
+  protected:
+    virtual void adjustWindow();
+
+  private:
+    void updateModel();
+    void updateState();
+
+    enum State { Startup, Drain, ProbeBW, ProbeRTT };
+
+    State state;
+
+    // Bottleneck bandwidth, as the maximum of the recent samples
+    static const int bandwidthRounds = 10;
+    unsigned long long bandwidthSamples[bandwidthRounds];
+    int bandwidthIndex;
+    unsigned long long btlBw;
+
+    // Propagation delay, as the minimum over a longer period
+    unsigned rtProp;
+    struct timeval rtPropStamp;
+    bool rtPropExpired;
+
+    // Detection of a full pipe during startup
+    unsigned long long fullBw;
+    int fullBwRounds;
+    bool filledPipe;
+
+    int cycleIndex;
+    struct timeval probeRTTStart;
+  };
+
+}
+
+#endif
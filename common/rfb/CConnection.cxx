@@ -27,9 +27,12 @@
 #include <rfb/CMsgWriter.h>
 #include <rfb/CSecurity.h>
 #include <rfb/Decoder.h>
+#include <rfb/JpegDecompressor.h>
+#include <rfb/SharedMemory.h>
 #include <rfb/Security.h>
 #include <rfb/SecurityClient.h>
 #include <rfb/CConnection.h>
+#include <rfb/ClientParams.h>
 #include <rfb/util.h>
 
 #include <rfb/LogWriter.h>
@@ -41,15 +44,24 @@ using namespace rfb;
 
 static LogWriter vlog("CConnection");
 
+// How many datagram rects we hold on to while they wait for the
+// content they are based on
+static const size_t maxQueuedDatagrams = 256;
+
 CConnection::CConnection()
   : csecurity(0),
     supportsLocalCursor(false), supportsCursorPosition(false),
     supportsDesktopResize(false), supportsLEDState(false),
+    supportsSharedMemory(false),
     is(0), os(0), reader_(0), writer_(0),
     shared(false),
     state_(RFBSTATE_UNINITIALISED),
     pendingPFChange(false), preferredEncoding(encodingTight),
     compressLevel(2), qualityLevel(-1),
+    fineQualityLevel(-1), subsampling(subsampleUndefined), serverScale(1),
+    udpTransport(false), hasViewport(false),
+    lastUDPMarker(0), udpMarkerSynced(true), datagramDecompressor(NULL),
+    sharedMemory(NULL), sharedMemoryRefused(false), sharedStride(0),
     formatChange(false), encodingChange(false),
     firstUpdate(true), pendingUpdate(false), continuousUpdates(false),
     forceNonincremental(true),
@@ -61,6 +73,9 @@ CConnection::CConnection()
 CConnection::~CConnection()
 {
   close();
+
+  delete datagramDecompressor;
+  delete sharedMemory;
 }
 
 void CConnection::setStreams(rdr::InStream* is_, rdr::OutStream* os_)
@@ -440,6 +455,14 @@ void CConnection::endOfContinuousUpdates()
   }
 }
 
+void CConnection::supportsViewport()
+{
+  CMsgHandler::supportsViewport();
+
+  if (hasViewport)
+    writer()->writeSetViewport(viewport);
+}
+
 void CConnection::serverInit(int width, int height,
                              const PixelFormat& pf,
                              const char* name)
@@ -491,6 +514,7 @@ void CConnection::framebufferUpdateStart()
 void CConnection::framebufferUpdateEnd()
 {
   decoder.flush();
+  udpMarkerSynced = true;
 
   CMsgHandler::framebufferUpdateEnd();
 
@@ -519,6 +543,104 @@ bool CConnection::dataRect(const Rect& r, int encoding)
   return decoder.decodeRect(r, encoding, framebuffer);
 }
 
+void CConnection::udpMarker(rdr::U32 seq)
+{
+  std::list<QueuedDatagram>::iterator iter;
+
+  lastUDPMarker = seq;
+  udpMarkerSynced = false;
+
+  // Anything older has been overwritten by what came before this
+  // marker, and anything for this update can now be applied
+  iter = queuedDatagrams.begin();
+  while (iter != queuedDatagrams.end()) {
+    if (iter->seq > seq) {
+      ++iter;
+      continue;
+    }
+
+    if (iter->seq == seq) {
+      syncDatagrams();
+      applyDatagramRect(iter->r, &iter->data[0], iter->data.size());
+    }
+
+    iter = queuedDatagrams.erase(iter);
+  }
+}
+
+void CConnection::sharedMemoryOffer(int width, int height, int stride,
+                                    const PixelFormat& pf)
+{
+  int fd;
+  SharedMemory* newMemory;
+
+  if (!supportsSharedMemory)
+    throw Exception("Server offered shared memory without being asked");
+
+  if ((width > stride) || (pf.bpp == 0))
+    throw Exception("Invalid shared memory offer");
+
+  fd = receiveFd();
+  if (fd == -1)
+    throw Exception("No shared memory received from server");
+
+  delete sharedMemory;
+  sharedMemory = NULL;
+
+  newMemory = new SharedMemory();
+  try {
+    newMemory->attach(fd, (size_t)stride * height * (pf.bpp/8));
+  } catch (rdr::Exception& e) {
+    delete newMemory;
+
+    // The server will switch to normal encodings once it sees that we
+    // no longer ask for shared memory, and then resend everything
+    vlog.error("Unable to use shared memory: %s", e.str());
+    sharedMemoryRefused = true;
+    encodingChange = true;
+    refreshFramebuffer();
+
+    return;
+  }
+
+  sharedMemory = newMemory;
+  sharedRect.setXYWH(0, 0, width, height);
+  sharedStride = stride;
+  sharedPF = pf;
+
+  vlog.debug("Using shared memory for %dx%d framebuffer", width, height);
+}
+
+void CConnection::sharedMemoryRect(const Rect& r)
+{
+  const rdr::U8* src;
+  rdr::U8* dst;
+  int stride;
+
+  if (sharedMemory == NULL) {
+    // Until the server has seen our refusal, these will be covered by
+    // the refresh we asked for
+    if (sharedMemoryRefused)
+      return;
+    throw Exception("Shared memory rect without any shared memory");
+  }
+  if (!r.enclosed_by(sharedRect) ||
+      !r.enclosed_by(framebuffer->getRect()))
+    throw Exception("Shared memory rect outside the framebuffer");
+
+  // Earlier rects might still be decoding in the background
+  decoder.flush();
+
+  src = sharedMemory->getData() +
+        ((size_t)r.tl.y * sharedStride + r.tl.x) * (sharedPF.bpp/8);
+
+  dst = framebuffer->getBufferRW(r, &stride);
+  framebuffer->getPF().bufferFromBuffer(dst, sharedPF, src,
+                                        r.width(), r.height(),
+                                        stride, sharedStride);
+  framebuffer->commitBufferRW(r);
+}
+
 void CConnection::serverCutText(const char* str)
 {
   hasLocalClipboard = false;
@@ -609,6 +731,11 @@ void CConnection::resizeFramebuffer()
   assert(false);
 }
 
+int CConnection::receiveFd()
+{
+  return -1;
+}
+
 void CConnection::handleClipboardRequest()
 {
 }
@@ -723,6 +850,121 @@ void CConnection::setQualityLevel(int level)
   encodingChange = true;
 }
 
+void CConnection::setFineQualityLevel(int quality, int subsampling_)
+{
+  if ((fineQualityLevel == quality) && (subsampling == subsampling_))
+    return;
+
+  fineQualityLevel = quality;
+  subsampling = subsampling_;
+  encodingChange = true;
+}
+
+void CConnection::setServerScale(int divisor)
+{
+  if (serverScale == divisor)
+    return;
+
+  serverScale = divisor;
+  encodingChange = true;
+}
+
+void CConnection::setViewport(const Region& visible)
+{
+  if (hasViewport && viewport.equals(visible))
+    return;
+
+  // The extension is only announced once we have something to tell
+  if (!hasViewport)
+    encodingChange = true;
+
+  hasViewport = true;
+  viewport = visible;
+
+  if ((state_ == RFBSTATE_NORMAL) && server.supportsViewport)
+    writer()->writeSetViewport(viewport);
+}
+
+void CConnection::setUDPTransport(bool enable)
+{
+  if (udpTransport == enable)
+    return;
+
+  udpTransport = enable;
+  encodingChange = true;
+}
+
+bool CConnection::handleDatagramRect(rdr::U32 seq, const Rect& r,
+                                     const rdr::U8* data, size_t length)
+{
+  // Anything sent over the normal connection after this datagram
+  // would have been overwritten by it
+  if (seq < lastUDPMarker)
+    return false;
+
+  // The datagram overtook the content it is based on, so it has to
+  // wait for its marker
+  if (seq > lastUDPMarker) {
+    QueuedDatagram datagram;
+
+    if (queuedDatagrams.size() >= maxQueuedDatagrams)
+      queuedDatagrams.pop_front();
+
+    datagram.seq = seq;
+    datagram.r = r;
+
+    // Fill in the data in place, rather than copying it
+    queuedDatagrams.push_back(datagram);
+    queuedDatagrams.back().data.assign(data, data + length);
+
+    return false;
+  }
+
+  syncDatagrams();
+
+  return applyDatagramRect(r, data, length);
+}
+
+// syncDatagrams() makes sure everything that came before the latest
+// marker has been decoded, including CopyRects that might read from
+// where a datagram is about to go
+void CConnection::syncDatagrams()
+{
+  if (udpMarkerSynced)
+    return;
+
+  decoder.flush();
+  udpMarkerSynced = true;
+}
+
+bool CConnection::applyDatagramRect(const Rect& r, const rdr::U8* data,
+                                    size_t length)
+{
+  rdr::U8* buffer;
+  int stride;
+
+  if (framebuffer == NULL)
+    return false;
+  if (!r.enclosed_by(framebuffer->getRect()))
+    return false;
+
+  if (datagramDecompressor == NULL)
+    datagramDecompressor = new JpegDecompressor();
+
+  buffer = framebuffer->getBufferRW(r, &stride);
+  try {
+    datagramDecompressor->decompress(data, length, buffer, stride, r,
+                                     framebuffer->getPF());
+  } catch (rdr::Exception& e) {
+    framebuffer->commitBufferRW(r);
+    vlog.error("Failed to decode datagram rect: %s", e.str());
+    return false;
+  }
+  framebuffer->commitBufferRW(r);
+
+  return true;
+}
+
 void CConnection::setPF(const PixelFormat& pf)
 {
   if (server.pf().equal(pf) && !formatChange)
@@ -816,6 +1058,12 @@ void CConnection::updateEncodings()
     encodings.push_back(pseudoEncodingLEDState);
     encodings.push_back(pseudoEncodingVMwareLEDState);
   }
+  if (hasViewport)
+    encodings.push_back(pseudoEncodingViewport);
+  if (udpTransport)
+    encodings.push_back(pseudoEncodingUDPTransport);
+  if (supportsSharedMemory && !sharedMemoryRefused)
+    encodings.push_back(pseudoEncodingSharedMemory);
 
   encodings.push_back(pseudoEncodingDesktopName);
   encodings.push_back(pseudoEncodingLastRect);
@@ -839,6 +1087,30 @@ void CConnection::updateEncodings()
       encodings.push_back(pseudoEncodingCompressLevel0 + compressLevel);
   if (qualityLevel >= 0 && qualityLevel <= 9)
       encodings.push_back(pseudoEncodingQualityLevel0 + qualityLevel);
+  if (fineQualityLevel >= 0 && fineQualityLevel <= 100)
+      encodings.push_back(pseudoEncodingFineQualityLevel0 + fineQualityLevel);
+  switch (subsampling) {
+  case subsampleNone:
+    encodings.push_back(pseudoEncodingSubsamp1X);
+    break;
+  case subsampleGray:
+    encodings.push_back(pseudoEncodingSubsampGray);
+    break;
+  case subsample2X:
+    encodings.push_back(pseudoEncodingSubsamp2X);
+    break;
+  case subsample4X:
+    encodings.push_back(pseudoEncodingSubsamp4X);
+    break;
+  case subsample8X:
+    encodings.push_back(pseudoEncodingSubsamp8X);
+    break;
+  case subsample16X:
+    encodings.push_back(pseudoEncodingSubsamp16X);
+    break;
+  }
+  if (serverScale > 1 && serverScale <= 8)
+      encodings.push_back(pseudoEncodingScaleDivisor1 + serverScale - 1);
 
   writer()->writeSetEncodings(encodings);
 }
@@ -24,6 +24,9 @@
 #ifndef __RFB_CCONNECTION_H__
 #define __RFB_CCONNECTION_H__
 
+#include <list>
+#include <vector>
+
 #include <rfb/CMsgHandler.h>
 #include <rfb/DecodeManager.h>
 #include <rfb/SecurityClient.h>
@@ -31,6 +34,9 @@
 
 namespace rfb {
 
+  class JpegDecompressor;
+  class SharedMemory;
+
   class CMsgReader;
   class CMsgWriter;
   class CSecurity;
@@ -102,6 +108,7 @@ namespace rfb {
                                         const ScreenSet& layout);
 
     virtual void endOfContinuousUpdates();
+    virtual void supportsViewport();
 
     virtual void serverInit(int width, int height,
                             const PixelFormat& pf,
@@ -114,6 +121,12 @@ namespace rfb {
     virtual void framebufferUpdateEnd();
     virtual bool dataRect(const Rect& r, int encoding);
 
+    virtual void udpMarker(rdr::U32 seq);
+
+    virtual void sharedMemoryOffer(int width, int height, int stride,
+                                   const PixelFormat& pf);
+    virtual void sharedMemoryRect(const Rect& r);
+
     virtual void serverCutText(const char* str);
 
     virtual void handleClipboardCaps(rdr::U32 flags,
@@ -155,6 +168,12 @@ namespace rfb {
     // actual data.
     virtual void handleClipboardAnnounce(bool available);
 
+    // receiveFd() is called to get a file descriptor that the server
+    // has passed along with its data. It must be implemented by a
+    // subclass that sets supportsSharedMemory. Returns -1 if there is
+    // none.
+    virtual int receiveFd();
+
     // handleClipboardData() is called when the server has sent over
     // the clipboard data as a result of a previous call to
     // requestClipboard(). Note that this function might never be
@@ -193,6 +212,33 @@ namespace rfb {
     // sent to the server
     void setCompressLevel(int level);
     void setQualityLevel(int level);
+    int getCompressLevel() { return compressLevel; }
+    int getQualityLevel() { return qualityLevel; }
+    // setFineQualityLevel() overrides the JPEG quality (0-100) and
+    // subsampling implied by the quality level, -1 and
+    // subsampleUndefined leave them to the server
+    void setFineQualityLevel(int quality, int subsampling);
+    int getFineQualityLevel() { return fineQualityLevel; }
+    int getSubsampling() { return subsampling; }
+    // setServerScale() asks the server to scale the framebuffer down
+    // by the given divisor before sending it
+    void setServerScale(int divisor);
+    // setViewport() tells the server which part of the framebuffer
+    // the user can currently see, so that it can send that part first.
+    // An empty region means that nothing is visible.
+    void setViewport(const Region& visible);
+    // setUDPTransport() controls if the server is allowed to offer a
+    // UDP side channel for lossy content
+    void setUDPTransport(bool enable);
+
+    // handleDatagramRect() applies a JPEG rect that arrived over the
+    // UDP side channel. It is ignored if the server has since sent
+    // newer content over the normal connection, and held back if the
+    // content it follows hasn't arrived yet. Returns true if the
+    // framebuffer was modified.
+    bool handleDatagramRect(rdr::U32 seq, const Rect& r,
+                            const rdr::U8* data, size_t length);
+
     // setPF() controls the pixel format requested from the server.
     // server.pf() will automatically be adjusted once the new format
     // is active.
@@ -235,6 +281,8 @@ namespace rfb {
 
     ModifiablePixelBuffer* getFramebuffer() { return framebuffer; }
 
+    DecodeManager* getDecodeManager() { return &decoder; }
+
   protected:
     // Optional capabilities that a subclass is expected to set to true
     // if supported
@@ -242,6 +290,7 @@ namespace rfb {
     bool supportsCursorPosition;
     bool supportsDesktopResize;
     bool supportsLEDState;
+    bool supportsSharedMemory;
 
   private:
     // This is a default implementation of fences that automatically
@@ -263,6 +312,10 @@ namespace rfb {
     void requestNewUpdate();
     void updateEncodings();
 
+    void syncDatagrams();
+    bool applyDatagramRect(const Rect& r, const rdr::U8* data,
+                           size_t length);
+
     rdr::InStream* is;
     rdr::OutStream* os;
     CMsgReader* reader_;
@@ -279,6 +332,30 @@ namespace rfb {
     int preferredEncoding;
     int compressLevel;
     int qualityLevel;
+    int fineQualityLevel;
+    int subsampling;
+    int serverScale;
+    bool udpTransport;
+
+    bool hasViewport;
+    Region viewport;
+
+    rdr::U32 lastUDPMarker;
+    bool udpMarkerSynced;
+    JpegDecompressor* datagramDecompressor;
+
+    struct QueuedDatagram {
+      rdr::U32 seq;
+      Rect r;
+      std::vector<rdr::U8> data;
+    };
+    std::list<QueuedDatagram> queuedDatagrams;
+
+    SharedMemory* sharedMemory;
+    bool sharedMemoryRefused;
+    Rect sharedRect;
+    int sharedStride;
+    PixelFormat sharedPF;
 
     bool formatChange;
     rfb::PixelFormat nextPF;
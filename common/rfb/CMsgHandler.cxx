@@ -78,6 +78,11 @@ void CMsgHandler::supportsQEMUKeyEvent()
   server.supportsQEMUKeyEvent = true;
 }
 
+void CMsgHandler::supportsViewport()
+{
+  server.supportsViewport = true;
+}
+
 void CMsgHandler::serverInit(int width, int height,
                              const PixelFormat& pf,
                              const char* name)
@@ -100,6 +105,24 @@ void CMsgHandler::setLEDState(unsigned int state)
   server.setLEDState(state);
 }
 
+void CMsgHandler::udpOffer(int port, rdr::U32 token)
+{
+}
+
+void CMsgHandler::udpMarker(rdr::U32 seq)
+{
+}
+
+void CMsgHandler::sharedMemoryOffer(int width, int height, int stride,
+                                    const PixelFormat& pf)
+{
+}
+
+void CMsgHandler::sharedMemoryRect(const Rect& r)
+{
+  throw Exception("Unexpected shared memory rect");
+}
+
 void CMsgHandler::handleClipboardCaps(rdr::U32 flags, const rdr::U32* lengths)
 {
   int i;
@@ -58,6 +58,7 @@ namespace rfb {
     virtual void fence(rdr::U32 flags, unsigned len, const char data[]);
     virtual void endOfContinuousUpdates();
     virtual void supportsQEMUKeyEvent();
+    virtual void supportsViewport();
     virtual void serverInit(int width, int height,
                             const PixelFormat& pf,
                             const char* name) = 0;
@@ -76,6 +77,13 @@ namespace rfb {
 
     virtual void setLEDState(unsigned int state);
 
+    virtual void udpOffer(int port, rdr::U32 token);
+    virtual void udpMarker(rdr::U32 seq);
+
+    virtual void sharedMemoryOffer(int width, int height, int stride,
+                                   const PixelFormat& pf);
+    virtual void sharedMemoryRect(const Rect& r);
+
     virtual void handleClipboardCaps(rdr::U32 flags,
                                      const rdr::U32* lengths);
     virtual void handleClipboardRequest(rdr::U32 flags);
@@ -25,6 +25,7 @@
 
 #include <rfb/msgTypes.h>
 #include <rfb/clipboardTypes.h>
+#include <rfb/udpTypes.h>
 #include <rfb/Exception.h>
 #include <rfb/LogWriter.h>
 #include <rfb/util.h>
@@ -191,6 +192,22 @@ bool CMsgReader::readMsg()
       handler->supportsQEMUKeyEvent();
       ret = true;
       break;
+    case pseudoEncodingViewport:
+      handler->supportsViewport();
+      ret = true;
+      break;
+    case pseudoEncodingUDPTransport:
+      ret = readUDPTransport();
+      break;
+    case pseudoEncodingSharedMemory:
+      // Empty for the offer, otherwise it is an updated rect
+      if (dataRect.is_empty())
+        ret = readSharedMemoryOffer();
+      else {
+        handler->sharedMemoryRect(dataRect);
+        ret = true;
+      }
+      break;
     default:
       ret = readRect(dataRect, rectEncoding);
       break;
@@ -802,6 +819,65 @@ bool CMsgReader::readLEDState()
   return true;
 }
 
+bool CMsgReader::readUDPTransport()
+{
+  rdr::U8 type;
+
+  if (!is->hasData(1))
+    return false;
+
+  is->setRestorePoint();
+
+  type = is->readU8();
+
+  switch (type) {
+  case udpTransportOffer:
+    {
+      int port;
+      rdr::U32 token;
+
+      if (!is->hasDataOrRestore(2 + 4))
+        return false;
+      is->clearRestorePoint();
+
+      port = is->readU16();
+      token = is->readU32();
+
+      handler->udpOffer(port, token);
+    }
+    break;
+  case udpTransportMarker:
+    if (!is->hasDataOrRestore(4))
+      return false;
+    is->clearRestorePoint();
+
+    handler->udpMarker(is->readU32());
+    break;
+  default:
+    throw Exception("Unknown UDP transport message type %d", (int)type);
+  }
+
+  return true;
+}
+
+bool CMsgReader::readSharedMemoryOffer()
+{
+  int width, height, stride;
+  PixelFormat pf;
+
+  if (!is->hasData(2 + 2 + 4 + 16))
+    return false;
+
+  width = is->readU16();
+  height = is->readU16();
+  stride = is->readU32();
+  pf.read(is);
+
+  handler->sharedMemoryOffer(width, height, stride, pf);
+
+  return true;
+}
+
 bool CMsgReader::readVMwareLEDState()
 {
   rdr::U32 state;
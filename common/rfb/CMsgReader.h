@@ -69,6 +69,8 @@ namespace rfb {
     bool readExtendedDesktopSize(int x, int y, int w, int h);
     bool readLEDState();
     bool readVMwareLEDState();
+    bool readUDPTransport();
+    bool readSharedMemoryOffer();
 
   private:
     CMsgHandler* handler;
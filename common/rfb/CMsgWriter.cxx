@@ -29,6 +29,7 @@
 #include <rfb/Exception.h>
 #include <rfb/PixelFormat.h>
 #include <rfb/Rect.h>
+#include <rfb/Region.h>
 #include <rfb/ServerParams.h>
 #include <rfb/CMsgWriter.h>
 
@@ -125,6 +126,33 @@ void CMsgWriter::writeEnableContinuousUpdates(bool enable,
   endMsg();
 }
 
+void CMsgWriter::writeSetViewport(const Region& visible)
+{
+  std::vector<Rect> rects;
+  std::vector<Rect>::const_iterator iter;
+
+  if (!server->supportsViewport)
+    throw Exception("Server does not support the viewport extension");
+
+  visible.get_rects(&rects);
+  if (rects.size() > 0xffff)
+    throw Exception("Too many rects in viewport");
+
+  startMsg(msgTypeSetViewport);
+
+  os->pad(1);
+  os->writeU16(rects.size());
+
+  for (iter = rects.begin(); iter != rects.end(); ++iter) {
+    os->writeU16(iter->tl.x);
+    os->writeU16(iter->tl.y);
+    os->writeU16(iter->width());
+    os->writeU16(iter->height());
+  }
+
+  endMsg();
+}
+
 void CMsgWriter::writeFence(rdr::U32 flags, unsigned len, const char data[])
 {
   if (!server->supportsFence)
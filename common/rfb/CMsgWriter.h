@@ -36,6 +36,7 @@ namespace rfb {
   struct ScreenSet;
   struct Point;
   struct Rect;
+  class Region;
 
   class CMsgWriter {
   public:
@@ -50,6 +51,7 @@ namespace rfb {
 
     void writeFramebufferUpdateRequest(const Rect& r,bool incremental);
     void writeEnableContinuousUpdates(bool enable, int x, int y, int w, int h);
+    void writeSetViewport(const Region& visible);
 
     void writeFence(rdr::U32 flags, unsigned len, const char data[]);
 
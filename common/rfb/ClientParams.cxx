@@ -28,7 +28,7 @@ using namespace rfb;
 ClientParams::ClientParams()
   : majorVersion(0), minorVersion(0),
     compressLevel(2), qualityLevel(-1), fineQualityLevel(-1),
-    subsampling(subsampleUndefined),
+    subsampling(subsampleUndefined), scaleDivisor(1),
     width_(0), height_(0), name_(0),
     cursorPos_(0, 0), ledState_(ledUnknown)
 {
@@ -101,6 +101,7 @@ void ClientParams::setEncodings(int nEncodings, const rdr::S32* encodings)
   qualityLevel = -1;
   fineQualityLevel = -1;
   subsampling = subsampleUndefined;
+  scaleDivisor = 1;
 
   encodings_.clear();
   encodings_.insert(encodingRaw);
@@ -139,6 +140,10 @@ void ClientParams::setEncodings(int nEncodings, const rdr::S32* encodings)
         encodings[i] <= pseudoEncodingFineQualityLevel100)
       fineQualityLevel = encodings[i] - pseudoEncodingFineQualityLevel0;
 
+    if (encodings[i] >= pseudoEncodingScaleDivisor1 &&
+        encodings[i] <= pseudoEncodingScaleDivisor8)
+      scaleDivisor = encodings[i] - pseudoEncodingScaleDivisor1 + 1;
+
     encodings_.insert(encodings[i]);
   }
 }
@@ -104,6 +104,7 @@ namespace rfb {
     int qualityLevel;
     int fineQualityLevel;
     int subsampling;
+    int scaleDivisor;
 
   private:
 
@@ -31,9 +31,21 @@
  * We use a simplistic form of slow start in order to ramp up quickly
  * from an idle state. We do not have any persistent threshold though
  * as we have too much noise for it to be reliable.
+ *
+ * On Linux we can usually skip the pings altogether and ask the kernel
+ * instead. TCP_INFO gives us the RTT as seen by TCP itself, and
+ * SIOCOUTQ exactly how much data hasn't been acknowledged yet. The
+ * window is still managed the same way, but with far better input.
+ *
+ * The window adjustment is kept separate in adjustWindow() so that
+ * other algorithms can reuse the measurements (see BBRCongestion).
  */
 
 #include <assert.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
 #include <sys/time.h>
 
 #ifdef __linux__
@@ -44,6 +56,10 @@
 #include <linux/sockios.h>
 #endif
 
+#include <rdr/types.h>
+
+#include <rfb/BBRCongestion.h>
+#include <rfb/Configuration.h>
 #include <rfb/Congestion.h>
 #include <rfb/LogWriter.h>
 #include <rfb/util.h>
@@ -75,10 +91,81 @@ static inline bool isAfter(unsigned a, unsigned b) {
 
 static LogWriter vlog("Congestion");
 
+static BoolParameter useTCPInfo("UseTCPInfo",
+                                "Use the kernel's TCP statistics for "
+                                "congestion control when available", true);
+
+#ifdef __linux__
+// The C library's struct tcp_info often lags behind the kernel, so we
+// have our own copy of the kernel ABI. The kernel fills in as much as
+// it knows about and tells us how much that was.
+struct KernelTCPInfo {
+  rdr::U8 tcpi_state;
+  rdr::U8 tcpi_ca_state;
+  rdr::U8 tcpi_retransmits;
+  rdr::U8 tcpi_probes;
+  rdr::U8 tcpi_backoff;
+  rdr::U8 tcpi_options;
+  rdr::U8 tcpi_wscale;
+  rdr::U8 tcpi_flags; // delivery_rate_app_limited is bit 0
+
+  rdr::U32 tcpi_rto;
+  rdr::U32 tcpi_ato;
+  rdr::U32 tcpi_snd_mss;
+  rdr::U32 tcpi_rcv_mss;
+
+  rdr::U32 tcpi_unacked;
+  rdr::U32 tcpi_sacked;
+  rdr::U32 tcpi_lost;
+  rdr::U32 tcpi_retrans;
+  rdr::U32 tcpi_fackets;
+
+  rdr::U32 tcpi_last_data_sent;
+  rdr::U32 tcpi_last_ack_sent;
+  rdr::U32 tcpi_last_data_recv;
+  rdr::U32 tcpi_last_ack_recv;
+
+  rdr::U32 tcpi_pmtu;
+  rdr::U32 tcpi_rcv_ssthresh;
+  rdr::U32 tcpi_rtt;
+  rdr::U32 tcpi_rttvar;
+  rdr::U32 tcpi_snd_ssthresh;
+  rdr::U32 tcpi_snd_cwnd;
+  rdr::U32 tcpi_advmss;
+  rdr::U32 tcpi_reordering;
+
+  rdr::U32 tcpi_rcv_rtt;
+  rdr::U32 tcpi_rcv_space;
+
+  rdr::U32 tcpi_total_retrans;
+
+  rdr::U64 tcpi_pacing_rate;
+  rdr::U64 tcpi_max_pacing_rate;
+  rdr::U64 tcpi_bytes_acked;
+  rdr::U64 tcpi_bytes_received;
+  rdr::U32 tcpi_segs_out;
+  rdr::U32 tcpi_segs_in;
+
+  rdr::U32 tcpi_notsent_bytes;
+  rdr::U32 tcpi_min_rtt;
+  rdr::U32 tcpi_data_segs_in;
+  rdr::U32 tcpi_data_segs_out;
+
+  rdr::U64 tcpi_delivery_rate;
+};
+
+#define HAVE_FIELD(len, field) \
+  ((len) >= offsetof(KernelTCPInfo, field) + sizeof(((KernelTCPInfo*)0)->field))
+#endif
+
 Congestion::Congestion() :
     lastPosition(0), extraBuffer(0),
     baseRTT(-1), congWindow(INITIAL_WINDOW), inSlowStart(true),
-    safeBaseRTT(-1), measurements(0), minRTT(-1), minCongestedRTT(-1)
+    safeBaseRTT(-1), datagramBytes(0),
+    measurements(0), minRTT(-1), minCongestedRTT(-1),
+    ackedPosition(0), adjustmentAcked(0),
+    sockFd(-1), sockRTT(0), sockMinRTT(0), sockInFlight(0),
+    deliveryRate(0), adjustments(0), windowTotal(0), bandwidthTotal(0)
 {
   gettimeofday(&lastUpdate, NULL);
   gettimeofday(&lastSent, NULL);
@@ -91,6 +178,35 @@ Congestion::~Congestion()
 {
 }
 
+Congestion* Congestion::create(const char* algorithm)
+{
+  if (strcasecmp(algorithm, "BBR") == 0)
+    return new BBRCongestion();
+
+  if (strcasecmp(algorithm, "Vegas") != 0)
+    vlog.error("Unknown congestion control algorithm \"%s\", using Vegas",
+               algorithm);
+
+  return new Congestion();
+}
+
+void Congestion::setSocket(int fd)
+{
+  if (!useTCPInfo)
+    return;
+
+#ifdef __linux__
+  // Only TCP sockets will answer
+  sockFd = fd;
+  if (!readSocket()) {
+    sockFd = -1;
+    return;
+  }
+
+  vlog.debug("Using TCP_INFO for congestion control");
+#endif
+}
+
 void Congestion::updatePosition(unsigned pos)
 {
   struct timeval now;
@@ -116,11 +232,20 @@ void Congestion::updatePosition(unsigned pos)
     congWindow = __rfbmin(INITIAL_WINDOW, congWindow);
     baseRTT = -1;
     measurements = 0;
+    deliveryRate = 0;
     gettimeofday(&lastAdjustment, NULL);
+    adjustmentAcked = ackedPosition;
     minRTT = minCongestedRTT = -1;
     inSlowStart = true;
   }
 
+  if (sockFd != -1) {
+    lastPosition = pos;
+    lastUpdate = now;
+    sampleSocket();
+    return;
+  }
+
   // Commonly we will be in a state of overbuffering. We need to
   // estimate the extra delay that causes so we can separate it from
   // the delay caused by an incorrect congestion window.
@@ -168,6 +293,7 @@ void Congestion::gotPong()
 
   lastPong = rttInfo;
   lastPongArrival = now;
+  ackedPosition = rttInfo.pos;
 
   rtt = msBetween(&rttInfo.tv, &now);
   if (rtt < 1)
@@ -214,9 +340,23 @@ void Congestion::gotPong()
   updateCongestion();
 }
 
+void Congestion::sentDatagram(unsigned length)
+{
+  struct DatagramInfo info;
+
+  if (length == 0)
+    return;
+
+  gettimeofday(&info.tv, NULL);
+  info.length = length;
+
+  datagrams.push_back(info);
+  datagramBytes += length;
+}
+
 bool Congestion::isCongested()
 {
-  if (getInFlight() < congWindow)
+  if ((getInFlight() + getDatagramsInFlight()) < congWindow)
     return false;
 
   return true;
@@ -224,7 +364,7 @@ bool Congestion::isCongested()
 
 int Congestion::getUncongestedETA()
 {
-  unsigned targetAcked;
+  unsigned window, targetAcked;
 
   const struct RTTInfo* prevPing;
   unsigned eta, elapsed;
@@ -232,7 +372,37 @@ int Congestion::getUncongestedETA()
 
   std::list<struct RTTInfo>::const_iterator iter;
 
-  targetAcked = lastPosition - congWindow;
+  // Datagrams take up part of the window until they expire, and if
+  // they fill all of it then we have to wait for the oldest ones
+  window = getDatagramsInFlight();
+  if (window >= congWindow) {
+    elapsed = msSince(&datagrams.front().tv);
+    if (elapsed >= getDatagramLifetime())
+      return 1;
+    return getDatagramLifetime() - elapsed;
+  }
+  window = congWindow - window;
+
+  // The kernel knows exactly what is left, and we assume it will
+  // drain at the rate it currently is being delivered
+  if (sockFd != -1) {
+    unsigned long long rate;
+
+    if (sockInFlight < window)
+      return 0;
+
+    if (deliveryRate != 0)
+      rate = deliveryRate;
+    else if (baseRTT != (unsigned)-1)
+      rate = (unsigned long long)congWindow * 1000 / baseRTT;
+    else
+      return -1;
+
+    eta = (sockInFlight - window) * 1000ULL / rate;
+    return __rfbmax(eta, 1);
+  }
+
+  targetAcked = lastPosition - window;
 
   // Simple case?
   if (isAfter(lastPong.pos, targetAcked))
@@ -293,6 +463,11 @@ size_t Congestion::getBandwidth()
 {
   size_t bandwidth;
 
+  // The kernel's measurement is better than anything we can guess,
+  // as long as it wasn't limited by us not having anything to send
+  if (deliveryRate != 0)
+    return __rfbmax(deliveryRate, congWindow * 1000 / safeBaseRTT);
+
   // No measurements yet? Guess RTT of 60 ms
   if (safeBaseRTT == (unsigned)-1)
     bandwidth = congWindow * 1000 / 60;
@@ -307,6 +482,23 @@ size_t Congestion::getBandwidth()
   return bandwidth;
 }
 
+void Congestion::printStats(char* buffer, size_t len)
+{
+  char rtt[256];
+
+  if (adjustments == 0) {
+    snprintf(buffer, len, "%s: no measurements", getName());
+    return;
+  }
+
+  rttStats.print(rtt, sizeof(rtt));
+  snprintf(buffer, len,
+           "%s: %u adjustments, avg window %u KiB, "
+           "avg bandwidth %g Mbit/s, RTT %s", getName(), adjustments,
+           (unsigned)(windowTotal / adjustments / 1024),
+           (double)bandwidthTotal / adjustments * 8.0 / 1000000.0, rtt);
+}
+
 void Congestion::debugTrace(const char* filename, int fd)
 {
 #ifdef CONGESTION_TRACE
@@ -356,6 +548,9 @@ unsigned Congestion::getInFlight()
   struct RTTInfo nextPong;
   unsigned etaNext, delay, elapsed, acked;
 
+  if (sockFd != -1)
+    return sockInFlight;
+
   // Simple case?
   if (lastPosition == lastPong.pos)
     return 0;
@@ -406,10 +601,122 @@ unsigned Congestion::getInFlight()
   return lastPosition - acked;
 }
 
-void Congestion::updateCongestion()
+unsigned Congestion::getDatagramsInFlight()
 {
-  unsigned diff;
+  unsigned lifetime;
+
+  lifetime = getDatagramLifetime();
+
+  while (!datagrams.empty()) {
+    if (msSince(&datagrams.front().tv) < lifetime)
+      break;
+
+    datagramBytes -= datagrams.front().length;
+    datagrams.pop_front();
+  }
+
+  return datagramBytes;
+}
+
+// getDatagramLifetime() returns how long datagrams are assumed to be in
+// flight, which is the current round trip time as far as we know it
+unsigned Congestion::getDatagramLifetime()
+{
+  if (sockFd != -1)
+    return sockRTT;
+
+  // No measurements yet? Guess RTT of 60 ms
+  if (baseRTT == (unsigned)-1)
+    return 60;
+
+  return baseRTT + getExtraBuffer() * baseRTT / congWindow;
+}
+
+// readSocket() fetches the current state of the TCP connection from
+// the kernel
+bool Congestion::readSocket()
+{
+#ifdef __linux__
+  KernelTCPInfo info;
+  socklen_t len;
+  int outq;
+
+  memset(&info, 0, sizeof(info));
+  len = sizeof(info);
+  if (getsockopt(sockFd, IPPROTO_TCP, TCP_INFO, &info, &len) != 0)
+    return false;
+  if (!HAVE_FIELD(len, tcpi_rtt))
+    return false;
+
+  // Everything that hasn't been acknowledged yet, whether it has been
+  // put on the wire or not
+  if (ioctl(sockFd, SIOCOUTQ, &outq) != 0)
+    return false;
+
+  sockInFlight = outq;
+
+  sockRTT = __rfbmax(info.tcpi_rtt / 1000, 1);
+
+  // Older kernels don't track the minimum, so we have to do it
+  sockMinRTT = 0;
+  if (HAVE_FIELD(len, tcpi_min_rtt) && (info.tcpi_min_rtt != 0))
+    sockMinRTT = __rfbmax(info.tcpi_min_rtt / 1000, 1);
+
+  // A rate measured when we didn't have enough to send says nothing
+  // about the link
+  if (HAVE_FIELD(len, tcpi_delivery_rate) && !(info.tcpi_flags & 1) &&
+      (info.tcpi_delivery_rate != 0))
+    deliveryRate = info.tcpi_delivery_rate;
+
+  return true;
+#else
+  return false;
+#endif
+}
+
+// sampleSocket() feeds the kernel's view of the connection in to the
+// same window logic that the pings normally drive
+void Congestion::sampleSocket()
+{
+  unsigned rtt;
+
+  if (!readSocket())
+    return;
+
+  ackedPosition = lastPosition - sockInFlight;
+
+  if (sockMinRTT != 0)
+    baseRTT = sockMinRTT;
+  else if (sockRTT < baseRTT)
+    baseRTT = sockRTT;
+  safeBaseRTT = baseRTT;
+
+  // The kernel's minimum only covers a recent window, so it can go
+  // up and leave earlier samples from this period below it
+  if (minRTT < baseRTT)
+    minRTT = baseRTT;
+  if (minCongestedRTT < baseRTT)
+    minCongestedRTT = baseRTT;
 
+  // The kernel's value is smoothed, so it can lag behind the minimum
+  rtt = __rfbmax(sockRTT, baseRTT);
+
+  if (rtt < minRTT)
+    minRTT = rtt;
+  if (sockInFlight >= congWindow) {
+    if (rtt < minCongestedRTT)
+      minCongestedRTT = rtt;
+  }
+
+  measurements++;
+
+  // Adjust once per round trip, like we would with pings
+  if (msSince(&lastAdjustment) >= baseRTT)
+    updateCongestion();
+}
+
+void Congestion::updateCongestion()
+{
   // We want at least three measurements to avoid noise
   if (measurements < 3)
     return;
@@ -417,6 +724,35 @@ void Congestion::updateCongestion()
   assert(minRTT >= baseRTT);
   assert(minCongestedRTT >= baseRTT);
 
+  adjustWindow();
+
+  if (congWindow < MINIMUM_WINDOW)
+    congWindow = MINIMUM_WINDOW;
+  if (congWindow > MAXIMUM_WINDOW)
+    congWindow = MAXIMUM_WINDOW;
+
+#ifdef CONGESTION_DEBUG
+  vlog.debug("RTT: %d/%d ms (%d ms), Window: %d KiB, Bandwidth: %g Mbps%s",
+             minRTT, minCongestedRTT, baseRTT, congWindow / 1024,
+             congWindow * 8.0 / baseRTT / 1000.0,
+             inSlowStart ? " (slow start)" : "");
+#endif
+
+  adjustments++;
+  windowTotal += congWindow;
+  bandwidthTotal += getBandwidth();
+  rttStats.add(minRTT);
+
+  measurements = 0;
+  gettimeofday(&lastAdjustment, NULL);
+  adjustmentAcked = ackedPosition;
+  minRTT = minCongestedRTT = -1;
+}
+
+void Congestion::adjustWindow()
+{
+  unsigned diff;
+
   // The goal is to have a slightly too large congestion window since
   // a "perfect" one cannot be distinguished from a too small one. This
   // translates to a goal of a few extra milliseconds of delay.
@@ -473,21 +809,5 @@ void Congestion::updateCongestion()
       }
     }
   }
-
-  if (congWindow < MINIMUM_WINDOW)
-    congWindow = MINIMUM_WINDOW;
-  if (congWindow > MAXIMUM_WINDOW)
-    congWindow = MAXIMUM_WINDOW;
-
-#ifdef CONGESTION_DEBUG
-  vlog.debug("RTT: %d/%d ms (%d ms), Window: %d KiB, Bandwidth: %g Mbps%s",
-             minRTT, minCongestedRTT, baseRTT, congWindow / 1024,
-             congWindow * 8.0 / baseRTT / 1000.0,
-             inSlowStart ? " (slow start)" : "");
-#endif
-
-  measurements = 0;
-  gettimeofday(&lastAdjustment, NULL);
-  minRTT = minCongestedRTT = -1;
 }
 
@@ -21,11 +21,26 @@
 
 #include <list>
 
+#include <rfb/LatencyHistogram.h>
+
 namespace rfb {
   class Congestion {
   public:
     Congestion();
-    ~Congestion();
+    virtual ~Congestion();
+
+    // create() returns a new instance of the named congestion control
+    // algorithm. Unknown names give the default algorithm.
+    static Congestion* create(const char* algorithm);
+
+    virtual const char* getName() { return "Vegas"; }
+
+    // setSocket() lets the congestion control read the state of the
+    // underlying TCP socket directly from the kernel, where that is
+    // possible. isSocketBased() tells if this worked, in which case
+    // pings are no longer needed.
+    void setSocket(int fd);
+    bool isSocketBased() { return sockFd != -1; }
 
     // updatePosition() registers the current stream position and can
     // and should be called often.
@@ -37,6 +52,11 @@ namespace rfb {
     void sentPing();
     void gotPong();
 
+    // sentDatagram() registers data that was sent next to the stream,
+    // e.g. over a UDP side channel. Such data is never acknowledged, so
+    // it is counted as in flight for one round trip.
+    void sentDatagram(unsigned length);
+
     // isCongested() determines if the transport is currently congested
     // or if more data can be sent.
     bool isCongested();
@@ -49,7 +69,11 @@ namespace rfb {
 
     // getBandwidth() returns the current bandwidth estimation in bytes
     // per second.
-    size_t getBandwidth();
+    virtual size_t getBandwidth();
+
+    // printStats() writes a one line summary of how the congestion
+    // control has behaved so far, for comparing algorithms
+    void printStats(char* buffer, size_t len);
 
     // debugTrace() writes the current congestion window, as well as the
     // congestion window of the underlying TCP layer, to the specified
@@ -59,10 +83,21 @@ namespace rfb {
   protected:
     unsigned getExtraBuffer();
     unsigned getInFlight();
+    unsigned getDatagramsInFlight();
+    unsigned getDatagramLifetime();
+
+    // readSocket() is virtual so that the tests can provide their own
+    // kernel state
+    virtual bool readSocket();
+    void sampleSocket();
 
     void updateCongestion();
 
-  private:
+    // adjustWindow() is called about once per round trip with fresh
+    // measurements and should update congWindow accordingly
+    virtual void adjustWindow();
+
+  protected:
     unsigned lastPosition;
     unsigned extraBuffer;
     struct timeval lastUpdate;
@@ -83,12 +118,38 @@ namespace rfb {
 
     std::list<struct RTTInfo> pings;
 
+    struct DatagramInfo {
+      struct timeval tv;
+      unsigned length;
+    };
+
+    std::list<struct DatagramInfo> datagrams;
+    unsigned datagramBytes;
+
     struct RTTInfo lastPong;
     struct timeval lastPongArrival;
 
     int measurements;
     struct timeval lastAdjustment;
     unsigned minRTT, minCongestedRTT;
+
+    // Stream position known to have reached the client, and what it
+    // was at the last adjustment
+    unsigned ackedPosition;
+    unsigned adjustmentAcked;
+
+    // Kernel state, if sockFd is set
+    int sockFd;
+    unsigned sockRTT;
+    unsigned sockMinRTT;
+    unsigned sockInFlight;
+    unsigned long long deliveryRate;
+
+  private:
+    unsigned adjustments;
+    unsigned long long windowTotal;
+    unsigned long long bandwidthTotal;
+    LatencyHistogram rttStats;
   };
 }
 
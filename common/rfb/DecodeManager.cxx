@@ -18,8 +18,10 @@
 
 #include <assert.h>
 #include <string.h>
+#include <sys/time.h>
 
 #include <rfb/CConnection.h>
+#include <rfb/Configuration.h>
 #include <rfb/DecodeManager.h>
 #include <rfb/Decoder.h>
 #include <rfb/Exception.h>
@@ -27,6 +29,7 @@
 
 #include <rfb/LogWriter.h>
 
+#include <rdr/BufferedInStream.h>
 #include <rdr/Exception.h>
 #include <rdr/MemOutStream.h>
 
@@ -36,42 +39,70 @@ using namespace rfb;
 
 static LogWriter vlog("DecodeManager");
 
+static IntParameter decoderThreads("DecoderThreads",
+                                   "Number of threads to use for decoding "
+                                   "(0 means one per CPU core)", 0, 0);
+static BoolParameter zeroCopyDecoding("ZeroCopyDecoding",
+                                      "Decode rects directly from the "
+                                      "network buffer when possible",
+                                      true);
+
+// Size of the cells that pending entries are indexed by. Small enough
+// that a storm of small rects spreads out, and large enough that a full
+// frame update doesn't touch too many of them.
+static const int gridSize = 128;
+
+static unsigned long long usBetween(const struct timeval *first,
+                                    const struct timeval *second)
+{
+  return (second->tv_sec - first->tv_sec) * 1000000ULL +
+         (second->tv_usec - first->tv_usec);
+}
+
 DecodeManager::DecodeManager(CConnection *conn) :
-  conn(conn), threadException(NULL)
+  conn(conn), lookupCount(0), copiedBytes(0), directBytes(0), idleThreads(0),
+  nextThread(0), threadException(NULL)
 {
-  size_t cpuCount;
+  size_t threadCount;
 
   memset(decoders, 0, sizeof(decoders));
 
+  memset(decodedRects, 0, sizeof(decodedRects));
+  memset(decodeTime, 0, sizeof(decodeTime));
+
   queueMutex = new os::Mutex();
   producerCond = new os::Condition(queueMutex);
   consumerCond = new os::Condition(queueMutex);
 
-  cpuCount = os::Thread::getSystemCPUCount();
-  if (cpuCount == 0) {
-    vlog.error("Unable to determine the number of CPU cores on this system");
-    cpuCount = 1;
-  } else {
-    vlog.info("Detected %d CPU core(s)", (int)cpuCount);
-    // No point creating more threads than this, they'll just end up
-    // wasting CPU fighting for locks
-    if (cpuCount > 4)
-      cpuCount = 4;
-    // The overhead of threading is small, but not small enough to
-    // ignore on single CPU systems
-    if (cpuCount == 1)
-      vlog.info("Decoding data on main thread");
-    else
-      vlog.info("Creating %d decoder thread(s)", (int)cpuCount);
+  threadCount = decoderThreads;
+  if (threadCount == 0) {
+    threadCount = os::Thread::getSystemCPUCount();
+    if (threadCount == 0) {
+      vlog.error("Unable to determine the number of CPU cores on this system");
+      threadCount = 1;
+    } else {
+      vlog.info("Detected %d CPU core(s)", (int)threadCount);
+    }
   }
 
-  if (cpuCount == 1) {
+  // The overhead of threading is small, but not small enough to
+  // ignore on single CPU systems
+  if (threadCount == 1)
+    vlog.info("Decoding data on main thread");
+  else
+    vlog.info("Creating %d decoder thread(s)", (int)threadCount);
+
+  if (threadCount == 1) {
     // Threads are not used on single CPU machines
     freeBuffers.push_back(new rdr::MemOutStream());
     return;
   }
 
-  while (cpuCount--) {
+  // The threads look at each other's queues as soon as they start
+  os::AutoMutex a(queueMutex);
+
+  threads.reserve(threadCount);
+  while (threadCount--) {
     // Twice as many possible entries in the queue as there
     // are worker threads to make sure they don't stall
     freeBuffers.push_back(new rdr::MemOutStream());
@@ -83,6 +114,13 @@ DecodeManager::DecodeManager(CConnection *conn) :
 
 DecodeManager::~DecodeManager()
 {
+  std::vector<DecodeThread*>::iterator iter;
+
+  // Stop everyone first so no thread tries to steal from one that
+  // is already gone
+  for (iter = threads.begin(); iter != threads.end(); ++iter)
+    (*iter)->stop();
+
   while (!threads.empty()) {
     delete threads.back();
     threads.pop_back();
@@ -90,6 +128,14 @@ DecodeManager::~DecodeManager()
 
   delete threadException;
 
+  // Any retained data belongs to the InStream, which might already
+  // be gone at this point
+  while (!pendingEntries.empty()) {
+    freeBuffers.push_back(pendingEntries.front()->bufferStream);
+    delete pendingEntries.front();
+    pendingEntries.pop_front();
+  }
+
   while (!freeBuffers.empty()) {
     delete freeBuffers.back();
     freeBuffers.pop_back();
@@ -108,6 +154,12 @@ bool DecodeManager::decodeRect(const Rect& r, int encoding,
 {
   Decoder *decoder;
   rdr::MemOutStream *bufferStream;
+  rdr::InStream *is;
+  rdr::BufferedInStream *bis;
+  bool passthrough;
+  const rdr::U8* data;
+  size_t length;
+  struct timeval start, end;
 
   QueueEntry *entry;
 
@@ -128,19 +180,49 @@ bool DecodeManager::decodeRect(const Rect& r, int encoding,
 
   decoder = decoders[encoding];
 
+  is = conn->getInStream();
+
+  // Can we avoid copying the data?
+  passthrough = zeroCopyDecoding && (decoder->flags & DecoderPassthrough);
+
   // Fast path for single CPU machines to avoid the context
   // switching overhead
   if (threads.empty()) {
+    if (passthrough) {
+      // The data stays put as we are done with it before reading
+      // anything else
+      if (!decoder->getRectLength(r, is, conn->server, &length))
+        return false;
+      data = is->getptr(length);
+      gettimeofday(&start, NULL);
+      try {
+        decoder->decodeRect(r, data, length, conn->server, pb);
+      } catch (rdr::Exception& e) {
+        throw Exception("Error decoding rect: %s", e.str());
+      }
+      gettimeofday(&end, NULL);
+      is->setptr(length);
+      directBytes += length;
+      decodedRects[encoding]++;
+      decodeTime[encoding] += usBetween(&start, &end);
+      return true;
+    }
+
     bufferStream = freeBuffers.front();
     bufferStream->clear();
-    if (!decoder->readRect(r, conn->getInStream(), conn->server, bufferStream))
+    if (!decoder->readRect(r, is, conn->server, bufferStream))
       return false;
+    copiedBytes += bufferStream->length();
+    gettimeofday(&start, NULL);
     try {
       decoder->decodeRect(r, bufferStream->data(), bufferStream->length(),
                           conn->server, pb);
     } catch (rdr::Exception& e) {
       throw Exception("Error decoding rect: %s", e.str());
     }
+    gettimeofday(&end, NULL);
+    decodedRects[encoding]++;
+    decodeTime[encoding] += usBetween(&start, &end);
     return true;
   }
 
@@ -151,6 +233,8 @@ bool DecodeManager::decodeRect(const Rect& r, int encoding,
   while (freeBuffers.empty())
     producerCond->wait();
 
+  releaseData();
+
   // Don't pop the buffer in case we throw an exception
   // whilst reading
   bufferStream = freeBuffers.front();
@@ -160,25 +244,45 @@ bool DecodeManager::decodeRect(const Rect& r, int encoding,
   // First check if any thread has encountered a problem
   throwThreadException();
 
+  // Data can only be left in the InStream if it's prepared to hold
+  // on to it for us
+  bis = NULL;
+  if (passthrough)
+    bis = dynamic_cast<rdr::BufferedInStream*>(is);
+
   // Read the rect
-  bufferStream->clear();
-  if (!decoder->readRect(r, conn->getInStream(), conn->server, bufferStream))
-    return false;
+  if (bis != NULL) {
+    if (!decoder->getRectLength(r, bis, conn->server, &length))
+      return false;
+    data = bis->retain(length);
+    directBytes += length;
+  } else {
+    bufferStream->clear();
+    if (!decoder->readRect(r, is, conn->server, bufferStream))
+      return false;
+    data = (const rdr::U8*)bufferStream->data();
+    length = bufferStream->length();
+    copiedBytes += length;
+  }
 
   // Then try to put it on the queue
   entry = new QueueEntry;
 
-  entry->active = false;
   entry->rect = r;
   entry->encoding = encoding;
   entry->decoder = decoder;
   entry->server = &conn->server;
   entry->pb = pb;
   entry->bufferStream = bufferStream;
+  entry->data = data;
+  entry->length = length;
+  entry->retainedFrom = bis;
+  entry->blockers = 0;
+  entry->checked = 0;
 
-  decoder->getAffectedRegion(r, bufferStream->data(),
-                             bufferStream->length(), conn->server,
+  decoder->getAffectedRegion(r, entry->data, entry->length, conn->server,
                              &entry->affectedRegion);
+  entry->affectedBounds = entry->affectedRegion.get_bounding_rect();
 
   queueMutex->lock();
 
@@ -186,11 +290,11 @@ bool DecodeManager::decodeRect(const Rect& r, int encoding,
   // the front is still the same buffer
   freeBuffers.pop_front();
 
-  workQueue.push_back(entry);
+  findDependencies(entry);
+  addEntry(entry);
 
-  // We only put a single entry on the queue so waking a single
-  // thread is sufficient
-  consumerCond->signal();
+  if (entry->blockers == 0)
+    makeReady(entry, NULL);
 
   queueMutex->unlock();
 
@@ -201,14 +305,211 @@ void DecodeManager::flush()
 {
   queueMutex->lock();
 
-  while (!workQueue.empty())
+  while (!pendingEntries.empty())
     producerCond->wait();
 
+  releaseData();
+
   queueMutex->unlock();
 
   throwThreadException();
 }
 
+void DecodeManager::getStats(unsigned long long& copied,
+                             unsigned long long& direct)
+{
+  copied = copiedBytes;
+  direct = directBytes;
+}
+
+void DecodeManager::getDecodeStats(int encoding, unsigned& rects,
+                                   unsigned long long& time)
+{
+  assert((encoding >= 0) && (encoding <= encodingMax));
+
+  os::AutoMutex a(queueMutex);
+
+  rects = decodedRects[encoding];
+  time = decodeTime[encoding];
+}
+
+size_t DecodeManager::getThreadCount()
+{
+  if (threads.empty())
+    return 1;
+  return threads.size();
+}
+
+void DecodeManager::findDependencies(QueueEntry* entry)
+{
+  std::list<QueueEntry*>::iterator iter;
+  const Rect& bounds = entry->affectedBounds;
+
+  // Figure out once which earlier rects this one has to wait for, so
+  // the workers never have to search the queue for something to do
+
+  lookupCount++;
+
+  // Ordering constraints only apply within the same encoding
+  if (entry->decoder->flags & (DecoderOrdered | DecoderPartiallyOrdered)) {
+    std::list<QueueEntry*>& same = encodingEntries[entry->encoding];
+    for (iter = same.begin(); iter != same.end(); ++iter)
+      checkDependency(entry, *iter);
+  }
+
+  // Anything else has to overlap, so only look at the nearby entries
+  if (bounds.is_empty())
+    return;
+
+  for (int y = bounds.tl.y / gridSize; y <= (bounds.br.y-1) / gridSize; y++) {
+    for (int x = bounds.tl.x / gridSize; x <= (bounds.br.x-1) / gridSize; x++) {
+      std::map<GridCell, std::list<QueueEntry*> >::iterator cell;
+
+      cell = entryGrid.find(GridCell(x, y));
+      if (cell == entryGrid.end())
+        continue;
+
+      for (iter = cell->second.begin(); iter != cell->second.end(); ++iter)
+        checkDependency(entry, *iter);
+    }
+  }
+}
+
+void DecodeManager::checkDependency(QueueEntry* entry, QueueEntry* other)
+{
+  bool conflict;
+
+  // Large entries are found through several cells
+  if (other->checked == lookupCount)
+    return;
+  other->checked = lookupCount;
+
+  conflict = false;
+
+  if (entry->encoding == other->encoding) {
+    // An ordered decoder must see the rects in the order they
+    // arrived
+    if (entry->decoder->flags & DecoderOrdered)
+      conflict = true;
+    // For a partially ordered decoder we must ask the decoder for
+    // each pair of rectangles
+    else if (entry->decoder->flags & DecoderPartiallyOrdered)
+      conflict = entry->decoder->doRectsConflict(entry->rect,
+                                                 entry->data,
+                                                 entry->length,
+                                                 other->rect,
+                                                 other->data,
+                                                 other->length,
+                                                 *entry->server);
+  }
+
+  // Check overlap with earlier rectangles, but only bother with the
+  // full regions if the bounding boxes touch
+  if (!conflict && entry->affectedBounds.overlaps(other->affectedBounds))
+    conflict = !entry->affectedRegion.intersect(other->affectedRegion).is_empty();
+
+  if (!conflict)
+    return;
+
+  entry->blockers++;
+  other->dependents.push_back(entry);
+}
+
+void DecodeManager::addEntry(QueueEntry* entry)
+{
+  const Rect& bounds = entry->affectedBounds;
+
+  pendingEntries.push_back(entry);
+  encodingEntries[entry->encoding].push_back(entry);
+
+  if (bounds.is_empty())
+    return;
+
+  for (int y = bounds.tl.y / gridSize; y <= (bounds.br.y-1) / gridSize; y++) {
+    for (int x = bounds.tl.x / gridSize; x <= (bounds.br.x-1) / gridSize; x++)
+      entryGrid[GridCell(x, y)].push_back(entry);
+  }
+}
+
+void DecodeManager::removeEntry(QueueEntry* entry)
+{
+  const Rect& bounds = entry->affectedBounds;
+
+  pendingEntries.remove(entry);
+  encodingEntries[entry->encoding].remove(entry);
+
+  if (bounds.is_empty())
+    return;
+
+  for (int y = bounds.tl.y / gridSize; y <= (bounds.br.y-1) / gridSize; y++) {
+    for (int x = bounds.tl.x / gridSize; x <= (bounds.br.x-1) / gridSize; x++) {
+      std::map<GridCell, std::list<QueueEntry*> >::iterator cell;
+
+      cell = entryGrid.find(GridCell(x, y));
+      assert(cell != entryGrid.end());
+
+      cell->second.remove(entry);
+      if (cell->second.empty())
+        entryGrid.erase(cell);
+    }
+  }
+}
+
+void DecodeManager::makeReady(QueueEntry* entry, DecodeThread* thread)
+{
+  // New work is spread out over the threads, whilst work that gets
+  // unblocked stays with the thread that just finished, as it is
+  // likely to touch the same data
+  if (thread == NULL) {
+    thread = threads[nextThread];
+    nextThread = (nextThread + 1) % threads.size();
+  }
+
+  thread->pushEntry(entry);
+
+  // Idle threads will steal it if the owner is busy
+  if (idleThreads > 0)
+    consumerCond->signal();
+}
+
+void DecodeManager::completeEntry(QueueEntry* entry, DecodeThread* thread,
+                                  unsigned long long time)
+{
+  std::vector<QueueEntry*>::iterator iter;
+
+  os::AutoMutex a(queueMutex);
+
+  decodedRects[entry->encoding]++;
+  decodeTime[entry->encoding] += time;
+
+  for (iter = entry->dependents.begin();
+       iter != entry->dependents.end(); ++iter) {
+    (*iter)->blockers--;
+    if ((*iter)->blockers == 0)
+      makeReady(*iter, thread);
+  }
+
+  // The InStream may only be touched from the main thread
+  if (entry->retainedFrom != NULL)
+    releasedData.push_back(std::make_pair(entry->retainedFrom, entry->data));
+
+  // Remove the entry from the queue and give back the memory buffer
+  freeBuffers.push_back(entry->bufferStream);
+  removeEntry(entry);
+  delete entry;
+
+  // Wake the main thread in case it is waiting for a memory buffer
+  producerCond->signal();
+}
+
+void DecodeManager::releaseData()
+{
+  while (!releasedData.empty()) {
+    releasedData.front().first->release(releasedData.front().second);
+    releasedData.pop_front();
+  }
+}
+
 void DecodeManager::setThreadException(const rdr::Exception& e)
 {
   os::AutoMutex a(queueMutex);
@@ -240,6 +541,8 @@ DecodeManager::DecodeThread::DecodeThread(DecodeManager* manager)
 
   stopRequested = false;
 
+  readyMutex = new os::Mutex();
+
   start();
 }
 
@@ -247,6 +550,8 @@ DecodeManager::DecodeThread::~DecodeThread()
 {
   stop();
   wait();
+
+  delete readyMutex;
 }
 
 void DecodeManager::DecodeThread::stop()
@@ -262,30 +567,64 @@ void DecodeManager::DecodeThread::stop()
   manager->consumerCond->broadcast();
 }
 
-void DecodeManager::DecodeThread::worker()
+void DecodeManager::DecodeThread::pushEntry(QueueEntry* entry)
 {
-  manager->queueMutex->lock();
+  os::AutoMutex a(readyMutex);
+  readyQueue.push_back(entry);
+}
 
-  while (!stopRequested) {
+DecodeManager::QueueEntry* DecodeManager::DecodeThread::popEntry()
+{
+  DecodeManager::QueueEntry* entry;
+
+  os::AutoMutex a(readyMutex);
+
+  if (readyQueue.empty())
+    return NULL;
+
+  entry = readyQueue.back();
+  readyQueue.pop_back();
+
+  return entry;
+}
+
+DecodeManager::QueueEntry* DecodeManager::DecodeThread::stealEntry()
+{
+  DecodeManager::QueueEntry* entry;
+
+  os::AutoMutex a(readyMutex);
+
+  if (readyQueue.empty())
+    return NULL;
+
+  entry = readyQueue.front();
+  readyQueue.pop_front();
+
+  return entry;
+}
+
+void DecodeManager::DecodeThread::worker()
+{
+  while (true) {
     DecodeManager::QueueEntry *entry;
+    struct timeval start, end;
 
-    // Look for an available entry in the work queue
-    entry = findEntry();
+    // Our own queue only needs our own lock
+    entry = popEntry();
     if (entry == NULL) {
-      // Wait and try again
-      manager->consumerCond->wait();
-      continue;
-    }
-
-    // This is ours now
-    entry->active = true;
+      manager->queueMutex->lock();
+      entry = findEntry();
+      manager->queueMutex->unlock();
 
-    manager->queueMutex->unlock();
+      // Stop requested
+      if (entry == NULL)
+        break;
+    }
 
     // Do the actual decoding
+    gettimeofday(&start, NULL);
     try {
-      entry->decoder->decodeRect(entry->rect, entry->bufferStream->data(),
-                                 entry->bufferStream->length(),
+      entry->decoder->decodeRect(entry->rect, entry->data, entry->length,
                                  *entry->server, entry->pb);
     } catch (rdr::Exception& e) {
       manager->setThreadException(e);
@@ -293,82 +632,39 @@ void DecodeManager::DecodeThread::worker()
       assert(false);
     }
 
-    manager->queueMutex->lock();
+    gettimeofday(&end, NULL);
 
-    // Remove the entry from the queue and give back the memory buffer
-    manager->freeBuffers.push_back(entry->bufferStream);
-    manager->workQueue.remove(entry);
-    delete entry;
-
-    // Wake the main thread in case it is waiting for a memory buffer
-    manager->producerCond->signal();
-    // This rect might have been blocking multiple other rects, so
-    // wake up every worker thread
-    if (manager->workQueue.size() > 1)
-      manager->consumerCond->broadcast();
+    manager->completeEntry(entry, this, usBetween(&start, &end));
   }
-
-  manager->queueMutex->unlock();
 }
 
 DecodeManager::QueueEntry* DecodeManager::DecodeThread::findEntry()
 {
-  std::list<DecodeManager::QueueEntry*>::iterator iter;
-  Region lockedRegion;
+  std::vector<DecodeThread*>::iterator iter;
 
-  if (manager->workQueue.empty())
-    return NULL;
-
-  if (!manager->workQueue.front()->active)
-    return manager->workQueue.front();
+  // Entries are only ever made ready with queueMutex held, so nothing
+  // can slip past us between checking the queues and going to sleep
 
-  for (iter = manager->workQueue.begin();
-       iter != manager->workQueue.end();
-       ++iter) {
+  while (!stopRequested) {
     DecodeManager::QueueEntry* entry;
 
-    std::list<DecodeManager::QueueEntry*>::iterator iter2;
-
-    entry = *iter;
-
-    // Another thread working on this?
-    if (entry->active)
-      goto next;
-
-    // If this is an ordered decoder then make sure this is the first
-    // rectangle in the queue for that decoder
-    if (entry->decoder->flags & DecoderOrdered) {
-      for (iter2 = manager->workQueue.begin(); iter2 != iter; ++iter2) {
-        if (entry->encoding == (*iter2)->encoding)
-          goto next;
-      }
-    }
-
-    // For a partially ordered decoder we must ask the decoder for each
-    // pair of rectangles.
-    if (entry->decoder->flags & DecoderPartiallyOrdered) {
-      for (iter2 = manager->workQueue.begin(); iter2 != iter; ++iter2) {
-        if (entry->encoding != (*iter2)->encoding)
-          continue;
-        if (entry->decoder->doRectsConflict(entry->rect,
-                                            entry->bufferStream->data(),
-                                            entry->bufferStream->length(),
-                                            (*iter2)->rect,
-                                            (*iter2)->bufferStream->data(),
-                                            (*iter2)->bufferStream->length(),
-                                            *entry->server))
-          goto next;
-      }
+    entry = popEntry();
+    if (entry != NULL)
+      return entry;
+
+    for (iter = manager->threads.begin();
+         iter != manager->threads.end(); ++iter) {
+      if (*iter == this)
+        continue;
+      entry = (*iter)->stealEntry();
+      if (entry != NULL)
+        return entry;
     }
 
-    // Check overlap with earlier rectangles
-    if (!lockedRegion.intersect(entry->affectedRegion).is_empty())
-      goto next;
-
-    return entry;
-
-next:
-    lockedRegion.assign_union(entry->affectedRegion);
+    // Wait and try again
+    manager->idleThreads++;
+    manager->consumerCond->wait();
+    manager->idleThreads--;
   }
 
   return NULL;
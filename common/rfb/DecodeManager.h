@@ -19,10 +19,16 @@
 #ifndef __RFB_DECODEMANAGER_H__
 #define __RFB_DECODEMANAGER_H__
 
+#include <deque>
 #include <list>
+#include <map>
+#include <utility>
+#include <vector>
 
 #include <os/Thread.h>
 
+#include <rdr/types.h>
+
 #include <rfb/Region.h>
 #include <rfb/encodings.h>
 
@@ -33,6 +39,7 @@ namespace os {
 
 namespace rdr {
   struct Exception;
+  class BufferedInStream;
   class MemOutStream;
 }
 
@@ -52,7 +59,32 @@ namespace rfb {
 
     void flush();
 
+    // getStats() returns how much rect data has been copied out of the
+    // InStream, and how much was decoded directly from it
+    void getStats(unsigned long long& copied,
+                  unsigned long long& direct);
+
+    // getDecodeStats() returns how many rects of the given encoding
+    // have been decoded, and how long that took in total (in
+    // microseconds)
+    void getDecodeStats(int encoding, unsigned& rects,
+                        unsigned long long& time);
+    // getThreadCount() returns how many threads are decoding rects
+    size_t getThreadCount();
+
   private:
+    struct QueueEntry;
+    class DecodeThread;
+
+    void findDependencies(QueueEntry* entry);
+    void checkDependency(QueueEntry* entry, QueueEntry* other);
+    void addEntry(QueueEntry* entry);
+    void removeEntry(QueueEntry* entry);
+    void makeReady(QueueEntry* entry, DecodeThread* thread);
+    void completeEntry(QueueEntry* entry, DecodeThread* thread,
+                       unsigned long long time);
+    void releaseData();
+
     void setThreadException(const rdr::Exception& e);
     void throwThreadException();
 
@@ -61,23 +93,56 @@ namespace rfb {
     Decoder *decoders[encodingMax+1];
 
     struct QueueEntry {
-      bool active;
       Rect rect;
       int encoding;
       Decoder* decoder;
       const ServerParams* server;
       ModifiablePixelBuffer* pb;
       rdr::MemOutStream* bufferStream;
+      // Either bufferStream's data, or data retained directly from
+      // the InStream
+      const rdr::U8* data;
+      size_t length;
+      rdr::BufferedInStream* retainedFrom;
       Region affectedRegion;
+      Rect affectedBounds;
+
+      // Number of earlier entries that must finish before this one
+      // can be decoded, and the entries that are waiting for us
+      int blockers;
+      std::vector<QueueEntry*> dependents;
+
+      // Last lookup that has compared a new entry against this one
+      unsigned checked;
     };
 
     std::list<rdr::MemOutStream*> freeBuffers;
-    std::list<QueueEntry*> workQueue;
-
+    // Every entry that hasn't finished decoding, in arrival order
+    std::list<QueueEntry*> pendingEntries;
+    // The same entries, indexed by the grid cells their affected area
+    // touches and by encoding, so that a new entry is only compared
+    // against those that can possibly conflict with it
+    typedef std::pair<int, int> GridCell;
+    std::map<GridCell, std::list<QueueEntry*> > entryGrid;
+    std::list<QueueEntry*> encodingEntries[encodingMax+1];
+    unsigned lookupCount;
+    // Retained data that the main thread needs to give back
+    std::list<std::pair<rdr::BufferedInStream*, const rdr::U8*> > releasedData;
+
+    unsigned long long copiedBytes;
+    unsigned long long directBytes;
+
+    unsigned decodedRects[encodingMax+1];
+    unsigned long long decodeTime[encodingMax+1];
+
+    // Protects everything except the threads' ready queues
     os::Mutex* queueMutex;
     os::Condition* producerCond;
     os::Condition* consumerCond;
 
+    size_t idleThreads;
+    size_t nextThread;
+
   private:
     class DecodeThread : public os::Thread {
     public:
@@ -86,6 +151,10 @@ namespace rfb {
 
       void stop();
 
+      void pushEntry(QueueEntry* entry);
+      DecodeManager::QueueEntry* popEntry();
+      DecodeManager::QueueEntry* stealEntry();
+
     protected:
       void worker();
       DecodeManager::QueueEntry* findEntry();
@@ -94,9 +163,14 @@ namespace rfb {
       DecodeManager* manager;
 
       bool stopRequested;
+
+      // Entries that can be decoded right away. The owning thread
+      // takes from the back, other threads steal from the front.
+      os::Mutex* readyMutex;
+      std::deque<QueueEntry*> readyQueue;
     };
 
-    std::list<DecodeThread*> threads;
+    std::vector<DecodeThread*> threads;
     rdr::Exception *threadException;
   };
 }
@@ -39,6 +39,10 @@ namespace rfb {
     // Only some of the rects must be handled in order,
     // see doesRectsConflict()
     DecoderPartiallyOrdered = 1 << 1,
+    // readRect() passes the data through unchanged, so decodeRect()
+    // can also be given the data directly from the InStream, see
+    // getRectLength()
+    DecoderPassthrough = 1 << 2,
   };
 
   class Decoder {
@@ -55,6 +59,14 @@ namespace rfb {
     virtual bool readRect(const Rect& r, rdr::InStream* is,
                           const ServerParams& server, rdr::OutStream* os)=0;
 
+    // getRectLength() determines how many bytes the given rectangle
+    // occupies on the InStream without consuming any of them. It
+    // returns false if not all of the rectangle's data is available
+    // yet. This will only be called if the DecoderPassthrough flag has
+    // been set, and follows the same rules as readRect().
+    virtual bool getRectLength(const Rect& r, rdr::InStream* is,
+                               const ServerParams& server, size_t* length);
+
     // These functions will be called from any of the worker threads.
     // A lock will be held whilst these are called so it is safe to
     // read and update internal state as necessary.
@@ -20,6 +20,9 @@
  */
 
 #include <stdlib.h>
+#include <sys/time.h>
+
+#include <algorithm>
 
 #include <rfb/EncodeManager.h>
 #include <rfb/Encoder.h>
@@ -29,6 +32,8 @@
 #include <rfb/UpdateTracker.h>
 #include <rfb/LogWriter.h>
 #include <rfb/Exception.h>
+#include <rfb/SharedMemory.h>
+#include <rfb/UDPChannel.h>
 
 #include <rfb/RawEncoder.h>
 #include <rfb/RREEncoder.h>
@@ -46,6 +51,9 @@ static LogWriter vlog("EncodeManager");
 static const int SubRectMaxArea = 65536;
 static const int SubRectMaxWidth = 2048;
 
+// Size of the tiles used when there is a focus point
+static const int FocusTileSize = 256;
+
 // The size in pixels of either side of each block tested when looking
 // for solid blocks.
 static const int SolidSearchBlock = 16;
@@ -129,7 +137,8 @@ static const char *encoderTypeName(EncoderType type)
 }
 
 EncodeManager::EncodeManager(SConnection* conn_)
-  : conn(conn_), recentChangeTimer(this)
+  : conn(conn_), recentChangeTimer(this), sideChannel(NULL),
+    sharedMemory(NULL), sharedStride(0), hasFocus(false)
 {
   StatsVector::iterator iter;
 
@@ -144,7 +153,10 @@ EncodeManager::EncodeManager(SConnection* conn_)
   encoders[encoderZRLE] = new ZRLEEncoder(conn);
 
   updates = 0;
+  encodeTime = encodePixels = 0;
   memset(&copyStats, 0, sizeof(copyStats));
+  memset(&datagramStats, 0, sizeof(datagramStats));
+  memset(&sharedStats, 0, sizeof(sharedStats));
   stats.resize(encoderClassMax);
   for (iter = stats.begin();iter != stats.end();++iter) {
     StatsVector::value_type::iterator iter2;
@@ -199,6 +211,44 @@ void EncodeManager::logStats()
               a, ratio);
   }
 
+  if (datagramStats.rects != 0) {
+    vlog.info("  %s:", "UDP");
+
+    rects += datagramStats.rects;
+    pixels += datagramStats.pixels;
+    bytes += datagramStats.bytes;
+    equivalent += datagramStats.equivalent;
+
+    ratio = (double)datagramStats.equivalent / datagramStats.bytes;
+
+    siPrefix(datagramStats.rects, "rects", a, sizeof(a));
+    siPrefix(datagramStats.pixels, "pixels", b, sizeof(b));
+    vlog.info("    %s: %s, %s", "Tight (JPEG)", a, b);
+    iecPrefix(datagramStats.bytes, "B", a, sizeof(a));
+    vlog.info("    %*s  %s (1:%g ratio)",
+              (int)strlen("Tight (JPEG)"), "",
+              a, ratio);
+  }
+
+  if (sharedStats.rects != 0) {
+    vlog.info("  %s:", "Shared memory");
+
+    rects += sharedStats.rects;
+    pixels += sharedStats.pixels;
+    bytes += sharedStats.bytes;
+    equivalent += sharedStats.equivalent;
+
+    ratio = (double)sharedStats.equivalent / sharedStats.bytes;
+
+    siPrefix(sharedStats.rects, "rects", a, sizeof(a));
+    siPrefix(sharedStats.pixels, "pixels", b, sizeof(b));
+    vlog.info("    %s: %s, %s", "Copies", a, b);
+    iecPrefix(sharedStats.bytes, "B", a, sizeof(a));
+    vlog.info("    %*s  %s (1:%g ratio)",
+              (int)strlen("Copies"), "",
+              a, ratio);
+  }
+
   for (i = 0;i < stats.size();i++) {
     // Did this class do anything at all?
     for (j = 0;j < stats[i].size();j++) {
@@ -238,6 +288,11 @@ void EncodeManager::logStats()
   vlog.info("  Total: %s, %s", a, b);
   iecPrefix(bytes, "B", a, sizeof(a));
   vlog.info("         %s (1:%g ratio)", a, ratio);
+
+  if (encodePixels != 0) {
+    vlog.info("  Encoding time: %g ms/Mpixel",
+              (double)encodeTime * 1000.0 / encodePixels);
+  }
 }
 
 bool EncodeManager::supported(int encoding)
@@ -277,10 +332,22 @@ void EncodeManager::pruneLosslessRefresh(const Region& limits)
   pendingRefreshRegion.assign_intersect(limits);
 }
 
+void EncodeManager::resetCompression()
+{
+  std::vector<Encoder*>::iterator iter;
+
+  for (iter = encoders.begin();iter != encoders.end();iter++)
+    (*iter)->resetCompression();
+}
+
 void EncodeManager::writeUpdate(const UpdateInfo& ui, const PixelBuffer* pb,
                                 const RenderedCursor* renderedCursor)
 {
+  struct timeval start;
+
+  gettimeofday(&start, NULL);
   doUpdate(true, ui.changed, ui.copied, ui.copy_delta, pb, renderedCursor);
+  addEncodeTime(&start, ui.changed);
 
   recentlyChangedRegion.assign_union(ui.changed);
   recentlyChangedRegion.assign_union(ui.copied);
@@ -292,8 +359,14 @@ void EncodeManager::writeLosslessRefresh(const Region& req, const PixelBuffer* p
                                          const RenderedCursor* renderedCursor,
                                          size_t maxUpdateSize)
 {
-  doUpdate(false, getLosslessRefresh(req, maxUpdateSize),
-           Region(), Point(), pb, renderedCursor);
+  struct timeval start;
+  Region refresh;
+
+  refresh = getLosslessRefresh(req, maxUpdateSize);
+
+  gettimeofday(&start, NULL);
+  doUpdate(false, refresh, Region(), Point(), pb, renderedCursor);
+  addEncodeTime(&start, refresh);
 }
 
 bool EncodeManager::handleTimeout(Timer* t)
@@ -322,6 +395,11 @@ void EncodeManager::doUpdate(bool allowLossy, const Region& changed_,
 
     updates++;
 
+    if (sharedMemory != NULL) {
+      doSharedMemoryUpdate(changed_, copied, pb, renderedCursor);
+      return;
+    }
+
     prepareEncoders(allowLossy);
 
     changed = changed_;
@@ -353,6 +431,12 @@ void EncodeManager::doUpdate(bool allowLossy, const Region& changed_,
     if (conn->client.supportsEncoding(encodingCopyRect))
       writeCopyRects(copied, copyDelta);
 
+    // Lets the client know which datagrams are older than what follows.
+    // This has to come after the copies, as those must not pick up
+    // anything from the datagrams of this update.
+    if (sideChannel != NULL)
+      conn->writer()->writeUDPMarker(updates);
+
     /*
      * We start by searching for solid rects, which are then removed
      * from the changed region.
@@ -366,6 +450,36 @@ void EncodeManager::doUpdate(bool allowLossy, const Region& changed_,
     conn->writer()->writeFramebufferUpdateEnd();
 }
 
+void EncodeManager::doSharedMemoryUpdate(const Region& changed_,
+                                         const Region& copied,
+                                         const PixelBuffer* pb,
+                                         const RenderedCursor* renderedCursor)
+{
+  int nRects;
+  Region changed, cursorRegion;
+
+  // The client already has the memory, so copies are no cheaper
+  // than anything else
+  changed = changed_.union_(copied);
+
+  if (renderedCursor != NULL) {
+    cursorRegion = changed.intersect(renderedCursor->getEffectiveRect());
+    changed.assign_subtract(renderedCursor->getEffectiveRect());
+  }
+
+  if (conn->client.supportsEncoding(pseudoEncodingLastRect))
+    nRects = 0xFFFF;
+  else
+    nRects = changed.numRects() + cursorRegion.numRects();
+
+  conn->writer()->writeFramebufferUpdateStart(nRects);
+
+  writeSharedMemoryRects(changed, pb);
+  writeSharedMemoryRects(cursorRegion, renderedCursor);
+
+  conn->writer()->writeFramebufferUpdateEnd();
+}
+
 void EncodeManager::prepareEncoders(bool allowLossy)
 {
   enum EncoderClass solid, bitmap, bitmapRLE;
@@ -487,87 +601,268 @@ void EncodeManager::prepareEncoders(bool allowLossy)
   }
 }
 
-Region EncodeManager::getLosslessRefresh(const Region& req,
-                                         size_t maxUpdateSize)
+// limitRects() picks rects until their total area reaches maxArea,
+// including as much as possible of the final rect
+static Region limitRects(std::vector<Rect>* rects, size_t maxArea,
+                         bool randomOrder)
 {
-  std::vector<Rect> rects;
-  Region refresh;
+  Region result;
   size_t area;
 
-  // We make a conservative guess at the compression ratio at 2:1
-  maxUpdateSize *= 2;
-
-  // We will measure pixels, not bytes (assume 32 bpp)
-  maxUpdateSize /= 4;
-
   area = 0;
-  pendingRefreshRegion.intersect(req).get_rects(&rects);
-  while (!rects.empty()) {
+  while (!rects->empty()) {
     size_t idx;
     Rect rect;
 
-    // Grab a random rect so we don't keep damaging and restoring the
-    // same rect over and over
-    idx = rand() % rects.size();
+    if (randomOrder)
+      idx = rand() % rects->size();
+    else
+      idx = 0;
 
-    rect = rects[idx];
+    rect = (*rects)[idx];
 
     // Add rects until we exceed the threshold, then include as much as
     // possible of the final rect
-    if ((area + rect.area()) > maxUpdateSize) {
+    if ((area + rect.area()) > maxArea) {
       // Use the narrowest axis to avoid getting to thin rects
       if (rect.width() > rect.height()) {
-        int width = (maxUpdateSize - area) / rect.height();
+        int width = (maxArea - area) / rect.height();
         rect.br.x = rect.tl.x + __rfbmax(1, width);
       } else {
-        int height = (maxUpdateSize - area) / rect.width();
+        int height = (maxArea - area) / rect.width();
         rect.br.y = rect.tl.y + __rfbmax(1, height);
       }
-      refresh.assign_union(Region(rect));
+      result.assign_union(Region(rect));
       break;
     }
 
     area += rect.area();
-    refresh.assign_union(Region(rect));
+    result.assign_union(Region(rect));
 
-    rects.erase(rects.begin() + idx);
+    rects->erase(rects->begin() + idx);
   }
 
-  return refresh;
+  return result;
 }
 
-int EncodeManager::computeNumRects(const Region& changed)
+Region EncodeManager::getLosslessRefresh(const Region& req,
+                                         size_t maxUpdateSize)
+{
+  std::vector<Rect> rects;
+
+  // We make a conservative guess at the compression ratio at 2:1
+  maxUpdateSize *= 2;
+
+  // We will measure pixels, not bytes (assume 32 bpp)
+  maxUpdateSize /= 4;
+
+  // Grab random rects so we don't keep damaging and restoring the
+  // same rect over and over
+  pendingRefreshRegion.intersect(req).get_rects(&rects);
+  return limitRects(&rects, maxUpdateSize, true);
+}
+
+double EncodeManager::getCompressionRatio()
+{
+  unsigned long long bytes, equivalent;
+  size_t i, j;
+
+  // Solid areas compress extremely well and would make the estimate
+  // useless for anything else, so it is capped
+  bytes = equivalent = 0;
+  for (i = 0;i < stats.size();i++) {
+    for (j = 0;j < stats[i].size();j++) {
+      bytes += stats[i][j].bytes;
+      equivalent += stats[i][j].equivalent;
+    }
+  }
+
+  if (bytes == 0)
+    return 2.0;
+
+  return __rfbmin((double)equivalent / bytes, 16.0);
+}
+
+Region EncodeManager::getLimitedUpdate(const Region& changed,
+                                       size_t maxUpdateSize)
 {
-  int numRects;
+  std::vector<Rect> rects;
+  size_t maxArea;
+
+  // Use the compression we have seen so far to estimate how much
+  // fits
+  maxArea = maxUpdateSize * getCompressionRatio() /
+            (conn->client.pf().bpp / 8);
+
+  // Closest to the focus first (or top to bottom), so that the rest
+  // of the screen follows in the next update
+  splitRects(changed, &rects);
+  sortRects(&rects);
+  return limitRects(&rects, maxArea, false);
+}
+
+Region EncodeManager::getTimeLimitedUpdate(const Region& changed,
+                                           unsigned maxTime)
+{
+  std::vector<Rect> rects;
+  double maxArea;
+
+  // Nothing to go on yet
+  if ((encodeTime == 0) || (encodePixels == 0))
+    return changed;
+
+  maxArea = (double)maxTime * 1000 * encodePixels / encodeTime;
+  if (maxArea > (double)((size_t)-1))
+    return changed;
+
+  splitRects(changed, &rects);
+  sortRects(&rects);
+  return limitRects(&rects, (size_t)maxArea, false);
+}
+
+void EncodeManager::setFocus(const Point& pos)
+{
+  hasFocus = true;
+  focus = pos;
+}
+
+void EncodeManager::clearFocus()
+{
+  hasFocus = false;
+}
+
+void EncodeManager::setSideChannel(UDPChannel* channel)
+{
+  sideChannel = channel;
+}
+
+void EncodeManager::setSharedMemory(SharedMemory* memory, int stride)
+{
+  sharedMemory = memory;
+  sharedStride = stride;
+}
+
+void EncodeManager::addEncodeTime(const struct timeval* start,
+                                  const Region& changed)
+{
+  struct timeval now;
   std::vector<Rect> rects;
   std::vector<Rect>::const_iterator rect;
 
-  numRects = 0;
+  gettimeofday(&now, NULL);
+
+  encodeTime += (now.tv_sec - start->tv_sec) * 1000000ULL;
+  encodeTime += now.tv_usec;
+  encodeTime -= start->tv_usec;
+
   changed.get_rects(&rects);
-  for (rect = rects.begin(); rect != rects.end(); ++rect) {
+  for (rect = rects.begin(); rect != rects.end(); ++rect)
+    encodePixels += rect->area();
+
+  // Only the last few seconds of encoding are of interest, as the
+  // content and the client's settings change over time
+  if (encodeTime > 5000000) {
+    encodeTime /= 2;
+    encodePixels /= 2;
+  }
+}
+
+// FocusOrder sorts rects by their distance from the focus point, with
+// anything covering the point itself first
+struct FocusOrder {
+  FocusOrder(const Point& p) : focus(p) {}
+
+  long long distance(const Rect& r) const {
+    long long dx, dy;
+
+    dx = dy = 0;
+    if (focus.x < r.tl.x)
+      dx = r.tl.x - focus.x;
+    else if (focus.x >= r.br.x)
+      dx = focus.x - r.br.x + 1;
+    if (focus.y < r.tl.y)
+      dy = r.tl.y - focus.y;
+    else if (focus.y >= r.br.y)
+      dy = focus.y - r.br.y + 1;
+
+    return dx*dx + dy*dy;
+  }
+
+  bool operator()(const Rect& a, const Rect& b) const {
+    return distance(a) < distance(b);
+  }
+
+  Point focus;
+};
+
+void EncodeManager::splitRects(const Region& changed,
+                               std::vector<Rect>* rects)
+{
+  std::vector<Rect> input;
+  std::vector<Rect>::const_iterator rect;
+
+  rects->clear();
+
+  changed.get_rects(&input);
+  for (rect = input.begin(); rect != input.end(); ++rect) {
     int w, h, sw, sh;
+    Rect sr;
 
     w = rect->width();
     h = rect->height();
 
     // No split necessary?
     if (((w*h) < SubRectMaxArea) && (w < SubRectMaxWidth)) {
-      numRects += 1;
+      rects->push_back(*rect);
       continue;
     }
 
-    if (w <= SubRectMaxWidth)
-      sw = w;
-    else
-      sw = SubRectMaxWidth;
+    if (hasFocus) {
+      // Evenly sized tiles, so the area around the focus can be picked
+      // out and sent first
+      sw = (w - 1) / ((w - 1) / FocusTileSize + 1) + 1;
+      sh = (h - 1) / ((h - 1) / FocusTileSize + 1) + 1;
+    } else {
+      if (w <= SubRectMaxWidth)
+        sw = w;
+      else
+        sw = SubRectMaxWidth;
+
+      sh = SubRectMaxArea / sw;
+    }
 
-    sh = SubRectMaxArea / sw;
+    for (sr.tl.y = rect->tl.y; sr.tl.y < rect->br.y; sr.tl.y += sh) {
+      sr.br.y = sr.tl.y + sh;
+      if (sr.br.y > rect->br.y)
+        sr.br.y = rect->br.y;
 
-    // ceil(w/sw) * ceil(h/sh)
-    numRects += (((w - 1)/sw) + 1) * (((h - 1)/sh) + 1);
+      for (sr.tl.x = rect->tl.x; sr.tl.x < rect->br.x; sr.tl.x += sw) {
+        sr.br.x = sr.tl.x + sw;
+        if (sr.br.x > rect->br.x)
+          sr.br.x = rect->br.x;
+
+        rects->push_back(sr);
+      }
+    }
   }
+}
+
+void EncodeManager::sortRects(std::vector<Rect>* rects)
+{
+  if (!hasFocus)
+    return;
+
+  // Stable, so equally distant rects keep their top to bottom order
+  std::stable_sort(rects->begin(), rects->end(), FocusOrder(focus));
+}
+
+int EncodeManager::computeNumRects(const Region& changed)
+{
+  std::vector<Rect> rects;
+
+  splitRects(changed, &rects);
 
-  return numRects;
+  return rects.size();
 }
 
 Encoder *EncodeManager::startRect(const Rect& rect, int type)
@@ -761,41 +1056,11 @@ void EncodeManager::writeRects(const Region& changed, const PixelBuffer* pb)
   std::vector<Rect> rects;
   std::vector<Rect>::const_iterator rect;
 
-  changed.get_rects(&rects);
-  for (rect = rects.begin(); rect != rects.end(); ++rect) {
-    int w, h, sw, sh;
-    Rect sr;
-
-    w = rect->width();
-    h = rect->height();
+  splitRects(changed, &rects);
+  sortRects(&rects);
 
-    // No split necessary?
-    if (((w*h) < SubRectMaxArea) && (w < SubRectMaxWidth)) {
-      writeSubRect(*rect, pb);
-      continue;
-    }
-
-    if (w <= SubRectMaxWidth)
-      sw = w;
-    else
-      sw = SubRectMaxWidth;
-
-    sh = SubRectMaxArea / sw;
-
-    for (sr.tl.y = rect->tl.y; sr.tl.y < rect->br.y; sr.tl.y += sh) {
-      sr.br.y = sr.tl.y + sh;
-      if (sr.br.y > rect->br.y)
-        sr.br.y = rect->br.y;
-
-      for (sr.tl.x = rect->tl.x; sr.tl.x < rect->br.x; sr.tl.x += sw) {
-        sr.br.x = sr.tl.x + sw;
-        if (sr.br.x > rect->br.x)
-          sr.br.x = rect->br.x;
-
-        writeSubRect(sr, pb);
-      }
-    }
-  }
+  for (rect = rects.begin(); rect != rects.end(); ++rect)
+    writeSubRect(*rect, pb);
 }
 
 void EncodeManager::writeSubRect(const Rect& rect, const PixelBuffer *pb)
@@ -872,6 +1137,12 @@ void EncodeManager::writeSubRect(const Rect& rect, const PixelBuffer *pb)
       type = encoderIndexed;
   }
 
+  if ((type == encoderFullColour) && (sideChannel != NULL) &&
+      (activeEncoders[encoderFullColour] == encoderTightJPEG)) {
+    if (writeDatagramRect(rect, pb))
+      return;
+  }
+
   encoder = startRect(rect, type);
 
   if (encoder->flags & EncoderUseNativePF)
@@ -882,6 +1153,95 @@ void EncodeManager::writeSubRect(const Rect& rect, const PixelBuffer *pb)
   endRect();
 }
 
+void EncodeManager::writeSharedMemoryRects(const Region& changed,
+                                           const PixelBuffer* pb)
+{
+  std::vector<Rect> rects;
+  std::vector<Rect>::const_iterator rect;
+
+  const PixelFormat& pf = conn->client.pf();
+
+  beforeLength = conn->getOutStream()->length();
+
+  changed.get_rects(&rects);
+  for (rect = rects.begin(); rect != rects.end(); ++rect) {
+    const rdr::U8* src;
+    rdr::U8* dst;
+    int stride;
+
+    src = pb->getBuffer(*rect, &stride);
+    dst = sharedMemory->getData() +
+          ((size_t)rect->tl.y * sharedStride + rect->tl.x) * (pf.bpp/8);
+
+    pf.bufferFromBuffer(dst, pb->getPF(), src,
+                        rect->width(), rect->height(),
+                        sharedStride, stride);
+
+    conn->writer()->writeSharedMemoryRect(*rect);
+
+    sharedStats.rects++;
+    sharedStats.pixels += rect->area();
+    sharedStats.equivalent += 12 + rect->area() * (pf.bpp/8);
+  }
+
+  sharedStats.bytes += conn->getOutStream()->length() - beforeLength;
+
+  // Everything is now exact on the client
+  lossyRegion.assign_subtract(changed);
+  pendingRefreshRegion.assign_subtract(changed);
+}
+
+bool EncodeManager::writeDatagramRect(const Rect& rect,
+                                      const PixelBuffer *pb)
+{
+  TightJPEGEncoder *encoder;
+  PixelBuffer *ppb;
+
+  const rdr::U8* data;
+  size_t length;
+  bool sent;
+
+  encoder = (TightJPEGEncoder*)encoders[encoderTightJPEG];
+
+  // The client must be able to rely on lossless content, so that has
+  // to go over the normal connection
+  if ((encoder->losslessQuality != -1) &&
+      (encoder->getQualityLevel() >= encoder->losslessQuality))
+    return false;
+
+  ppb = preparePixelBuffer(rect, pb, false);
+  data = encoder->compress(ppb, &length);
+
+  try {
+    sent = sideChannel->sendRect(updates, rect, data, length);
+  } catch (rdr::Exception& e) {
+    vlog.error("Disabling UDP transport: %s", e.str());
+    sideChannel = NULL;
+    sent = false;
+  }
+
+  // Too large for the channel, but there is no point in compressing
+  // it all over again
+  if (!sent) {
+    startRect(rect, encoderFullColour);
+    encoder->writeCompressed(data, length);
+    endRect();
+    return true;
+  }
+
+  datagramStats.rects++;
+  datagramStats.pixels += rect.area();
+  datagramStats.equivalent += 12 + rect.area() * (conn->client.pf().bpp/8);
+  datagramStats.bytes += length;
+
+  // This may never arrive, so it is up to the lossless refresh to
+  // fix things
+  lossyRegion.assign_union(Region(rect));
+  pendingRefreshRegion.assign_subtract(Region(rect));
+
+  return true;
+}
+
 bool EncodeManager::checkSolidTile(const Rect& r, const rdr::U8* colourValue,
                                    const PixelBuffer *pb)
 {
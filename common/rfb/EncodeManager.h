@@ -33,6 +33,8 @@ namespace rfb {
   class UpdateInfo;
   class PixelBuffer;
   class RenderedCursor;
+  class UDPChannel;
+  class SharedMemory;
   struct Rect;
 
   struct RectInfo;
@@ -52,6 +54,11 @@ namespace rfb {
 
     void pruneLosslessRefresh(const Region& limits);
 
+    // resetCompression() makes sure that the following updates can be
+    // decoded without any knowledge of earlier ones (where the
+    // encodings allow it)
+    void resetCompression();
+
     void writeUpdate(const UpdateInfo& ui, const PixelBuffer* pb,
                      const RenderedCursor* renderedCursor);
 
@@ -59,6 +66,36 @@ namespace rfb {
                               const RenderedCursor* renderedCursor,
                               size_t maxUpdateSize);
 
+    // getCompressionRatio() returns an estimate of how well updates
+    // compress, based on what has been sent so far
+    double getCompressionRatio();
+
+    // getLimitedUpdate() returns the part of the changed region that
+    // is expected to encode to at most maxUpdateSize bytes
+    Region getLimitedUpdate(const Region& changed, size_t maxUpdateSize);
+
+    // getTimeLimitedUpdate() returns the part of the changed region
+    // that is expected to take at most maxTime ms to encode
+    Region getTimeLimitedUpdate(const Region& changed, unsigned maxTime);
+
+    // setFocus() makes the area around the given point, normally the
+    // pointer, get encoded first and be preferred when an update has to
+    // be limited. Coordinates are those of the regions passed in.
+    void setFocus(const Point& pos);
+    void clearFocus();
+
+    // setSideChannel() makes lossy JPEG rects go out over the given
+    // datagram channel instead of the normal connection. Lossless
+    // refreshes still use the normal connection and will eventually
+    // repair anything that gets lost. The client must support LastRect
+    // as the number of rects in each update is no longer known.
+    void setSideChannel(UDPChannel* channel);
+
+    // setSharedMemory() makes updates get copied to the given memory
+    // area, which the client has mapped, instead of being encoded.
+    // The area is in the client's pixel format with the given stride.
+    void setSharedMemory(SharedMemory* memory, int stride);
+
   protected:
     virtual bool handleTimeout(Timer* t);
 
@@ -68,10 +105,20 @@ namespace rfb {
                   const RenderedCursor* renderedCursor);
     void prepareEncoders(bool allowLossy);
 
+    void doSharedMemoryUpdate(const Region& changed, const Region& copied,
+                              const PixelBuffer* pb,
+                              const RenderedCursor* renderedCursor);
+    void writeSharedMemoryRects(const Region& changed,
+                                const PixelBuffer* pb);
+
     Region getLosslessRefresh(const Region& req, size_t maxUpdateSize);
 
+    void splitRects(const Region& changed, std::vector<Rect>* rects);
+    void sortRects(std::vector<Rect>* rects);
     int computeNumRects(const Region& changed);
 
+    void addEncodeTime(const struct timeval* start, const Region& changed);
+
     Encoder *startRect(const Rect& rect, int type);
     void endRect();
 
@@ -81,6 +128,7 @@ namespace rfb {
     void writeRects(const Region& changed, const PixelBuffer* pb);
 
     void writeSubRect(const Rect& rect, const PixelBuffer *pb);
+    bool writeDatagramRect(const Rect& rect, const PixelBuffer *pb);
 
     bool checkSolidTile(const Rect& r, const rdr::U8* colourValue,
                         const PixelBuffer *pb);
@@ -127,6 +175,17 @@ namespace rfb {
 
     Timer recentChangeTimer;
 
+    UDPChannel* sideChannel;
+
+    SharedMemory* sharedMemory;
+    int sharedStride;
+
+    bool hasFocus;
+    Point focus;
+
+    // Recent encoding speed, in microseconds and pixels
+    unsigned long long encodeTime, encodePixels;
+
     struct EncoderStats {
       unsigned rects;
       unsigned long long bytes;
@@ -137,6 +196,8 @@ namespace rfb {
 
     unsigned updates;
     EncoderStats copyStats;
+    EncoderStats datagramStats;
+    EncoderStats sharedStats;
     StatsVector stats;
     int activeType;
     int beforeLength;
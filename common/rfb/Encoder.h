@@ -58,6 +58,11 @@ namespace rfb {
     virtual int getCompressLevel() { return -1; };
     virtual int getQualityLevel() { return -1; };
 
+    // resetCompression() requests that any compression state shared
+    // between rectangles is discarded, so that the client can decode
+    // the following rectangles without having seen the earlier ones.
+    virtual void resetCompression() {};
+
     // writeRect() is the main interface that encodes the given rectangle
     // with data from the PixelBuffer onto the SConnection given at
     // encoder creation.
@@ -0,0 +1,255 @@
+/* Copyright (C) 2026 TigerVNC Team
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ * USA.
+ */
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <rfb/ImageScaler.h>
+
+using namespace rfb;
+
+#ifdef __GNUC__
+typedef int v4si __attribute__ ((vector_size (16)));
+#endif
+
+// Index of the first weight table that uses source positions at or
+// after pos
+static int firstAffected(const SFilterWeightTab* tabs, int count, int pos)
+{
+  int low, high;
+
+  low = 0;
+  high = count;
+  while (low < high) {
+    int mid = (low + high) / 2;
+    if (tabs[mid].i1 > pos)
+      high = mid;
+    else
+      low = mid + 1;
+  }
+
+  return low;
+}
+
+// Index of the first weight table that only uses source positions at
+// or after pos
+static int firstUnaffected(const SFilterWeightTab* tabs, int count, int pos)
+{
+  int low, high;
+
+  low = 0;
+  high = count;
+  while (low < high) {
+    int mid = (low + high) / 2;
+    if (tabs[mid].i0 >= pos)
+      high = mid;
+    else
+      low = mid + 1;
+  }
+
+  return low;
+}
+
+static void findRepeats(const SFilterWeightTab* tabs, int count,
+                        std::vector<bool>* repeats)
+{
+  repeats->resize(count);
+  (*repeats)[0] = false;
+  for (int i = 1; i < count; i++) {
+    const SFilterWeightTab* prev;
+    const SFilterWeightTab* tab;
+
+    prev = &tabs[i - 1];
+    tab = &tabs[i];
+
+    (*repeats)[i] = (tab->i0 == prev->i0) && (tab->i1 == prev->i1) &&
+                    (memcmp(tab->weight, prev->weight,
+                            (tab->i1 - tab->i0) * sizeof(short)) == 0);
+  }
+}
+
+static void freeWeightTabs(SFilterWeightTab* tabs, int count)
+{
+  for (int i = 0; i < count; i++)
+    delete [] tabs[i].weight;
+  delete [] tabs;
+}
+
+ImageScaler::ImageScaler(int srcWidth_, int srcHeight_,
+                         int dstWidth_, int dstHeight_,
+                         unsigned int filter)
+  : srcWidth(srcWidth_), srcHeight(srcHeight_),
+    dstWidth(dstWidth_), dstHeight(dstHeight_),
+    xWeightTabs(NULL), yWeightTabs(NULL)
+{
+  ScaleFilters filters;
+
+  assert(filter <= scaleFilterMaxNumber);
+
+  filters.makeWeightTabs(filter, srcWidth, dstWidth, &xWeightTabs);
+  filters.makeWeightTabs(filter, srcHeight, dstHeight, &yWeightTabs);
+
+  // When scaling up, neighbouring pixels often end up with the exact
+  // same weights, and hence the exact same value
+  findRepeats(xWeightTabs, dstWidth, &xRepeats);
+  findRepeats(yWeightTabs, dstHeight, &yRepeats);
+}
+
+ImageScaler::~ImageScaler()
+{
+  freeWeightTabs(xWeightTabs, dstWidth);
+  freeWeightTabs(yWeightTabs, dstHeight);
+}
+
+Rect ImageScaler::getDestRect(const Rect& src) const
+{
+  Rect r;
+
+  if (src.is_empty())
+    return r;
+
+  r.tl.x = firstAffected(xWeightTabs, dstWidth, src.tl.x);
+  r.tl.y = firstAffected(yWeightTabs, dstHeight, src.tl.y);
+  r.br.x = firstUnaffected(xWeightTabs, dstWidth, src.br.x);
+  r.br.y = firstUnaffected(yWeightTabs, dstHeight, src.br.y);
+
+  return r;
+}
+
+void ImageScaler::scaleRect(const Rect& dst,
+                            const rdr::U8* srcData, int srcStride,
+                            rdr::U8* dstData, int dstStride)
+{
+  int sx1, sx2, width;
+
+  assert(dst.enclosed_by(Rect(0, 0, dstWidth, dstHeight)));
+
+  if (dst.is_empty())
+    return;
+
+  // Source columns needed for this rect
+  sx1 = xWeightTabs[dst.tl.x].i0;
+  sx2 = xWeightTabs[dst.br.x - 1].i1;
+  width = (sx2 - sx1) * 4;
+
+  row.resize(width);
+
+  for (int y = dst.tl.y; y < dst.br.y; y++) {
+    const SFilterWeightTab* tab;
+    int* acc;
+
+    if ((y != dst.tl.y) && yRepeats[y]) {
+      memcpy(dstData + (y * dstStride + dst.tl.x) * 4,
+             dstData + ((y - 1) * dstStride + dst.tl.x) * 4,
+             dst.width() * 4);
+      continue;
+    }
+
+    tab = &yWeightTabs[y];
+
+    // Vertical pass first, as that is plain arithmetic over entire
+    // rows and something the compiler can vectorise
+    acc = &row[0];
+    for (int i = 0; i < width; i++)
+      acc[i] = 1 << (BITS_OF_CHANEL - 1);
+
+    for (int sy = tab->i0; sy < tab->i1; sy++) {
+      const rdr::U8* in;
+      int weight;
+
+      in = srcData + (sy * srcStride + sx1) * 4;
+      weight = tab->weight[sy - tab->i0];
+
+      for (int i = 0; i < width; i++)
+        acc[i] += in[i] * weight;
+    }
+
+    // Keep some of the fractional bits for the horizontal pass
+    for (int i = 0; i < width; i++)
+      acc[i] >>= BITS_OF_CHANEL;
+
+    filterRow(acc - sx1 * 4, dstData + (y * dstStride + dst.tl.x) * 4,
+              dst.tl.x, dst.br.x);
+  }
+}
+
+void ImageScaler::filterRow(const int* src, rdr::U8* dst, int x1, int x2)
+{
+  int* out;
+  int count;
+
+  count = (x2 - x1) * 4;
+  sums.resize(count);
+  out = &sums[0];
+
+  for (int x = x1; x < x2; x++) {
+    const SFilterWeightTab* tab;
+    const int* in;
+
+    if ((x != x1) && xRepeats[x]) {
+      memcpy(out, out - 4, sizeof(int) * 4);
+      out += 4;
+      continue;
+    }
+
+    tab = &xWeightTabs[x];
+    in = src + tab->i0 * 4;
+
+#ifdef __GNUC__
+    // All four channels at once
+    v4si sum;
+
+    sum = (v4si){ 0, 0, 0, 0 } + (1 << (FINALSHIFT - 1));
+    for (int i = 0; i < tab->i1 - tab->i0; i++) {
+      v4si pixel;
+      memcpy(&pixel, in, sizeof(pixel));
+      sum += pixel * tab->weight[i];
+      in += 4;
+    }
+
+    memcpy(out, &sum, sizeof(sum));
+#else
+    for (int i = 0; i < 4; i++)
+      out[i] = 1 << (FINALSHIFT - 1);
+
+    for (int i = 0; i < tab->i1 - tab->i0; i++) {
+      int weight = tab->weight[i];
+      for (int j = 0; j < 4; j++)
+        out[j] += in[j] * weight;
+      in += 4;
+    }
+#endif
+
+    out += 4;
+  }
+
+  // Scaling down and clamping is done for the whole row at once, so
+  // that the compiler can vectorise it
+  out = &sums[0];
+  for (int i = 0; i < count; i++) {
+    int c;
+
+    c = out[i] >> FINALSHIFT;
+    if (c < 0)
+      c = 0;
+    if (c > 255)
+      c = 255;
+    dst[i] = c;
+  }
+}
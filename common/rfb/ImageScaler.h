@@ -0,0 +1,75 @@
+/* Copyright (C) 2026 TigerVNC Team
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ * USA.
+ */
+
+//
+// ImageScaler resamples an image to a different size using one of the
+// filters from ScaleFilters. It works on a rect at a time so that only
+// the areas that have changed need to be scaled again.
+//
+// Pixels are four 8-bit channels, in any order.
+//
+
+#ifndef __RFB_IMAGESCALER_H__
+#define __RFB_IMAGESCALER_H__
+
+#include <vector>
+
+#include <rdr/types.h>
+#include <rfb/Rect.h>
+#include <rfb/ScaleFilters.h>
+
+namespace rfb {
+
+  class ImageScaler {
+  public:
+    ImageScaler(int srcWidth, int srcHeight, int dstWidth, int dstHeight,
+                unsigned int filter=defaultScaleFilter);
+    ~ImageScaler();
+
+    // getDestRect() returns the area of the destination that depends
+    // on the given area of the source
+    Rect getDestRect(const Rect& src) const;
+
+    // scaleRect() computes the given area of the destination. Strides
+    // are given in pixels.
+    void scaleRect(const Rect& dst, const rdr::U8* srcData, int srcStride,
+                   rdr::U8* dstData, int dstStride);
+
+  private:
+    void filterRow(const int* src, rdr::U8* dst, int x1, int x2);
+
+  private:
+    int srcWidth, srcHeight;
+    int dstWidth, dstHeight;
+
+    SFilterWeightTab* xWeightTabs;
+    SFilterWeightTab* yWeightTabs;
+
+    // Columns and rows that are identical to the previous one
+    std::vector<bool> xRepeats;
+    std::vector<bool> yRepeats;
+
+    // Vertically filtered source row
+    std::vector<int> row;
+    // Horizontally filtered row, before it is clamped
+    std::vector<int> sums;
+  };
+
+}
+
+#endif
@@ -25,6 +25,7 @@
 #include <rfb/PixelFormat.h>
 
 #include <stdio.h>
+#include <string.h>
 extern "C" {
 #include <jpeglib.h>
 }
@@ -42,6 +43,9 @@ static const PixelFormat pfBGRX(32, 24, false, true, 255, 255, 255, 16, 8, 0);
 static const PixelFormat pfXRGB(32, 24, false, true, 255, 255, 255, 8, 16, 24);
 static const PixelFormat pfXBGR(32, 24, false, true, 255, 255, 255, 24, 16, 8);
 
+// Size of the intermediate buffer when libjpeg can't write our format
+static const int stripSize = 65536;
+
 //
 // Error manager implementation for the JPEG library
 //
@@ -146,13 +150,96 @@ JpegDecompressor::~JpegDecompressor(void)
   delete dinfo;
 }
 
+//
+// Expands an image that was decoded at a reduced size by repeating
+// its pixels
+//
+
+static void expandImage(const rdr::U8 *src, int srcStride,
+                        rdr::U8 *dst, int dstStride,
+                        int w, int h, int bytesPerPixel, int scale)
+{
+  for (int y = 0; y < h; y++) {
+    const rdr::U8 *srcRow;
+    rdr::U8 *dstRow;
+
+    dstRow = dst + y * dstStride * bytesPerPixel;
+
+    // Repeated rows can be copied in one go
+    if ((y % scale) != 0) {
+      memcpy(dstRow, dstRow - dstStride * bytesPerPixel, w * bytesPerPixel);
+      continue;
+    }
+
+    srcRow = src + (y / scale) * srcStride * bytesPerPixel;
+
+    if (bytesPerPixel == 4) {
+      const rdr::U32 *srcPix = (const rdr::U32*)srcRow;
+      rdr::U32 *dstPix = (rdr::U32*)dstRow;
+      int x;
+      for (x = 0; x + scale <= w; x += scale) {
+        rdr::U32 pix = *srcPix++;
+        for (int i = 0; i < scale; i++)
+          *dstPix++ = pix;
+      }
+      for (; x < w; x++)
+        *dstPix++ = *srcPix;
+    } else {
+      for (int x = 0; x < w; x++) {
+        memcpy(dstRow + x * bytesPerPixel,
+               srcRow + (x / scale) * bytesPerPixel, bytesPerPixel);
+      }
+    }
+  }
+}
+
 void JpegDecompressor::decompress(const rdr::U8 *jpegBuf, int jpegBufLen,
-  rdr::U8 *buf, int stride, const Rect& r, const PixelFormat& pf)
+  rdr::U8 *buf, int stride, const Rect& r, const PixelFormat& pf,
+  int detailDivisor)
 {
   int w = r.width();
   int h = r.height();
+  int scale;
+  int scaledW, scaledH;
+  rdr::U8 *scaledBuf;
+
+  if (stride == 0)
+    stride = w;
+
+  // libjpeg can only leave out detail in the DCT for these factors
+  scale = 1;
+  while ((scale < 8) && (scale * 2 <= detailDivisor))
+    scale *= 2;
+
+  if (scale == 1) {
+    decode(jpegBuf, jpegBufLen, buf, stride, w, h, pf, 1);
+    return;
+  }
+
+  scaledW = (w + scale - 1) / scale;
+  scaledH = (h + scale - 1) / scale;
+
+  scaledBuf = new rdr::U8[scaledW * scaledH * (pf.bpp/8)];
+
+  try {
+    decode(jpegBuf, jpegBufLen, scaledBuf, scaledW,
+           scaledW, scaledH, pf, scale);
+  } catch (...) {
+    delete [] scaledBuf;
+    throw;
+  }
+
+  expandImage(scaledBuf, scaledW, buf, stride, w, h, pf.bpp/8, scale);
+
+  delete [] scaledBuf;
+}
+
+void JpegDecompressor::decode(const rdr::U8 *jpegBuf, int jpegBufLen,
+  rdr::U8 *buf, int stride, int w, int h, const PixelFormat& pf, int scale)
+{
   int pixelsize;
   int dstBufStride;
+  int stripHeight;
   rdr::U8 *dstBuf = NULL;
   bool dstBufIsTemp = false;
   JSAMPROW *rowPointer = NULL;
@@ -170,21 +257,26 @@ void JpegDecompressor::decompress(const rdr::U8 *jpegBuf, int jpegBufLen,
 
   jpeg_read_header(dinfo, TRUE);
   dinfo->out_color_space = JCS_RGB;
+  dinfo->scale_num = 1;
+  dinfo->scale_denom = scale;
   pixelsize = 3;
-  if (stride == 0)
-    stride = w;
   dstBufStride = stride;
 
 #ifdef JCS_EXTENSIONS
   // Try to have libjpeg output directly to our native format
-  // libjpeg can only handle some "standard" formats
-  if (pfRGBX.equal(pf))
+  // libjpeg can only handle some "standard" formats. It fills in
+  // the unused byte itself, so any extra depth doesn't matter.
+  PixelFormat nativePF(pf);
+  if ((nativePF.bpp == 32) && (nativePF.depth == 32))
+    nativePF.depth = 24;
+
+  if (pfRGBX.equal(nativePF))
     dinfo->out_color_space = JCS_EXT_RGBX;
-  else if (pfBGRX.equal(pf))
+  else if (pfBGRX.equal(nativePF))
     dinfo->out_color_space = JCS_EXT_BGRX;
-  else if (pfXRGB.equal(pf))
+  else if (pfXRGB.equal(nativePF))
     dinfo->out_color_space = JCS_EXT_XRGB;
-  else if (pfXBGR.equal(pf))
+  else if (pfXBGR.equal(nativePF))
     dinfo->out_color_space = JCS_EXT_XBGR;
 
   if (dinfo->out_color_space != JCS_RGB) {
@@ -194,19 +286,29 @@ void JpegDecompressor::decompress(const rdr::U8 *jpegBuf, int jpegBufLen,
 #endif
 
   if (dinfo->out_color_space == JCS_RGB) {
-    dstBuf = new rdr::U8[w * h * pixelsize];
+    // Only decode a few rows at a time so that the conversion works
+    // on data that is still in the cache
+    stripHeight = stripSize / (w * pixelsize);
+    if (stripHeight < 1)
+      stripHeight = 1;
+    if (stripHeight > h)
+      stripHeight = h;
+
+    dstBuf = new rdr::U8[w * stripHeight * pixelsize];
     dstBufIsTemp = true;
     dstBufStride = w;
+  } else {
+    stripHeight = h;
   }
 
-  rowPointer = new JSAMPROW[h];
-  for (int dy = 0; dy < h; dy++)
+  rowPointer = new JSAMPROW[stripHeight];
+  for (int dy = 0; dy < stripHeight; dy++)
     rowPointer[dy] = (JSAMPROW)(&dstBuf[dy * dstBufStride * pixelsize]);
 
   jpeg_start_decompress(dinfo);
 
-  if (dinfo->output_width != (unsigned)r.width()
-    || dinfo->output_height != (unsigned)r.height()
+  if (dinfo->output_width != (unsigned)w
+    || dinfo->output_height != (unsigned)h
     || dinfo->output_components != pixelsize) {
     jpeg_abort_decompress(dinfo);
     if (dstBufIsTemp && dstBuf) delete[] dstBuf;
@@ -215,13 +317,25 @@ void JpegDecompressor::decompress(const rdr::U8 *jpegBuf, int jpegBufLen,
   }
 
   while (dinfo->output_scanline < dinfo->output_height) {
-    jpeg_read_scanlines(dinfo, &rowPointer[dinfo->output_scanline],
-			dinfo->output_height - dinfo->output_scanline);
+    if (dstBufIsTemp) {
+      int y, rows;
+
+      y = dinfo->output_scanline;
+      rows = 0;
+      while ((rows < stripHeight) &&
+             (dinfo->output_scanline < dinfo->output_height)) {
+        rows += jpeg_read_scanlines(dinfo, &rowPointer[rows],
+                                    stripHeight - rows);
+      }
+
+      pf.bufferFromRGB(buf + y * stride * (pf.bpp/8), dstBuf,
+                       w, stride, rows);
+    } else {
+      jpeg_read_scanlines(dinfo, &rowPointer[dinfo->output_scanline],
+                          dinfo->output_height - dinfo->output_scanline);
+    }
   }
 
-  if (dinfo->out_color_space == JCS_RGB)
-    pf.bufferFromRGB((rdr::U8*)buf, dstBuf, w, stride, h);
-
   jpeg_finish_decompress(dinfo);
 
   if (dstBufIsTemp) delete [] dstBuf;
@@ -43,8 +43,15 @@ namespace rfb {
     JpegDecompressor(void);
     virtual ~JpegDecompressor();
 
+    // decompress() can skip detail if the image will be shown reduced
+    // by detailDivisor. The output still covers the entire rect.
     void decompress(const rdr::U8 *, int, rdr::U8 *, int, const Rect&,
-                    const PixelFormat&);
+                    const PixelFormat&, int detailDivisor=1);
+
+  private:
+
+    void decode(const rdr::U8 *, int, rdr::U8 *, int, int, int,
+                const PixelFormat&, int);
 
   private:
 
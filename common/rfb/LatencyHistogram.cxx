@@ -0,0 +1,101 @@
+/* Copyright (C) 2026 TigerVNC Team
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ * USA.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include <rfb/LatencyHistogram.h>
+
+using namespace rfb;
+
+LatencyHistogram::LatencyHistogram()
+{
+  reset();
+}
+
+void LatencyHistogram::reset()
+{
+  memset(buckets, 0, sizeof(buckets));
+  samples = 0;
+  total = 0;
+  maxValue = 0;
+}
+
+void LatencyHistogram::add(unsigned ms)
+{
+  int bucket;
+
+  bucket = 0;
+  while ((bucket < bucketCount - 1) && ((ms >> bucket) != 0))
+    bucket++;
+
+  buckets[bucket]++;
+
+  samples++;
+  total += ms;
+  if (ms > maxValue)
+    maxValue = ms;
+}
+
+unsigned LatencyHistogram::average() const
+{
+  if (samples == 0)
+    return 0;
+  return (total + samples / 2) / samples;
+}
+
+unsigned LatencyHistogram::percentile(unsigned pct) const
+{
+  unsigned long long target, seen;
+  int bucket;
+
+  if (samples == 0)
+    return 0;
+
+  // Number of samples that must be at or below the result
+  target = ((unsigned long long)samples * pct + 99) / 100;
+  if (target == 0)
+    target = 1;
+
+  seen = 0;
+  for (bucket = 0; bucket < bucketCount - 1; bucket++) {
+    seen += buckets[bucket];
+    if (seen >= target)
+      break;
+  }
+
+  // No point claiming more than we've actually seen
+  if ((bucket == bucketCount - 1) || (((1U << bucket) - 1) > maxValue))
+    return maxValue;
+
+  return (1U << bucket) - 1;
+}
+
+void LatencyHistogram::print(char* buffer, size_t len) const
+{
+  if (samples == 0) {
+    if (len > 0)
+      buffer[0] = '\0';
+    return;
+  }
+
+  snprintf(buffer, len,
+           "%u samples, avg %u ms, p50 %u ms, p95 %u ms, "
+           "p99 %u ms, max %u ms", samples, average(),
+           percentile(50), percentile(95), percentile(99), maxValue);
+}
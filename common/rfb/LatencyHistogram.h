@@ -0,0 +1,64 @@
+/* Copyright (C) 2026 TigerVNC Team
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ * USA.
+ */
+
+//
+// LatencyHistogram collects latency measurements (in milliseconds) in
+// power of two buckets, so that percentiles can be estimated for long
+// sessions without keeping every sample around.
+//
+
+#ifndef __RFB_LATENCYHISTOGRAM_H__
+#define __RFB_LATENCYHISTOGRAM_H__
+
+#include <stddef.h>
+
+namespace rfb {
+
+  class LatencyHistogram {
+  public:
+    LatencyHistogram();
+
+    void reset();
+
+    void add(unsigned ms);
+
+    unsigned count() const { return samples; }
+    unsigned max() const { return maxValue; }
+    unsigned average() const;
+    // percentile() returns the upper bound of the bucket that the
+    // given percentile falls in
+    unsigned percentile(unsigned pct) const;
+
+    // print() writes a one line summary, or an empty string if there
+    // are no samples
+    void print(char* buffer, size_t len) const;
+
+  private:
+    // Bucket n holds values of exactly n significant bits, i.e.
+    // 2^(n-1) to 2^n-1, with the last bucket taking everything above
+    static const int bucketCount = 17;
+    unsigned buckets[bucketCount];
+
+    unsigned samples;
+    unsigned long long total;
+    unsigned maxValue;
+  };
+
+}
+
+#endif
@@ -120,6 +120,11 @@ namespace rfb {
     //   getBufferRW().
     virtual void commitBufferRW(const Rect& r) = 0;
 
+    // Get how much the buffer is reduced by when displayed
+    //   Decoders can use this to avoid computing lossy detail that
+    //   will not be visible anyway.
+    virtual int getDisplayDivisor() const { return 1; }
+
     ///////////////////////////////////////////////
     // Basic rendering operations
     // These operations DO NOT clip to the pixelbuffer area, or trap overruns.
@@ -36,7 +36,7 @@ using namespace rfb;
 #include <rfb/rreDecode.h>
 #undef BPP
 
-RREDecoder::RREDecoder() : Decoder(DecoderPlain)
+RREDecoder::RREDecoder() : Decoder(DecoderPassthrough)
 {
 }
 
@@ -46,6 +46,19 @@ RREDecoder::~RREDecoder()
 
 bool RREDecoder::readRect(const Rect& r, rdr::InStream* is,
                           const ServerParams& server, rdr::OutStream* os)
+{
+  size_t len;
+
+  if (!getRectLength(r, is, server, &len))
+    return false;
+
+  os->copyBytes(is, len);
+
+  return true;
+}
+
+bool RREDecoder::getRectLength(const Rect& r, rdr::InStream* is,
+                               const ServerParams& server, size_t* length)
 {
   rdr::U32 numRects;
   size_t len;
@@ -54,18 +67,15 @@ bool RREDecoder::readRect(const Rect& r, rdr::InStream* is,
     return false;
 
   is->setRestorePoint();
-
   numRects = is->readU32();
-  os->writeU32(numRects);
+  is->gotoRestorePoint();
 
-  len = server.pf().bpp/8 + numRects * (server.pf().bpp/8 + 8);
+  len = 4 + server.pf().bpp/8 + numRects * (server.pf().bpp/8 + 8);
 
-  if (!is->hasDataOrRestore(len))
+  if (!is->hasData(len))
     return false;
 
-  is->clearRestorePoint();
-
-  os->copyBytes(is, len);
+  *length = len;
 
   return true;
 }
@@ -25,7 +25,7 @@
 
 using namespace rfb;
 
-RawDecoder::RawDecoder() : Decoder(DecoderPlain)
+RawDecoder::RawDecoder() : Decoder(DecoderPassthrough)
 {
 }
 
@@ -35,10 +35,21 @@ RawDecoder::~RawDecoder()
 
 bool RawDecoder::readRect(const Rect& r, rdr::InStream* is,
                           const ServerParams& server, rdr::OutStream* os)
+{
+  size_t len;
+
+  if (!getRectLength(r, is, server, &len))
+    return false;
+  os->copyBytes(is, len);
+  return true;
+}
+
+bool RawDecoder::getRectLength(const Rect& r, rdr::InStream* is,
+                               const ServerParams& server, size_t* length)
 {
   if (!is->hasData(r.area() * (server.pf().bpp/8)))
     return false;
-  os->copyBytes(is, r.area() * (server.pf().bpp/8));
+  *length = r.area() * (server.pf().bpp/8);
   return true;
 }
 
@@ -27,6 +27,8 @@ namespace rfb {
     virtual ~RawDecoder();
     virtual bool readRect(const Rect& r, rdr::InStream* is,
                           const ServerParams& server, rdr::OutStream* os);
+    virtual bool getRectLength(const Rect& r, rdr::InStream* is,
+                               const ServerParams& server, size_t* length);
     virtual void decodeRect(const Rect& r, const void* buffer,
                             size_t buflen, const ServerParams& server,
                             ModifiablePixelBuffer* pb);
@@ -0,0 +1,113 @@
+/* Copyright (C) 2026 TigerVNC Team
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ * USA.
+ */
+
+#include <vector>
+
+#include <rfb/PixelBuffer.h>
+#include <rfb/RecordingConnection.h>
+#include <rfb/SMsgWriter.h>
+#include <rfb/SessionRecorder.h>
+#include <rfb/UpdateTracker.h>
+#include <rfb/encodings.h>
+
+using namespace rfb;
+
+RecordingConnection::RecordingConnection(SessionRecorder* recorder_)
+  : recorder(recorder_), encodeManager(this)
+{
+  setStreams(NULL, &out);
+  setWriter(new SMsgWriter(&client, &out));
+  setState(RFBSTATE_NORMAL);
+
+  setEncodings(0, NULL);
+}
+
+RecordingConnection::~RecordingConnection()
+{
+}
+
+void RecordingConnection::writeServerInit(const PixelBuffer* pb,
+                                          const PixelFormat& pf,
+                                          const char* name)
+{
+  client.setDimensions(pb->width(), pb->height());
+  client.setPF(pf);
+
+  writer()->writeServerInit(client.width(), client.height(),
+                            client.pf(), name);
+
+  insertData();
+}
+
+void RecordingConnection::writeKeyframe(const PixelBuffer* pb,
+                                        const PixelFormat& pf,
+                                        const RenderedCursor* cursor)
+{
+  UpdateInfo full;
+
+  // Any size change has already been sent to the real client
+  client.setDimensions(pb->width(), pb->height());
+  client.setPF(pf);
+
+  // A keyframe must not depend on any earlier data
+  encodeManager.resetCompression();
+
+  full.changed = pb->getRect();
+
+  recorder->markUpdate(true);
+  encodeManager.writeUpdate(full, pb, cursor);
+
+  insertData();
+}
+
+void RecordingConnection::setEncodings(int nEncodings,
+                                       const rdr::S32* encodings)
+{
+  std::vector<rdr::S32> recorded;
+
+  // Only what affects how the framebuffer is encoded, as we don't
+  // want any other messages in the keyframes. Quality levels are left
+  // out so that they are lossless.
+  for (int i = 0; i < nEncodings; i++) {
+    rdr::S32 encoding = encodings[i];
+
+    if ((encoding >= 0) ||
+        (encoding == pseudoEncodingLastRect) ||
+        ((encoding >= pseudoEncodingCompressLevel0) &&
+         (encoding <= pseudoEncodingCompressLevel9)))
+      recorded.push_back(encoding);
+  }
+
+  if (recorded.empty()) {
+    SConnection::setEncodings(0, NULL);
+    return;
+  }
+
+  SConnection::setEncodings(recorded.size(), &recorded[0]);
+}
+
+void RecordingConnection::setDesktopSize(int fb_width, int fb_height,
+                                         const ScreenSet& layout)
+{
+}
+
+void RecordingConnection::insertData()
+{
+  recorder->insert(out.data(), out.length());
+  out.clear();
+}
@@ -0,0 +1,74 @@
+/* Copyright (C) 2026 TigerVNC Team
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ * USA.
+ */
+
+//
+// RecordingConnection is a pretend client that encodes the keyframes
+// of a session recording. Everything between the keyframes is copied
+// from what the real client was sent, so a keyframe uses the real
+// client's pixel format and encodings. It is lossless, and it resets
+// the compression state of its own encoders, so that playback can
+// start there.
+//
+
+#ifndef __RFB_RECORDINGCONNECTION_H__
+#define __RFB_RECORDINGCONNECTION_H__
+
+#include <rdr/MemOutStream.h>
+
+#include <rfb/EncodeManager.h>
+#include <rfb/SConnection.h>
+
+namespace rfb {
+
+  class PixelBuffer;
+  class RenderedCursor;
+  class SessionRecorder;
+
+  class RecordingConnection : public SConnection {
+  public:
+    RecordingConnection(SessionRecorder* recorder);
+    virtual ~RecordingConnection();
+
+    // writeServerInit() starts a new recording file
+    void writeServerInit(const PixelBuffer* pb, const PixelFormat& pf,
+                         const char* name);
+
+    // writeKeyframe() records the entire screen, at the current
+    // position in the stream to the real client
+    void writeKeyframe(const PixelBuffer* pb, const PixelFormat& pf,
+                       const RenderedCursor* cursor);
+
+    // setEncodings() should be given the real client's encodings
+    virtual void setEncodings(int nEncodings, const rdr::S32* encodings);
+
+    // SMsgHandler methods that are never called, as nothing is read
+    virtual void setDesktopSize(int fb_width, int fb_height,
+                                const ScreenSet& layout);
+
+  protected:
+    void insertData();
+
+  protected:
+    SessionRecorder* recorder;
+    rdr::MemOutStream out;
+    EncodeManager encodeManager;
+  };
+
+}
+
+#endif
@@ -63,6 +63,30 @@ void rfb::Region::reset(const Rect& r) {
   pixman_region_init_rect(rgn, r.tl.x, r.tl.y, r.width(), r.height());
 }
 
+void rfb::Region::reset(const std::vector<Rect>& rects) {
+  std::vector<pixman_box16_t> boxes;
+  std::vector<Rect>::const_iterator i;
+
+  pixman_region_fini(rgn);
+
+  if (rects.empty()) {
+    pixman_region_init(rgn);
+    return;
+  }
+
+  // Overlapping and unordered rects are fine, pixman sorts it all out
+  boxes.resize(rects.size());
+  for (i = rects.begin(); i != rects.end(); i++) {
+    pixman_box16_t* box = &boxes[i - rects.begin()];
+    box->x1 = i->tl.x;
+    box->y1 = i->tl.y;
+    box->x2 = i->br.x;
+    box->y2 = i->br.y;
+  }
+
+  pixman_region_init_rects(rgn, &boxes[0], boxes.size());
+}
+
 void rfb::Region::translate(const Point& delta) {
   pixman_region_translate(rgn, delta.x, delta.y);
 }
@@ -45,6 +45,7 @@ namespace rfb {
 
     void clear();
     void reset(const Rect& r);
+    void reset(const std::vector<Rect>& rects);
     void translate(const rfb::Point& delta);
 
     void assign_intersect(const Region& r);
@@ -47,12 +47,13 @@ void SMsgHandler::setPixelFormat(const PixelFormat& pf)
 void SMsgHandler::setEncodings(int nEncodings, const rdr::S32* encodings)
 {
   bool firstFence, firstContinuousUpdates, firstLEDState,
-       firstQEMUKeyEvent;
+       firstQEMUKeyEvent, firstViewport;
 
   firstFence = !client.supportsFence();
   firstContinuousUpdates = !client.supportsContinuousUpdates();
   firstLEDState = !client.supportsLEDState();
   firstQEMUKeyEvent = !client.supportsEncoding(pseudoEncodingQEMUKeyEvent);
+  firstViewport = !client.supportsEncoding(pseudoEncodingViewport);
 
   client.setEncodings(nEncodings, encodings);
 
@@ -66,6 +67,12 @@ void SMsgHandler::setEncodings(int nEncodings, const rdr::S32* encodings)
     supportsLEDState();
   if (client.supportsEncoding(pseudoEncodingQEMUKeyEvent) && firstQEMUKeyEvent)
     supportsQEMUKeyEvent();
+  if (client.supportsEncoding(pseudoEncodingViewport) && firstViewport)
+    supportsViewport();
+}
+
+void SMsgHandler::setViewport(const Region& visible)
+{
 }
 
 void SMsgHandler::handleClipboardCaps(rdr::U32 flags, const rdr::U32* lengths)
@@ -150,3 +157,7 @@ void SMsgHandler::supportsLEDState()
 void SMsgHandler::supportsQEMUKeyEvent()
 {
 }
+
+void SMsgHandler::supportsViewport()
+{
+}
@@ -27,6 +27,7 @@
 #include <rfb/PixelFormat.h>
 #include <rfb/ClientParams.h>
 #include <rfb/InputHandler.h>
+#include <rfb/Region.h>
 #include <rfb/ScreenSet.h>
 
 namespace rdr { class InStream; }
@@ -53,6 +54,7 @@ namespace rfb {
     virtual void fence(rdr::U32 flags, unsigned len, const char data[]) = 0;
     virtual void enableContinuousUpdates(bool enable,
                                          int x, int y, int w, int h) = 0;
+    virtual void setViewport(const Region& visible);
 
     virtual void handleClipboardCaps(rdr::U32 flags,
                                      const rdr::U32* lengths);
@@ -94,6 +96,12 @@ namespace rfb {
     // handler will send a pseudo-rect back, signalling server support.
     virtual void supportsQEMUKeyEvent();
 
+    // supportsViewport() is called the first time we detect that the
+    // client can tell us which part of the framebuffer it shows. The
+    // default handler will send a pseudo-rect back, signalling server
+    // support.
+    virtual void supportsViewport();
+
     ClientParams client;
   };
 }
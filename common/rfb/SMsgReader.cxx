@@ -83,6 +83,9 @@ bool SMsgReader::readMsg()
   case msgTypeEnableContinuousUpdates:
     ret = readEnableContinuousUpdates();
     break;
+  case msgTypeSetViewport:
+    ret = readSetViewport();
+    break;
   case msgTypeClientFence:
     ret = readFence();
     break;
@@ -218,6 +221,39 @@ bool SMsgReader::readEnableContinuousUpdates()
   return true;
 }
 
+bool SMsgReader::readSetViewport()
+{
+  int count;
+  Region visible;
+
+  if (!is->hasData(1 + 2))
+    return false;
+
+  is->setRestorePoint();
+
+  is->skip(1);
+  count = is->readU16();
+
+  if (!is->hasDataOrRestore(count * (2 + 2 + 2 + 2)))
+    return false;
+  is->clearRestorePoint();
+
+  for (int i = 0; i < count; i++) {
+    int x, y, w, h;
+
+    x = is->readU16();
+    y = is->readU16();
+    w = is->readU16();
+    h = is->readU16();
+
+    visible.assign_union(Region(Rect(x, y, x + w, y + h)));
+  }
+
+  handler->setViewport(visible);
+
+  return true;
+}
+
 bool SMsgReader::readFence()
 {
   rdr::U32 flags;
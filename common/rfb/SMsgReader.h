@@ -48,6 +48,7 @@ namespace rfb {
 
     bool readFramebufferUpdateRequest();
     bool readEnableContinuousUpdates();
+    bool readSetViewport();
 
     bool readFence();
 
@@ -26,6 +26,7 @@
 #include <rfb/msgTypes.h>
 #include <rfb/fenceTypes.h>
 #include <rfb/clipboardTypes.h>
+#include <rfb/udpTypes.h>
 #include <rfb/Exception.h>
 #include <rfb/ClientParams.h>
 #include <rfb/UpdateTracker.h>
@@ -43,7 +44,9 @@ SMsgWriter::SMsgWriter(ClientParams* client_, rdr::OutStream* os_)
     nRectsInUpdate(0), nRectsInHeader(0),
     needSetDesktopName(false), needCursor(false),
     needCursorPos(false), needLEDState(false),
-    needQEMUKeyEvent(false)
+    needQEMUKeyEvent(false), needViewport(false), needUDPOffer(false),
+    udpPort(0), udpToken(0), needSharedMemoryOffer(false),
+    sharedWidth(0), sharedHeight(0), sharedStride(0)
 {
 }
 
@@ -297,6 +300,37 @@ void SMsgWriter::writeQEMUKeyEvent()
   needQEMUKeyEvent = true;
 }
 
+void SMsgWriter::writeViewport()
+{
+  if (!client->supportsEncoding(pseudoEncodingViewport))
+    throw Exception("Client does not support the viewport extension");
+
+  needViewport = true;
+}
+
+void SMsgWriter::writeUDPOffer(int port, rdr::U32 token)
+{
+  if (!client->supportsEncoding(pseudoEncodingUDPTransport))
+    throw Exception("Client does not support UDP transport");
+
+  udpPort = port;
+  udpToken = token;
+  needUDPOffer = true;
+}
+
+void SMsgWriter::writeSharedMemoryOffer(int width, int height, int stride,
+                                        const PixelFormat& pf)
+{
+  if (!client->supportsEncoding(pseudoEncodingSharedMemory))
+    throw Exception("Client does not support shared memory");
+
+  sharedWidth = width;
+  sharedHeight = height;
+  sharedStride = stride;
+  sharedPF = pf;
+  needSharedMemoryOffer = true;
+}
+
 bool SMsgWriter::needFakeUpdate()
 {
   if (needSetDesktopName)
@@ -309,6 +343,12 @@ bool SMsgWriter::needFakeUpdate()
     return true;
   if (needQEMUKeyEvent)
     return true;
+  if (needViewport)
+    return true;
+  if (needUDPOffer)
+    return true;
+  if (needSharedMemoryOffer)
+    return true;
   if (needNoDataUpdate())
     return true;
 
@@ -357,6 +397,12 @@ void SMsgWriter::writeFramebufferUpdateStart(int nRects)
       nRects++;
     if (needQEMUKeyEvent)
       nRects++;
+    if (needViewport)
+      nRects++;
+    if (needUDPOffer)
+      nRects++;
+    if (needSharedMemoryOffer)
+      nRects++;
   }
 
   os->writeU16(nRects);
@@ -396,6 +442,28 @@ void SMsgWriter::writeCopyRect(const Rect& r, int srcX, int srcY)
   endRect();
 }
 
+void SMsgWriter::writeSharedMemoryRect(const Rect& r)
+{
+  startRect(r, pseudoEncodingSharedMemory);
+  endRect();
+}
+
+void SMsgWriter::writeUDPMarker(rdr::U32 seq)
+{
+  if (!client->supportsEncoding(pseudoEncodingUDPTransport))
+    throw Exception("Client does not support UDP transport");
+  if (++nRectsInUpdate > nRectsInHeader && nRectsInHeader)
+    throw Exception("SMsgWriter::writeUDPMarker: nRects out of sync");
+
+  os->writeS16(0);
+  os->writeS16(0);
+  os->writeU16(0);
+  os->writeU16(0);
+  os->writeU32(pseudoEncodingUDPTransport);
+  os->writeU8(udpTransportMarker);
+  os->writeU32(seq);
+}
+
 void SMsgWriter::startRect(const Rect& r, int encoding)
 {
   if (++nRectsInUpdate > nRectsInHeader && nRectsInHeader)
@@ -494,6 +562,21 @@ void SMsgWriter::writePseudoRects()
     writeQEMUKeyEventRect();
     needQEMUKeyEvent = false;
   }
+
+  if (needViewport) {
+    writeViewportRect();
+    needViewport = false;
+  }
+
+  if (needUDPOffer) {
+    writeUDPOfferRect(udpPort, udpToken);
+    needUDPOffer = false;
+  }
+
+  if (needSharedMemoryOffer) {
+    writeSharedMemoryOfferRect();
+    needSharedMemoryOffer = false;
+  }
 }
 
 void SMsgWriter::writeNoDataRects()
@@ -725,3 +808,53 @@ void SMsgWriter::writeQEMUKeyEventRect()
   os->writeU16(0);
   os->writeU32(pseudoEncodingQEMUKeyEvent);
 }
+
+void SMsgWriter::writeViewportRect()
+{
+  if (!client->supportsEncoding(pseudoEncodingViewport))
+    throw Exception("Client does not support the viewport extension");
+  if (++nRectsInUpdate > nRectsInHeader && nRectsInHeader)
+    throw Exception("SMsgWriter::writeViewportRect: nRects out of sync");
+
+  os->writeS16(0);
+  os->writeS16(0);
+  os->writeU16(0);
+  os->writeU16(0);
+  os->writeU32(pseudoEncodingViewport);
+}
+
+void SMsgWriter::writeUDPOfferRect(int port, rdr::U32 token)
+{
+  if (!client->supportsEncoding(pseudoEncodingUDPTransport))
+    throw Exception("Client does not support UDP transport");
+  if (++nRectsInUpdate > nRectsInHeader && nRectsInHeader)
+    throw Exception("SMsgWriter::writeUDPOfferRect: nRects out of sync");
+
+  os->writeS16(0);
+  os->writeS16(0);
+  os->writeU16(0);
+  os->writeU16(0);
+  os->writeU32(pseudoEncodingUDPTransport);
+  os->writeU8(udpTransportOffer);
+  os->writeU16(port);
+  os->writeU32(token);
+}
+
+void SMsgWriter::writeSharedMemoryOfferRect()
+{
+  if (!client->supportsEncoding(pseudoEncodingSharedMemory))
+    throw Exception("Client does not support shared memory");
+  if (++nRectsInUpdate > nRectsInHeader && nRectsInHeader)
+    throw Exception("SMsgWriter::writeSharedMemoryOfferRect: nRects out of sync");
+
+  // An empty rect, to tell it apart from updated rects
+  os->writeS16(0);
+  os->writeS16(0);
+  os->writeU16(0);
+  os->writeU16(0);
+  os->writeU32(pseudoEncodingSharedMemory);
+  os->writeU16(sharedWidth);
+  os->writeU16(sharedHeight);
+  os->writeU32(sharedStride);
+  sharedPF.write(os);
+}
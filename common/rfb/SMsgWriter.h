@@ -25,6 +25,7 @@
 
 #include <rdr/types.h>
 #include <rfb/encodings.h>
+#include <rfb/PixelFormat.h>
 #include <rfb/ScreenSet.h>
 
 namespace rdr { class OutStream; }
@@ -92,6 +93,17 @@ namespace rfb {
     // And QEMU keyboard event handshake
     void writeQEMUKeyEvent();
 
+    // And the viewport extension handshake
+    void writeViewport();
+
+    // And the offer of a UDP side channel
+    void writeUDPOffer(int port, rdr::U32 token);
+
+    // And the description of a shared memory area, which must have
+    // been passed to the client as a file descriptor
+    void writeSharedMemoryOffer(int width, int height, int stride,
+                                const PixelFormat& pf);
+
     // needFakeUpdate() returns true when an immediate update is needed in
     // order to flush out pseudo-rectangles to the client.
     bool needFakeUpdate();
@@ -115,6 +127,15 @@ namespace rfb {
     // There is no explicit encoder for CopyRect rects.
     void writeCopyRect(const Rect& r, int srcX, int srcY);
 
+    // writeSharedMemoryRect() tells the client that the rect has been
+    // updated in the shared memory area.
+    void writeSharedMemoryRect(const Rect& r);
+
+    // writeUDPMarker() tells the client which update the following
+    // rects belong to, so it can order them against datagrams that
+    // are sent over the UDP side channel.
+    void writeUDPMarker(rdr::U32 seq);
+
     // Encoders should call these to mark the start and stop of individual
     // rects.
     void startRect(const Rect& r, int enc);
@@ -147,6 +168,9 @@ namespace rfb {
     void writeSetVMwareCursorPositionRect(int hotspotX, int hotspotY);
     void writeLEDStateRect(rdr::U8 state);
     void writeQEMUKeyEventRect();
+    void writeViewportRect();
+    void writeUDPOfferRect(int port, rdr::U32 token);
+    void writeSharedMemoryOfferRect();
 
     ClientParams* client;
     rdr::OutStream* os;
@@ -159,6 +183,15 @@ namespace rfb {
     bool needCursorPos;
     bool needLEDState;
     bool needQEMUKeyEvent;
+    bool needViewport;
+    bool needUDPOffer;
+
+    int udpPort;
+    rdr::U32 udpToken;
+
+    bool needSharedMemoryOffer;
+    int sharedWidth, sharedHeight, sharedStride;
+    PixelFormat sharedPF;
 
     typedef struct {
       rdr::U16 reason, result;
@@ -22,6 +22,9 @@
 //  
 // 
 
+#ifndef __RFB_SCALEFILTERS_H__
+#define __RFB_SCALEFILTERS_H__
+
 namespace rfb {
 
   #define SCALE_ERROR (1e-7)
@@ -79,3 +82,5 @@ namespace rfb {
   };
 
 };
+
+#endif
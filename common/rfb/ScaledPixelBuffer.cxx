@@ -0,0 +1,166 @@
+/* Copyright (C) 2026 TigerVNC Team
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ * USA.
+ */
+
+
+#include <assert.h>
+
+#include <vector>
+
+#include <rfb/Exception.h>
+#include <rfb/ImageScaler.h>
+#include <rfb/Region.h>
+#include <rfb/ScaledPixelBuffer.h>
+
+using namespace rfb;
+
+ScaledPixelBuffer::ScaledPixelBuffer(const PixelBuffer* source_,
+                                     int divisor_)
+  : source(NULL), divisor(divisor_), scaler(NULL)
+{
+  assert(divisor > 0);
+  setSource(source_);
+}
+
+ScaledPixelBuffer::~ScaledPixelBuffer()
+{
+  delete scaler;
+}
+
+bool ScaledPixelBuffer::canScale(const PixelBuffer* source)
+{
+  return source->getPF().bpp == 32;
+}
+
+void ScaledPixelBuffer::setSource(const PixelBuffer* source_)
+{
+  int w, h;
+
+  if (!canScale(source_))
+    throw Exception("ScaledPixelBuffer: only 32 bpp can be scaled");
+
+  source = source_;
+
+  w = (source->width() + divisor - 1) / divisor;
+  h = (source->height() + divisor - 1) / divisor;
+
+  delete scaler;
+  scaler = new ImageScaler(source->width(), source->height(), w, h);
+
+  setPF(source->getPF());
+  setSize(w, h);
+
+  update(source->getRect());
+}
+
+void ScaledPixelBuffer::update(const Region& changed)
+{
+  const rdr::U8* srcData;
+  int srcStride;
+  rdr::U8* dstData;
+  int dstStride;
+
+  std::vector<Rect> rects;
+  std::vector<Rect>::const_iterator iter;
+
+  if (changed.is_empty())
+    return;
+
+  srcData = source->getBuffer(source->getRect(), &srcStride);
+  dstData = getBufferRW(getRect(), &dstStride);
+
+  // Scale each pixel only once, even if the changes overlap
+  toScaled(changed).get_rects(&rects);
+  for (iter = rects.begin(); iter != rects.end(); ++iter)
+    scaler->scaleRect(*iter, srcData, srcStride, dstData, dstStride);
+
+  commitBufferRW(getRect());
+}
+
+Point ScaledPixelBuffer::toScaled(const Point& p) const
+{
+  return Point(p.x * width() / source->width(),
+               p.y * height() / source->height());
+}
+
+Region ScaledPixelBuffer::toScaled(const Region& r) const
+{
+  Region scaled;
+  std::vector<Rect> rects;
+  std::vector<Rect>::const_iterator iter;
+
+  r.get_rects(&rects);
+  for (iter = rects.begin(); iter != rects.end(); ++iter)
+    scaled.assign_union(Region(scaler->getDestRect(*iter)));
+
+  return scaled;
+}
+
+ScreenSet ScaledPixelBuffer::toScaled(const ScreenSet& layout) const
+{
+  ScreenSet scaled;
+  ScreenSet::const_iterator iter;
+
+  for (iter = layout.begin(); iter != layout.end(); ++iter) {
+    Screen screen;
+
+    screen = *iter;
+    screen.dimensions.tl = toScaled(iter->dimensions.tl);
+    screen.dimensions.br = toScaled(iter->dimensions.br);
+
+    // Tiny screens must not vanish
+    if (screen.dimensions.br.x <= screen.dimensions.tl.x)
+      screen.dimensions.br.x = screen.dimensions.tl.x + 1;
+    if (screen.dimensions.br.y <= screen.dimensions.tl.y)
+      screen.dimensions.br.y = screen.dimensions.tl.y + 1;
+    screen.dimensions = screen.dimensions.intersect(getRect());
+
+    scaled.add_screen(screen);
+  }
+
+  return scaled;
+}
+
+Point ScaledPixelBuffer::toSource(const Point& p) const
+{
+  return Point(p.x * source->width() / width(),
+               p.y * source->height() / height());
+}
+
+Rect ScaledPixelBuffer::toSource(const Rect& r) const
+{
+  Rect src;
+
+  src.tl = toSource(r.tl);
+  src.br.x = (r.br.x * source->width() + width() - 1) / width();
+  src.br.y = (r.br.y * source->height() + height() - 1) / height();
+
+  return src.intersect(source->getRect());
+}
+
+Region ScaledPixelBuffer::toSource(const Region& r) const
+{
+  Region src;
+  std::vector<Rect> rects;
+  std::vector<Rect>::const_iterator iter;
+
+  r.get_rects(&rects);
+  for (iter = rects.begin(); iter != rects.end(); ++iter)
+    src.assign_union(Region(toSource(*iter)));
+
+  return src;
+}
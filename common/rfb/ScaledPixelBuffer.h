@@ -0,0 +1,75 @@
+/* Copyright (C) 2026 TigerVNC Team
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ * USA.
+ */
+
+
+//
+// ScaledPixelBuffer is a shadow copy of another PixelBuffer, reduced
+// in size by an integer divisor. It is used for clients that have
+// asked for a smaller version of the framebuffer, and is only brought
+// up to date for the areas of the source it is told have changed.
+//
+// Only 32 bits per pixel formats can be scaled.
+//
+
+#ifndef __RFB_SCALEDPIXELBUFFER_H__
+#define __RFB_SCALEDPIXELBUFFER_H__
+
+#include <rfb/PixelBuffer.h>
+#include <rfb/ScreenSet.h>
+
+namespace rfb {
+
+  class ImageScaler;
+
+  class ScaledPixelBuffer : public ManagedPixelBuffer {
+  public:
+    ScaledPixelBuffer(const PixelBuffer* source, int divisor);
+    virtual ~ScaledPixelBuffer();
+
+    static bool canScale(const PixelBuffer* source);
+
+    const PixelBuffer* getSource() const { return source; }
+    int getDivisor() const { return divisor; }
+
+    // setSource() switches to a new source, resizing the buffer and
+    // scaling its entire contents
+    void setSource(const PixelBuffer* source);
+
+    // update() scales again every part of the buffer that depends on
+    // the given area of the source
+    void update(const Region& changed);
+
+    // Conversion of coordinates between the source and the scaled
+    // buffer. Areas are converted to every pixel they affect.
+    Point toScaled(const Point& p) const;
+    Region toScaled(const Region& r) const;
+    ScreenSet toScaled(const ScreenSet& layout) const;
+
+    Point toSource(const Point& p) const;
+    Rect toSource(const Rect& r) const;
+    Region toSource(const Region& r) const;
+
+  private:
+    const PixelBuffer* source;
+    int divisor;
+    ImageScaler* scaler;
+  };
+
+}
+
+#endif
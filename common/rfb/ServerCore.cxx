@@ -51,6 +51,33 @@ rfb::IntParameter rfb::Server::frameRate
 ("FrameRate",
  "The maximum number of updates per second sent to each client",
  60);
+rfb::IntParameter rfb::Server::maxUnsentData
+("MaxUnsentData",
+ "The maximum amount of data (in KiB) to queue up for a client at once. "
+ "Larger updates are split and the rest is sent later with the latest "
+ "screen contents (0: based on the current bandwidth, -1: no limit)",
+ -1, -1);
+rfb::IntParameter rfb::Server::maxEncodeTime
+("MaxEncodeTime",
+ "The maximum time (in ms) to spend encoding a single update for one "
+ "client when several clients are connected. Larger updates are split "
+ "and the rest is sent later (0: share each frame between the clients, "
+ "-1: no limit)",
+ -1, -1);
+rfb::BoolParameter rfb::Server::limitSendQueue
+("LimitSendQueue",
+ "Limit the unsent data in the kernel to what the measured bandwidth "
+ "needs, so that data doesn't pile up there",
+ true);
+rfb::BoolParameter rfb::Server::udpTransport
+("UDPTransport",
+ "Offer clients a UDP side channel for lossy content",
+ false);
+rfb::BoolParameter rfb::Server::sharedMemory
+("SharedMemory",
+ "Pass the framebuffer to clients on Unix domain sockets as shared memory "
+ "instead of encoding it",
+ true);
 rfb::BoolParameter rfb::Server::protocol3_3
 ("Protocol3.3",
  "Always use protocol version 3.3 for backwards compatibility with "
@@ -96,3 +123,17 @@ rfb::BoolParameter rfb::Server::queryConnect
 ("QueryConnect",
  "Prompt the local user to accept or reject incoming connections.",
  false);
+rfb::StringParameter rfb::Server::recordSessions
+("RecordSessions",
+ "Record the updates sent to each client to a file in this directory "
+ "(empty means no recording)",
+ "");
+rfb::IntParameter rfb::Server::recordKeyframeInterval
+("RecordKeyframeInterval",
+ "The number of seconds between full screen updates in session "
+ "recordings (zero means only at the start)",
+ 60, 0);
+rfb::StringParameter rfb::Server::congestionControl
+("CongestionControl",
+ "The algorithm used to avoid overfilling the network (Vegas or BBR)",
+ "Vegas");
@@ -38,6 +38,11 @@ namespace rfb {
     static IntParameter maxIdleTime;
     static IntParameter compareFB;
     static IntParameter frameRate;
+    static IntParameter maxUnsentData;
+    static IntParameter maxEncodeTime;
+    static BoolParameter limitSendQueue;
+    static BoolParameter udpTransport;
+    static BoolParameter sharedMemory;
     static BoolParameter protocol3_3;
     static BoolParameter alwaysShared;
     static BoolParameter neverShared;
@@ -48,6 +53,9 @@ namespace rfb {
     static BoolParameter sendCutText;
     static BoolParameter acceptSetDesktopSize;
     static BoolParameter queryConnect;
+    static StringParameter recordSessions;
+    static IntParameter recordKeyframeInterval;
+    static StringParameter congestionControl;
 
   };
 
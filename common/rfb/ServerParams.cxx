@@ -27,7 +27,7 @@ ServerParams::ServerParams()
   : majorVersion(0), minorVersion(0),
     supportsQEMUKeyEvent(false),
     supportsSetDesktopSize(false), supportsFence(false),
-    supportsContinuousUpdates(false),
+    supportsContinuousUpdates(false), supportsViewport(false),
     width_(0), height_(0), name_(0),
     ledState_(ledUnknown)
 {
@@ -0,0 +1,320 @@
+/* Copyright (C) 2026 TigerVNC Team
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ * USA.
+ */
+
+#include <assert.h>
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <os/Mutex.h>
+
+#include <rdr/Exception.h>
+#include <rdr/MemOutStream.h>
+
+#include <rfb/LogWriter.h>
+#include <rfb/SessionRecorder.h>
+#include <rfb/util.h>
+
+using namespace rfb;
+
+static LogWriter vlog("SessionRecorder");
+
+// Size of the buffer in front of the real stream
+static const size_t bufferSize = 16384;
+// Amount of data collected before it is handed to the writer thread
+static const size_t chunkSize = 256 * 1024;
+// Amount of data we allow to pile up if the disk is slow
+static const size_t maxQueuedBytes = 64 * 1024 * 1024;
+
+SessionRecorder::SessionRecorder(rdr::OutStream* underlying_)
+  : underlying(underlying_), offset(0), recording(false), failed(false),
+    recordedBytes(0), dataFile(NULL), indexFile(NULL), queuedBytes(0),
+    thread(NULL)
+{
+  ptr = buffer = new rdr::U8[bufferSize];
+  end = buffer + bufferSize;
+
+  current.data = new rdr::MemOutStream(chunkSize);
+  current.index = new rdr::MemOutStream();
+
+  queueMutex = new os::Mutex();
+  consumerCond = new os::Condition(queueMutex);
+}
+
+SessionRecorder::~SessionRecorder()
+{
+  // Anything still in our buffer was never sent, so it doesn't belong
+  // in the recording either
+  ptr = buffer;
+
+  stop();
+
+  delete current.data;
+  delete current.index;
+
+  while (!freeChunks.empty()) {
+    delete freeChunks.front().data;
+    delete freeChunks.front().index;
+    freeChunks.pop_front();
+  }
+
+  delete consumerCond;
+  delete queueMutex;
+
+  delete [] buffer;
+}
+
+void SessionRecorder::start(const char* filename)
+{
+  CharArray indexName;
+  int err;
+
+  assert(dataFile == NULL);
+
+  dataFile = fopen(filename, "wb");
+  if (dataFile == NULL)
+    throw rdr::SystemException("unable to create recording", errno);
+
+  indexName.format("%s.idx", filename);
+  indexFile = fopen(indexName.buf, "w");
+  if (indexFile == NULL) {
+    err = errno;
+    fclose(dataFile);
+    dataFile = NULL;
+    throw rdr::SystemException("unable to create recording index", err);
+  }
+
+  // Only what is written from now on should be recorded
+  transfer();
+
+  failed = false;
+  recordedBytes = 0;
+
+  thread = new WriterThread(this);
+
+  recording = true;
+  gettimeofday(&startTime, NULL);
+}
+
+void SessionRecorder::stop()
+{
+  if (dataFile == NULL)
+    return;
+
+  transfer();
+  queueChunk();
+
+  recording = false;
+
+  // The thread writes out everything queued before it exits
+  delete thread;
+  thread = NULL;
+
+  fclose(indexFile);
+  indexFile = NULL;
+  fclose(dataFile);
+  dataFile = NULL;
+}
+
+void SessionRecorder::insert(const void* data, size_t length)
+{
+  if (!recording)
+    return;
+
+  // Everything before this has to go first
+  transfer();
+
+  current.data->writeBytes(data, length);
+  recordedBytes += length;
+
+  if (current.data->length() >= chunkSize)
+    queueChunk();
+}
+
+void SessionRecorder::markUpdate(bool keyframe)
+{
+  char line[64];
+
+  if (!recording)
+    return;
+
+  snprintf(line, sizeof(line), "%u %llu %c\n", msSince(&startTime),
+           recordedBytes + (ptr - buffer), keyframe ? 'K' : 'U');
+  current.index->writeBytes(line, strlen(line));
+
+  if (current.data->length() >= chunkSize)
+    queueChunk();
+}
+
+size_t SessionRecorder::length()
+{
+  return offset + (ptr - buffer);
+}
+
+void SessionRecorder::flush()
+{
+  transfer();
+  underlying->flush();
+}
+
+void SessionRecorder::cork(bool enable)
+{
+  corked = enable;
+  transfer();
+  underlying->cork(enable);
+}
+
+void SessionRecorder::overrun(size_t needed)
+{
+  assert(needed <= bufferSize);
+
+  transfer();
+}
+
+void SessionRecorder::transfer()
+{
+  size_t len;
+
+  len = ptr - buffer;
+  if (len == 0)
+    return;
+
+  underlying->writeBytes(buffer, len);
+
+  if (recording) {
+    current.data->writeBytes(buffer, len);
+    recordedBytes += len;
+  }
+
+  offset += len;
+  ptr = buffer;
+}
+
+void SessionRecorder::queueChunk()
+{
+  os::AutoMutex a(queueMutex);
+
+  if ((current.data->length() == 0) && (current.index->length() == 0))
+    return;
+
+  if (recording &&
+      (failed || (queuedBytes + current.data->length() > maxQueuedBytes))) {
+    if (failed)
+      vlog.error("Failed to write recording, stopping");
+    else
+      vlog.error("Recording is falling behind, stopping");
+    recording = false;
+  }
+
+  if (!recording) {
+    current.data->clear();
+    current.index->clear();
+    return;
+  }
+
+  queuedBytes += current.data->length();
+  queue.push_back(current);
+
+  if (freeChunks.empty()) {
+    current.data = new rdr::MemOutStream(chunkSize);
+    current.index = new rdr::MemOutStream();
+  } else {
+    current = freeChunks.front();
+    freeChunks.pop_front();
+  }
+
+  consumerCond->signal();
+}
+
+SessionRecorder::WriterThread::WriterThread(SessionRecorder* recorder)
+{
+  this->recorder = recorder;
+
+  stopRequested = false;
+
+  start();
+}
+
+SessionRecorder::WriterThread::~WriterThread()
+{
+  stop();
+  wait();
+}
+
+void SessionRecorder::WriterThread::stop()
+{
+  os::AutoMutex a(recorder->queueMutex);
+
+  if (!isRunning())
+    return;
+
+  stopRequested = true;
+
+  recorder->consumerCond->signal();
+}
+
+void SessionRecorder::WriterThread::worker()
+{
+  recorder->queueMutex->lock();
+
+  while (true) {
+    Chunk chunk;
+    bool ok;
+
+    if (recorder->queue.empty()) {
+      if (stopRequested)
+        break;
+
+      recorder->consumerCond->wait();
+      continue;
+    }
+
+    chunk = recorder->queue.front();
+    recorder->queue.pop_front();
+
+    recorder->queueMutex->unlock();
+
+    ok = true;
+    if (fwrite(chunk.data->data(), chunk.data->length(), 1,
+               recorder->dataFile) != 1)
+      ok = false;
+    // Make sure the index never points past the end of the data
+    if (fflush(recorder->dataFile) != 0)
+      ok = false;
+    if (chunk.index->length() != 0) {
+      if (fwrite(chunk.index->data(), chunk.index->length(), 1,
+                 recorder->indexFile) != 1)
+        ok = false;
+      if (fflush(recorder->indexFile) != 0)
+        ok = false;
+    }
+
+    recorder->queueMutex->lock();
+
+    if (!ok)
+      recorder->failed = true;
+
+    recorder->queuedBytes -= chunk.data->length();
+
+    chunk.data->clear();
+    chunk.index->clear();
+    recorder->freeChunks.push_back(chunk);
+  }
+
+  recorder->queueMutex->unlock();
+}
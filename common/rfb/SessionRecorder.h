@@ -0,0 +1,131 @@
+/* Copyright (C) 2026 TigerVNC Team
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ * USA.
+ */
+
+//
+// SessionRecorder sits between a connection and its real output stream
+// and keeps a copy of everything sent while a recording is running.
+// The recording is the plain server to client RFB stream starting with
+// ServerInit, which is the format read by tests/perf/decperf. Data that
+// only belongs in the recording, like ServerInit and keyframes, is
+// added with insert().
+//
+// Next to it an index file (same name with ".idx" appended) gets one
+// line per update: "<milliseconds> <byte offset> <K|U>", where K marks
+// keyframes, i.e. updates from which playback can start.
+//
+// All disk access happens on a separate thread. If the disk cannot
+// keep up then the recording is aborted rather than slowing down the
+// connection.
+//
+
+#ifndef __RFB_SESSIONRECORDER_H__
+#define __RFB_SESSIONRECORDER_H__
+
+#include <stdio.h>
+#include <sys/time.h>
+
+#include <list>
+
+#include <os/Thread.h>
+#include <rdr/OutStream.h>
+
+namespace os {
+  class Condition;
+  class Mutex;
+}
+
+namespace rdr { class MemOutStream; }
+
+namespace rfb {
+
+  class SessionRecorder : public rdr::OutStream {
+  public:
+    SessionRecorder(rdr::OutStream* underlying);
+    virtual ~SessionRecorder();
+
+    // start() creates the given file and begins copying data to it,
+    // stop() finishes the current file
+    void start(const char* filename);
+    void stop();
+
+    // insert() adds data to the recording without sending it
+    void insert(const void* data, size_t length);
+
+    // markUpdate() adds an index entry at the current position
+    void markUpdate(bool keyframe);
+
+    bool isRecording() { return recording; }
+
+    virtual size_t length();
+    virtual void flush();
+    virtual void cork(bool enable);
+
+  private:
+    virtual void overrun(size_t needed);
+
+    void transfer();
+    void queueChunk();
+
+  private:
+    class WriterThread : public os::Thread {
+    public:
+      WriterThread(SessionRecorder* recorder);
+      ~WriterThread();
+
+      void stop();
+
+    protected:
+      void worker();
+
+    private:
+      SessionRecorder* recorder;
+      bool stopRequested;
+    };
+
+    struct Chunk {
+      rdr::MemOutStream* data;
+      rdr::MemOutStream* index;
+    };
+
+    rdr::OutStream* underlying;
+
+    rdr::U8* buffer;
+    size_t offset;
+
+    bool recording;
+    bool failed;
+    struct timeval startTime;
+    unsigned long long recordedBytes;
+
+    FILE* dataFile;
+    FILE* indexFile;
+
+    Chunk current;
+    size_t queuedBytes;
+    std::list<Chunk> queue;
+    std::list<Chunk> freeChunks;
+
+    os::Mutex* queueMutex;
+    os::Condition* consumerCond;
+
+    WriterThread* thread;
+  };
+
+}
+
+#endif
@@ -0,0 +1,146 @@
+/* Copyright (C) 2026 TigerVNC Team
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ * USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#ifndef WIN32
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#endif
+
+#include <rdr/Exception.h>
+#include <rfb/SharedMemory.h>
+
+// Memory is only passed along if its size can be locked down
+#if defined(__linux__) && defined(MFD_ALLOW_SEALING) && defined(F_ADD_SEALS)
+#define HAVE_SEALS
+#endif
+
+using namespace rfb;
+
+SharedMemory::SharedMemory()
+  : fd(-1), data(NULL), size(0)
+{
+}
+
+SharedMemory::~SharedMemory()
+{
+#ifndef WIN32
+  if (data != NULL)
+    munmap(data, size);
+  if (fd != -1)
+    close(fd);
+#endif
+}
+
+void SharedMemory::create(size_t size_)
+{
+#ifdef WIN32
+  throw rdr::Exception("Shared memory is not supported on this platform");
+#else
+  void* mapping;
+
+  if (fd != -1)
+    throw rdr::Exception("Shared memory already set up");
+
+#ifdef HAVE_SEALS
+  fd = memfd_create("vnc-framebuffer", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+  if (fd < 0)
+    throw rdr::SystemException("memfd_create", errno);
+
+  if (ftruncate(fd, size_) != 0)
+    throw rdr::SystemException("ftruncate", errno);
+
+  // The other end will only accept memory that cannot change size
+  // behind its back, as that would give it a SIGBUS
+  if (fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL) != 0)
+    throw rdr::SystemException("fcntl", errno);
+#else
+  throw rdr::Exception("Shared memory is not supported on this platform");
+#endif
+
+  mapping = mmap(NULL, size_, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (mapping == MAP_FAILED)
+    throw rdr::SystemException("mmap", errno);
+
+  data = (rdr::U8*)mapping;
+  size = size_;
+#endif
+}
+
+void SharedMemory::attach(int fd_, size_t size_)
+{
+#ifdef WIN32
+  throw rdr::Exception("Shared memory is not supported on this platform");
+#else
+  struct stat st;
+  void* mapping;
+
+  if (fd != -1)
+    throw rdr::Exception("Shared memory already set up");
+
+  fd = fd_;
+
+  if (fstat(fd, &st) != 0)
+    throw rdr::SystemException("fstat", errno);
+  if (!S_ISREG(st.st_mode) || ((size_t)st.st_size < size_))
+    throw rdr::Exception("Shared memory is too small");
+
+  // Anything that can be truncated could make us crash when we read it
+#ifdef HAVE_SEALS
+  int seals;
+
+  seals = fcntl(fd, F_GET_SEALS);
+  if (seals == -1)
+    throw rdr::SystemException("fcntl", errno);
+  if ((seals & (F_SEAL_SHRINK | F_SEAL_GROW)) != (F_SEAL_SHRINK | F_SEAL_GROW))
+    throw rdr::Exception("Shared memory can change size");
+#else
+  throw rdr::Exception("Shared memory cannot be verified on this platform");
+#endif
+
+  mapping = mmap(NULL, size_, PROT_READ, MAP_SHARED, fd, 0);
+  if (mapping == MAP_FAILED)
+    throw rdr::SystemException("mmap", errno);
+
+  data = (rdr::U8*)mapping;
+  size = size_;
+#endif
+}
+
+bool SharedMemory::isSupported(int sock)
+{
+#ifndef HAVE_SEALS
+  return false;
+#else
+  struct sockaddr_storage sa;
+  socklen_t salen;
+
+  salen = sizeof(sa);
+  if (getsockname(sock, (struct sockaddr*)&sa, &salen) != 0)
+    return false;
+
+  return sa.ss_family == AF_UNIX;
+#endif
+}
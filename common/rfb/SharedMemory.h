@@ -0,0 +1,64 @@
+/* Copyright (C) 2026 TigerVNC Team
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ * USA.
+ */
+
+//
+// SharedMemory is an area of memory that can be passed to another
+// process on the same machine as a file descriptor. The size of the
+// area is sealed, so currently this requires Linux' memfd.
+//
+
+#ifndef __RFB_SHAREDMEMORY_H__
+#define __RFB_SHAREDMEMORY_H__
+
+#include <stddef.h>
+
+#include <rdr/types.h>
+
+namespace rfb {
+
+  class SharedMemory {
+  public:
+    SharedMemory();
+    ~SharedMemory();
+
+    // create() allocates a new area of the given size, which can
+    // then be passed on using the descriptor from getFd()
+    void create(size_t size);
+
+    // attach() maps an area that has been received from another
+    // process, read only. The object takes over the descriptor. Areas
+    // whose size hasn't been sealed are refused.
+    void attach(int fd, size_t size);
+
+    int getFd() { return fd; }
+    rdr::U8* getData() { return data; }
+    size_t getSize() { return size; }
+
+    // isSupported() checks if descriptors can be passed over the
+    // given socket
+    static bool isSupported(int sock);
+
+  private:
+    int fd;
+    rdr::U8* data;
+    size_t size;
+  };
+
+}
+
+#endif
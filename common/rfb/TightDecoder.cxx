@@ -46,7 +46,8 @@ static const int TIGHT_MIN_TO_COMPRESS = 12;
 #include <rfb/tightDecode.h>
 #undef BPP
 
-TightDecoder::TightDecoder() : Decoder(DecoderPartiallyOrdered)
+TightDecoder::TightDecoder() :
+  Decoder((enum DecoderFlags)(DecoderPartiallyOrdered | DecoderPassthrough))
 {
 }
 
@@ -56,31 +57,45 @@ TightDecoder::~TightDecoder()
 
 bool TightDecoder::readRect(const Rect& r, rdr::InStream* is,
                             const ServerParams& server, rdr::OutStream* os)
+{
+  size_t len;
+
+  // We keep the data as is, so reuse the parsing in getRectLength()
+  if (!getRectLength(r, is, server, &len))
+    return false;
+
+  os->copyBytes(is, len);
+
+  return true;
+}
+
+bool TightDecoder::getRectLength(const Rect& r, rdr::InStream* is,
+                                 const ServerParams& server, size_t* length)
 {
   rdr::U8 comp_ctl;
+  size_t start;
 
   if (!is->hasData(1))
     return false;
 
   is->setRestorePoint();
+  start = is->pos();
 
-  comp_ctl = is->readU8();
-  os->writeU8(comp_ctl);
-
-  comp_ctl >>= 4;
+  comp_ctl = is->readU8() >> 4;
 
   // "Fill" compression type.
   if (comp_ctl == tightFill) {
     if (server.pf().is888()) {
       if (!is->hasDataOrRestore(3))
         return false;
-      os->copyBytes(is, 3);
+      is->skip(3);
     } else {
       if (!is->hasDataOrRestore(server.pf().bpp/8))
         return false;
-      os->copyBytes(is, server.pf().bpp/8);
+      is->skip(server.pf().bpp/8);
     }
-    is->clearRestorePoint();
+    *length = is->pos() - start;
+    is->gotoRestorePoint();
     return true;
   }
 
@@ -93,14 +108,14 @@ bool TightDecoder::readRect(const Rect& r, rdr::InStream* is,
       return false;
 
     len = readCompact(is);
-    os->writeOpaque32(len);
 
     if (!is->hasDataOrRestore(len))
       return false;
 
-    os->copyBytes(is, len);
+    is->skip(len);
 
-    is->clearRestorePoint();
+    *length = is->pos() - start;
+    is->gotoRestorePoint();
 
     return true;
   }
@@ -124,7 +139,6 @@ bool TightDecoder::readRect(const Rect& r, rdr::InStream* is,
       return false;
 
     filterId = is->readU8();
-    os->writeU8(filterId);
 
     switch (filterId) {
     case tightFilterPalette:
@@ -132,16 +146,15 @@ bool TightDecoder::readRect(const Rect& r, rdr::InStream* is,
         return false;
 
       palSize = is->readU8() + 1;
-      os->writeU8(palSize - 1);
 
       if (server.pf().is888()) {
         if (!is->hasDataOrRestore(palSize * 3))
           return false;
-        os->copyBytes(is, palSize * 3);
+        is->skip(palSize * 3);
       } else {
         if (!is->hasDataOrRestore(palSize * server.pf().bpp/8))
           return false;
-        os->copyBytes(is, palSize * server.pf().bpp/8);
+        is->skip(palSize * server.pf().bpp/8);
       }
       break;
     case tightFilterGradient:
@@ -173,7 +186,7 @@ bool TightDecoder::readRect(const Rect& r, rdr::InStream* is,
   if (dataSize < TIGHT_MIN_TO_COMPRESS) {
     if (!is->hasDataOrRestore(dataSize))
       return false;
-    os->copyBytes(is, dataSize);
+    is->skip(dataSize);
   } else {
     rdr::U32 len;
 
@@ -182,15 +195,15 @@ bool TightDecoder::readRect(const Rect& r, rdr::InStream* is,
       return false;
 
     len = readCompact(is);
-    os->writeOpaque32(len);
 
     if (!is->hasDataOrRestore(len))
       return false;
 
-    os->copyBytes(is, len);
+    is->skip(len);
   }
 
-  is->clearRestorePoint();
+  *length = is->pos() - start;
+  is->gotoRestorePoint();
 
   return true;
 }
@@ -273,15 +286,15 @@ void TightDecoder::decodeRect(const Rect& r, const void* buffer,
 
     JpegDecompressor jd;
 
-    assert(buflen >= 4);
+    len = readCompact(&bufptr, &buflen);
 
-    memcpy(&len, bufptr, 4);
-    bufptr += 4;
-    buflen -= 4;
+    assert(buflen >= len);
 
-    // We always use direct decoding with JPEG images
+    // We always use direct decoding with JPEG images, and there is
+    // no point in decoding detail that will not be shown
     buf = pb->getBufferRW(r, &stride);
-    jd.decompress(bufptr, len, buf, stride, r, pb->getPF());
+    jd.decompress(bufptr, len, buf, stride, r, pb->getPF(),
+                  pb->getDisplayDivisor());
     pb->commitBufferRW(r);
     return;
   }
@@ -371,11 +384,7 @@ void TightDecoder::decodeRect(const Rect& r, const void* buffer,
     int streamId;
     rdr::MemInStream* ms;
 
-    assert(buflen >= 4);
-
-    memcpy(&len, bufptr, 4);
-    bufptr += 4;
-    buflen -= 4;
+    len = readCompact(&bufptr, &buflen);
 
     assert(buflen >= len);
 
@@ -505,3 +514,16 @@ rdr::U32 TightDecoder::readCompact(rdr::InStream* is)
 
   return result;
 }
+
+rdr::U32 TightDecoder::readCompact(const rdr::U8** bufptr, size_t* buflen)
+{
+  rdr::MemInStream ms(*bufptr, *buflen);
+  rdr::U32 result;
+
+  result = readCompact(&ms);
+
+  *bufptr += ms.pos();
+  *buflen -= ms.pos();
+
+  return result;
+}
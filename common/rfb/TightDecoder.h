@@ -33,6 +33,8 @@ namespace rfb {
     virtual ~TightDecoder();
     virtual bool readRect(const Rect& r, rdr::InStream* is,
                           const ServerParams& server, rdr::OutStream* os);
+    virtual bool getRectLength(const Rect& r, rdr::InStream* is,
+                               const ServerParams& server, size_t* length);
     virtual bool doRectsConflict(const Rect& rectA,
                                  const void* bufferA,
                                  size_t buflenA,
@@ -46,6 +48,7 @@ namespace rfb {
 
   private:
     rdr::U32 readCompact(rdr::InStream* is);
+    rdr::U32 readCompact(const rdr::U8** bufptr, size_t* buflen);
 
     void FilterGradient24(const rdr::U8* inbuf, const PixelFormat& pf,
                           rdr::U32* outbuf, int stride, const Rect& r);
@@ -59,6 +59,7 @@ TightEncoder::TightEncoder(SConnection* conn) :
   Encoder(conn, encodingTight, EncoderPlain, 256)
 {
   setCompressLevel(-1);
+  pendingResets = 0;
 }
 
 TightEncoder::~TightEncoder()
@@ -80,6 +81,13 @@ void TightEncoder::setCompressLevel(int level)
   rawZlibLevel = conf[level].rawZlibLevel;
 }
 
+void TightEncoder::resetCompression()
+{
+  // The reset is signalled to the client the next time each stream
+  // is used
+  pendingResets = 0x0f;
+}
+
 void TightEncoder::writeRect(const PixelBuffer* pb, const Palette& palette)
 {
   switch (palette.size()) {
@@ -166,7 +174,7 @@ void TightEncoder::writeFullColourRect(const PixelBuffer* pb, const Palette& pal
 
   os = conn->getOutStream();
 
-  os->writeU8(streamId << 4);
+  os->writeU8(streamId << 4 | getStreamReset(streamId));
 
   // Set up compression
   if ((pb->getPF().bpp != 32) || !pb->getPF().is888())
@@ -232,6 +240,19 @@ void TightEncoder::writeCompact(rdr::OutStream* os, rdr::U32 value)
   }
 }
 
+rdr::U8 TightEncoder::getStreamReset(int streamId)
+{
+  if (!(pendingResets & (1 << streamId)))
+    return 0;
+
+  // The client resets its stream as soon as it sees the flag, even if
+  // the rect is too small to be compressed, so we must do the same
+  zlibStreams[streamId].reset();
+  pendingResets &= ~(1 << streamId);
+
+  return 1 << streamId;
+}
+
 rdr::OutStream* TightEncoder::getZlibOutStream(int streamId, int level, size_t length)
 {
   // Minimum amount of data to be compressed. This value should not be
@@ -35,6 +35,8 @@ namespace rfb {
 
     virtual void setCompressLevel(int level);
 
+    virtual void resetCompression();
+
     virtual void writeRect(const PixelBuffer* pb, const Palette& palette);
     virtual void writeSolidRect(int width, int height,
                                 const PixelFormat& pf,
@@ -50,6 +52,8 @@ namespace rfb {
 
     void writeCompact(rdr::OutStream* os, rdr::U32 value);
 
+    rdr::U8 getStreamReset(int streamId);
+
     rdr::OutStream* getZlibOutStream(int streamId, int level, size_t length);
     void flushZlibOutStream(rdr::OutStream* os);
 
@@ -76,6 +80,8 @@ namespace rfb {
     rdr::MemOutStream memStream;
 
     int idxZlibLevel, monoZlibLevel, rawZlibLevel;
+
+    unsigned pendingResets;
   };
 
 }
@@ -40,7 +40,8 @@ void TightEncoder::writeMonoRect(int width, int height,
 
   os = conn->getOutStream();
 
-  os->writeU8((streamId | tightExplicitFilter) << 4);
+  os->writeU8((streamId | tightExplicitFilter) << 4 |
+              getStreamReset(streamId));
   os->writeU8(tightFilterPalette);
 
   // Write the palette
@@ -127,7 +128,8 @@ void TightEncoder::writeIndexedRect(int width, int height,
 
   os = conn->getOutStream();
 
-  os->writeU8((streamId | tightExplicitFilter) << 4);
+  os->writeU8((streamId | tightExplicitFilter) << 4 |
+              getStreamReset(streamId));
   os->writeU8(tightFilterPalette);
 
   // Write the palette
@@ -108,14 +108,34 @@ int TightJPEGEncoder::getQualityLevel()
 }
 
 void TightJPEGEncoder::writeRect(const PixelBuffer* pb, const Palette& palette)
+{
+  const rdr::U8* data;
+  size_t length;
+
+  data = compress(pb, &length);
+  writeCompressed(data, length);
+}
+
+void TightJPEGEncoder::writeCompressed(const rdr::U8* data, size_t length)
+{
+  rdr::OutStream* os;
+
+  os = conn->getOutStream();
+
+  os->writeU8(tightJpeg << 4);
+
+  writeCompact(length, os);
+  os->writeBytes(data, length);
+}
+
+const rdr::U8* TightJPEGEncoder::compress(const PixelBuffer* pb,
+                                          size_t* length)
 {
   const rdr::U8* buffer;
   int stride;
 
   int quality, subsampling;
 
-  rdr::OutStream* os;
-
   buffer = pb->getBuffer(pb->getRect(), &stride);
 
   if (qualityLevel >= 0 && qualityLevel <= 9) {
@@ -136,12 +156,8 @@ void TightJPEGEncoder::writeRect(const PixelBuffer* pb, const Palette& palette)
   jc.compress(buffer, stride, pb->getRect(),
               pb->getPF(), quality, subsampling);
 
-  os = conn->getOutStream();
-
-  os->writeU8(tightJpeg << 4);
-
-  writeCompact(jc.length(), os);
-  os->writeBytes(jc.data(), jc.length());
+  *length = jc.length();
+  return (const rdr::U8*)jc.data();
 }
 
 void TightJPEGEncoder::writeSolidRect(int width, int height,
@@ -42,6 +42,12 @@ namespace rfb {
                                 const PixelFormat& pf,
                                 const rdr::U8* colour);
 
+    // compress() returns the bare JPEG data for the given buffer,
+    // which stays valid until the next call
+    const rdr::U8* compress(const PixelBuffer* pb, size_t* length);
+    // writeCompressed() sends data from compress() as a normal rect
+    void writeCompressed(const rdr::U8* data, size_t length);
+
   protected:
     void writeCompact(rdr::U32 value, rdr::OutStream* os);
 
@@ -0,0 +1,146 @@
+/* Copyright (C) 2026 TigerVNC Team
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ * USA.
+ */
+
+#include <vector>
+
+#include <rfb/Rect.h>
+#include <rfb/Region.h>
+#include <rfb/TileDamage.h>
+
+using namespace rfb;
+
+static const int tileShift = 4;
+
+TileDamage::TileDamage(int width_, int height_)
+  : width(width_), height(height_)
+{
+  tilesX = (width + tileSize - 1) >> tileShift;
+  tilesY = (height + tileSize - 1) >> tileShift;
+  wordsPerRow = (tilesX + 31) / 32;
+
+  tiles = new rdr::U32[wordsPerRow * tilesY];
+  for (int i = 0; i < wordsPerRow * tilesY; i++)
+    tiles[i] = 0;
+}
+
+TileDamage::~TileDamage()
+{
+  delete [] tiles;
+}
+
+void TileDamage::add(const Rect& r_)
+{
+  Rect r;
+  int x1, x2, y1, y2;
+
+  r = r_.intersect(Rect(0, 0, width, height));
+  if (r.is_empty())
+    return;
+
+  x1 = r.tl.x >> tileShift;
+  x2 = (r.br.x - 1) >> tileShift;
+  y1 = r.tl.y >> tileShift;
+  y2 = (r.br.y - 1) >> tileShift;
+
+  // The pixels must have been written before we look at the tiles.
+  // Otherwise drain() could clear a tile we have just seen as marked,
+  // and then read the pixels before our writes reach it, losing the
+  // change.
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+  for (int y = y1; y <= y2; y++) {
+    rdr::U32* row = tiles + y * wordsPerRow;
+
+    for (int word = x1 / 32; word <= x2 / 32; word++) {
+      rdr::U32 mask;
+      int first, last;
+
+      first = word * 32 > x1 ? 0 : x1 % 32;
+      last = word * 32 + 31 < x2 ? 31 : x2 % 32;
+
+      mask = (0xffffffffU >> (31 - last)) & (0xffffffffU << first);
+
+      // Avoid dirtying the cache line if someone else already marked
+      // these tiles
+      if ((__atomic_load_n(&row[word], __ATOMIC_RELAXED) & mask) != mask)
+        __atomic_fetch_or(&row[word], mask, __ATOMIC_SEQ_CST);
+    }
+  }
+}
+
+bool TileDamage::pending() const
+{
+  for (int i = 0; i < wordsPerRow * tilesY; i++) {
+    if (__atomic_load_n(&tiles[i], __ATOMIC_ACQUIRE) != 0)
+      return true;
+  }
+
+  return false;
+}
+
+void TileDamage::drain(Region* region)
+{
+  std::vector<Rect> rects;
+
+  for (int y = 0; y < tilesY; y++) {
+    rdr::U32* row = tiles + y * wordsPerRow;
+    int runStart;
+
+    runStart = -1;
+
+    for (int word = 0; word < wordsPerRow; word++) {
+      rdr::U32 bits;
+
+      bits = 0;
+      if (__atomic_load_n(&row[word], __ATOMIC_RELAXED) != 0)
+        bits = __atomic_exchange_n(&row[word], 0, __ATOMIC_SEQ_CST);
+
+      // Collect runs of marked tiles
+      for (int bit = 0; bit < 32; bit++) {
+        int x = word * 32 + bit;
+
+        if (bits & (1U << bit)) {
+          if (runStart == -1)
+            runStart = x;
+          continue;
+        }
+
+        if (runStart != -1) {
+          rects.push_back(Rect(runStart << tileShift, y << tileShift,
+                               x << tileShift, (y + 1) << tileShift));
+          runStart = -1;
+        }
+
+        // Skip the rest of an empty word
+        if ((bits >> bit) == 0)
+          break;
+      }
+    }
+
+    if (runStart != -1) {
+      rects.push_back(Rect(runStart << tileShift, y << tileShift,
+                           tilesX << tileShift, (y + 1) << tileShift));
+    }
+  }
+
+  // The edge tiles can extend past the framebuffer
+  for (std::vector<Rect>::iterator i = rects.begin(); i != rects.end(); ++i)
+    *i = i->intersect(Rect(0, 0, width, height));
+
+  region->reset(rects);
+}
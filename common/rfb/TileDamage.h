@@ -0,0 +1,63 @@
+/* Copyright (C) 2026 TigerVNC Team
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ * USA.
+ */
+
+//
+// TileDamage keeps track of changed areas of a framebuffer at the
+// granularity of small tiles. Any number of threads can add damage at
+// the same time without taking a lock, whilst a single thread
+// periodically collects it.
+//
+
+#ifndef __RFB_TILEDAMAGE_H__
+#define __RFB_TILEDAMAGE_H__
+
+#include <rdr/types.h>
+
+namespace rfb {
+
+  class Region;
+  struct Rect;
+
+  class TileDamage {
+  public:
+    TileDamage(int width, int height);
+    ~TileDamage();
+
+    // add() can be called from any thread
+    void add(const Rect& r);
+
+    // These must only be called from a single thread. drain() replaces
+    // the region with everything added since the last call.
+    bool pending() const;
+    void drain(Region* region);
+
+    static const int tileSize = 16;
+
+  private:
+    int width, height;
+    int tilesX, tilesY;
+    int wordsPerRow;
+
+    // One bit per tile, one row of tiles after another. Only ever
+    // accessed through atomic operations.
+    rdr::U32* tiles;
+  };
+
+}
+
+#endif
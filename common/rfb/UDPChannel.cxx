@@ -0,0 +1,438 @@
+/* Copyright (C) 2026 TigerVNC Team
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ * USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#ifdef WIN32
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#define errorNumber WSAGetLastError()
+#undef EAGAIN
+#define EAGAIN WSAEWOULDBLOCK
+#else
+#define errorNumber errno
+#define closesocket close
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#endif
+
+#include <string.h>
+
+#include <rdr/Exception.h>
+#include <rdr/RandomStream.h>
+#include <rfb/UDPChannel.h>
+
+using namespace rfb;
+
+// Sent by the client to tell the server where to send datagrams
+static const rdr::U32 helloMagic = 0x52464255; // "RFBU"
+
+// How many sequence numbers back we keep incomplete rects around
+static const rdr::U32 maxSeqAge = 2;
+
+static const size_t maxPayload =
+  UDPChannel::maxDatagramSize - UDPChannel::headerSize;
+
+static void writeU16(rdr::U8* buf, rdr::U16 value)
+{
+  buf[0] = value >> 8;
+  buf[1] = value;
+}
+
+static void writeU32(rdr::U8* buf, rdr::U32 value)
+{
+  buf[0] = value >> 24;
+  buf[1] = value >> 16;
+  buf[2] = value >> 8;
+  buf[3] = value;
+}
+
+static rdr::U16 readU16(const rdr::U8* buf)
+{
+  return buf[0] << 8 | buf[1];
+}
+
+static rdr::U32 readU32(const rdr::U8* buf)
+{
+  return (rdr::U32)buf[0] << 24 | buf[1] << 16 | buf[2] << 8 | buf[3];
+}
+
+static void setPort(struct sockaddr_storage* sa, int port)
+{
+  switch (sa->ss_family) {
+  case AF_INET:
+    ((struct sockaddr_in*)sa)->sin_port = htons(port);
+    break;
+  case AF_INET6:
+    ((struct sockaddr_in6*)sa)->sin6_port = htons(port);
+    break;
+  default:
+    throw rdr::Exception("UDP transport requires an IP connection");
+  }
+}
+
+static socklen_t addressLength(const struct sockaddr_storage* sa)
+{
+  if (sa->ss_family == AF_INET6)
+    return sizeof(struct sockaddr_in6);
+  return sizeof(struct sockaddr_in);
+}
+
+UDPChannel::UDPChannel()
+  : fd(-1), connected(false), failed(false), token(0), lossRate(0),
+    lossState(1), nextRectId(0), sentRects(0), sentBytes(0),
+    receivedRects(0), droppedRects(0)
+{
+}
+
+UDPChannel::~UDPChannel()
+{
+  if (fd != -1)
+    closesocket(fd);
+}
+
+void UDPChannel::listen(int tcpFd)
+{
+  struct sockaddr_storage sa;
+  socklen_t salen;
+  rdr::RandomStream rs;
+
+  salen = sizeof(sa);
+  if (getsockname(tcpFd, (struct sockaddr*)&sa, &salen) != 0)
+    throw rdr::SystemException("getsockname", errorNumber);
+
+  setPort(&sa, 0);
+
+  openSocket(sa.ss_family);
+
+  if (bind(fd, (struct sockaddr*)&sa, addressLength(&sa)) != 0)
+    throw rdr::SystemException("bind", errorNumber);
+
+  if (!rs.hasData(sizeof(token)))
+    throw rdr::Exception("Could not generate random data for UDP token");
+  rs.readBytes(&token, sizeof(token));
+  lossState = token | 1;
+}
+
+int UDPChannel::getPort()
+{
+  struct sockaddr_storage sa;
+  socklen_t salen;
+
+  salen = sizeof(sa);
+  if (getsockname(fd, (struct sockaddr*)&sa, &salen) != 0)
+    throw rdr::SystemException("getsockname", errorNumber);
+
+  if (sa.ss_family == AF_INET6)
+    return ntohs(((struct sockaddr_in6*)&sa)->sin6_port);
+  return ntohs(((struct sockaddr_in*)&sa)->sin_port);
+}
+
+bool UDPChannel::accept()
+{
+  if (connected)
+    return true;
+
+  while (true) {
+    rdr::U8 buf[8];
+    struct sockaddr_storage sa;
+    socklen_t salen;
+    int len;
+
+    salen = sizeof(sa);
+    len = recvfrom(fd, (char*)buf, sizeof(buf), 0,
+                   (struct sockaddr*)&sa, &salen);
+    if (len < 0) {
+      if (errorNumber == EAGAIN || errorNumber == EWOULDBLOCK)
+        return false;
+      throw rdr::SystemException("recvfrom", errorNumber);
+    }
+
+    if (len != 8)
+      continue;
+    if (readU32(buf) != token)
+      continue;
+    if (readU32(buf + 4) != helloMagic)
+      continue;
+
+    if (::connect(fd, (struct sockaddr*)&sa, salen) != 0)
+      throw rdr::SystemException("connect", errorNumber);
+
+    connected = true;
+    return true;
+  }
+}
+
+bool UDPChannel::sendRect(rdr::U32 seq, const Rect& r,
+                          const rdr::U8* data, size_t length)
+{
+  rdr::U8 buf[maxDatagramSize];
+  unsigned count;
+
+  if (!connected || failed)
+    return false;
+
+  if (length == 0)
+    return false;
+
+  count = (length + maxPayload - 1) / maxPayload;
+  if (count > maxFragments)
+    return false;
+
+  writeU32(buf, token);
+  writeU32(buf + 4, seq);
+  writeU16(buf + 8, nextRectId);
+  writeU16(buf + 12, count);
+  writeU16(buf + 14, r.tl.x);
+  writeU16(buf + 16, r.tl.y);
+  writeU16(buf + 18, r.width());
+  writeU16(buf + 20, r.height());
+
+  for (unsigned i = 0; i < count; i++) {
+    size_t fragLength;
+
+    fragLength = length - i * maxPayload;
+    if (fragLength > maxPayload)
+      fragLength = maxPayload;
+
+    writeU16(buf + 10, i);
+    memcpy(buf + headerSize, data + i * maxPayload, fragLength);
+
+    sendDatagram(buf, headerSize + fragLength);
+  }
+
+  nextRectId++;
+  sentRects++;
+
+  return true;
+}
+
+void UDPChannel::connect(int tcpFd, int port, rdr::U32 token_)
+{
+  struct sockaddr_storage sa;
+  socklen_t salen;
+
+  salen = sizeof(sa);
+  if (getpeername(tcpFd, (struct sockaddr*)&sa, &salen) != 0)
+    throw rdr::SystemException("getpeername", errorNumber);
+
+  setPort(&sa, port);
+
+  openSocket(sa.ss_family);
+
+  if (::connect(fd, (struct sockaddr*)&sa, addressLength(&sa)) != 0)
+    throw rdr::SystemException("connect", errorNumber);
+
+  token = token_;
+  connected = true;
+
+  sendHello();
+}
+
+void UDPChannel::sendHello()
+{
+  rdr::U8 buf[8];
+
+  writeU32(buf, token);
+  writeU32(buf + 4, helloMagic);
+
+  if (send(fd, (const char*)buf, sizeof(buf), 0) < 0) {
+    if (errorNumber != EAGAIN && errorNumber != EWOULDBLOCK)
+      throw rdr::SystemException("send", errorNumber);
+  }
+}
+
+bool UDPChannel::readRect(rdr::U32* seq, Rect* r,
+                          std::vector<rdr::U8>* data)
+{
+  while (complete.empty()) {
+    rdr::U8 buf[maxDatagramSize];
+    int len;
+
+    len = recv(fd, (char*)buf, sizeof(buf), 0);
+    if (len < 0) {
+      if (errorNumber == EAGAIN || errorNumber == EWOULDBLOCK)
+        return false;
+      // Datagrams from the server may trigger ICMP errors that
+      // we'll see here, but they are not fatal
+      if (errorNumber == ECONNREFUSED)
+        continue;
+      throw rdr::SystemException("recv", errorNumber);
+    }
+
+    handleFragment(buf, len);
+  }
+
+  *seq = complete.front().seq;
+  *r = complete.front().r;
+  data->swap(complete.front().data);
+
+  complete.erase(complete.begin());
+
+  receivedRects++;
+
+  return true;
+}
+
+void UDPChannel::openSocket(int family)
+{
+  int bufferSize;
+
+  fd = socket(family, SOCK_DGRAM, 0);
+  if (fd < 0)
+    throw rdr::SystemException("socket", errorNumber);
+
+#ifdef WIN32
+  u_long arg = 1;
+  ioctlsocket(fd, FIONBIO, &arg);
+#else
+  fcntl(fd, F_SETFD, FD_CLOEXEC);
+  fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+#endif
+
+  // A full update can be a long burst of datagrams, so make sure the
+  // receiver doesn't have to drop them because it is a bit slow
+  bufferSize = 1024 * 1024;
+  setsockopt(fd, SOL_SOCKET, SO_RCVBUF,
+             (const char*)&bufferSize, sizeof(bufferSize));
+}
+
+void UDPChannel::sendDatagram(const rdr::U8* data, size_t length)
+{
+  // Counted even if it gets lost, as it still takes up room on the
+  // link until then
+  sentBytes += length;
+
+  if (lossRate != 0) {
+    // xorshift32
+    lossState ^= lossState << 13;
+    lossState ^= lossState >> 17;
+    lossState ^= lossState << 5;
+    if ((lossState % 1000) < lossRate)
+      return;
+  }
+
+  if (send(fd, (const char*)data, length, 0) < 0) {
+    // A full send buffer just means the datagram got lost earlier
+    // than usual
+    if (errorNumber == EAGAIN || errorNumber == EWOULDBLOCK ||
+        errorNumber == ENOBUFS)
+      return;
+    failed = true;
+    throw rdr::SystemException("send", errorNumber);
+  }
+}
+
+void UDPChannel::handleFragment(const rdr::U8* data, size_t length)
+{
+  rdr::U32 seq;
+  unsigned id, index, count;
+  Rect r;
+  size_t fragLength;
+  rdr::U64 key;
+  PendingMap::iterator iter;
+
+  if (length <= headerSize)
+    return;
+
+  if (readU32(data) != token)
+    return;
+
+  seq = readU32(data + 4);
+  id = readU16(data + 8);
+  index = readU16(data + 10);
+  count = readU16(data + 12);
+  r.setXYWH(readU16(data + 14), readU16(data + 16),
+            readU16(data + 18), readU16(data + 20));
+
+  fragLength = length - headerSize;
+
+  if ((count == 0) || (count > maxFragments) || (index >= count))
+    return;
+  if (r.is_empty())
+    return;
+  // Only the last fragment may be short
+  if ((index != count - 1) && (fragLength != maxPayload))
+    return;
+
+  expireFragments(seq);
+
+  key = (rdr::U64)seq << 16 | id;
+
+  iter = pending.find(key);
+  if (iter == pending.end()) {
+    PendingRect rect;
+
+    rect.seq = seq;
+    rect.r = r;
+    rect.count = count;
+    rect.received = 0;
+    rect.have.resize(count);
+    rect.data.resize(count * maxPayload);
+    rect.lastLength = 0;
+
+    iter = pending.insert(PendingMap::value_type(key, rect)).first;
+  }
+
+  PendingRect& rect = iter->second;
+
+  if ((rect.count != count) || !rect.r.equals(r))
+    return;
+  if (rect.have[index])
+    return;
+
+  memcpy(&rect.data[index * maxPayload], data + headerSize, fragLength);
+  rect.have[index] = true;
+  rect.received++;
+
+  if (index == count - 1)
+    rect.lastLength = fragLength;
+
+  if (rect.received != rect.count)
+    return;
+
+  rect.data.resize((count - 1) * maxPayload + rect.lastLength);
+  complete.push_back(rect);
+  pending.erase(iter);
+}
+
+void UDPChannel::expireFragments(rdr::U32 seq)
+{
+  PendingMap::iterator iter, next;
+
+  if (seq < maxSeqAge)
+    return;
+
+  // Fragments arrive mostly in order, so anything this old will
+  // never be completed
+  for (iter = pending.begin(); iter != pending.end(); iter = next) {
+    next = iter;
+    ++next;
+
+    if (iter->second.seq >= seq - maxSeqAge)
+      continue;
+
+    pending.erase(iter);
+    droppedRects++;
+  }
+}
@@ -0,0 +1,136 @@
+/* Copyright (C) 2026 TigerVNC Team
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ * USA.
+ */
+
+//
+// UDPChannel is a datagram side channel next to the normal RFB
+// connection. The server uses it to send independently decodable
+// rects that may be lost without affecting the rest of the session.
+// Rects larger than a datagram are fragmented and only delivered to
+// the client once every fragment has arrived.
+//
+
+#ifndef __RFB_UDPCHANNEL_H__
+#define __RFB_UDPCHANNEL_H__
+
+#include <map>
+#include <vector>
+
+#include <rdr/types.h>
+#include <rfb/Rect.h>
+
+namespace rfb {
+
+  class UDPChannel {
+  public:
+    UDPChannel();
+    ~UDPChannel();
+
+    // Server side
+
+    // listen() opens a datagram socket on the same local address as
+    // the given TCP socket, and picks a random token the client must
+    // present
+    void listen(int tcpFd);
+    int getPort();
+    rdr::U32 getToken() { return token; }
+
+    // accept() checks for a hello from the client and starts sending
+    // to where it came from. Returns true once that has happened.
+    bool accept();
+
+    // sendRect() sends the data for a rect as one or more datagrams.
+    // Returns false if the data is too large for the channel, or if
+    // the channel has failed.
+    bool sendRect(rdr::U32 seq, const Rect& r,
+                  const rdr::U8* data, size_t length);
+
+    // Client side
+
+    // connect() opens a datagram socket towards the same host as the
+    // given TCP socket and sends a hello to the given port
+    void connect(int tcpFd, int port, rdr::U32 token);
+    // sendHello() repeats the hello in case it got lost
+    void sendHello();
+
+    // readRect() returns the next rect that has been fully received,
+    // or false if there is nothing more at the moment
+    bool readRect(rdr::U32* seq, Rect* r, std::vector<rdr::U8>* data);
+
+    int getFd() { return fd; }
+    bool isConnected() { return connected; }
+    // hasFailed() returns true once sending has failed, after which
+    // the channel should no longer be used
+    bool hasFailed() { return failed; }
+    bool hasReceived() { return receivedRects != 0; }
+
+    // setLossRate() makes the channel throw away the given fraction
+    // (in per mille) of the outgoing datagrams, for testing purposes
+    void setLossRate(unsigned rate) { lossRate = rate; }
+
+    unsigned getSentRects() { return sentRects; }
+    unsigned long long getSentBytes() { return sentBytes; }
+    unsigned getReceivedRects() { return receivedRects; }
+    unsigned getDroppedRects() { return droppedRects; }
+
+  public:
+    static const size_t maxDatagramSize = 1200;
+    static const size_t headerSize = 22;
+    static const size_t maxFragments = 256;
+
+  private:
+    void openSocket(int family);
+    void sendDatagram(const rdr::U8* data, size_t length);
+    void handleFragment(const rdr::U8* data, size_t length);
+    void expireFragments(rdr::U32 seq);
+
+  private:
+    int fd;
+    bool connected;
+    bool failed;
+    rdr::U32 token;
+
+    unsigned lossRate;
+    rdr::U32 lossState;
+
+    rdr::U16 nextRectId;
+
+    struct PendingRect {
+      rdr::U32 seq;
+      Rect r;
+      unsigned count, received;
+      std::vector<bool> have;
+      std::vector<rdr::U8> data;
+      size_t lastLength;
+    };
+
+    // Partially received rects, indexed on sequence number and id
+    typedef std::map<rdr::U64, PendingRect> PendingMap;
+    PendingMap pending;
+
+    // Complete rects waiting to be picked up
+    std::vector<PendingRect> complete;
+
+    unsigned sentRects;
+    unsigned long long sentBytes;
+    unsigned receivedRects;
+    unsigned droppedRects;
+  };
+
+}
+
+#endif
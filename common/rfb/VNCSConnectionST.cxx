@@ -18,15 +18,25 @@
  * USA.
  */
 
+#include <limits.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
 #include <network/TcpSocket.h>
 
 #include <rfb/ComparingUpdateTracker.h>
 #include <rfb/Encoder.h>
 #include <rfb/KeyRemapper.h>
 #include <rfb/LogWriter.h>
+#include <rfb/RecordingConnection.h>
+#include <rfb/ScaledPixelBuffer.h>
 #include <rfb/Security.h>
 #include <rfb/ServerCore.h>
+#include <rfb/SessionRecorder.h>
 #include <rfb/SMsgWriter.h>
+#include <rfb/SharedMemory.h>
+#include <rfb/UDPChannel.h>
 #include <rfb/VNCServerST.h>
 #include <rfb/VNCSConnectionST.h>
 #include <rfb/screenTypes.h>
@@ -43,20 +53,38 @@ static LogWriter vlog("VNCSConnST");
 
 static Cursor emptyCursor(0, 0, Point(0, 0), NULL);
 
+// How long changes outside the viewport may be held back (ms) before
+// they start getting a share of every update
+static const unsigned hiddenMaxAge = 1000;
+
 VNCSConnectionST::VNCSConnectionST(VNCServerST* server_, network::Socket *s,
                                    bool reverse)
   : sock(s), reverseConnection(reverse),
     inProcessMessages(false),
     pendingSyncFence(false), syncFence(false), fenceFlags(0),
-    fenceDataLen(0), fenceData(NULL), congestionTimer(this),
-    losslessTimer(this), server(server_),
+    fenceDataLen(0), fenceData(NULL), updatePending(false),
+    congestionTimer(this),
+    sendLowWater(0), losslessTimer(this),
+    udpChannel(NULL), udpFailed(false), udpChargedBytes(0),
+    sharedMemory(NULL), sharedWidth(0), sharedMemoryFailed(false),
+    sharedMemoryBusy(false),
+    recorder(NULL), keyframes(NULL), keyframeTimer(this),
+    pendingKeyframe(false), server(server_),
     updateRenderedCursor(false), removeRenderedCursor(false),
-    continuousUpdates(false), encodeManager(this), idleTimer(this),
+    continuousUpdates(false), hasViewport(false), hiddenSkipped(0),
+    encodeManager(this), scaledPb(NULL),
+    idleTimer(this),
     pointerEventTime(0), clientHasCursor(false)
 {
   setStreams(&sock->inStream(), &sock->outStream());
   peerEndpoint.buf = sock->getPeerEndpoint();
 
+  congestion = Congestion::create(rfb::Server::congestionControl);
+  congestion->setSocket(sock->getFd());
+
+  memset(&recentDamageStart, 0, sizeof(recentDamageStart));
+  memset(&hiddenPendingSince, 0, sizeof(hiddenPendingSince));
+
   // Kick off the idle timer
   if (rfb::Server::idleTimeout) {
     // minimum of 15 seconds while authenticating
@@ -88,6 +116,53 @@ VNCSConnectionST::~VNCSConnectionST()
   }
 
   delete [] fenceData;
+
+  if (inputLatency.count() > 0) {
+    char summary[256];
+    inputLatency.print(summary, sizeof(summary));
+    vlog.info("Input latency for %s (until the first new change is "
+              "sent): %s", peerEndpoint.buf, summary);
+  }
+
+  if (hiddenSkipped != 0) {
+    char a[256], b[256];
+    // Only a guess, as these pixels were never actually encoded
+    siPrefix(hiddenSkipped, "pixels", a, sizeof(a));
+    iecPrefix(hiddenSkipped * (client.pf().bpp / 8) /
+              encodeManager.getCompressionRatio(), "B", b, sizeof(b));
+    vlog.info("Viewport for %s: %s of hidden changes skipped (estimated "
+              "%s at the current compression ratio)",
+              peerEndpoint.buf, a, b);
+  }
+
+  if (updateWait.count() > 0) {
+    char summary[256];
+    updateWait.print(summary, sizeof(summary));
+    vlog.info("Update wait for %s: %s", peerEndpoint.buf, summary);
+  }
+
+  {
+    char summary[512];
+    congestion->printStats(summary, sizeof(summary));
+    vlog.info("Congestion control for %s: %s", peerEndpoint.buf, summary);
+  }
+  delete congestion;
+
+  if (udpChannel) {
+    vlog.info("UDP transport for %s: %u rects sent", peerEndpoint.buf,
+              udpChannel->getSentRects());
+    encodeManager.setSideChannel(NULL);
+    delete udpChannel;
+  }
+
+  encodeManager.setSharedMemory(NULL, 0);
+  delete sharedMemory;
+
+  delete keyframes;
+  delete recorder;
+
+  if (scaledPb)
+    server->releaseScaledPixelBuffer(scaledPb);
 }
 
 
@@ -114,6 +189,10 @@ void VNCSConnectionST::close(const char* reason)
     vlog.debug("second close: %s (%s)", peerEndpoint.buf, reason);
 
   try {
+    // The recorder might be holding on to some data
+    if (recorder)
+      recorder->flush();
+
     if (sock->outStream().hasBufferedData()) {
       sock->outStream().cork(false);
       sock->outStream().flush();
@@ -203,9 +282,12 @@ void VNCSConnectionST::pixelBufferChange()
 {
   try {
     if (!authenticated()) return;
+
+    updateScaling();
+
     if (client.width() && client.height() &&
-        (server->getPixelBuffer()->width() != client.width() ||
-         server->getPixelBuffer()->height() != client.height()))
+        (getClientPixelBuffer()->width() != client.width() ||
+         getClientPixelBuffer()->height() != client.height()))
     {
       // We need to clip the next update to the new size, but also add any
       // extra bits if it's bigger.  If we wanted to do this exactly, something
@@ -224,9 +306,9 @@ void VNCSConnectionST::pixelBufferChange()
 
       damagedCursorRegion.assign_intersect(server->getPixelBuffer()->getRect());
 
-      client.setDimensions(server->getPixelBuffer()->width(),
-                           server->getPixelBuffer()->height(),
-                           server->getScreenLayout());
+      client.setDimensions(getClientPixelBuffer()->width(),
+                           getClientPixelBuffer()->height(),
+                           getClientScreenLayout());
       if (state() == RFBSTATE_NORMAL) {
         if (!client.supportsDesktopSize()) {
           close("Client does not support desktop resize");
@@ -236,12 +318,14 @@ void VNCSConnectionST::pixelBufferChange()
       }
 
       // Drop any lossy tracking that is now outside the framebuffer
-      encodeManager.pruneLosslessRefresh(Region(server->getPixelBuffer()->getRect()));
+      encodeManager.pruneLosslessRefresh(Region(getClientPixelBuffer()->getRect()));
     }
     // Just update the whole screen at the moment because we're too lazy to
     // work out what's actually changed.
     updates.clear();
     updates.add_changed(server->getPixelBuffer()->getRect());
+
+    updateSharedMemory();
     writeFramebufferUpdate();
   } catch(rdr::Exception &e) {
     close(e.str());
@@ -394,6 +478,11 @@ bool VNCSConnectionST::needRenderedCursor()
   if (state() != RFBSTATE_NORMAL)
     return false;
 
+  // We cannot render in to a scaled framebuffer, but such clients
+  // have a local cursor
+  if (scaledPb)
+    return false;
+
   if (!client.supportsLocalCursor())
     return true;
   if (!server->getCursorPos().equals(pointerEventPos) &&
@@ -442,6 +531,10 @@ void VNCSConnectionST::authSuccess()
 
 void VNCSConnectionST::queryConnection(const char* userName)
 {
+  // The security handshake is done, so this is the last point where
+  // we can get in front of the stream before the protocol messages
+  startRecording();
+
   server->queryConnection(this, userName);
 }
 
@@ -452,6 +545,12 @@ void VNCSConnectionST::clientInit(bool shared)
   if (rfb::Server::alwaysShared || reverseConnection) shared = true;
   if (!accessCheck(AccessNonShared)) shared = true;
   if (rfb::Server::neverShared) shared = false;
+  if (recorder) {
+    // The recording starts with the first update
+    pendingKeyframe = true;
+    if (rfb::Server::recordKeyframeInterval)
+      keyframeTimer.start(secsToMillis(rfb::Server::recordKeyframeInterval));
+  }
   SConnection::clientInit(shared);
   server->clientReady(this, shared);
 }
@@ -463,6 +562,37 @@ void VNCSConnectionST::setPixelFormat(const PixelFormat& pf)
   pf.print(buffer, 256);
   vlog.info("Client pixel format %s", buffer);
   setCursor();
+  updateSharedMemory();
+
+  // A recording cannot change pixel format, so start a new one
+  if (recorder && recorder->isRecording()) {
+    recorder->stop();
+    pendingKeyframe = true;
+  }
+}
+
+void VNCSConnectionST::setEncodings(int nEncodings, const rdr::S32* encodings)
+{
+  int oldDivisor, newDivisor;
+
+  oldDivisor = scaledPb ? scaledPb->getDivisor() : 1;
+
+  SConnection::setEncodings(nEncodings, encodings);
+
+  if (keyframes)
+    keyframes->setEncodings(nEncodings, encodings);
+
+  updateScaling();
+  updateUDPTransport();
+  updateSharedMemory();
+
+  // A different scale is just like a new framebuffer to the client
+  newDivisor = scaledPb ? scaledPb->getDivisor() : 1;
+  if (newDivisor != oldDivisor) {
+    pixelBufferChange();
+    // We might have stopped rendering the cursor ourselves
+    setCursor();
+  }
 }
 
 void VNCSConnectionST::pointerEvent(const Point& pos, int buttonMask)
@@ -472,7 +602,10 @@ void VNCSConnectionST::pointerEvent(const Point& pos, int buttonMask)
   pointerEventTime = time(0);
   if (!accessCheck(AccessPtrEvents)) return;
   if (!rfb::Server::acceptPointerEvents) return;
-  pointerEventPos = pos;
+  if (scaledPb)
+    pointerEventPos = scaledPb->toSource(pos);
+  else
+    pointerEventPos = pos;
   server->pointerEvent(this, pointerEventPos, buttonMask);
 }
 
@@ -624,6 +757,8 @@ void VNCSConnectionST::framebufferUpdateRequest(const Rect& r,bool incremental)
   // Just update the requested region.
   // Framebuffer update will be sent a bit later, see processMessages().
   Region reqRgn(safeRect);
+  if (scaledPb)
+    reqRgn = scaledPb->toSource(reqRgn);
   if (!incremental || !continuousUpdates)
     requested.assign_union(reqRgn);
 
@@ -650,7 +785,26 @@ void VNCSConnectionST::setDesktopSize(int fb_width, int fb_height,
 
   if (!accessCheck(AccessSetDesktopSize) || !rfb::Server::acceptSetDesktopSize)
     result = resultProhibited;
-  else
+  else if (scaledPb) {
+    // The client only knows about the scaled framebuffer
+    int divisor;
+    ScreenSet srcLayout;
+    ScreenSet::const_iterator iter;
+
+    divisor = scaledPb->getDivisor();
+    for (iter = layout.begin(); iter != layout.end(); ++iter) {
+      Screen screen;
+      screen = *iter;
+      screen.dimensions.setXYWH(iter->dimensions.tl.x * divisor,
+                                iter->dimensions.tl.y * divisor,
+                                iter->dimensions.width() * divisor,
+                                iter->dimensions.height() * divisor);
+      srcLayout.add_screen(screen);
+    }
+
+    result = server->setDesktopSize(this, fb_width * divisor,
+                                    fb_height * divisor, srcLayout);
+  } else
     result = server->setDesktopSize(this, fb_width, fb_height, layout);
 
   writer()->writeDesktopSize(reasonClient, result);
@@ -660,6 +814,17 @@ void VNCSConnectionST::fence(rdr::U32 flags, unsigned len, const char data[])
 {
   rdr::U8 type;
 
+  if ((flags == fenceFlagRequest) && (len == fenceLatencyProbeLen)) {
+    rdr::U32 marker;
+
+    marker = ((rdr::U8)data[0] << 24) | ((rdr::U8)data[1] << 16) |
+             ((rdr::U8)data[2] << 8) | (rdr::U8)data[3];
+    if (marker == fenceLatencyProbe) {
+      addLatencyProbe(data);
+      return;
+    }
+  }
+
   if (flags & fenceFlagRequest) {
     if (flags & fenceFlagSyncNext) {
       pendingSyncFence = true;
@@ -693,7 +858,11 @@ void VNCSConnectionST::fence(rdr::U32 flags, unsigned len, const char data[])
     // Initial dummy fence;
     break;
   case 1:
-    congestion.gotPong();
+    congestion->gotPong();
+    break;
+  case 2:
+    // processMessages() will send any update that was held back
+    sharedMemoryBusy = false;
     break;
   default:
     vlog.error("Fence response of unexpected type received");
@@ -711,6 +880,8 @@ void VNCSConnectionST::enableContinuousUpdates(bool enable,
   continuousUpdates = enable;
 
   rect.setXYWH(x, y, w, h);
+  if (scaledPb)
+    rect = scaledPb->toSource(rect);
   cuRegion.reset(rect);
 
   if (enable) {
@@ -720,6 +891,15 @@ void VNCSConnectionST::enableContinuousUpdates(bool enable,
   }
 }
 
+void VNCSConnectionST::setViewport(const Region& visible)
+{
+  if (!client.supportsEncoding(pseudoEncodingViewport))
+    throw Exception("Client tried to set viewport when not allowed");
+
+  hasViewport = true;
+  viewport = visible;
+}
+
 void VNCSConnectionST::handleClipboardRequest()
 {
   if (!accessCheck(AccessCutText)) return;
@@ -769,6 +949,11 @@ void VNCSConnectionST::supportsContinuousUpdates()
   writer()->writeEndOfContinuousUpdates();
 }
 
+void VNCSConnectionST::supportsViewport()
+{
+  writer()->writeViewport();
+}
+
 void VNCSConnectionST::supportsLEDState()
 {
   if (client.ledState() == ledUnknown)
@@ -783,6 +968,14 @@ bool VNCSConnectionST::handleTimeout(Timer* t)
     if ((t == &congestionTimer) ||
         (t == &losslessTimer))
       writeFramebufferUpdate();
+
+    if (t == &keyframeTimer) {
+      pendingKeyframe = true;
+      // Otherwise it is done with the next update
+      if (updates.is_empty() && canWriteKeyframe())
+        writeRecordingKeyframe();
+      return true;
+    }
   } catch (rdr::Exception& e) {
     close(e.str());
   }
@@ -807,6 +1000,142 @@ bool VNCSConnectionST::isShiftPressed()
   return false;
 }
 
+// Session recordings are a copy of what the client is sent, so they
+// cost no extra encoding. Only the keyframes, which playback can start
+// from, are encoded separately and exist in the recording alone.
+
+void VNCSConnectionST::startRecording()
+{
+  if (((const char*)rfb::Server::recordSessions)[0] == '\0')
+    return;
+
+  // Everything from now on goes via the recorder, but it won't keep
+  // anything until the first keyframe
+  recorder = new SessionRecorder(getOutStream());
+  setStreams(getInStream(), recorder);
+
+  keyframes = new RecordingConnection(recorder);
+}
+
+// canWriteKeyframe() checks that the client's view will be correct if
+// it starts from what the screen looks like now. Copies that haven't
+// been sent would copy from areas that might have changed since.
+
+bool VNCSConnectionST::canWriteKeyframe()
+{
+  UpdateInfo ui;
+
+  if (!server->getPendingRegion().is_empty())
+    return false;
+
+  updates.getUpdateInfo(&ui, server->getPixelBuffer()->getRect());
+
+  return ui.copied.is_empty();
+}
+
+void VNCSConnectionST::writeRecordingKeyframe()
+{
+  const RenderedCursor *cursor;
+
+  pendingKeyframe = false;
+
+  if (!recorder->isRecording()) {
+    char filename[PATH_MAX];
+    char timestamp[32];
+    time_t now;
+
+    static unsigned counter = 0;
+
+    // Finish whatever was recorded before a pixel format change or a
+    // failure
+    recorder->stop();
+
+    now = time(0);
+    strftime(timestamp, sizeof(timestamp), "%Y%m%d-%H%M%S",
+             localtime(&now));
+    snprintf(filename, sizeof(filename), "%s/%s-%u.rfb",
+             (const char*)rfb::Server::recordSessions, timestamp,
+             counter++);
+
+    try {
+      recorder->start(filename);
+    } catch (rdr::Exception& e) {
+      vlog.error("Unable to record session: %s", e.str());
+      keyframeTimer.stop();
+      return;
+    }
+
+    vlog.info("Recording session for %s to %s", peerEndpoint.buf,
+              filename);
+
+    keyframes->writeServerInit(getClientPixelBuffer(), client.pf(),
+                               server->getName());
+  }
+
+  cursor = NULL;
+  if (needRenderedCursor())
+    cursor = server->getRenderedCursor();
+
+  // What the client is sent next must not depend on anything before
+  // the keyframe either. Only Tight can tell the client about this.
+  encodeManager.resetCompression();
+
+  keyframes->writeKeyframe(getClientPixelBuffer(), client.pf(), cursor);
+}
+
+// updateScaling() makes sure we are using the scaled framebuffer the
+// client has asked for, or none if that isn't possible.
+
+void VNCSConnectionST::updateScaling()
+{
+  int divisor;
+
+  divisor = client.scaleDivisor;
+
+  // The client must be able to handle the size change, and we have
+  // no way of rendering the cursor in to the scaled framebuffer
+  if ((divisor != 1) &&
+      (!client.supportsDesktopSize() || !client.supportsLocalCursor())) {
+    vlog.debug("Client cannot handle a scaled framebuffer");
+    divisor = 1;
+  }
+
+  if (scaledPb) {
+    if ((scaledPb->getDivisor() == divisor) &&
+        (scaledPb->getSource() == server->getPixelBuffer()))
+      return;
+
+    server->releaseScaledPixelBuffer(scaledPb);
+    scaledPb = NULL;
+  }
+
+  if (divisor == 1)
+    return;
+
+  scaledPb = server->getScaledPixelBuffer(divisor);
+  if (scaledPb == NULL) {
+    vlog.error("Unable to scale framebuffer for %s", peerEndpoint.buf);
+    return;
+  }
+
+  vlog.info("Scaling framebuffer down by %d for %s",
+            divisor, peerEndpoint.buf);
+}
+
+const PixelBuffer* VNCSConnectionST::getClientPixelBuffer()
+{
+  if (scaledPb)
+    return scaledPb;
+  return server->getPixelBuffer();
+}
+
+ScreenSet VNCSConnectionST::getClientScreenLayout()
+{
+  if (scaledPb)
+    return scaledPb->toScaled(server->getScreenLayout());
+  return server->getScreenLayout();
+}
+
 void VNCSConnectionST::writeRTTPing()
 {
   char type;
@@ -814,7 +1143,11 @@ void VNCSConnectionST::writeRTTPing()
   if (!client.supportsFence())
     return;
 
-  congestion.updatePosition(sock->outStream().length());
+  // The kernel already tracks the round trip time for us
+  if (congestion->isSocketBased())
+    return;
+
+  congestion->updatePosition(sock->outStream().length());
 
   // We need to make sure any old update are already processed by the
   // time we get the response back. This allows us to reliably throttle
@@ -823,7 +1156,7 @@ void VNCSConnectionST::writeRTTPing()
   writer()->writeFence(fenceFlagRequest | fenceFlagBlockBefore,
                        sizeof(type), &type);
 
-  congestion.sentPing();
+  congestion->sentPing();
 }
 
 bool VNCSConnectionST::isCongested()
@@ -834,28 +1167,362 @@ bool VNCSConnectionST::isCongested()
 
   // Stuff still waiting in the send buffer?
   sock->outStream().flush();
-  congestion.debugTrace("congestion-trace.csv", sock->getFd());
+  congestion->debugTrace("congestion-trace.csv", sock->getFd());
   if (sock->outStream().hasBufferedData())
     return true;
 
-  if (!client.supportsFence())
+  if (!client.supportsFence() && !congestion->isSocketBased())
     return false;
 
-  congestion.updatePosition(sock->outStream().length());
-  if (!congestion.isCongested())
+  congestion->updatePosition(sock->outStream().length());
+  if (!congestion->isCongested())
     return false;
 
-  eta = congestion.getUncongestedETA();
+  eta = congestion->getUncongestedETA();
   if (eta >= 0)
     congestionTimer.start(eta);
 
   return true;
 }
 
+// getMaxUpdateSize() returns how much data a single update may
+// contain, or zero if there is no limit
+
+size_t VNCSConnectionST::getMaxUpdateSize()
+{
+  size_t bandwidth;
+
+  if (rfb::Server::maxUnsentData < 0)
+    return 0;
+
+  if (rfb::Server::maxUnsentData > 0)
+    return rfb::Server::maxUnsentData * 1024;
+
+  // Enough to keep the link busy until the next update
+  bandwidth = congestion->getBandwidth();
+  return __rfbmax(bandwidth / rfb::Server::frameRate, 16384);
+}
+
+
+// updateSendQueue() keeps the amount of unsent data in the kernel in
+// line with what the network can actually carry. Anything beyond that
+// would just sit there, adding latency and hiding the congestion from
+// us. With a low water mark the socket only becomes writable when it
+// is almost out of unsent data, so the rest stays in our own buffer
+// where isCongested() can see it. The socket buffer size itself is
+// left to the kernel, as setting it turns off its automatic tuning.
+
+void VNCSConnectionST::updateSendQueue()
+{
+  size_t bandwidth, lowWater;
+
+  if (!rfb::Server::limitSendQueue)
+    return;
+
+  bandwidth = congestion->getBandwidth();
+
+  // Enough unsent data to cover short scheduling delays
+  lowWater = __rfbmin(__rfbmax(bandwidth / 100, 16384), 1048576);
+
+  // Only change things when there is a significant difference, as
+  // the estimates are noisy
+  if ((lowWater < sendLowWater * 3 / 4) || (lowWater > sendLowWater * 5 / 4)) {
+    if (sock->outStream().setLowWaterMark(lowWater))
+      vlog.debug("Send queue low water mark for %s set to %d KiB",
+                 peerEndpoint.buf, (int)(lowWater / 1024));
+    sendLowWater = lowWater;
+  }
+}
+
+
+// The UDP side channel is offered once the client has said it
+// supports it, and used once the client has found its way to it. It
+// is only used when the client accepts an open ended number of rects,
+// and never when recording as the recording would miss its content.
+
+void VNCSConnectionST::updateUDPTransport()
+{
+  if (!client.supportsEncoding(pseudoEncodingUDPTransport) ||
+      !client.supportsEncoding(pseudoEncodingLastRect) ||
+      (recorder != NULL)) {
+    encodeManager.setSideChannel(NULL);
+    return;
+  }
+
+  if (udpChannel != NULL) {
+    if (udpChannel->isConnected() && !udpChannel->hasFailed())
+      encodeManager.setSideChannel(udpChannel);
+    return;
+  }
+
+  if (!rfb::Server::udpTransport || udpFailed)
+    return;
+
+  udpChannel = new UDPChannel();
+  try {
+    udpChannel->listen(sock->getFd());
+  } catch (rdr::Exception& e) {
+    vlog.error("Failed to set up UDP transport for %s: %s",
+               peerEndpoint.buf, e.str());
+    delete udpChannel;
+    udpChannel = NULL;
+    udpFailed = true;
+    return;
+  }
+
+  vlog.debug("Offering UDP transport on port %d to %s",
+             udpChannel->getPort(), peerEndpoint.buf);
+
+  writer()->writeUDPOffer(udpChannel->getPort(), udpChannel->getToken());
+}
+
+void VNCSConnectionST::acceptUDPTransport()
+{
+  try {
+    if (!udpChannel->accept())
+      return;
+  } catch (rdr::Exception& e) {
+    vlog.error("Failed to set up UDP transport for %s: %s",
+               peerEndpoint.buf, e.str());
+    closeUDPTransport();
+    return;
+  }
+
+  vlog.info("Using UDP transport for %s", peerEndpoint.buf);
+
+  updateUDPTransport();
+}
+
+void VNCSConnectionST::closeUDPTransport()
+{
+  encodeManager.setSideChannel(NULL);
+  delete udpChannel;
+  udpChannel = NULL;
+  udpFailed = true;
+}
+
+// Clients on the same machine can map a copy of the framebuffer that
+// we update directly, so that only the changed rects need to be sent.
+// The memory is replaced whenever the client's size or pixel format
+// changes. The client keeps its mapping of the old memory until it
+// has seen the new offer, so it can safely be freed here right away.
+
+void VNCSConnectionST::updateSharedMemory()
+{
+  SharedMemory* newMemory;
+  int width, height;
+  size_t size;
+
+  if (!rfb::Server::sharedMemory || sharedMemoryFailed ||
+      !client.supportsEncoding(pseudoEncodingSharedMemory) ||
+      !client.supportsFence() || !client.pf().trueColour ||
+      (recorder != NULL) ||
+      !SharedMemory::isSupported(sock->getFd())) {
+    if (sharedMemory != NULL) {
+      encodeManager.setSharedMemory(NULL, 0);
+      delete sharedMemory;
+      sharedMemory = NULL;
+    }
+    return;
+  }
+
+  width = client.width();
+  height = client.height();
+  size = (size_t)width * height * (client.pf().bpp/8);
+
+  if ((sharedMemory != NULL) && (sharedMemory->getSize() == size) &&
+      (sharedWidth == width) && sharedPF.equal(client.pf()))
+    return;
+
+  newMemory = new SharedMemory();
+  try {
+    newMemory->create(size);
+    sock->outStream().sendFd(newMemory->getFd());
+  } catch (rdr::Exception& e) {
+    vlog.error("Failed to set up shared memory for %s: %s",
+               peerEndpoint.buf, e.str());
+    delete newMemory;
+    // The old memory no longer matches, so fall back to encoding
+    encodeManager.setSharedMemory(NULL, 0);
+    delete sharedMemory;
+    sharedMemory = NULL;
+    sharedMemoryFailed = true;
+    return;
+  }
+
+  writer()->writeSharedMemoryOffer(width, height, width, client.pf());
+
+  encodeManager.setSharedMemory(newMemory, width);
+  delete sharedMemory;
+  sharedMemory = newMemory;
+  sharedWidth = width;
+  sharedPF = client.pf();
+
+  vlog.debug("Using shared memory for %s", peerEndpoint.buf);
+}
+
+// writeSharedMemoryFence() asks the client to tell us when it has
+// handled the update that was just written to the shared memory, so
+// that we don't write the next one whilst it is still copying.
+
+void VNCSConnectionST::writeSharedMemoryFence()
+{
+  char type;
+
+  if (sharedMemory == NULL)
+    return;
+
+  type = 2;
+  writer()->writeFence(fenceFlagRequest | fenceFlagBlockBefore,
+                       sizeof(type), &type);
+
+  sharedMemoryBusy = true;
+}
+
+// getVisibleRegion() returns the part of the framebuffer that the user
+// can currently see
+
+Region VNCSConnectionST::getVisibleRegion()
+{
+  Region visible;
+
+  visible = viewport;
+  if (scaledPb)
+    visible = scaledPb->toSource(visible);
+
+  return visible.intersect(server->getPixelBuffer()->getRect());
+}
+
+// getHiddenUpdateSize() returns how much data to spend on changes
+// outside the viewport for each update
+
+size_t VNCSConnectionST::getHiddenUpdateSize()
+{
+  size_t bandwidth;
+
+  // A fraction of the link, so that it stays responsive when the user
+  // scrolls to something else
+  bandwidth = congestion->getBandwidth();
+  return __rfbmax(bandwidth / rfb::Server::frameRate / 4, 16384);
+}
+
+// countHiddenChanges() keeps track of how many pixels of changes did
+// not have to be sent as they were replaced before the user could see
+// them
+
+void VNCSConnectionST::countHiddenChanges(const Region& region)
+{
+  std::vector<Rect> rects;
+  std::vector<Rect>::const_iterator iter;
+
+  if (hiddenPending.is_empty())
+    return;
+
+  region.intersect(hiddenPending).get_rects(&rects);
+  for (iter = rects.begin(); iter != rects.end(); ++iter)
+    hiddenSkipped += iter->area();
+}
+
+// Latency probes are fences that the client sends right after an input
+// event. We answer them once the first damage after the probe has been
+// sent, which gives the client the time from input until the result is
+// on its way back. Probes that don't cause any damage are dropped.
+//
+// We cannot know which damage the input actually caused, so this is an
+// approximation. Damage in areas that were already changing during the
+// last second or two, e.g. a clock or a video, is ignored, as that is
+// most likely unrelated. Any other new damage counts.
+
+void VNCSConnectionST::addLatencyProbe(const char data[])
+{
+  LatencyProbe probe;
+  std::list<LatencyProbe>::iterator iter;
+
+  iter = latencyProbes.begin();
+  while (iter != latencyProbes.end()) {
+    if (!iter->damaged && (msSince(&iter->received) > 1000))
+      iter = latencyProbes.erase(iter);
+    else
+      ++iter;
+  }
+
+  if (latencyProbes.size() >= 16)
+    latencyProbes.pop_front();
+
+  gettimeofday(&probe.received, NULL);
+  probe.background = recentDamage.union_(olderDamage);
+  probe.damaged = false;
+  memcpy(probe.data, data, fenceLatencyProbeLen);
+
+  latencyProbes.push_back(probe);
+}
+
+void VNCSConnectionST::damageLatencyProbes(const Region& region)
+{
+  std::list<LatencyProbe>::iterator iter;
+
+  if (region.is_empty())
+    return;
+
+  for (iter = latencyProbes.begin(); iter != latencyProbes.end(); ++iter) {
+    if (iter->damaged)
+      continue;
+    if (region.subtract(iter->background).is_empty())
+      continue;
+    iter->damaged = true;
+  }
+
+  // Only needed to tell what is background for new probes, so don't
+  // bother until the client has shown that it sends them
+  if (latencyProbes.empty() && (inputLatency.count() == 0))
+    return;
+
+  if (msSince(&recentDamageStart) >= 1000) {
+    olderDamage = recentDamage;
+    recentDamage.clear();
+    gettimeofday(&recentDamageStart, NULL);
+  }
+
+  recentDamage.assign_union(region);
+}
+
+// The update wait is how long changes sit in the update tracker before
+// they are encoded. It includes time spent behind other clients, or
+// congestion, or being carried over because of the update limits.
+
+void VNCSConnectionST::markUpdatePending(const Region& region)
+{
+  if (updatePending || region.is_empty())
+    return;
+
+  updatePending = true;
+  gettimeofday(&pendingSince, NULL);
+}
+
+void VNCSConnectionST::writeLatencyProbes()
+{
+  std::list<LatencyProbe>::iterator iter;
+
+  iter = latencyProbes.begin();
+  while (iter != latencyProbes.end()) {
+    if (!iter->damaged) {
+      ++iter;
+      continue;
+    }
+
+    inputLatency.add(msSince(&iter->received));
+    writer()->writeFence(0, fenceLatencyProbeLen, iter->data);
+
+    iter = latencyProbes.erase(iter);
+  }
+}
 
 void VNCSConnectionST::writeFramebufferUpdate()
 {
-  congestion.updatePosition(sock->outStream().length());
+  congestion->updatePosition(sock->outStream().length());
+
+  if ((udpChannel != NULL) && !udpChannel->isConnected())
+    acceptUDPTransport();
 
   // We're in the middle of processing a command that's supposed to be
   // synchronised. Allowing an update to slip out right now might violate
@@ -894,7 +1561,19 @@ void VNCSConnectionST::writeFramebufferUpdate()
 
   getOutStream()->cork(false);
 
-  congestion.updatePosition(sock->outStream().length());
+  congestion->updatePosition(sock->outStream().length());
+
+  // Datagrams share the link with the stream, so they have to count
+  // against the same congestion window
+  if (udpChannel != NULL) {
+    congestion->sentDatagram(udpChannel->getSentBytes() - udpChargedBytes);
+    udpChargedBytes = udpChannel->getSentBytes();
+
+    if (udpChannel->hasFailed())
+      closeUDPTransport();
+  }
+
+  updateSendQueue();
 }
 
 void VNCSConnectionST::writeNoDataUpdate()
@@ -910,10 +1589,12 @@ void VNCSConnectionST::writeNoDataUpdate()
 
 void VNCSConnectionST::writeDataUpdate()
 {
-  Region req;
+  Region req, withheld;
   UpdateInfo ui;
   bool needNewUpdateInfo;
   const RenderedCursor *cursor;
+  size_t maxUpdateSize;
+  unsigned maxEncodeTime;
 
   // See what the client has requested (if anything)
   if (continuousUpdates)
@@ -924,6 +1605,11 @@ void VNCSConnectionST::writeDataUpdate()
   if (req.is_empty())
     return;
 
+  // The client might still be copying the previous update out of the
+  // shared memory, so we cannot touch it yet
+  if ((sharedMemory != NULL) && sharedMemoryBusy)
+    return;
+
   // Get the lists of updates. Prior to exporting the data to the `ui' object,
   // getUpdateInfo() will normalize the `updates' object such way that its
   // `changed' and `copied' regions would not intersect.
@@ -978,6 +1664,70 @@ void VNCSConnectionST::writeDataUpdate()
     ui.copied.clear();
   }
 
+  // While the pointer is being moved, the user is most likely looking
+  // at whatever is under it, so that area is encoded first and is what
+  // gets picked when the update has to be limited below. Otherwise the
+  // update is sent in normal order and with normal sized rects.
+  if (server->isCursorMoving())
+    encodeManager.setFocus(server->getCursorPos());
+  else
+    encodeManager.clearFocus();
+
+  // Changes that the user cannot see are held back as long as there
+  // is anything else to send, and are then sent a little at a time.
+  // Anything that changes again meanwhile only has to be sent once.
+  // To not starve them completely when the visible area never stops
+  // changing, a little is sent with every update once they have been
+  // waiting for too long.
+  if (hasViewport && !ui.changed.is_empty()) {
+    Region hidden;
+
+    hidden = ui.changed.subtract(getVisibleRegion());
+    if (!hidden.is_empty()) {
+      bool starved;
+
+      starved = !hiddenPending.is_empty() &&
+                (msSince(&hiddenPendingSince) >= hiddenMaxAge);
+
+      ui.changed.assign_subtract(hidden);
+      if ((ui.changed.is_empty() && ui.copied.is_empty()) || starved) {
+        ui.changed.assign_union(
+          encodeManager.getLimitedUpdate(hidden, getHiddenUpdateSize()));
+      }
+    }
+
+    if (hiddenPending.is_empty())
+      gettimeofday(&hiddenPendingSince, NULL);
+
+    hiddenPending = hidden.subtract(ui.changed);
+    withheld.assign_union(hiddenPending);
+  }
+
+  // Don't queue up more than the client can receive in a reasonable
+  // time. Whatever doesn't fit stays in the update tracker and will be
+  // sent with whatever the content is by then, rather than having the
+  // client catch up through stale frames.
+  maxUpdateSize = getMaxUpdateSize();
+  if ((maxUpdateSize != 0) && !ui.changed.is_empty()) {
+    Region limited;
+
+    limited = encodeManager.getLimitedUpdate(ui.changed, maxUpdateSize);
+    withheld.assign_union(ui.changed.subtract(limited));
+    ui.changed = limited;
+  }
+
+  // Likewise, don't let an expensive encoding hold up updates for the
+  // other clients for too long. The rest is sent on a following frame,
+  // by which time the others have had their turn.
+  maxEncodeTime = server->getEncodeBudget();
+  if ((maxEncodeTime != 0) && !ui.changed.is_empty()) {
+    Region limited;
+
+    limited = encodeManager.getTimeLimitedUpdate(ui.changed, maxEncodeTime);
+    withheld.assign_union(ui.changed.subtract(limited));
+    ui.changed = limited;
+  }
+
   // Does the client need a server-side rendered cursor?
 
   cursor = NULL;
@@ -999,8 +1749,18 @@ void VNCSConnectionST::writeDataUpdate()
     damagedCursorRegion.assign_union(ui.changed.intersect(renderedCursorRect));
   }
 
+  // Copies rarely line up with the pixels of a scaled framebuffer, so
+  // everything is sent as changed
+  if (scaledPb) {
+    ui.changed = scaledPb->toScaled(ui.changed.union_(ui.copied));
+    ui.copied.clear();
+    if (server->isCursorMoving())
+      encodeManager.setFocus(scaledPb->toScaled(server->getCursorPos()));
+  }
+
   // If we don't have a normal update, then try a lossless refresh
   if (ui.is_empty() && !writer()->needFakeUpdate()) {
+    encodeManager.clearFocus();
     writeLosslessRefresh();
     return;
   }
@@ -1009,15 +1769,40 @@ void VNCSConnectionST::writeDataUpdate()
 
   writeRTTPing();
 
-  encodeManager.writeUpdate(ui, server->getPixelBuffer(), cursor);
+  if (updatePending)
+    updateWait.add(msSince(&pendingSince));
+
+  if (recorder) {
+    if (pendingKeyframe && canWriteKeyframe())
+      writeRecordingKeyframe();
+    recorder->markUpdate(false);
+  }
+
+  encodeManager.writeUpdate(ui, getClientPixelBuffer(), cursor);
+
+  // The focus only applies to this update
+  encodeManager.clearFocus();
+
+  writeSharedMemoryFence();
+
+  writeLatencyProbes();
 
   writeRTTPing();
 
   // The request might be for just part of the screen, so we cannot
   // just clear the entire update tracker.
   updates.subtract(req);
+  updates.add_changed(withheld);
+
+  // Anything carried over has been waiting since the original change
+  if (updates.is_empty())
+    updatePending = false;
 
   requested.clear();
+
+  // Make sure we come back for the rest even if nothing else happens
+  if (!withheld.is_empty() && !congestionTimer.isStarted())
+    congestionTimer.start(1000 / rfb::Server::frameRate);
 }
 
 void VNCSConnectionST::writeLosslessRefresh()
@@ -1049,6 +1834,9 @@ void VNCSConnectionST::writeLosslessRefresh()
     req.assign_subtract(ui.copied);
   }
 
+  if (scaledPb)
+    req = scaledPb->toScaled(req);
+
   // Any lossy area we can refresh?
   if (!encodeManager.needsLosslessRefresh(req))
     return;
@@ -1076,7 +1864,7 @@ void VNCSConnectionST::writeLosslessRefresh()
     return;
 
   // FIXME: Bandwidth estimation without congestion control
-  bandwidth = congestion.getBandwidth();
+  bandwidth = congestion->getBandwidth();
 
   // FIXME: Hard coded value for maximum CPU throughput
   if (bandwidth > 5000000)
@@ -1086,9 +1874,14 @@ void VNCSConnectionST::writeLosslessRefresh()
 
   writeRTTPing();
 
-  encodeManager.writeLosslessRefresh(req, server->getPixelBuffer(),
+  if (recorder)
+    recorder->markUpdate(false);
+
+  encodeManager.writeLosslessRefresh(req, getClientPixelBuffer(),
                                      cursor, maxUpdateSize);
 
+  writeSharedMemoryFence();
+
   writeRTTPing();
 
   requested.clear();
@@ -1101,7 +1894,7 @@ void VNCSConnectionST::screenLayoutChange(rdr::U16 reason)
     return;
 
   client.setDimensions(client.width(), client.height(),
-                       server->getScreenLayout());
+                       getClientScreenLayout());
 
   if (state() != RFBSTATE_NORMAL)
     return;
@@ -1142,7 +1935,10 @@ void VNCSConnectionST::setCursorPos()
     return;
 
   if (client.supportsCursorPosition()) {
-    client.setCursorPos(server->getCursorPos());
+    if (scaledPb)
+      client.setCursorPos(scaledPb->toScaled(server->getCursorPos()));
+    else
+      client.setCursorPos(server->getCursorPos());
     writer()->writeCursorPos();
   }
 }
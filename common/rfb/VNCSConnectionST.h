@@ -27,12 +27,25 @@
 #ifndef __RFB_VNCSCONNECTIONST_H__
 #define __RFB_VNCSCONNECTIONST_H__
 
+#include <list>
 #include <map>
 
+#include <sys/time.h>
+
 #include <rfb/Congestion.h>
 #include <rfb/EncodeManager.h>
+#include <rfb/LatencyHistogram.h>
 #include <rfb/SConnection.h>
 #include <rfb/Timer.h>
+#include <rfb/fenceTypes.h>
+
+namespace rfb {
+  class RecordingConnection;
+  class SessionRecorder;
+  class ScaledPixelBuffer;
+  class SharedMemory;
+  class UDPChannel;
+}
 
 namespace rfb {
   class VNCServerST;
@@ -107,9 +120,16 @@ namespace rfb {
 
     // Change tracking
 
-    void add_changed(const Region& region) { updates.add_changed(region); }
+    void add_changed(const Region& region) {
+      countHiddenChanges(region);
+      updates.add_changed(region);
+      damageLatencyProbes(region);
+      markUpdatePending(region);
+    }
     void add_copied(const Region& dest, const Point& delta) {
       updates.add_copied(dest, delta);
+      damageLatencyProbes(dest);
+      markUpdatePending(dest);
     }
 
     const char* getPeerEndpoint() const {return peerEndpoint.buf;}
@@ -123,6 +143,7 @@ namespace rfb {
     virtual void queryConnection(const char* userName);
     virtual void clientInit(bool shared);
     virtual void setPixelFormat(const PixelFormat& pf);
+    virtual void setEncodings(int nEncodings, const rdr::S32* encodings);
     virtual void pointerEvent(const Point& pos, int buttonMask);
     virtual void keyEvent(rdr::U32 keysym, rdr::U32 keycode, bool down);
     virtual void framebufferUpdateRequest(const Rect& r, bool incremental);
@@ -131,6 +152,7 @@ namespace rfb {
     virtual void fence(rdr::U32 flags, unsigned len, const char data[]);
     virtual void enableContinuousUpdates(bool enable,
                                          int x, int y, int w, int h);
+    virtual void setViewport(const Region& visible);
     virtual void handleClipboardRequest();
     virtual void handleClipboardAnnounce(bool available);
     virtual void handleClipboardData(const char* data);
@@ -138,6 +160,7 @@ namespace rfb {
     virtual void supportsFence();
     virtual void supportsContinuousUpdates();
     virtual void supportsLEDState();
+    virtual void supportsViewport();
 
     // Timer callbacks
     virtual bool handleTimeout(Timer* t);
@@ -146,9 +169,43 @@ namespace rfb {
 
     bool isShiftPressed();
 
+    // Session recording
+    void startRecording();
+    bool canWriteKeyframe();
+    void writeRecordingKeyframe();
+
+    // Scaling of the framebuffer for the client
+    void updateScaling();
+    const PixelBuffer* getClientPixelBuffer();
+    ScreenSet getClientScreenLayout();
+
     // Congestion control
     void writeRTTPing();
     bool isCongested();
+    size_t getMaxUpdateSize();
+
+    // Viewport of the client
+    Region getVisibleRegion();
+    size_t getHiddenUpdateSize();
+    void countHiddenChanges(const Region& region);
+    void updateSendQueue();
+
+    // UDP side channel
+    void updateUDPTransport();
+    void acceptUDPTransport();
+    void closeUDPTransport();
+
+    // Framebuffer in shared memory
+    void updateSharedMemory();
+    void writeSharedMemoryFence();
+
+    // Input latency measurement
+    void addLatencyProbe(const char data[]);
+    void damageLatencyProbes(const Region& region);
+    void writeLatencyProbes();
+
+    // Update wait measurement
+    void markUpdatePending(const Region& region);
 
     // writeFramebufferUpdate() attempts to write a framebuffer update to the
     // client.
@@ -176,10 +233,46 @@ namespace rfb {
     unsigned fenceDataLen;
     char *fenceData;
 
-    Congestion congestion;
+    // Latency probes that are waiting for damage to be sent
+    struct LatencyProbe {
+      struct timeval received;
+      // Areas that were already changing when the probe arrived
+      Region background;
+      bool damaged;
+      char data[fenceLatencyProbeLen];
+    };
+    std::list<LatencyProbe> latencyProbes;
+    // Damage seen in the current and the previous second
+    Region recentDamage, olderDamage;
+    struct timeval recentDamageStart;
+    LatencyHistogram inputLatency;
+
+    // When the oldest change that hasn't been sent yet was made
+    bool updatePending;
+    struct timeval pendingSince;
+    LatencyHistogram updateWait;
+
+    Congestion* congestion;
     Timer congestionTimer;
+    size_t sendLowWater;
     Timer losslessTimer;
 
+    UDPChannel* udpChannel;
+    bool udpFailed;
+    unsigned long long udpChargedBytes;
+
+    SharedMemory* sharedMemory;
+    int sharedWidth;
+    PixelFormat sharedPF;
+    bool sharedMemoryFailed;
+    // Waiting for the client to finish with the last update
+    bool sharedMemoryBusy;
+
+    SessionRecorder* recorder;
+    RecordingConnection* keyframes;
+    Timer keyframeTimer;
+    bool pendingKeyframe;
+
     VNCServerST* server;
     SimpleUpdateTracker updates;
     Region requested;
@@ -187,8 +280,18 @@ namespace rfb {
     Region damagedCursorRegion;
     bool continuousUpdates;
     Region cuRegion;
+
+    // The part of the framebuffer the user can see (in the client's
+    // coordinates), and the changes outside of it that are held back
+    bool hasViewport;
+    Region viewport;
+    Region hiddenPending;
+    struct timeval hiddenPendingSince;
+    unsigned long long hiddenSkipped;
     EncodeManager encodeManager;
 
+    ScaledPixelBuffer* scaledPb;
+
     std::map<rdr::U32, rdr::U32> pressedKeys;
 
     Timer idleTimer;
@@ -54,6 +54,7 @@
 #include <rfb/ComparingUpdateTracker.h>
 #include <rfb/KeyRemapper.h>
 #include <rfb/LogWriter.h>
+#include <rfb/ScaledPixelBuffer.h>
 #include <rfb/Security.h>
 #include <rfb/ServerCore.h>
 #include <rfb/VNCServerST.h>
@@ -86,6 +87,9 @@ VNCServerST::VNCServerST(const char* name_, SDesktop* desktop_)
 {
   slog.debug("creating single-threaded server %s", name.buf);
 
+  cursorMoveTime.tv_sec = 0;
+  cursorMoveTime.tv_usec = 0;
+
   // FIXME: Do we really want to kick off these right away?
   if (rfb::Server::maxIdleTime)
     idleTimer.start(secsToMillis(rfb::Server::maxIdleTime));
@@ -280,6 +284,14 @@ void VNCServerST::setPixelBuffer(PixelBuffer* pb_, const ScreenSet& layout)
   renderedCursorInvalid = true;
   add_changed(pb->getRect());
 
+  // Any scaled copies need to follow, unless this is a framebuffer we
+  // cannot scale, in which case the clients will stop using them
+  std::list<ScaledBuffer>::iterator si;
+  for (si = scaledBuffers.begin(); si != scaledBuffers.end(); ++si) {
+    if (ScaledPixelBuffer::canScale(pb))
+      si->pb->setSource(pb);
+  }
+
   std::list<VNCSConnectionST*>::iterator ci, ci_next;
   for (ci=clients.begin();ci!=clients.end();ci=ci_next) {
     ci_next = ci; ci_next++;
@@ -433,6 +445,7 @@ void VNCServerST::setCursorPos(const Point& pos, bool warped)
 {
   if (!cursorPos.equals(pos)) {
     cursorPos = pos;
+    gettimeofday(&cursorMoveTime, NULL);
     renderedCursorInvalid = true;
     std::list<VNCSConnectionST*>::iterator ci;
     for (ci = clients.begin(); ci != clients.end(); ci++) {
@@ -763,6 +776,14 @@ void VNCServerST::stopFrameClock()
   frameTimer.stop();
 }
 
+bool VNCServerST::isCursorMoving() const
+{
+  if (cursorMoveTime.tv_sec == 0)
+    return false;
+
+  return msSince(&cursorMoveTime) < 1000;
+}
+
 int VNCServerST::msToNextUpdate()
 {
   // FIXME: If the application is updating slower than frameRate then
@@ -774,6 +795,25 @@ int VNCServerST::msToNextUpdate()
     return frameTimer.getRemainingMs();
 }
 
+unsigned VNCServerST::getEncodeBudget()
+{
+  int count;
+
+  if (rfb::Server::maxEncodeTime < 0)
+    return 0;
+
+  // Nobody else to wait for?
+  count = authClientCount();
+  if (count <= 1)
+    return 0;
+
+  if (rfb::Server::maxEncodeTime > 0)
+    return rfb::Server::maxEncodeTime;
+
+  // Never go so low that updates get split in to tiny pieces
+  return __rfbmax(1000 / rfb::Server::frameRate / count, 5);
+}
+
 // writeUpdate() is called on a regular interval in order to see what
 // updates are pending and propagates them to the update tracker for
 // each client. It uses the ComparingUpdateTracker's compare() method
@@ -786,6 +826,7 @@ void VNCServerST::writeUpdate()
   UpdateInfo ui;
   Region toCheck;
 
+  std::list<ScaledBuffer>::iterator si;
   std::list<VNCSConnectionST*>::iterator ci, ci_next;
 
   assert(blockCounter == 0);
@@ -815,6 +856,14 @@ void VNCServerST::writeUpdate()
 
   comparer->clear();
 
+  toCheck = ui.changed.union_(ui.copied);
+  for (si = scaledBuffers.begin(); si != scaledBuffers.end(); ++si)
+    si->pb->update(toCheck);
+
+  // Whoever goes first gets the freshest update, so take turns
+  if (clients.size() > 1)
+    clients.splice(clients.end(), clients, clients.begin());
+
   for (ci = clients.begin(); ci != clients.end(); ci = ci_next) {
     ci_next = ci; ci_next++;
     (*ci)->add_copied(ui.copied, ui.copy_delta);
@@ -853,6 +902,49 @@ const RenderedCursor* VNCServerST::getRenderedCursor()
   return &renderedCursor;
 }
 
+ScaledPixelBuffer* VNCServerST::getScaledPixelBuffer(int divisor)
+{
+  std::list<ScaledBuffer>::iterator iter;
+  ScaledBuffer sb;
+
+  if (!ScaledPixelBuffer::canScale(pb))
+    return NULL;
+
+  for (iter = scaledBuffers.begin(); iter != scaledBuffers.end(); ++iter) {
+    if (iter->pb->getDivisor() == divisor) {
+      iter->users++;
+      return iter->pb;
+    }
+  }
+
+  slog.debug("Creating framebuffer copy scaled down by %d", divisor);
+
+  sb.pb = new ScaledPixelBuffer(pb, divisor);
+  sb.users = 1;
+  scaledBuffers.push_back(sb);
+
+  return sb.pb;
+}
+
+void VNCServerST::releaseScaledPixelBuffer(ScaledPixelBuffer* spb)
+{
+  std::list<ScaledBuffer>::iterator iter;
+
+  for (iter = scaledBuffers.begin(); iter != scaledBuffers.end(); ++iter) {
+    if (iter->pb != spb)
+      continue;
+
+    if (--iter->users == 0) {
+      delete iter->pb;
+      scaledBuffers.erase(iter);
+    }
+
+    return;
+  }
+
+  assert(false);
+}
+
 bool VNCServerST::getComparerState()
 {
   if (rfb::Server::compareFB == 0)
@@ -39,6 +39,7 @@ namespace rfb {
   class ComparingUpdateTracker;
   class ListConnInfo;
   class PixelBuffer;
+  class ScaledPixelBuffer;
   class KeyRemapper;
 
   class VNCServerST : public VNCServer,
@@ -112,6 +113,8 @@ namespace rfb {
     const ScreenSet& getScreenLayout() const { return screenLayout; }
     const Cursor* getCursor() const { return cursor; }
     const Point& getCursorPos() const { return cursorPos; }
+    // isCursorMoving() is true if the cursor has moved in the last second
+    bool isCursorMoving() const;
     const char* getName() const { return name.buf; }
     unsigned getLEDState() const { return ledState; }
 
@@ -144,6 +147,10 @@ namespace rfb {
     // to clients
     int msToNextUpdate();
 
+    // Time (in ms) that a client may spend encoding a single update so
+    // that it doesn't hold up the others, or zero if there is no limit
+    unsigned getEncodeBudget();
+
     // Part of the framebuffer that has been modified but is not yet
     // ready to be sent to clients
     Region getPendingRegion();
@@ -152,6 +159,13 @@ namespace rfb {
     // side rendered cursor buffer
     const RenderedCursor* getRenderedCursor();
 
+    // getScaledPixelBuffer() returns a copy of the framebuffer scaled
+    // down by the given divisor, which is kept up to date along with
+    // the framebuffer. Clients using the same divisor share the copy.
+    // It returns NULL if the framebuffer cannot be scaled.
+    ScaledPixelBuffer* getScaledPixelBuffer(int divisor);
+    void releaseScaledPixelBuffer(ScaledPixelBuffer* spb);
+
   protected:
 
     // Timer callbacks
@@ -194,10 +208,17 @@ namespace rfb {
     ComparingUpdateTracker* comparer;
 
     Point cursorPos;
+    struct timeval cursorMoveTime;
     Cursor* cursor;
     RenderedCursor renderedCursor;
     bool renderedCursorInvalid;
 
+    struct ScaledBuffer {
+      ScaledPixelBuffer* pb;
+      int users;
+    };
+    std::list<ScaledBuffer> scaledBuffers;
+
     KeyRemapper* keyRemapper;
 
     Timer idleTimer;
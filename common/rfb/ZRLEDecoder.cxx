@@ -68,7 +68,8 @@ static inline void zlibHasData(rdr::ZlibInStream* zis, size_t length)
 #undef CPIXEL
 #undef BPP
 
-ZRLEDecoder::ZRLEDecoder() : Decoder(DecoderOrdered)
+ZRLEDecoder::ZRLEDecoder() :
+  Decoder((enum DecoderFlags)(DecoderOrdered | DecoderPassthrough))
 {
 }
 
@@ -78,6 +79,19 @@ ZRLEDecoder::~ZRLEDecoder()
 
 bool ZRLEDecoder::readRect(const Rect& r, rdr::InStream* is,
                            const ServerParams& server, rdr::OutStream* os)
+{
+  size_t len;
+
+  if (!getRectLength(r, is, server, &len))
+    return false;
+
+  os->copyBytes(is, len);
+
+  return true;
+}
+
+bool ZRLEDecoder::getRectLength(const Rect& r, rdr::InStream* is,
+                                const ServerParams& server, size_t* length)
 {
   rdr::U32 len;
 
@@ -85,16 +99,19 @@ bool ZRLEDecoder::readRect(const Rect& r, rdr::InStream* is,
     return false;
 
   is->setRestorePoint();
-
   len = is->readU32();
-  os->writeU32(len);
+  is->gotoRestorePoint();
 
-  if (!is->hasDataOrRestore(len))
-    return false;
+  // The length comes from the server, so make sure adding the header
+  // cannot wrap around
+  if ((size_t)len > (size_t)-1 - 4)
+    throw Exception("ZRLEDecoder: too large rectangle data (%u bytes)",
+                    (unsigned)len);
 
-  is->clearRestorePoint();
+  if (!is->hasData((size_t)4 + len))
+    return false;
 
-  os->copyBytes(is, len);
+  *length = (size_t)4 + len;
 
   return true;
 }
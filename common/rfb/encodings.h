@@ -67,6 +67,19 @@ namespace rfb {
   // UltraVNC-specific
   const int pseudoEncodingExtendedClipboard = 0xC0A1E5CE;
 
+  // Experimental TigerVNC extensions
+  //
+  // These are NOT registered and may change or be removed in any
+  // release, so they must not be used outside of TigerVNC's own server
+  // and viewer. To stay clear of registered values, they have the ASCII
+  // tag "TVX" in the upper three bytes, the same way the VMware
+  // extensions above are tagged.
+  const int pseudoEncodingScaleDivisor1 = 0x54565800;
+  const int pseudoEncodingScaleDivisor8 = 0x54565807;
+  const int pseudoEncodingUDPTransport = 0x54565810;
+  const int pseudoEncodingSharedMemory = 0x54565811;
+  const int pseudoEncodingViewport = 0x54565812;
+
   int encodingNum(const char* name);
   const char* encodingName(int num);
 }
@@ -31,6 +31,13 @@ namespace rfb {
                                          fenceFlagBlockAfter |
                                          fenceFlagSyncNext |
                                          fenceFlagRequest);
+
+  // TigerVNC-specific payload for measuring input latency: the
+  // (big-endian) marker followed by a sequence number. The server
+  // holds on to such a request until it has sent an update with
+  // damage that appeared after the request arrived.
+  const rdr::U32 fenceLatencyProbe    = 0x494c4154; // "ILAT"
+  const unsigned fenceLatencyProbeLen = 8;
 }
 
 #endif
@@ -47,5 +47,14 @@ namespace rfb {
   const int msgTypeSetDesktopSize = 251;
 
   const int msgTypeQEMUClientMessage = 255;
+
+  // Experimental TigerVNC extensions
+  //
+  // These are NOT registered and may change or be removed in any
+  // release. They are only sent once the other side has announced
+  // support through the matching experimental pseudo-encoding in
+  // encodings.h, so the numbers cannot reach anyone else.
+
+  const int msgTypeSetViewport = 240;
 }
 #endif
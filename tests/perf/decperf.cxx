@@ -26,9 +26,12 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <math.h>
 #include <sys/time.h>
 
+#include <os/Mutex.h>
+
 #include <rdr/Exception.h>
 #include <rdr/FileInStream.h>
 #include <rdr/OutStream.h>
@@ -36,14 +39,41 @@
 #include <rfb/CConnection.h>
 #include <rfb/CMsgReader.h>
 #include <rfb/CMsgWriter.h>
+#include <rfb/Configuration.h>
 #include <rfb/PixelBuffer.h>
 #include <rfb/PixelFormat.h>
+#include <rfb/Region.h>
+#include <rfb/TileDamage.h>
 
 #include "util.h"
 
 // FIXME: Files are always in this format
 static const rfb::PixelFormat filePF(32, 24, false, true, 255, 255, 255, 0, 8, 16);
 
+static rfb::StringParameter format("format",
+                                   "Pixel format of the frame buffer "
+                                   "(e.g. bgr888, default is the file's)", "");
+
+static rfb::StringParameter damage("damage",
+                                   "How to track changed areas (none, "
+                                   "region or tiles)", "tiles");
+
+// Mimics the damage tracking in the viewer, which is hit by all
+// decoder threads at the same time
+class DamagePixelBuffer : public rfb::ManagedPixelBuffer {
+public:
+  DamagePixelBuffer(const rfb::PixelFormat& pf, int width, int height);
+
+  virtual void commitBufferRW(const rfb::Rect& r);
+
+  void drain();
+
+protected:
+  os::Mutex mutex;
+  rfb::Region region;
+  rfb::TileDamage tiles;
+};
+
 class DummyOutStream : public rdr::OutStream {
 public:
   DummyOutStream();
@@ -73,6 +103,8 @@ public:
   virtual void bell();
   virtual void serverCutText(const char*);
 
+  void getStats(unsigned long long& copied, unsigned long long& direct);
+
 public:
   double cpuTime;
 
@@ -130,9 +162,54 @@ CConn::~CConn()
 
 void CConn::initDone()
 {
-  setFramebuffer(new rfb::ManagedPixelBuffer(filePF,
-                                             server.width(),
-                                             server.height()));
+  rfb::PixelFormat pf;
+
+  // Decoding to a different format shows the cost of conversion
+  pf = filePF;
+  if (strcmp(format, "") != 0) {
+    if (!pf.parse(format)) {
+      fprintf(stderr, "Invalid pixel format: %s\n", (const char*)format);
+      exit(1);
+    }
+  }
+
+  if ((strcmp(damage, "none") != 0) && (strcmp(damage, "region") != 0) &&
+      (strcmp(damage, "tiles") != 0)) {
+    fprintf(stderr, "Invalid damage tracking: %s\n", (const char*)damage);
+    exit(1);
+  }
+
+  setFramebuffer(new DamagePixelBuffer(pf, server.width(), server.height()));
+}
+
+DamagePixelBuffer::DamagePixelBuffer(const rfb::PixelFormat& pf,
+                                     int width, int height)
+  : rfb::ManagedPixelBuffer(pf, width, height), tiles(width, height)
+{
+}
+
+void DamagePixelBuffer::commitBufferRW(const rfb::Rect& r)
+{
+  rfb::ManagedPixelBuffer::commitBufferRW(r);
+
+  if (strcmp(damage, "region") == 0) {
+    mutex.lock();
+    region.assign_union(rfb::Region(r));
+    mutex.unlock();
+  } else if (strcmp(damage, "tiles") == 0) {
+    tiles.add(r);
+  }
+}
+
+void DamagePixelBuffer::drain()
+{
+  if (strcmp(damage, "region") == 0) {
+    mutex.lock();
+    region.clear();
+    mutex.unlock();
+  } else if (strcmp(damage, "tiles") == 0) {
+    tiles.drain(&region);
+  }
 }
 
 void CConn::setPixelFormat(const rfb::PixelFormat& pf)
@@ -160,6 +237,8 @@ void CConn::framebufferUpdateEnd()
 {
   CConnection::framebufferUpdateEnd();
 
+  ((DamagePixelBuffer*)getFramebuffer())->drain();
+
   endCpuCounter();
 
   cpuTime += getCpuCounter();
@@ -177,10 +256,18 @@ void CConn::serverCutText(const char*)
 {
 }
 
+void CConn::getStats(unsigned long long& copied, unsigned long long& direct)
+{
+  getDecodeManager()->getStats(copied, direct);
+}
+
 struct stats
 {
   double decodeTime;
   double realTime;
+
+  unsigned long long copied;
+  unsigned long long direct;
 };
 
 static struct stats runTest(const char *fn)
@@ -212,6 +299,7 @@ static struct stats runTest(const char *fn)
   s.decodeTime = cc->cpuTime;
   s.realTime = (double)stop.tv_sec - start.tv_sec;
   s.realTime += ((double)stop.tv_usec - start.tv_usec)/1000000.0;
+  cc->getStats(s.copied, s.direct);
 
   delete cc;
 
@@ -236,56 +324,129 @@ static void sort(double *array, int count)
   } while (!sorted);
 }
 
+static void calcMedian(const double *values, int count,
+                       double *median, double *meddev)
+{
+  double *sorted, *dev;
+  int i;
+
+  sorted = new double[count];
+  dev = new double[count];
+
+  for (i = 0;i < count;i++)
+    sorted[i] = values[i];
+
+  sort(sorted, count);
+  *median = sorted[count/2];
+
+  for (i = 0;i < count;i++)
+    dev[i] = fabs((sorted[i] - *median) / *median) * 100;
+
+  sort(dev, count);
+  *meddev = dev[count/2];
+
+  delete [] sorted;
+  delete [] dev;
+}
+
 static const int runCount = 9;
 
+// Thread counts to compare
+static const int threadCounts[] = { 1, 2, 4, 8, 12, 16 };
+
+static void usage(const char *argv0)
+{
+  fprintf(stderr, "Syntax: %s [options] <rfb file>\n", argv0);
+  fprintf(stderr, "Options:\n");
+  rfb::Configuration::listParams(79, 14);
+  exit(1);
+}
+
 int main(int argc, char **argv)
 {
-  int i;
+  int i, j;
+  const char *fn;
   struct stats runs[runCount];
-  double values[runCount], dev[runCount];
+  double values[runCount];
   double median, meddev;
 
-  if (argc != 2) {
-    printf("Syntax: %s <rfb file>\n", argv[0]);
-    return 1;
+  fn = NULL;
+  for (i = 1; i < argc; i++) {
+    if (rfb::Configuration::setParam(argv[i]))
+      continue;
+
+    if (argv[i][0] == '-') {
+      if (i + 1 < argc) {
+        if (rfb::Configuration::setParam(&argv[i][1], argv[i + 1])) {
+          i++;
+          continue;
+        }
+      }
+      usage(argv[0]);
+    }
+
+    if (fn != NULL)
+      usage(argv[0]);
+
+    fn = argv[i];
   }
 
-  // Warmup
-  runTest(argv[1]);
+  if (fn == NULL) {
+    fprintf(stderr, "No file specified!\n\n");
+    usage(argv[0]);
+  }
+
+  printf("%7s  %-20s  %-20s  %-20s  %-10s  %-10s\n",
+         "Threads", "CPU time (s)", "Wall time (s)", "Core usage",
+         "Copied", "Direct");
 
-  // Multiple runs to get a good average
-  for (i = 0;i < runCount;i++)
-    runs[i] = runTest(argv[1]);
+  for (j = 0;j < (int)(sizeof(threadCounts)/sizeof(threadCounts[0]));j++) {
+    char threads[16];
 
-  // Calculate median and median deviation for CPU usage
-  for (i = 0;i < runCount;i++)
-    values[i] = runs[i].decodeTime;
+    snprintf(threads, sizeof(threads), "%d", threadCounts[j]);
+    rfb::Configuration::setParam("DecoderThreads", threads);
 
-  sort(values, runCount);
-  median = values[runCount/2];
+    // Warmup
+    runTest(fn);
 
-  for (i = 0;i < runCount;i++)
-    dev[i] = fabs((values[i] - median) / median) * 100;
+    // Multiple runs to get a good average
+    for (i = 0;i < runCount;i++)
+      runs[i] = runTest(fn);
 
-  sort(dev, runCount);
-  meddev = dev[runCount/2];
+    printf("%7d", threadCounts[j]);
 
-  printf("CPU time: %g s (+/- %g %%)\n", median, meddev);
+    // Calculate median and median deviation for CPU usage
+    for (i = 0;i < runCount;i++)
+      values[i] = runs[i].decodeTime;
+    calcMedian(values, runCount, &median, &meddev);
+    printf("  %8.4g (+/- %4.2g %%)", median, meddev);
 
-  // And for CPU core usage
-  for (i = 0;i < runCount;i++)
-    values[i] = runs[i].decodeTime / runs[i].realTime;
+    // Then for the time it actually took
+    for (i = 0;i < runCount;i++)
+      values[i] = runs[i].realTime;
+    calcMedian(values, runCount, &median, &meddev);
+    printf("  %8.4g (+/- %4.2g %%)", median, meddev);
 
-  sort(values, runCount);
-  median = values[runCount/2];
+    // And for CPU core usage
+    for (i = 0;i < runCount;i++)
+      values[i] = runs[i].decodeTime / runs[i].realTime;
+    calcMedian(values, runCount, &median, &meddev);
+    printf("  %8.4g (+/- %4.2g %%)", median, meddev);
 
-  for (i = 0;i < runCount;i++)
-    dev[i] = fabs((values[i] - median) / median) * 100;
+    // How much data was moved around before decoding, as a rate so
+    // it can be compared to the memory bandwidth
+    for (i = 0;i < runCount;i++)
+      values[i] = runs[i].copied / runs[i].realTime;
+    calcMedian(values, runCount, &median, &meddev);
+    printf("  %6.4g MiB/s", median / 1048576);
 
-  sort(dev, runCount);
-  meddev = dev[runCount/2];
+    for (i = 0;i < runCount;i++)
+      values[i] = runs[i].direct / runs[i].realTime;
+    calcMedian(values, runCount, &median, &meddev);
+    printf("  %6.4g MiB/s", median / 1048576);
 
-  printf("Core usage: %g (+/- %g %%)\n", median, meddev);
+    printf("\n");
+  }
 
   return 0;
 }
@@ -54,6 +54,7 @@ public:
 
 protected:
   PlatformPixelBuffer* fb;
+  rfb::Region changed;
 };
 
 class PartialTestWindow: public TestWindow {
@@ -61,6 +62,11 @@ protected:
   virtual void changefb();
 };
 
+class ScatteredTestWindow: public TestWindow {
+protected:
+  virtual void changefb();
+};
+
 class OverlayTestWindow: public PartialTestWindow {
 public:
   OverlayTestWindow();
@@ -75,6 +81,26 @@ protected:
   Surface* offscreen;
 };
 
+class CompositeTestWindow: public ScatteredTestWindow {
+public:
+  CompositeTestWindow();
+
+  virtual void start(int width, int height);
+  virtual void stop();
+
+  virtual void draw();
+
+protected:
+  virtual void changefb();
+
+  rfb::Rect overlayRect();
+
+protected:
+  Surface* overlay;
+  int overlayAlpha;
+  Surface* offscreen;
+};
+
 TestWindow::TestWindow() :
   Fl_Window(0, 0, "Framebuffer Performance Test"),
   fb(NULL)
@@ -150,14 +176,21 @@ void TestWindow::flush()
 
 void TestWindow::update()
 {
-  rfb::Rect r;
+  rfb::Region region;
+  std::vector<rfb::Rect> rects;
+  std::vector<rfb::Rect>::const_iterator iter;
 
   startTimeCounter();
 
   changefb();
 
-  r = fb->getDamage();
-  damage(FL_DAMAGE_USER1, r.tl.x, r.tl.y, r.width(), r.height());
+  region = fb->getDamage();
+  changed.assign_union(region);
+  region.get_rects(&rects);
+  for (iter = rects.begin(); iter != rects.end(); ++iter) {
+    damage(FL_DAMAGE_USER1, iter->tl.x, iter->tl.y,
+           iter->width(), iter->height());
+  }
 
 #if !defined(WIN32) && !defined(__APPLE__)
   // Make sure we measure any work we queue up
@@ -202,6 +235,19 @@ void PartialTestWindow::changefb()
   fb->fillRect(r, &pixel);
 }
 
+void ScatteredTestWindow::changefb()
+{
+  rfb::Rect r;
+  rdr::U32 pixel;
+
+  // Small changes in opposite corners, e.g. a clock and a cursor
+  pixel = rand();
+  r.setXYWH(0, 0, 32, 32);
+  fb->fillRect(r, &pixel);
+  r.setXYWH(w() - 32, h() - 32, 32, 32);
+  fb->fillRect(r, &pixel);
+}
+
 OverlayTestWindow::OverlayTestWindow() :
   overlay(NULL), offscreen(NULL)
 {
@@ -285,6 +331,115 @@ void OverlayTestWindow::draw()
   }
 }
 
+CompositeTestWindow::CompositeTestWindow() :
+  overlay(NULL), overlayAlpha(0), offscreen(NULL)
+{
+}
+
+void CompositeTestWindow::start(int width, int height)
+{
+  ScatteredTestWindow::start(width, height);
+
+  overlay = new Surface(400, 200);
+  overlay->clear(0xff, 0x80, 0x00, 0xcc);
+  overlayAlpha = 0;
+
+#if !defined(__APPLE__)
+  offscreen = new Surface(w(), h());
+#else
+  offscreen = NULL;
+#endif
+}
+
+void CompositeTestWindow::stop()
+{
+  ScatteredTestWindow::stop();
+
+  delete offscreen;
+  offscreen = NULL;
+  delete overlay;
+  overlay = NULL;
+}
+
+rfb::Rect CompositeTestWindow::overlayRect()
+{
+  rfb::Rect r;
+
+  r.setXYWH((w() - overlay->width()) / 2, h() / 4 - overlay->height() / 2,
+            overlay->width(), overlay->height());
+
+  return r;
+}
+
+void CompositeTestWindow::changefb()
+{
+  rfb::Rect r;
+
+  ScatteredTestWindow::changefb();
+
+  // Constantly fading overlay, like the viewer's notifications
+  overlayAlpha = (overlayAlpha + 5) % 256;
+
+  r = overlayRect();
+  changed.assign_union(rfb::Region(r));
+  damage(FL_DAMAGE_USER1, r.tl.x, r.tl.y, r.width(), r.height());
+}
+
+void CompositeTestWindow::draw()
+{
+  std::vector<rfb::Rect> rects;
+  std::vector<rfb::Rect>::const_iterator iter;
+
+  // We cannot update the damage region from inside the draw function,
+  // so delegate this to an idle function
+  Fl::add_idle(timer, this);
+
+  // We might get a redraw before we are fully ready
+  if (!overlay)
+    return;
+
+  // Like DesktopWindow, only composite what the layers have changed,
+  // rather than the bounding box of it all
+  if (damage() & ~FL_DAMAGE_USER1)
+    changed.reset(fb->getRect());
+
+  changed.get_rects(&rects);
+  for (iter = rects.begin(); iter != rects.end(); ++iter) {
+    rfb::Rect r, lr;
+
+    r = *iter;
+
+    if (offscreen)
+      fb->draw(offscreen, r.tl.x, r.tl.y, r.tl.x, r.tl.y, r.width(), r.height());
+    else
+      fb->draw(r.tl.x, r.tl.y, r.tl.x, r.tl.y, r.width(), r.height());
+
+    lr = overlayRect();
+    r = r.intersect(lr);
+    if (!r.is_empty()) {
+      if (offscreen)
+        overlay->blend(offscreen, r.tl.x - lr.tl.x, r.tl.y - lr.tl.y,
+                       r.tl.x, r.tl.y, r.width(), r.height(), overlayAlpha);
+      else
+        overlay->blend(r.tl.x - lr.tl.x, r.tl.y - lr.tl.y,
+                       r.tl.x, r.tl.y, r.width(), r.height(), overlayAlpha);
+    }
+
+    pixels += iter->area();
+  }
+
+  if (offscreen) {
+    for (iter = rects.begin(); iter != rects.end(); ++iter) {
+      offscreen->draw(iter->tl.x, iter->tl.y, iter->tl.x, iter->tl.y,
+                      iter->width(), iter->height());
+    }
+  }
+
+  frames++;
+
+  changed.clear();
+}
+
 static void dosubtest(TestWindow* win, int width, int height,
                       unsigned long long* pixels,
 		      unsigned long long* frames,
@@ -389,11 +544,23 @@ int main(int argc, char** argv)
   delete win;
   fprintf(stderr, "\n");
 
+  fprintf(stderr, "Scattered small updates:\n\n");
+  win = new ScatteredTestWindow();
+  dotest(win);
+  delete win;
+  fprintf(stderr, "\n");
+
   fprintf(stderr, "Partial window update with overlay:\n\n");
   win = new OverlayTestWindow();
   dotest(win);
   delete win;
   fprintf(stderr, "\n");
 
+  fprintf(stderr, "Scattered updates with fading overlay:\n\n");
+  win = new CompositeTestWindow();
+  dotest(win);
+  delete win;
+  fprintf(stderr, "\n");
+
   return 0;
 }
@@ -0,0 +1,459 @@
+/* Copyright (C) 2026 TigerVNC Team
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ * USA.
+ */
+
+/*
+ * This program connects a server and a client, both running in this
+ * process, directly over a Unix socket. It measures how many full
+ * screen updates per second can be moved between them, either as Raw
+ * rects over the socket or through shared memory.
+ *
+ * The desktop only draws a new frame once the client has shown the
+ * previous one, so the result is the rate of the whole pipeline rather
+ * than of either side on its own.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include <rdr/Exception.h>
+
+#include <network/Socket.h>
+
+#include <rfb/CConnection.h>
+#include <rfb/CSecurity.h>
+#ifdef HAVE_GNUTLS
+#include <rfb/CSecurityTLS.h>
+#endif
+#include <rfb/LogWriter.h>
+#include <rfb/Logger_stdio.h>
+#include <rfb/PixelBuffer.h>
+#include <rfb/SDesktop.h>
+#include <rfb/SecurityClient.h>
+#include <rfb/SecurityServer.h>
+#include <rfb/ServerCore.h>
+#include <rfb/Timer.h>
+#include <rfb/VNCServerST.h>
+#include <rfb/encodings.h>
+#include <rfb/util.h>
+
+static rfb::IntParameter width("width", "Frame buffer width", 1920);
+static rfb::IntParameter height("height", "Frame buffer height", 1080);
+static rfb::IntParameter duration("duration", "Length of test in seconds",
+                                  10, 1);
+// Not just "SharedMemory", as that is the server's parameter
+static rfb::BoolParameter acceptSharedMemory("acceptsharedmemory",
+                                             "Let the client accept the "
+                                             "frame buffer as shared memory",
+                                             true);
+
+// The frame buffer (and output) is always this format
+static const rfb::PixelFormat fbPF(32, 24, false, true, 255, 255, 255, 0, 8, 16);
+
+// The sequence number marker in the corner of the screen
+static const rfb::Rect markerRect(0, 0, 64, 64);
+
+static unsigned long long getTime()
+{
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec * 1000000ULL + tv.tv_usec;
+}
+
+class LocalSocket : public network::Socket {
+public:
+  LocalSocket(int fd) : Socket(fd) {}
+
+  virtual char* getPeerAddress() { return rfb::strDup("local"); }
+  virtual char* getPeerEndpoint() { return rfb::strDup("local::0"); }
+};
+
+class Desktop : public rfb::SDesktop {
+public:
+  Desktop();
+  ~Desktop();
+
+  virtual void start(rfb::VNCServer* vs);
+  virtual void stop();
+  virtual void queryConnection(network::Socket* sock,
+                               const char* userName);
+  virtual void terminate();
+
+  // draw() changes the entire screen and returns the sequence number
+  // stamped in the corner
+  unsigned draw();
+
+  bool isStarted() { return server != NULL; }
+
+private:
+  rfb::VNCServer* server;
+  rfb::ManagedPixelBuffer* pb;
+  unsigned seq;
+};
+
+class Client : public rfb::CConnection {
+public:
+  Client(network::Socket* sock);
+  ~Client();
+
+  // processMsgs() handles everything that has arrived
+  void processMsgs();
+
+  virtual void initDone();
+  virtual void resizeFramebuffer();
+  virtual void setCursor(int, int, const rfb::Point&, const rdr::U8*);
+  virtual void setCursorPos(const rfb::Point&);
+  virtual void framebufferUpdateEnd();
+  virtual void setColourMapEntries(int, int, rdr::U16*);
+  virtual void bell();
+
+protected:
+  virtual int receiveFd();
+
+public:
+  unsigned lastSeq;
+  unsigned updates;
+
+protected:
+  network::Socket* sock;
+};
+
+class DummyPasswdGetter : public rfb::UserPasswdGetter {
+public:
+  virtual void getUserPasswd(bool, char**, char**) {}
+};
+
+#ifdef HAVE_GNUTLS
+class DummyMsgBox : public rfb::UserMsgBox {
+public:
+  virtual bool showMsgBox(int, const char*, const char*) { return false; }
+};
+#endif
+
+Desktop::Desktop()
+  : server(NULL), pb(NULL), seq(0)
+{
+  pb = new rfb::ManagedPixelBuffer(fbPF, width, height);
+}
+
+Desktop::~Desktop()
+{
+  delete pb;
+}
+
+void Desktop::start(rfb::VNCServer* vs)
+{
+  server = vs;
+  server->setPixelBuffer(pb);
+}
+
+void Desktop::stop()
+{
+  server->setPixelBuffer(NULL);
+  server = NULL;
+}
+
+void Desktop::queryConnection(network::Socket* sock, const char*)
+{
+  server->approveConnection(sock, true, NULL);
+}
+
+void Desktop::terminate()
+{
+}
+
+unsigned Desktop::draw()
+{
+  rdr::U32* buffer;
+  int stride;
+  rdr::U8 pixel[4];
+
+  seq++;
+
+  // A pattern that moves every frame, so no part of the screen is
+  // left unchanged or is a solid colour
+  buffer = (rdr::U32*)pb->getBufferRW(pb->getRect(), &stride);
+  for (int y = 0; y < pb->height(); y++) {
+    for (int x = 0; x < pb->width(); x++)
+      buffer[y * stride + x] = (x ^ y) * 0x010203 + seq * 0x030201;
+  }
+  pb->commitBufferRW(pb->getRect());
+
+  fbPF.bufferFromPixel(pixel, fbPF.pixelFromRGB((rdr::U8)(seq & 0xff),
+                                                (rdr::U8)((seq >> 8) & 0xff),
+                                                (rdr::U8)((seq >> 16) & 0xff)));
+  pb->fillRect(markerRect, pixel);
+
+  server->add_changed(pb->getRect());
+
+  return seq;
+}
+
+Client::Client(network::Socket* sock_)
+  : lastSeq(0), updates(0), sock(sock_)
+{
+  setServerName("localperf");
+  setStreams(&sock->inStream(), &sock->outStream());
+
+  setPreferredEncoding(rfb::encodingRaw);
+
+  if (acceptSharedMemory) {
+    sock->inStream().setAcceptFds(true);
+    supportsSharedMemory = true;
+  }
+
+  initialiseProtocol();
+}
+
+Client::~Client()
+{
+}
+
+void Client::processMsgs()
+{
+  sock->outStream().cork(true);
+  while (processMsg())
+    ;
+  sock->outStream().cork(false);
+  sock->outStream().flush();
+}
+
+void Client::initDone()
+{
+  resizeFramebuffer();
+}
+
+void Client::resizeFramebuffer()
+{
+  rfb::ModifiablePixelBuffer *pb;
+
+  pb = new rfb::ManagedPixelBuffer(server.pf(),
+                                   server.width(), server.height());
+  setFramebuffer(pb);
+}
+
+void Client::setCursor(int, int, const rfb::Point&, const rdr::U8*)
+{
+}
+
+void Client::setCursorPos(const rfb::Point&)
+{
+}
+
+void Client::framebufferUpdateEnd()
+{
+  const rdr::U8* buffer;
+  int stride;
+  rdr::U8 rgb[3];
+
+  CConnection::framebufferUpdateEnd();
+
+  updates++;
+
+  buffer = getFramebuffer()->getBuffer(markerRect, &stride);
+  server.pf().rgbFromBuffer(rgb, buffer, 1);
+
+  lastSeq = rgb[0] | rgb[1] << 8 | rgb[2] << 16;
+}
+
+void Client::setColourMapEntries(int, int, rdr::U16*)
+{
+}
+
+void Client::bell()
+{
+}
+
+int Client::receiveFd()
+{
+  return sock->inStream().takeFd();
+}
+
+static void usage(const char *argv0)
+{
+  fprintf(stderr, "Syntax: %s [options]\n", argv0);
+  fprintf(stderr, "Options:\n");
+  rfb::Configuration::listParams(79, 14);
+  exit(1);
+}
+
+int main(int argc, char **argv)
+{
+  int i;
+
+  int fds[2];
+
+  rfb::initStdIOLoggers();
+  rfb::LogWriter::setLogParams("*:stderr:30");
+
+  // No point in authenticating against ourselves
+  rfb::SecurityServer::secTypes.setParam("None");
+  rfb::SecurityClient::secTypes.setParam("None");
+  rfb::CSecurity::upg = new DummyPasswdGetter();
+#ifdef HAVE_GNUTLS
+  rfb::CSecurityTLS::msg = new DummyMsgBox();
+#endif
+
+  // Every frame is new, and we want to see how fast we can go
+  rfb::Server::compareFB.setParam(0);
+  rfb::Server::frameRate.setParam(1000);
+
+  for (i = 1; i < argc; i++) {
+    if (rfb::Configuration::setParam(argv[i]))
+      continue;
+
+    if (argv[i][0] == '-') {
+      if (i + 1 < argc) {
+        if (rfb::Configuration::setParam(&argv[i][1], argv[i + 1])) {
+          i++;
+          continue;
+        }
+      }
+    }
+
+    usage(argv[0]);
+  }
+
+  if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0) {
+    perror("socketpair");
+    return 1;
+  }
+
+  Desktop* desktop;
+  rfb::VNCServerST* server;
+  LocalSocket* serverSock;
+  LocalSocket* clientSock;
+  Client* client;
+
+  unsigned long long start, end;
+  unsigned seq, frames;
+
+  try {
+    desktop = new Desktop();
+    server = new rfb::VNCServerST("localperf", desktop);
+
+    serverSock = new LocalSocket(fds[0]);
+    server->addSocket(serverSock);
+
+    clientSock = new LocalSocket(fds[1]);
+    client = new Client(clientSock);
+  } catch (rdr::Exception& e) {
+    fprintf(stderr, "Failed to set up test: %s\n", e.str());
+    return 1;
+  }
+
+  start = 0;
+  end = 0;
+  seq = 0;
+  frames = 0;
+
+  try {
+    while (true) {
+      unsigned long long now;
+      fd_set rfds, wfds;
+      struct timeval tv;
+      int timeout, maxFd;
+
+      now = getTime();
+
+      // The clock doesn't start until a client is looking
+      if (desktop->isStarted()) {
+        if (start == 0) {
+          start = now;
+          end = start + (unsigned)duration * 1000000ULL;
+        }
+
+        if (now >= end)
+          break;
+
+        if (client->lastSeq == seq) {
+          if (seq != 0)
+            frames++;
+          seq = desktop->draw();
+        }
+      }
+
+      timeout = rfb::Timer::checkTimeouts();
+      if ((timeout == 0) || (timeout > 1000))
+        timeout = 1000;
+
+      FD_ZERO(&rfds);
+      FD_ZERO(&wfds);
+
+      FD_SET(fds[0], &rfds);
+      FD_SET(fds[1], &rfds);
+      if (serverSock->outStream().hasBufferedData())
+        FD_SET(fds[0], &wfds);
+      if (clientSock->outStream().hasBufferedData())
+        FD_SET(fds[1], &wfds);
+
+      maxFd = __rfbmax(fds[0], fds[1]);
+
+      tv.tv_sec = timeout / 1000;
+      tv.tv_usec = (timeout % 1000) * 1000;
+
+      if (select(maxFd + 1, &rfds, &wfds, NULL, &tv) < 0) {
+        if (errno == EINTR)
+          continue;
+        throw rdr::SystemException("select", errno);
+      }
+
+      if (FD_ISSET(fds[0], &rfds))
+        server->processSocketReadEvent(serverSock);
+      if (FD_ISSET(fds[0], &wfds))
+        server->processSocketWriteEvent(serverSock);
+
+      if (FD_ISSET(fds[1], &rfds))
+        client->processMsgs();
+      if (FD_ISSET(fds[1], &wfds))
+        clientSock->outStream().flush();
+
+      // The server shuts down the socket on errors
+      if (serverSock->isShutdown())
+        throw rdr::Exception("Server closed the connection");
+    }
+  } catch (rdr::Exception& e) {
+    fprintf(stderr, "Failed to run test: %s\n", e.str());
+    return 1;
+  }
+
+  // Gets the server to log its view of the connection
+  server->removeSocket(serverSock);
+
+  double seconds = (end - start) / 1000000.0;
+  double pixels = (double)frames * (int)width * (int)height;
+
+  printf("Transport: %s\n", (bool)acceptSharedMemory ? "shared memory" : "Raw");
+  printf("Duration: %g s\n", seconds);
+  printf("Frames: %u (%u updates)\n", frames, client->updates);
+  printf("Frame rate: %g fps\n", frames / seconds);
+  printf("Pixel rate: %g Mpixels/s\n", pixels / seconds / 1000000.0);
+
+  delete client;
+  delete clientSock;
+  delete server;
+  delete serverSock;
+  delete desktop;
+
+  return 0;
+}
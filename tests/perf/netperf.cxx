@@ -0,0 +1,932 @@
+/* Copyright (C) 2026 TigerVNC Team
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ * USA.
+ */
+
+/*
+ * This program connects a server and a client, both running in this
+ * process, through an emulated network link. This makes it possible to
+ * see how the congestion control and encoders behave on slow, distant
+ * or lossy networks without access to such a network.
+ *
+ * The link has a fixed bandwidth and a bottleneck buffer of a fixed
+ * size, much like a typical home router. On top of that it adds the
+ * round trip time, optional jitter, and can simulate packet loss by
+ * stalling the link for as long as TCP would need to retransmit.
+ *
+ * The desktop follows a scripted sequence of activities. Every change
+ * stamps a sequence number in the top left corner of the screen, which
+ * lets the client see how old the image it is showing is.
+ *
+ * All randomness comes from a fixed seed, so two runs with the same
+ * settings see the same link and the same desktop. Only the scheduling
+ * of this process itself varies.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include <deque>
+#include <vector>
+
+#include <rdr/Exception.h>
+
+#include <network/Socket.h>
+
+#include <rfb/CConnection.h>
+#include <rfb/CSecurity.h>
+#ifdef HAVE_GNUTLS
+#include <rfb/CSecurityTLS.h>
+#endif
+#include <rfb/LatencyHistogram.h>
+#include <rfb/LogWriter.h>
+#include <rfb/Logger_stdio.h>
+#include <rfb/PixelBuffer.h>
+#include <rfb/SDesktop.h>
+#include <rfb/SecurityClient.h>
+#include <rfb/SecurityServer.h>
+#include <rfb/Timer.h>
+#include <rfb/VNCServerST.h>
+#include <rfb/util.h>
+
+static rfb::IntParameter width("width", "Frame buffer width", 1280);
+static rfb::IntParameter height("height", "Frame buffer height", 720);
+
+static rfb::StringParameter activity("activity",
+                                     "Comma separated list of desktop "
+                                     "activities and their length in "
+                                     "seconds (idle, video, typing or "
+                                     "scroll)", "video:10");
+
+static rfb::IntParameter bandwidth("bandwidth",
+                                   "Link bandwidth in kbit/s", 10000, 1);
+static rfb::IntParameter rtt("rtt", "Link round trip time in ms", 50, 0);
+static rfb::IntParameter jitter("jitter",
+                                "Maximum extra delay per packet in ms",
+                                0, 0);
+static rfb::IntParameter loss("loss",
+                              "Packets per 10000 that are lost and stall "
+                              "the link until retransmitted", 0, 0, 10000);
+static rfb::IntParameter bufferSize("buffer",
+                                    "Size of the link buffer in KiB",
+                                    256, 1);
+static rfb::IntParameter seed("seed", "Seed for all random decisions", 1);
+
+static rfb::StringParameter viewportGeometry("viewport",
+                                             "Part of the screen that the "
+                                             "client shows, as WxH+X+Y (empty "
+                                             "for all of it)", "");
+
+static rfb::IntParameter quality("quality",
+                                 "JPEG quality level (-1 for lossless)",
+                                 8, -1, 9);
+static rfb::IntParameter compressLevel("compresslevel",
+                                       "Compression level", 2, 0, 9);
+
+// The frame buffer (and output) is always this format
+static const rfb::PixelFormat fbPF(32, 24, false, true, 255, 255, 255, 0, 8, 16);
+
+// Largest chunk of data the link handles at once, like a TCP segment
+static const size_t MSS = 1448;
+
+// The sequence number marker in the corner of the screen
+static const rfb::Rect markerRect(0, 0, 64, 64);
+
+#ifdef HAVE_GNUTLS
+class DummyMsgBox : public rfb::UserMsgBox {
+public:
+  virtual bool showMsgBox(int, const char*, const char*) { return false; }
+};
+#endif
+
+static unsigned long long getTime()
+{
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec * 1000000ULL + tv.tv_usec;
+}
+
+// Small deterministic random number generator (xorshift)
+class Random {
+public:
+  Random(unsigned seed) : state(seed ? seed : 1) {}
+
+  // next() returns a value in the range [0, limit)
+  unsigned next(unsigned limit) {
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    return state % limit;
+  }
+
+private:
+  rdr::U32 state;
+};
+
+class LinkSocket : public network::Socket {
+public:
+  LinkSocket(int fd) : Socket(fd) {}
+
+  virtual char* getPeerAddress() { return rfb::strDup("emulated"); }
+  virtual char* getPeerEndpoint() { return rfb::strDup("emulated::0"); }
+};
+
+// Link moves data in one direction between two sockets, delaying it
+// the way a real network would
+class Link {
+public:
+  Link(int inFd, int outFd, unsigned seed);
+
+  // transfer() pulls in as much data as the link buffer can hold, and
+  // delivers all data that has reached the other side
+  void transfer(unsigned long long now);
+
+  bool wantRead(unsigned long long now);
+  bool wantWrite(unsigned long long now);
+
+  // nextEvent() returns when transfer() next has anything to do, or
+  // zero if it is waiting for data
+  unsigned long long nextEvent(unsigned long long now);
+
+  unsigned long long getDelivered() { return delivered; }
+  unsigned getStalls() { return stalls; }
+  const rfb::LatencyHistogram& getQueueDelay() { return queueDelay; }
+  size_t getMaxQueued() { return maxQueued; }
+
+private:
+  size_t getQueued(unsigned long long now);
+
+  void receive(unsigned long long now);
+  void deliver(unsigned long long now);
+
+  struct Packet {
+    unsigned long long departure;
+    unsigned long long arrival;
+    size_t len, offset;
+    rdr::U8 data[MSS];
+  };
+
+  int inFd, outFd;
+  Random random;
+
+  std::deque<Packet> packets;
+  unsigned long long lastDeparture, lastArrival;
+
+  unsigned long long delivered;
+  unsigned stalls;
+  rfb::LatencyHistogram queueDelay;
+  size_t maxQueued;
+};
+
+enum ActivityType { Idle, Video, Typing, Scroll };
+
+struct Activity {
+  ActivityType type;
+  unsigned duration;
+};
+
+class Desktop : public rfb::SDesktop {
+public:
+  Desktop();
+  ~Desktop();
+
+  virtual void start(rfb::VNCServer* vs);
+  virtual void stop();
+  virtual void queryConnection(network::Socket* sock,
+                               const char* userName);
+  virtual void terminate();
+
+  // step() makes any changes that are due and returns when the next
+  // change should happen
+  unsigned long long step(unsigned long long now);
+
+  bool isFinished() { return current >= script.size(); }
+
+  unsigned getFrameCount() { return frameTimes.size(); }
+  unsigned long long getFrameTime(unsigned seq) { return frameTimes[seq]; }
+
+private:
+  void drawVideo(rfb::Region* changed);
+  void drawTyping(rfb::Region* changed);
+  void drawScroll(rfb::Region* changed);
+  void drawGlyph(const rfb::Rect& r);
+
+  void fill(const rfb::Rect& r, rdr::U8 red, rdr::U8 green, rdr::U8 blue);
+
+  rfb::VNCServer* server;
+  rfb::ManagedPixelBuffer* pb;
+  Random random;
+
+  std::vector<Activity> script;
+  size_t current;
+  unsigned long long activityEnd, nextChange;
+
+  rfb::Point cursor;
+
+  std::vector<unsigned long long> frameTimes;
+};
+
+class Client : public rfb::CConnection {
+public:
+  Client(network::Socket* sock, Desktop* desktop);
+  ~Client();
+
+  // processMsgs() handles everything that has arrived
+  void processMsgs();
+
+  virtual void initDone();
+  virtual void resizeFramebuffer();
+  virtual void setCursor(int, int, const rfb::Point&, const rdr::U8*);
+  virtual void setCursorPos(const rfb::Point&);
+  virtual void framebufferUpdateEnd();
+  virtual void setColourMapEntries(int, int, rdr::U16*);
+  virtual void bell();
+
+public:
+  unsigned framesShown;
+  rfb::LatencyHistogram frameLatency;
+
+protected:
+  network::Socket* sock;
+  Desktop* desktop;
+  // Never a valid sequence number, so that frame 0 is also counted
+  unsigned lastSeq;
+};
+
+class DummyPasswdGetter : public rfb::UserPasswdGetter {
+public:
+  virtual void getUserPasswd(bool, char**, char**) {}
+};
+
+Link::Link(int inFd_, int outFd_, unsigned seed)
+  : inFd(inFd_), outFd(outFd_), random(seed),
+    lastDeparture(0), lastArrival(0), delivered(0), stalls(0),
+    maxQueued(0)
+{
+}
+
+void Link::transfer(unsigned long long now)
+{
+  receive(now);
+  deliver(now);
+}
+
+bool Link::wantRead(unsigned long long now)
+{
+  return getQueued(now) < (size_t)bufferSize * 1024;
+}
+
+bool Link::wantWrite(unsigned long long now)
+{
+  return !packets.empty() && (packets.front().arrival <= now);
+}
+
+unsigned long long Link::nextEvent(unsigned long long now)
+{
+  std::deque<Packet>::const_iterator iter;
+
+  if (packets.empty())
+    return 0;
+
+  // Waiting for room in the buffer?
+  if (!wantRead(now)) {
+    for (iter = packets.begin(); iter != packets.end(); ++iter) {
+      if (iter->departure > now)
+        return __rfbmin(iter->departure, packets.front().arrival);
+    }
+  }
+
+  return packets.front().arrival;
+}
+
+size_t Link::getQueued(unsigned long long now)
+{
+  std::deque<Packet>::const_reverse_iterator iter;
+  size_t queued;
+
+  // Only data that hasn't left the bottleneck takes up buffer space
+  queued = 0;
+  for (iter = packets.rbegin(); iter != packets.rend(); ++iter) {
+    if (iter->departure <= now)
+      break;
+    queued += iter->len;
+  }
+
+  return queued;
+}
+
+void Link::receive(unsigned long long now)
+{
+  size_t queued, limit;
+
+  limit = (size_t)bufferSize * 1024;
+  queued = getQueued(now);
+
+  while (queued < limit) {
+    Packet packet;
+    unsigned long long start;
+    ssize_t len;
+
+    len = recv(inFd, packet.data, __rfbmin(MSS, limit - queued),
+               MSG_DONTWAIT);
+    if (len < 0) {
+      if ((errno == EAGAIN) || (errno == EWOULDBLOCK) || (errno == EINTR))
+        break;
+      throw rdr::SystemException("recv", errno);
+    }
+    if (len == 0)
+      break;
+
+    packet.len = len;
+    packet.offset = 0;
+
+    // Data is sent one packet at a time at the link bandwidth
+    start = __rfbmax(now, lastDeparture);
+    packet.departure = start + len * 8000ULL / (unsigned)bandwidth;
+    lastDeparture = packet.departure;
+
+    queueDelay.add((start - now) / 1000);
+
+    packet.arrival = packet.departure + (unsigned)rtt * 1000 / 2;
+    if (jitter > 0)
+      packet.arrival += random.next((unsigned)jitter * 1000);
+
+    // A lost packet needs a retransmission timeout before it gets
+    // through, and TCP holds back everything after it meanwhile
+    if ((loss > 0) && (random.next(10000) < (unsigned)loss)) {
+      packet.arrival += __rfbmax(200, 2 * (unsigned)rtt) * 1000;
+      stalls++;
+    }
+
+    if (packet.arrival < lastArrival)
+      packet.arrival = lastArrival;
+    lastArrival = packet.arrival;
+
+    packets.push_back(packet);
+
+    queued += len;
+    if (queued > maxQueued)
+      maxQueued = queued;
+  }
+}
+
+void Link::deliver(unsigned long long now)
+{
+  while (!packets.empty() && (packets.front().arrival <= now)) {
+    Packet& packet = packets.front();
+    ssize_t len;
+
+    len = send(outFd, packet.data + packet.offset,
+               packet.len - packet.offset, MSG_DONTWAIT | MSG_NOSIGNAL);
+    if (len < 0) {
+      if ((errno == EAGAIN) || (errno == EWOULDBLOCK) || (errno == EINTR))
+        break;
+      throw rdr::SystemException("send", errno);
+    }
+
+    packet.offset += len;
+    delivered += len;
+
+    if (packet.offset < packet.len)
+      break;
+
+    packets.pop_front();
+  }
+}
+
+Desktop::Desktop()
+  : server(NULL), pb(NULL), random(seed), current(0),
+    activityEnd(0), nextChange(0)
+{
+  char* list;
+  char* item;
+
+  list = activity.getData();
+  for (item = strtok(list, ","); item != NULL; item = strtok(NULL, ",")) {
+    Activity entry;
+    char* colon;
+
+    colon = strchr(item, ':');
+    if (colon == NULL)
+      throw rdr::Exception("Missing length for activity \"%s\"", item);
+    *colon = '\0';
+
+    if (strcasecmp(item, "idle") == 0)
+      entry.type = Idle;
+    else if (strcasecmp(item, "video") == 0)
+      entry.type = Video;
+    else if (strcasecmp(item, "typing") == 0)
+      entry.type = Typing;
+    else if (strcasecmp(item, "scroll") == 0)
+      entry.type = Scroll;
+    else
+      throw rdr::Exception("Unknown activity \"%s\"", item);
+
+    entry.duration = atoi(colon + 1);
+
+    script.push_back(entry);
+  }
+  delete [] list;
+
+  pb = new rfb::ManagedPixelBuffer(fbPF, width, height);
+
+  // Something that isn't trivial to compress as a background
+  for (int y = 0; y < pb->height(); y += 16) {
+    for (int x = 0; x < pb->width(); x += 16) {
+      fill(rfb::Rect(x, y, x + 16, y + 16),
+           x * 255 / pb->width(), y * 255 / pb->height(), 128);
+    }
+  }
+
+  cursor = rfb::Point(64, pb->height() / 2);
+}
+
+Desktop::~Desktop()
+{
+  delete pb;
+}
+
+void Desktop::start(rfb::VNCServer* vs)
+{
+  server = vs;
+  server->setPixelBuffer(pb);
+}
+
+void Desktop::stop()
+{
+  server->setPixelBuffer(NULL);
+  server = NULL;
+}
+
+void Desktop::queryConnection(network::Socket* sock, const char*)
+{
+  server->approveConnection(sock, true, NULL);
+}
+
+void Desktop::terminate()
+{
+}
+
+unsigned long long Desktop::step(unsigned long long now)
+{
+  rfb::Region changed;
+  unsigned seq;
+  unsigned interval;
+
+  if (isFinished())
+    return 0;
+
+  // The clock doesn't start until a client is looking
+  if (server == NULL)
+    return 0;
+
+  if (activityEnd == 0) {
+    activityEnd = now + script[current].duration * 1000000ULL;
+    nextChange = now;
+  }
+
+  while (now >= activityEnd) {
+    current++;
+    if (isFinished())
+      return 0;
+    activityEnd += script[current].duration * 1000000ULL;
+  }
+
+  if (now < nextChange)
+    return nextChange;
+
+  switch (script[current].type) {
+  case Video:
+    drawVideo(&changed);
+    interval = 33333;
+    break;
+  case Typing:
+    drawTyping(&changed);
+    interval = 100000;
+    break;
+  case Scroll:
+    drawScroll(&changed);
+    interval = 33333;
+    break;
+  default:
+    interval = activityEnd - now;
+    break;
+  }
+
+  if (!changed.is_empty()) {
+    seq = frameTimes.size();
+    frameTimes.push_back(now);
+
+    fill(markerRect, seq & 0xff, (seq >> 8) & 0xff, (seq >> 16) & 0xff);
+    changed.assign_union(markerRect);
+
+    server->add_changed(changed);
+  }
+
+  nextChange = __rfbmin(nextChange + interval, activityEnd);
+  if (nextChange < now)
+    nextChange = now;
+
+  return nextChange;
+}
+
+void Desktop::drawVideo(rfb::Region* changed)
+{
+  rfb::Rect area;
+
+  area.setXYWH((pb->width() - 640) / 2, (pb->height() - 360) / 2, 640, 360);
+  area = area.intersect(pb->getRect());
+
+  for (int y = area.tl.y; y < area.br.y; y += 16) {
+    for (int x = area.tl.x; x < area.br.x; x += 16) {
+      rfb::Rect block(x, y, x + 16, y + 16);
+      fill(block.intersect(area),
+           random.next(256), random.next(256), random.next(256));
+    }
+  }
+
+  changed->assign_union(area);
+}
+
+void Desktop::drawTyping(rfb::Region* changed)
+{
+  rfb::Rect glyph;
+
+  glyph.setXYWH(cursor.x, cursor.y, 8, 16);
+  glyph = glyph.intersect(pb->getRect());
+
+  drawGlyph(glyph);
+  changed->assign_union(glyph);
+
+  cursor.x += 8;
+  if (cursor.x + 8 > __rfbmin(pb->width(), 64 + 80 * 8)) {
+    cursor.x = 64;
+    cursor.y += 16;
+    if (cursor.y + 16 > pb->height())
+      cursor.y = pb->height() / 2;
+  }
+}
+
+void Desktop::drawScroll(rfb::Region* changed)
+{
+  rfb::Rect area, dest, line;
+
+  area = rfb::Rect(64, 64, 64 + 800, 64 + 600).intersect(pb->getRect());
+  if (area.height() <= 16)
+    return;
+
+  dest = rfb::Rect(area.tl.x, area.tl.y, area.br.x, area.br.y - 16);
+  pb->copyRect(dest, rfb::Point(0, -16));
+  server->add_copied(dest, rfb::Point(0, -16));
+
+  line = rfb::Rect(area.tl.x, area.br.y - 16, area.br.x, area.br.y);
+  fill(line, 255, 255, 255);
+  for (int x = line.tl.x; x + 8 <= line.br.x; x += 8) {
+    if (random.next(8) == 0)
+      continue;
+    drawGlyph(rfb::Rect(x, line.tl.y, x + 8, line.br.y));
+  }
+
+  changed->assign_union(line);
+}
+
+void Desktop::drawGlyph(const rfb::Rect& r)
+{
+  fill(r, 255, 255, 255);
+
+  // A few random strokes is close enough to text for the encoders
+  for (int i = 0; i < 3; i++) {
+    rfb::Rect stroke;
+    stroke.setXYWH(r.tl.x + 1 + random.next(5), r.tl.y + 2 + random.next(11),
+                   1 + random.next(3), 1 + random.next(3));
+    fill(stroke.intersect(r), 0, 0, 0);
+  }
+}
+
+void Desktop::fill(const rfb::Rect& r, rdr::U8 red, rdr::U8 green,
+                   rdr::U8 blue)
+{
+  rdr::U8 pixel[4];
+
+  fbPF.bufferFromPixel(pixel, fbPF.pixelFromRGB(red, green, blue));
+  pb->fillRect(r, pixel);
+}
+
+Client::Client(network::Socket* sock_, Desktop* desktop_)
+  : sock(sock_), desktop(desktop_), lastSeq((unsigned)-1)
+{
+  framesShown = 0;
+
+  setServerName("netperf");
+  setStreams(&sock->inStream(), &sock->outStream());
+
+  setQualityLevel(quality);
+  setCompressLevel(::compressLevel);
+
+  initialiseProtocol();
+}
+
+Client::~Client()
+{
+}
+
+void Client::processMsgs()
+{
+  sock->outStream().cork(true);
+  while (processMsg())
+    ;
+  sock->outStream().cork(false);
+  sock->outStream().flush();
+}
+
+void Client::initDone()
+{
+  rfb::CharArray geometry;
+  int x, y, w, h;
+
+  resizeFramebuffer();
+
+  geometry.buf = viewportGeometry.getData();
+  if (geometry.buf[0] != '\0') {
+    rfb::Rect rect;
+
+    if (sscanf(geometry.buf, "%dx%d+%d+%d", &w, &h, &x, &y) != 4)
+      throw rdr::Exception("Invalid viewport \"%s\"", geometry.buf);
+
+    rect.setXYWH(x, y, w, h);
+    setViewport(rfb::Region(rect));
+  }
+}
+
+void Client::resizeFramebuffer()
+{
+  rfb::ModifiablePixelBuffer *pb;
+
+  pb = new rfb::ManagedPixelBuffer(server.pf(),
+                                   server.width(), server.height());
+  setFramebuffer(pb);
+}
+
+void Client::setCursor(int, int, const rfb::Point&, const rdr::U8*)
+{
+}
+
+void Client::setCursorPos(const rfb::Point&)
+{
+}
+
+void Client::framebufferUpdateEnd()
+{
+  const rdr::U8* buffer;
+  int stride;
+  rdr::U8 rgb[3];
+  unsigned seq;
+
+  CConnection::framebufferUpdateEnd();
+
+  buffer = getFramebuffer()->getBuffer(markerRect, &stride);
+  server.pf().rgbFromBuffer(rgb, buffer, 1);
+
+  seq = rgb[0] | rgb[1] << 8 | rgb[2] << 16;
+  if (seq == lastSeq)
+    return;
+  if (seq >= desktop->getFrameCount())
+    return;
+
+  lastSeq = seq;
+  framesShown++;
+
+  frameLatency.add((getTime() - desktop->getFrameTime(seq)) / 1000);
+}
+
+void Client::setColourMapEntries(int, int, rdr::U16*)
+{
+}
+
+void Client::bell()
+{
+}
+
+static void setBuffers(int fd, int size)
+{
+  setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &size, sizeof(size));
+  setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+}
+
+static void usage(const char *argv0)
+{
+  fprintf(stderr, "Syntax: %s [options]\n", argv0);
+  fprintf(stderr, "Options:\n");
+  rfb::Configuration::listParams(79, 14);
+  exit(1);
+}
+
+int main(int argc, char **argv)
+{
+  int i;
+
+  int serverFds[2], clientFds[2];
+
+  rfb::initStdIOLoggers();
+  rfb::LogWriter::setLogParams("*:stderr:30");
+
+  // No point in authenticating against ourselves
+  rfb::SecurityServer::secTypes.setParam("None");
+  rfb::SecurityClient::secTypes.setParam("None");
+  rfb::CSecurity::upg = new DummyPasswdGetter();
+
+  for (i = 1; i < argc; i++) {
+    if (rfb::Configuration::setParam(argv[i]))
+      continue;
+
+    if (argv[i][0] == '-') {
+      if (i + 1 < argc) {
+        if (rfb::Configuration::setParam(&argv[i][1], argv[i + 1])) {
+          i++;
+          continue;
+        }
+      }
+    }
+
+    usage(argv[0]);
+  }
+
+  if ((socketpair(AF_UNIX, SOCK_STREAM, 0, serverFds) != 0) ||
+      (socketpair(AF_UNIX, SOCK_STREAM, 0, clientFds) != 0)) {
+    perror("socketpair");
+    return 1;
+  }
+
+  // Anything buffered outside of the emulated link would hide the
+  // link's behaviour, so keep the socket buffers small
+  setBuffers(serverFds[0], 8192);
+  setBuffers(serverFds[1], 8192);
+  setBuffers(clientFds[0], 8192);
+  setBuffers(clientFds[1], 8192);
+
+  Desktop* desktop;
+  rfb::VNCServerST* server;
+  LinkSocket* serverSock;
+  LinkSocket* clientSock;
+  Client* client;
+  Link* downstream;
+  Link* upstream;
+
+  unsigned long long start, end;
+
+#ifdef HAVE_GNUTLS
+  rfb::CSecurityTLS::msg = new DummyMsgBox();
+#endif
+
+  try {
+    desktop = new Desktop();
+    server = new rfb::VNCServerST("netperf", desktop);
+
+    serverSock = new LinkSocket(serverFds[0]);
+    server->addSocket(serverSock);
+
+    clientSock = new LinkSocket(clientFds[0]);
+    client = new Client(clientSock, desktop);
+  } catch (rdr::Exception& e) {
+    fprintf(stderr, "Failed to set up test: %s\n", e.str());
+    return 1;
+  }
+
+  downstream = new Link(serverFds[1], clientFds[1], seed);
+  upstream = new Link(clientFds[1], serverFds[1], seed + 1);
+
+  start = getTime();
+
+  try {
+    while (!desktop->isFinished()) {
+      unsigned long long now, next, event;
+      fd_set rfds, wfds;
+      struct timeval tv;
+      int timeout, maxFd;
+
+      now = getTime();
+
+      next = desktop->step(now);
+
+      downstream->transfer(now);
+      upstream->transfer(now);
+
+      timeout = rfb::Timer::checkTimeouts();
+
+      now = getTime();
+
+      event = downstream->nextEvent(now);
+      if ((event != 0) && ((next == 0) || (event < next)))
+        next = event;
+      event = upstream->nextEvent(now);
+      if ((event != 0) && ((next == 0) || (event < next)))
+        next = event;
+
+      if ((timeout == 0) || (timeout > 1000))
+        timeout = 1000;
+      if ((next != 0) && (next <= now))
+        timeout = 0;
+      else if ((next != 0) && ((next - now) / 1000 < (unsigned)timeout))
+        timeout = (next - now + 999) / 1000;
+
+      FD_ZERO(&rfds);
+      FD_ZERO(&wfds);
+
+      FD_SET(serverFds[0], &rfds);
+      FD_SET(clientFds[0], &rfds);
+      if (serverSock->outStream().hasBufferedData())
+        FD_SET(serverFds[0], &wfds);
+      if (clientSock->outStream().hasBufferedData())
+        FD_SET(clientFds[0], &wfds);
+
+      if (downstream->wantRead(now))
+        FD_SET(serverFds[1], &rfds);
+      if (upstream->wantRead(now))
+        FD_SET(clientFds[1], &rfds);
+      if (downstream->wantWrite(now))
+        FD_SET(clientFds[1], &wfds);
+      if (upstream->wantWrite(now))
+        FD_SET(serverFds[1], &wfds);
+
+      maxFd = __rfbmax(__rfbmax(serverFds[0], serverFds[1]),
+                       __rfbmax(clientFds[0], clientFds[1]));
+
+      tv.tv_sec = timeout / 1000;
+      tv.tv_usec = (timeout % 1000) * 1000;
+
+      if (select(maxFd + 1, &rfds, &wfds, NULL, &tv) < 0) {
+        if (errno == EINTR)
+          continue;
+        throw rdr::SystemException("select", errno);
+      }
+
+      if (FD_ISSET(serverFds[0], &rfds))
+        server->processSocketReadEvent(serverSock);
+      if (FD_ISSET(serverFds[0], &wfds))
+        server->processSocketWriteEvent(serverSock);
+
+      if (FD_ISSET(clientFds[0], &rfds))
+        client->processMsgs();
+      if (FD_ISSET(clientFds[0], &wfds))
+        clientSock->outStream().flush();
+
+      // The server shuts down the socket on errors
+      if (serverSock->isShutdown())
+        throw rdr::Exception("Server closed the connection");
+    }
+  } catch (rdr::Exception& e) {
+    fprintf(stderr, "Failed to run test: %s\n", e.str());
+    return 1;
+  }
+
+  end = getTime();
+
+  // Gets the server to log its view of the connection
+  server->removeSocket(serverSock);
+
+  double duration = (end - start) / 1000000.0;
+  double throughput = downstream->getDelivered() * 8.0 / duration / 1000.0;
+  char summary[256];
+
+  printf("Duration: %g s\n", duration);
+  printf("Frames: %u generated, %u shown\n",
+         desktop->getFrameCount(), client->framesShown);
+  client->frameLatency.print(summary, sizeof(summary));
+  printf("Frame latency: %s\n", summary);
+  printf("Throughput: %g kbit/s (%g %% of link)\n",
+         throughput, throughput * 100.0 / bandwidth);
+  downstream->getQueueDelay().print(summary, sizeof(summary));
+  printf("Queueing delay: %s\n", summary);
+  printf("Maximum queue: %u KiB\n",
+         (unsigned)(downstream->getMaxQueued() / 1024));
+  printf("Loss stalls: %u\n", downstream->getStalls());
+
+  delete client;
+  delete clientSock;
+  delete server;
+  delete serverSock;
+  delete desktop;
+  delete downstream;
+  delete upstream;
+
+  return 0;
+}
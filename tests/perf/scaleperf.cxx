@@ -0,0 +1,260 @@
+/* Copyright (C) 2026 TigerVNC Team
+ * 
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this software; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ * USA.
+ */
+
+/*
+ * This program reports the time needed to scale a frame between some
+ * common screen sizes, for each available filter, both for the entire
+ * frame and for a scattered set of small damaged areas.
+ *
+ * It also compares decoding JPEG data with reduced detail for a scaled
+ * down display against a full decode, both in time and in how much the
+ * displayed result differs.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+
+#include <vector>
+
+#include <rfb/ClientParams.h>
+#include <rfb/ImageScaler.h>
+#include <rfb/JpegCompressor.h>
+#include <rfb/JpegDecompressor.h>
+
+#include "util.h"
+
+static const int runs = 10;
+static const int damageRects = 64;
+static const int damageSize = 64;
+
+struct Ratio {
+  int srcWidth, srcHeight;
+  int dstWidth, dstHeight;
+};
+
+static const Ratio ratios[] = {
+  { 3840, 2160, 1920, 1080 },
+  { 2560, 1440, 1920, 1080 },
+  { 1920, 1080, 1280, 720 },
+  { 1920, 1080, 3840, 2160 },
+};
+
+static const char* filterNames[] = { "Nearest", "Bilinear", "Bicubic" };
+
+static const int jpegWidth = 1920;
+static const int jpegHeight = 1080;
+static const int jpegQuality = 80;
+
+static double doTest(rfb::ImageScaler* scaler,
+                     const std::vector<rfb::Rect>& rects,
+                     const rdr::U8* src, int srcStride,
+                     rdr::U8* dst, int dstStride)
+{
+  std::vector<rfb::Rect>::const_iterator iter;
+
+  startCpuCounter();
+
+  for (int i = 0;i < runs;i++) {
+    for (iter = rects.begin();iter != rects.end();++iter)
+      scaler->scaleRect(scaler->getDestRect(*iter),
+                        src, srcStride, dst, dstStride);
+  }
+
+  endCpuCounter();
+
+  return getCpuCounter() / runs;
+}
+
+// Something photo like, with both smooth areas and fine detail
+static void fillImage(rdr::U8* data, int width, int height)
+{
+  for (int y = 0;y < height;y++) {
+    for (int x = 0;x < width;x++) {
+      rdr::U8* pix = data + (y * width + x) * 4;
+      pix[0] = x * 255 / width;
+      pix[1] = y * 255 / height;
+      pix[2] = (int)(127.5 + 127.5 * sin(x / 13.0) * cos(y / 7.0));
+      pix[3] = 0;
+      if (((x / 4) % 16 == 0) || ((y / 3) % 20 == 0))
+        pix[2] = pix[1] = pix[0] = (x ^ y) & 0xff;
+    }
+  }
+}
+
+static double decodeAndScale(const rdr::U8* jpeg, int len, int divisor,
+                             rdr::U8* full, rdr::U8* scaled,
+                             rfb::ImageScaler* scaler)
+{
+  rfb::PixelFormat pf(32, 24, false, true, 255, 255, 255, 0, 8, 16);
+  rfb::Rect rect(0, 0, jpegWidth, jpegHeight);
+  rfb::Rect scaledRect;
+
+  scaledRect = scaler->getDestRect(rect);
+
+  // The scaling afterwards is the same in both cases, so only the
+  // decoding is timed
+  startCpuCounter();
+
+  for (int i = 0;i < runs;i++) {
+    rfb::JpegDecompressor jd;
+    jd.decompress(jpeg, len, full, jpegWidth, rect, pf, divisor);
+  }
+
+  endCpuCounter();
+
+  scaler->scaleRect(scaledRect, full, jpegWidth,
+                    scaled, scaledRect.width());
+
+  return getCpuCounter() / runs;
+}
+
+static double psnr(const rdr::U8* a, const rdr::U8* b, int pixels)
+{
+  double mse;
+
+  mse = 0;
+  for (int i = 0;i < pixels * 4;i++) {
+    if ((i % 4) == 3)
+      continue;
+    mse += (a[i] - b[i]) * (a[i] - b[i]);
+  }
+  mse /= pixels * 3;
+
+  if (mse == 0)
+    return INFINITY;
+
+  return 10 * log10(255.0 * 255.0 / mse);
+}
+
+static void doJpegTests()
+{
+  rfb::PixelFormat pf(32, 24, false, true, 255, 255, 255, 0, 8, 16);
+  rdr::U8 *image, *full;
+  rfb::JpegCompressor jc;
+
+  image = new rdr::U8[jpegWidth * jpegHeight * 4];
+  full = new rdr::U8[jpegWidth * jpegHeight * 4];
+
+  fillImage(image, jpegWidth, jpegHeight);
+  jc.compress(image, jpegWidth, rfb::Rect(0, 0, jpegWidth, jpegHeight),
+              pf, jpegQuality, rfb::subsample2X);
+
+  printf("\n");
+  printf("# JPEG: %dx%d pixels, quality %d, %d bytes\n",
+         jpegWidth, jpegHeight, jpegQuality, (int)jc.length());
+  printf("#\n");
+  printf("# Note: Times are milliseconds/frame, PSNR is in dB against\n");
+  printf("#       a full decode that is then scaled down\n");
+  printf("#\n");
+
+  printf("Divisor,Full decode,Reduced decode,PSNR\n");
+
+  for (int divisor = 2;divisor <= 8;divisor *= 2) {
+    rfb::ImageScaler scaler(jpegWidth, jpegHeight,
+                            jpegWidth / divisor, jpegHeight / divisor);
+    rdr::U8 *reference, *reduced;
+    double fullTime, reducedTime;
+    int pixels;
+
+    pixels = (jpegWidth / divisor) * (jpegHeight / divisor);
+    reference = new rdr::U8[pixels * 4];
+    reduced = new rdr::U8[pixels * 4];
+
+    fullTime = decodeAndScale((const rdr::U8*)jc.data(), jc.length(), 1,
+                              full, reference, &scaler);
+    reducedTime = decodeAndScale((const rdr::U8*)jc.data(), jc.length(), divisor,
+                                 full, reduced, &scaler);
+
+    printf("%d,%g,%g,%.1f\n", divisor, fullTime * 1000.0,
+           reducedTime * 1000.0, psnr(reference, reduced, pixels));
+
+    delete [] reference;
+    delete [] reduced;
+  }
+
+  delete [] image;
+  delete [] full;
+}
+
+int main(int argc, char **argv)
+{
+  time_t t;
+  char datebuffer[256];
+
+  size_t i;
+  unsigned int filter;
+
+  time(&t);
+  strftime(datebuffer, sizeof(datebuffer), "%Y-%m-%d %H:%M UTC", gmtime(&t));
+
+  printf("# Image Scaling Performance Test %s\n", datebuffer);
+  printf("#\n");
+  printf("# Damage: %d random rects of %dx%d pixels\n",
+         damageRects, damageSize, damageSize);
+  printf("#\n");
+  printf("# Note: Results are milliseconds/frame\n");
+  printf("#\n");
+
+  printf("Source size,Destination size,Filter,Full frame,Damage\n");
+
+  for (i = 0;i < sizeof(ratios)/sizeof(ratios[0]);i++) {
+    const Ratio& r = ratios[i];
+    rdr::U8 *src, *dst;
+    size_t srcSize;
+    std::vector<rfb::Rect> full, damage;
+
+    srcSize = r.srcWidth * r.srcHeight * 4;
+    src = new rdr::U8[srcSize];
+    dst = new rdr::U8[r.dstWidth * r.dstHeight * 4];
+
+    for (size_t j = 0;j < srcSize;j++)
+      src[j] = rand();
+
+    full.push_back(rfb::Rect(0, 0, r.srcWidth, r.srcHeight));
+
+    for (int j = 0;j < damageRects;j++) {
+      int x, y;
+      x = rand() % (r.srcWidth - damageSize);
+      y = rand() % (r.srcHeight - damageSize);
+      damage.push_back(rfb::Rect(x, y, x + damageSize, y + damageSize));
+    }
+
+    for (filter = 0;filter <= rfb::scaleFilterMaxNumber;filter++) {
+      rfb::ImageScaler scaler(r.srcWidth, r.srcHeight,
+                              r.dstWidth, r.dstHeight, filter);
+      double fullTime, damageTime;
+
+      fullTime = doTest(&scaler, full, src, r.srcWidth, dst, r.dstWidth);
+      damageTime = doTest(&scaler, damage, src, r.srcWidth, dst, r.dstWidth);
+
+      printf("%dx%d,%dx%d,%s,%g,%g\n",
+             r.srcWidth, r.srcHeight, r.dstWidth, r.dstHeight,
+             filterNames[filter], fullTime * 1000.0, damageTime * 1000.0);
+    }
+
+    delete [] src;
+    delete [] dst;
+  }
+
+  doJpegTests();
+
+  return 0;
+}
@@ -0,0 +1,122 @@
+/* Copyright (C) 2026 TigerVNC Team
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ * USA.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include <rfb/Congestion.h>
+
+#define ASSERT_EQ(expr, val) if ((expr) != (val)) { \
+  printf("FAILED on line %d (%s equals %d, expected %d)\n", __LINE__, #expr, (int)(expr), (int)(val)); \
+  return; \
+}
+
+// Feeds fake kernel state instead of reading a socket
+class FakeCongestion : public rfb::Congestion {
+public:
+  FakeCongestion() : nextRTT(0), nextMinRTT(0) {}
+
+  void sample(unsigned rtt, unsigned minRTT, bool adjust)
+  {
+    nextRTT = rtt;
+    nextMinRTT = minRTT;
+
+    if (adjust)
+      memset(&lastAdjustment, 0, sizeof(lastAdjustment));
+    else
+      gettimeofday(&lastAdjustment, NULL);
+
+    sampleSocket();
+  }
+
+  unsigned getBaseRTT() { return baseRTT; }
+  int getMeasurements() { return measurements; }
+
+protected:
+  virtual bool readSocket()
+  {
+    sockRTT = nextRTT;
+    sockMinRTT = nextMinRTT;
+    sockInFlight = 0;
+    return true;
+  }
+
+private:
+  unsigned nextRTT, nextMinRTT;
+};
+
+void testMinRTTIncrease()
+{
+  FakeCongestion c;
+
+  printf("%s: ", __func__);
+
+  c.sample(10, 10, false);
+  c.sample(10, 10, false);
+  ASSERT_EQ(c.getBaseRTT(), 10);
+
+  // The kernel's window moved on and the path got slower
+  c.sample(30, 30, true);
+  ASSERT_EQ(c.getBaseRTT(), 30);
+
+  // An adjustment was made, rather than tripping over the old samples
+  ASSERT_EQ(c.getMeasurements(), 0);
+
+  printf("OK\n");
+}
+
+void testMinRTTDecrease()
+{
+  FakeCongestion c;
+
+  printf("%s: ", __func__);
+
+  c.sample(30, 30, false);
+  c.sample(30, 30, false);
+  c.sample(10, 10, true);
+  ASSERT_EQ(c.getBaseRTT(), 10);
+  ASSERT_EQ(c.getMeasurements(), 0);
+
+  printf("OK\n");
+}
+
+void testNoKernelMinimum()
+{
+  FakeCongestion c;
+
+  printf("%s: ", __func__);
+
+  // Older kernels only give the smoothed value, so we keep our own
+  // minimum
+  c.sample(20, 0, false);
+  c.sample(10, 0, false);
+  c.sample(30, 0, false);
+  ASSERT_EQ(c.getBaseRTT(), 10);
+
+  printf("OK\n");
+}
+
+int main(int argc, char** argv)
+{
+  testMinRTTIncrease();
+  testMinRTTDecrease();
+  testNoKernelMinimum();
+
+  return 0;
+}
@@ -0,0 +1,149 @@
+/* Copyright (C) 2026 TigerVNC Team
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ * USA.
+ */
+
+#include <stdio.h>
+
+#include <rfb/LatencyHistogram.h>
+
+#define ASSERT_EQ(expr, val) if ((expr) != (val)) { \
+  printf("FAILED on line %d (%s equals %d, expected %d)\n", __LINE__, #expr, (int)(expr), (int)(val)); \
+  return; \
+}
+
+void testEmpty()
+{
+  rfb::LatencyHistogram h;
+  char buffer[256];
+
+  printf("%s: ", __func__);
+
+  ASSERT_EQ(h.count(), 0);
+  ASSERT_EQ(h.average(), 0);
+  ASSERT_EQ(h.percentile(50), 0);
+  ASSERT_EQ(h.max(), 0);
+
+  h.print(buffer, sizeof(buffer));
+  ASSERT_EQ(buffer[0], '\0');
+
+  printf("OK\n");
+}
+
+void testSingle()
+{
+  rfb::LatencyHistogram h;
+
+  printf("%s: ", __func__);
+
+  h.add(20);
+
+  ASSERT_EQ(h.count(), 1);
+  ASSERT_EQ(h.average(), 20);
+  ASSERT_EQ(h.max(), 20);
+  // Never more than the largest sample
+  ASSERT_EQ(h.percentile(50), 20);
+  ASSERT_EQ(h.percentile(99), 20);
+
+  printf("OK\n");
+}
+
+void testPercentiles()
+{
+  rfb::LatencyHistogram h;
+  unsigned i;
+
+  printf("%s: ", __func__);
+
+  // 90 fast, 9 slow and one very slow
+  for (i = 0; i < 90; i++)
+    h.add(10);
+  for (i = 0; i < 9; i++)
+    h.add(100);
+  h.add(1000);
+
+  ASSERT_EQ(h.count(), 100);
+  ASSERT_EQ(h.average(), 28);
+  ASSERT_EQ(h.max(), 1000);
+
+  // Upper bound of the power of two bucket
+  ASSERT_EQ(h.percentile(50), 15);
+  ASSERT_EQ(h.percentile(90), 15);
+  ASSERT_EQ(h.percentile(95), 127);
+  ASSERT_EQ(h.percentile(99), 127);
+  ASSERT_EQ(h.percentile(100), 1000);
+
+  printf("OK\n");
+}
+
+void testZero()
+{
+  rfb::LatencyHistogram h;
+
+  printf("%s: ", __func__);
+
+  h.add(0);
+  h.add(0);
+  h.add(1);
+
+  ASSERT_EQ(h.percentile(50), 0);
+  ASSERT_EQ(h.percentile(100), 1);
+
+  printf("OK\n");
+}
+
+void testHuge()
+{
+  rfb::LatencyHistogram h;
+
+  printf("%s: ", __func__);
+
+  h.add(10);
+  h.add(1000000);
+
+  ASSERT_EQ(h.percentile(100), 1000000);
+  ASSERT_EQ(h.max(), 1000000);
+
+  printf("OK\n");
+}
+
+void testReset()
+{
+  rfb::LatencyHistogram h;
+
+  printf("%s: ", __func__);
+
+  h.add(10);
+  h.reset();
+
+  ASSERT_EQ(h.count(), 0);
+  ASSERT_EQ(h.max(), 0);
+  ASSERT_EQ(h.percentile(50), 0);
+
+  printf("OK\n");
+}
+
+int main(int argc, char** argv)
+{
+  testEmpty();
+  testSingle();
+  testPercentiles();
+  testZero();
+  testHuge();
+  testReset();
+
+  return 0;
+}
@@ -0,0 +1,224 @@
+/* Copyright (C) 2026 TigerVNC Team
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ * USA.
+ */
+
+#include <stdio.h>
+#include <sys/time.h>
+
+#include <rfb/ClientParams.h>
+#include "QualityController.h"
+
+#define ASSERT_EQ(expr, val) if ((expr) != (val)) { \
+  printf("FAILED on line %d (%s equals %d, expected %d)\n", __LINE__, #expr, (int)(expr), (int)(val)); \
+  return; \
+}
+
+#define ASSERT_RANGE(expr, min, max) if (((expr) < (min)) || ((expr) > (max))) { \
+  printf("FAILED on line %d (%s equals %d, expected %d-%d)\n", __LINE__, #expr, (int)(expr), (int)(min), (int)(max)); \
+  return; \
+}
+
+static struct timeval at(unsigned ms)
+{
+  struct timeval tv;
+  tv.tv_sec = ms / 1000;
+  tv.tv_usec = (ms % 1000) * 1000;
+  return tv;
+}
+
+void testLAN()
+{
+  QualityController qc;
+
+  printf("%s: ", __func__);
+
+  ASSERT_EQ(qc.update(at(0), 100000000, 10, 2), true);
+
+  ASSERT_EQ(qc.getFullColour(), true);
+  ASSERT_RANGE(qc.getFineQualityLevel(), 90, 95);
+  ASSERT_EQ(qc.getQualityLevel(), 8);
+  ASSERT_EQ(qc.getSubsampling(), rfb::subsampleNone);
+  ASSERT_EQ(qc.getCompressLevel(), 1);
+
+  printf("OK\n");
+}
+
+void testContinuous()
+{
+  QualityController qc;
+  int prev;
+
+  printf("%s: ", __func__);
+
+  // Every halving of the throughput should give a bit lower quality
+  // and a bit more compression
+  qc.update(at(0), 16000000, 10, 2);
+  prev = qc.getFineQualityLevel();
+  ASSERT_RANGE(prev, 70, 90);
+  ASSERT_EQ(qc.getCompressLevel(), 2);
+
+  qc.update(at(2000), 8000000, 10, 2);
+  ASSERT_RANGE(qc.getFineQualityLevel(), prev - 15, prev - 8);
+  ASSERT_EQ(qc.getCompressLevel(), 3);
+  prev = qc.getFineQualityLevel();
+
+  qc.update(at(4000), 4000000, 10, 2);
+  ASSERT_RANGE(qc.getFineQualityLevel(), prev - 15, prev - 8);
+  ASSERT_EQ(qc.getCompressLevel(), 4);
+  ASSERT_EQ(qc.getSubsampling(), rfb::subsample2X);
+
+  qc.update(at(6000), 1000000, 10, 2);
+  ASSERT_RANGE(qc.getFineQualityLevel(), 10, 49);
+  ASSERT_EQ(qc.getSubsampling(), rfb::subsample4X);
+  ASSERT_EQ(qc.getFullColour(), true);
+
+  printf("OK\n");
+}
+
+void testDeadband()
+{
+  QualityController qc;
+  int quality;
+
+  printf("%s: ", __func__);
+
+  qc.update(at(0), 8000000, 10, 2);
+  quality = qc.getFineQualityLevel();
+
+  // Small variations shouldn't cause any changes
+  ASSERT_EQ(qc.update(at(2000), 9000000, 10, 2), false);
+  ASSERT_EQ(qc.update(at(4000), 7000000, 10, 2), false);
+  ASSERT_EQ(qc.getFineQualityLevel(), quality);
+
+  printf("OK\n");
+}
+
+void testRateLimit()
+{
+  QualityController qc;
+  int quality;
+
+  printf("%s: ", __func__);
+
+  qc.update(at(0), 100000000, 10, 2);
+  quality = qc.getFineQualityLevel();
+
+  // Large change, but too soon
+  ASSERT_EQ(qc.update(at(500), 1000000, 10, 2), false);
+  ASSERT_EQ(qc.getFineQualityLevel(), quality);
+
+  ASSERT_EQ(qc.update(at(1000), 1000000, 10, 2), true);
+  ASSERT_RANGE(qc.getFineQualityLevel(), 10, quality - 30);
+
+  printf("OK\n");
+}
+
+void testFullColour()
+{
+  QualityController qc;
+
+  printf("%s: ", __func__);
+
+  qc.update(at(0), 250000, 10, 2);
+  ASSERT_EQ(qc.getFullColour(), true);
+
+  qc.update(at(2000), 150000, 10, 2);
+  ASSERT_EQ(qc.getFullColour(), false);
+
+  // Needs to get well above the limit to go back
+  qc.update(at(4000), 250000, 10, 2);
+  ASSERT_EQ(qc.getFullColour(), false);
+
+  qc.update(at(6000), 400000, 10, 2);
+  ASSERT_EQ(qc.getFullColour(), true);
+
+  printf("OK\n");
+}
+
+void testLatency()
+{
+  QualityController qc;
+  int quality;
+  unsigned i;
+
+  printf("%s: ", __func__);
+
+  qc.update(at(0), 16000000, 10, 2);
+  quality = qc.getFineQualityLevel();
+
+  // Slow updates, even though the throughput looks fine
+  for (i = 1; i <= 20; i++)
+    qc.update(at(i * 100), 16000000, 300, 2);
+
+  ASSERT_RANGE(qc.getFineQualityLevel(), 10, quality - 20);
+
+  printf("OK\n");
+}
+
+void testDecodeTime()
+{
+  QualityController qc;
+  unsigned i;
+
+  printf("%s: ", __func__);
+
+  qc.update(at(0), 100000000, 10, 2);
+  ASSERT_EQ(qc.getSubsampling(), rfb::subsampleNone);
+
+  // The decoders can't keep up
+  for (i = 1; i <= 20; i++)
+    qc.update(at(i * 100), 100000000, 40, 40);
+
+  ASSERT_RANGE(qc.getFineQualityLevel(), 60, 90);
+  ASSERT_EQ(qc.getSubsampling(), rfb::subsample2X);
+
+  printf("OK\n");
+}
+
+void testReset()
+{
+  QualityController qc;
+
+  printf("%s: ", __func__);
+
+  qc.update(at(0), 100000000, 10, 2);
+  qc.reset();
+
+  ASSERT_EQ(qc.getFineQualityLevel(), -1);
+  ASSERT_EQ(qc.getQualityLevel(), -1);
+  ASSERT_EQ(qc.getSubsampling(), rfb::subsampleUndefined);
+  ASSERT_EQ(qc.getCompressLevel(), -1);
+
+  // Should not be rate limited after a reset
+  ASSERT_EQ(qc.update(at(100), 1000000, 10, 2), true);
+
+  printf("OK\n");
+}
+
+int main(int argc, char** argv)
+{
+  testLAN();
+  testContinuous();
+  testDeadband();
+  testRateLimit();
+  testFullColour();
+  testLatency();
+  testDecodeTime();
+  testReset();
+
+  return 0;
+}
@@ -0,0 +1,247 @@
+/* Copyright (C) 2026 TigerVNC Team
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ * USA.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include <vector>
+
+#include <rfb/UDPChannel.h>
+
+#define ASSERT_EQ(expr, val) if ((expr) != (val)) { \
+  printf("FAILED on line %d (%s equals %d, expected %d)\n", __LINE__, #expr, (int)(expr), (int)(val)); \
+  return; \
+}
+
+// A connected loopback TCP pair to hang the channels off
+static int serverTcp, clientTcp;
+
+static bool setupTcp()
+{
+  struct sockaddr_in sa;
+  socklen_t salen;
+  int listener;
+
+  listener = socket(AF_INET, SOCK_STREAM, 0);
+  if (listener < 0)
+    return false;
+
+  memset(&sa, 0, sizeof(sa));
+  sa.sin_family = AF_INET;
+  sa.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  if (bind(listener, (struct sockaddr*)&sa, sizeof(sa)) != 0)
+    return false;
+  if (listen(listener, 1) != 0)
+    return false;
+
+  salen = sizeof(sa);
+  getsockname(listener, (struct sockaddr*)&sa, &salen);
+
+  clientTcp = socket(AF_INET, SOCK_STREAM, 0);
+  if (connect(clientTcp, (struct sockaddr*)&sa, sizeof(sa)) != 0)
+    return false;
+
+  serverTcp = accept(listener, NULL, NULL);
+  close(listener);
+
+  return serverTcp >= 0;
+}
+
+static void waitFor(rfb::UDPChannel* channel)
+{
+  fd_set fds;
+  struct timeval tv;
+
+  FD_ZERO(&fds);
+  FD_SET(channel->getFd(), &fds);
+  tv.tv_sec = 0;
+  tv.tv_usec = 100000;
+  select(channel->getFd() + 1, &fds, NULL, NULL, &tv);
+}
+
+static bool setupPair(rfb::UDPChannel* server, rfb::UDPChannel* client)
+{
+  server->listen(serverTcp);
+  client->connect(clientTcp, server->getPort(), server->getToken());
+
+  waitFor(server);
+  return server->accept();
+}
+
+static void fillData(std::vector<rdr::U8>* data, size_t length,
+                     rdr::U32 seq)
+{
+  data->resize(length);
+  for (size_t i = 0; i < length; i++)
+    (*data)[i] = (i * 7 + seq) & 0xff;
+}
+
+void testHandshake()
+{
+  rfb::UDPChannel server, client, stranger;
+
+  printf("%s: ", __func__);
+
+  server.listen(serverTcp);
+  ASSERT_EQ(server.isConnected(), false);
+
+  // Wrong token should be ignored
+  stranger.connect(clientTcp, server.getPort(), server.getToken() + 1);
+  waitFor(&server);
+  ASSERT_EQ(server.accept(), false);
+
+  client.connect(clientTcp, server.getPort(), server.getToken());
+  waitFor(&server);
+  ASSERT_EQ(server.accept(), true);
+  ASSERT_EQ(server.isConnected(), true);
+
+  printf("OK\n");
+}
+
+void testSingle()
+{
+  rfb::UDPChannel server, client;
+  std::vector<rdr::U8> data, received;
+  rfb::Rect r;
+  rdr::U32 seq;
+
+  printf("%s: ", __func__);
+
+  ASSERT_EQ(setupPair(&server, &client), true);
+
+  fillData(&data, 500, 1);
+  ASSERT_EQ(server.sendRect(1, rfb::Rect(10, 20, 74, 84),
+                            &data[0], data.size()), true);
+
+  waitFor(&client);
+  ASSERT_EQ(client.readRect(&seq, &r, &received), true);
+  ASSERT_EQ(seq, 1);
+  ASSERT_EQ(r.tl.x, 10);
+  ASSERT_EQ(r.tl.y, 20);
+  ASSERT_EQ(r.width(), 64);
+  ASSERT_EQ(r.height(), 64);
+  ASSERT_EQ(received.size(), data.size());
+  ASSERT_EQ(received == data, true);
+
+  ASSERT_EQ(client.readRect(&seq, &r, &received), false);
+
+  printf("OK\n");
+}
+
+void testFragmented()
+{
+  rfb::UDPChannel server, client;
+  std::vector<rdr::U8> data, received;
+  rfb::Rect r;
+  rdr::U32 seq;
+
+  printf("%s: ", __func__);
+
+  ASSERT_EQ(setupPair(&server, &client), true);
+
+  fillData(&data, 20000, 5);
+  ASSERT_EQ(server.sendRect(5, rfb::Rect(0, 0, 256, 256),
+                            &data[0], data.size()), true);
+
+  waitFor(&client);
+  ASSERT_EQ(client.readRect(&seq, &r, &received), true);
+  ASSERT_EQ(seq, 5);
+  ASSERT_EQ(received.size(), data.size());
+  ASSERT_EQ(received == data, true);
+
+  printf("OK\n");
+}
+
+void testTooLarge()
+{
+  rfb::UDPChannel server, client;
+  std::vector<rdr::U8> data;
+
+  printf("%s: ", __func__);
+
+  ASSERT_EQ(setupPair(&server, &client), true);
+
+  data.resize(rfb::UDPChannel::maxFragments *
+              rfb::UDPChannel::maxDatagramSize);
+  ASSERT_EQ(server.sendRect(1, rfb::Rect(0, 0, 16, 16),
+                            &data[0], data.size()), false);
+
+  printf("OK\n");
+}
+
+void testLoss()
+{
+  rfb::UDPChannel server, client;
+  std::vector<rdr::U8> data, received;
+  rfb::Rect r;
+  rdr::U32 seq;
+  unsigned count, lost;
+
+  printf("%s: ", __func__);
+
+  ASSERT_EQ(setupPair(&server, &client), true);
+
+  server.setLossRate(50);
+
+  count = 0;
+  for (rdr::U32 i = 1; i <= 200; i++) {
+    fillData(&data, 5000, i);
+    ASSERT_EQ(server.sendRect(i, rfb::Rect(0, 0, 64, 64),
+                              &data[0], data.size()), true);
+
+    waitFor(&client);
+    while (client.readRect(&seq, &r, &received)) {
+      // Anything that comes out must be complete and unharmed
+      fillData(&data, 5000, seq);
+      ASSERT_EQ(received.size(), data.size());
+      ASSERT_EQ(received == data, true);
+      count++;
+    }
+  }
+
+  // 5 fragments at 5% loss should lose about a fifth of the rects
+  lost = 200 - count;
+  ASSERT_EQ(lost > 10, true);
+  ASSERT_EQ(lost < 90, true);
+  ASSERT_EQ(client.getReceivedRects(), count);
+  // Everything but the last couple of updates should be accounted for
+  ASSERT_EQ(client.getDroppedRects() + 2 >= lost, true);
+
+  printf("OK\n");
+}
+
+int main(int argc, char** argv)
+{
+  if (!setupTcp()) {
+    printf("Failed to set up loopback connection\n");
+    return 1;
+  }
+
+  testHandshake();
+  testSingle();
+  testFragmented();
+  testTooLarge();
+  testLoss();
+
+  return 0;
+}
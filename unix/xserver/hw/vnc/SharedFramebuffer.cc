@@ -0,0 +1,292 @@
+/* Copyright (C) 2026 TigerVNC Team
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ * USA.
+ */
+
+#include <assert.h>
+#include <errno.h>
+#include <limits.h>
+#include <stdio.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <rdr/Exception.h>
+#include <rdr/MemOutStream.h>
+#include <rfb/Configuration.h>
+#include <rfb/LogWriter.h>
+#include <rfb/PixelFormat.h>
+
+#include "SharedFramebuffer.h"
+
+using namespace rfb;
+
+static LogWriter vlog("SharedFramebuffer");
+
+StringParameter sharedFramebuffer("SharedFramebuffer",
+                                  "Name of a POSIX shared memory segment "
+                                  "to export the framebuffer in", "");
+IntParameter sharedFramebufferMode("SharedFramebufferMode",
+                                   "Access mode of the shared framebuffer "
+                                   "segment", 0600);
+
+std::map<const void*, SharedFramebuffer*> SharedFramebuffer::segments;
+
+// POSIX has no way of renaming a shared memory segment, but on Linux
+// they are ordinary files in /dev/shm. That allows a new segment to be
+// prepared under a temporary name and then atomically take over the
+// real name, so that consumers never find the name missing.
+#ifdef __linux__
+#define HAVE_SHM_RENAME
+#endif
+
+#ifdef HAVE_SHM_RENAME
+static void shmPath(char* path, size_t len, const char* name)
+{
+  while (*name == '/')
+    name++;
+  snprintf(path, len, "/dev/shm/%s", name);
+}
+#endif
+
+SharedFramebuffer::SharedFramebuffer(const char* name_, int mode,
+                                     size_t size_)
+  : name(strDup(name_)), published(false), fd(-1),
+    base(MAP_FAILED), mapSize(0), header(NULL), data(NULL), size(size_)
+{
+  long pageSize;
+  size_t dataOffset;
+  const char* openName;
+  int err;
+
+  pageSize = sysconf(_SC_PAGESIZE);
+  dataOffset = (sizeof(SharedFramebufferHeader) + pageSize - 1) /
+               pageSize * pageSize;
+  mapSize = dataOffset + size;
+
+#ifdef HAVE_SHM_RENAME
+  // The segment only appears under its real name once it describes a
+  // framebuffer, see setLayout()
+  tmpName.buf = new char[strlen(name.buf) + 32];
+  sprintf(tmpName.buf, "%s.new.%d", name.buf, (int)getpid());
+  openName = tmpName.buf;
+#else
+  // Any previous segment is replaced, but stays valid for those that
+  // still have it mapped
+  openName = name.buf;
+  published = true;
+#endif
+
+  shm_unlink(openName);
+
+  fd = shm_open(openName, O_RDWR | O_CREAT | O_EXCL, mode);
+  if (fd < 0)
+    throw rdr::SystemException("unable to create shared framebuffer", errno);
+
+  // shm_open() is subject to the umask, so set the mode explicitly
+  if (fchmod(fd, mode) < 0 || ftruncate(fd, mapSize) < 0) {
+    err = errno;
+    close(fd);
+    shm_unlink(openName);
+    throw rdr::SystemException("unable to size shared framebuffer", err);
+  }
+
+  base = mmap(NULL, mapSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (base == MAP_FAILED) {
+    err = errno;
+    close(fd);
+    shm_unlink(openName);
+    throw rdr::SystemException("unable to map shared framebuffer", err);
+  }
+
+  header = (SharedFramebufferHeader*)base;
+  data = (rdr::U8*)base + dataOffset;
+
+  // ftruncate() gives us zeroed memory, so only the identification
+  // needs to be filled in
+  header->magic = SHAREDFB_MAGIC;
+  header->version = SHAREDFB_VERSION;
+  header->dataOffset = dataOffset;
+
+  segments[data] = this;
+
+  vlog.debug("Created shared framebuffer %s (%d bytes)",
+             name.buf, (int)mapSize);
+}
+
+SharedFramebuffer::~SharedFramebuffer()
+{
+  std::map<const void*, SharedFramebuffer*>::const_iterator iter;
+  bool replaced;
+  struct stat ours, current;
+  int currentFd;
+
+  segments.erase(data);
+
+  header->retired = 1;
+  __sync_synchronize();
+
+  if (!published) {
+    shm_unlink(tmpName.buf);
+    munmap(base, mapSize);
+    close(fd);
+    return;
+  }
+
+  // A replacement that is still being prepared will take over the
+  // name once it is ready, so leave ours until then
+  replaced = false;
+  for (iter = segments.begin(); iter != segments.end(); ++iter) {
+    if (strcmp(iter->second->name.buf, name.buf) == 0)
+      replaced = true;
+  }
+
+  // Only remove the name if it hasn't been taken over by a newer
+  // segment
+  if (!replaced) {
+    currentFd = shm_open(name.buf, O_RDONLY, 0);
+    if (currentFd >= 0) {
+      if ((fstat(fd, &ours) == 0) && (fstat(currentFd, &current) == 0) &&
+          (ours.st_ino == current.st_ino))
+        shm_unlink(name.buf);
+      close(currentFd);
+    }
+  }
+
+  munmap(base, mapSize);
+  close(fd);
+}
+
+SharedFramebuffer* SharedFramebuffer::create(int screenIndex, size_t size)
+{
+  char name[PATH_MAX];
+
+  if (((const char*)sharedFramebuffer)[0] == '\0')
+    return NULL;
+
+  if (screenIndex == 0)
+    strncpy(name, sharedFramebuffer, sizeof(name));
+  else
+    snprintf(name, sizeof(name), "%s.%d",
+             (const char*)sharedFramebuffer, screenIndex);
+  name[sizeof(name)-1] = '\0';
+
+  try {
+    return new SharedFramebuffer(name, sharedFramebufferMode, size);
+  } catch (rdr::Exception& e) {
+    vlog.error("%s: %s", name, e.str());
+    return NULL;
+  }
+}
+
+SharedFramebuffer* SharedFramebuffer::find(const void* data)
+{
+  std::map<const void*, SharedFramebuffer*>::iterator iter;
+
+  iter = segments.find(data);
+  if (iter == segments.end())
+    return NULL;
+
+  return iter->second;
+}
+
+void SharedFramebuffer::setLayout(int width, int height, int stride,
+                                  const PixelFormat& pf)
+{
+  rdr::MemOutStream pfStream(sizeof(header->pixelFormat));
+
+  assert((size_t)(stride * height * (pf.bpp/8)) <= size);
+
+  pf.write(&pfStream);
+
+  header->width = width;
+  header->height = height;
+  header->stride = stride * (pf.bpp/8);
+  memcpy(header->pixelFormat, pfStream.data(),
+         sizeof(header->pixelFormat));
+
+  // Consumers should treat a new segment as fully damaged, but let's
+  // make that explicit
+  pending.assign_union(Region(Rect(0, 0, width, height)));
+
+  if (!published)
+    publishName();
+}
+
+void SharedFramebuffer::publishName()
+{
+#ifdef HAVE_SHM_RENAME
+  char from[PATH_MAX], to[PATH_MAX];
+
+  // The header must be complete before anyone can find the segment
+  __sync_synchronize();
+
+  // This replaces any previous segment in one step. That one stays
+  // valid for those that still have it mapped, until it is retired.
+  shmPath(from, sizeof(from), tmpName.buf);
+  shmPath(to, sizeof(to), name.buf);
+  if (rename(from, to) < 0) {
+    vlog.error("Unable to publish shared framebuffer %s: %s",
+               name.buf, strerror(errno));
+    return;
+  }
+
+  published = true;
+
+  vlog.debug("Published shared framebuffer %s", name.buf);
+#endif
+}
+
+void SharedFramebuffer::add_changed(const Region& region)
+{
+  pending.assign_union(region);
+}
+
+void SharedFramebuffer::publish()
+{
+  std::vector<Rect> rects;
+  std::vector<Rect>::const_iterator i;
+  rdr::U32 frame, count;
+
+  if (pending.is_empty())
+    return;
+
+  frame = header->frame + 1;
+  count = header->damageCount;
+
+  pending.get_rects(&rects);
+  for (i = rects.begin(); i != rects.end(); ++i) {
+    unsigned idx;
+
+    idx = count % SHAREDFB_DAMAGE_RING;
+    header->damage[idx].frame = frame;
+    header->damage[idx].x = i->tl.x;
+    header->damage[idx].y = i->tl.y;
+    header->damage[idx].width = i->width();
+    header->damage[idx].height = i->height();
+
+    // The entry must be complete before the consumer can see it
+    __sync_synchronize();
+    header->damageCount = ++count;
+  }
+
+  __sync_synchronize();
+  header->frame = frame;
+
+  pending.clear();
+}
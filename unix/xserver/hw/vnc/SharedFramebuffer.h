@@ -0,0 +1,120 @@
+/* Copyright (C) 2026 TigerVNC Team
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ * USA.
+ */
+//
+// SharedFramebuffer.h
+//
+// Exports a screen's framebuffer as a named POSIX shared memory
+// segment so that local processes (recorders, thumbnailers, ...) can
+// map it read-only instead of connecting as a VNC client.
+//
+// The segment starts with a SharedFramebufferHeader, followed by the
+// pixel data at dataOffset. The geometry and pixel format of a
+// segment never change. If the screen is resized then a new segment
+// is created under the same name and the old one is marked as
+// retired, so consumers should reopen the segment when they see that
+// flag.
+//
+// Damage is published through a ring of rectangles. The writer fills
+// in damage[damageCount % SHAREDFB_DAMAGE_RING] and then increments
+// damageCount. Once all damage for a frame has been published, frame
+// is incremented. A consumer that has fallen more than
+// SHAREDFB_DAMAGE_RING rectangles behind must assume the entire
+// screen has changed.
+//
+
+#ifndef __SHAREDFRAMEBUFFER_H__
+#define __SHAREDFRAMEBUFFER_H__
+
+#include <map>
+
+#include <rdr/types.h>
+#include <rfb/Region.h>
+#include <rfb/util.h>
+
+namespace rfb { class PixelFormat; }
+
+#define SHAREDFB_MAGIC 0x54564653 /* "TVFS" */
+#define SHAREDFB_VERSION 1
+#define SHAREDFB_DAMAGE_RING 256
+
+struct SharedFramebufferHeader {
+  rdr::U32 magic;
+  rdr::U32 version;
+  rdr::U32 dataOffset;
+  volatile rdr::U32 retired;
+
+  rdr::U16 width;
+  rdr::U16 height;
+  rdr::U32 stride;              // In bytes
+  rdr::U8 pixelFormat[16];      // RFB PIXEL_FORMAT, as on the wire
+
+  volatile rdr::U32 frame;
+  volatile rdr::U32 damageCount;
+  struct {
+    rdr::U32 frame;
+    rdr::U16 x, y, width, height;
+  } damage[SHAREDFB_DAMAGE_RING];
+};
+
+class SharedFramebuffer {
+public:
+  SharedFramebuffer(const char* name, int mode, size_t size);
+  ~SharedFramebuffer();
+
+  // create() returns a new segment for the given screen, or NULL if
+  // exporting is disabled or the segment could not be created
+  static SharedFramebuffer* create(int screenIndex, size_t size);
+
+  // find() returns the segment whose pixel data starts at data
+  static SharedFramebuffer* find(const void* data);
+
+  rdr::U8* getData() { return data; }
+  size_t getSize() { return size; }
+
+  void setLayout(int width, int height, int stride,
+                 const rfb::PixelFormat& pf);
+
+  void add_changed(const rfb::Region& region);
+  const rfb::Region& getPending() { return pending; }
+
+  // publish() makes all pending damage visible to consumers as a
+  // single frame
+  void publish();
+
+protected:
+  // publishName() makes the segment available under its real name
+  void publishName();
+
+  rfb::CharArray name;
+  rfb::CharArray tmpName;
+  bool published;
+  int fd;
+
+  void* base;
+  size_t mapSize;
+
+  SharedFramebufferHeader* header;
+  rdr::U8* data;
+  size_t size;
+
+  rfb::Region pending;
+
+  static std::map<const void*, SharedFramebuffer*> segments;
+};
+
+#endif
@@ -40,6 +40,7 @@
 #include <rfb/Configuration.h>
 #include <rfb/ServerCore.h>
 
+#include "SharedFramebuffer.h"
 #include "XserverDesktop.h"
 #include "vncBlockHandler.h"
 #include "vncExtInit.h"
@@ -75,7 +76,7 @@ XserverDesktop::XserverDesktop(int screenIndex_,
                                void* fbptr, int stride_)
   : screenIndex(screenIndex_),
     server(0), listeners(listeners_),
-    shadowFramebuffer(NULL),
+    shadowFramebuffer(NULL), sharedShadowFramebuffer(NULL),
     queryConnectId(0), queryConnectTimer(this)
 {
   format = pf;
@@ -99,6 +100,7 @@ XserverDesktop::~XserverDesktop()
   }
   if (shadowFramebuffer)
     delete [] shadowFramebuffer;
+  delete sharedShadowFramebuffer;
   delete server;
 }
 
@@ -115,20 +117,40 @@ void XserverDesktop::unblockUpdates()
 void XserverDesktop::setFramebuffer(int w, int h, void* fbptr, int stride_)
 {
   ScreenSet layout;
+  SharedFramebuffer* sharedFb;
+  SharedFramebuffer* oldSharedFb;
 
   if (shadowFramebuffer) {
     delete [] shadowFramebuffer;
     shadowFramebuffer = NULL;
   }
 
+  // The old segment has to stay until the new one has taken over its
+  // name, or consumers might briefly find nothing
+  oldSharedFb = sharedShadowFramebuffer;
+  sharedShadowFramebuffer = NULL;
+
   if (!fbptr) {
-    shadowFramebuffer = new rdr::U8[w * h * (format.bpp/8)];
-    fbptr = shadowFramebuffer;
+    sharedShadowFramebuffer = SharedFramebuffer::create(screenIndex,
+                                                        w * h * (format.bpp/8));
+    if (sharedShadowFramebuffer)
+      fbptr = sharedShadowFramebuffer->getData();
+    else {
+      shadowFramebuffer = new rdr::U8[w * h * (format.bpp/8)];
+      fbptr = shadowFramebuffer;
+    }
     stride_ = w;
   }
 
   setBuffer(w, h, (rdr::U8*)fbptr, stride_);
 
+  // Xvnc might have placed the framebuffer in an exported segment
+  sharedFb = SharedFramebuffer::find(fbptr);
+  if (sharedFb)
+    sharedFb->setLayout(w, h, stride_, format);
+
+  delete oldSharedFb;
+
   vncSetGlueContext(screenIndex);
   layout = ::computeScreenLayout(&outputIdMap);
 
@@ -272,6 +294,12 @@ void XserverDesktop::setCursorPos(int x, int y, bool warped)
 
 void XserverDesktop::add_changed(const rfb::Region &region)
 {
+  SharedFramebuffer* sharedFb;
+
+  sharedFb = getSharedFramebuffer();
+  if (sharedFb)
+    sharedFb->add_changed(region);
+
   try {
     server->add_changed(region);
   } catch (rdr::Exception& e) {
@@ -281,6 +309,12 @@ void XserverDesktop::add_changed(const rfb::Region &region)
 
 void XserverDesktop::add_copied(const rfb::Region &dest, const rfb::Point &delta)
 {
+  SharedFramebuffer* sharedFb;
+
+  sharedFb = getSharedFramebuffer();
+  if (sharedFb)
+    sharedFb->add_changed(dest);
+
   try {
     server->add_copied(dest, delta);
   } catch (rdr::Exception& e) {
@@ -389,6 +423,16 @@ void XserverDesktop::blockHandler(int* timeout)
       server->setCursorPos(oldCursorPos, false);
     }
 
+    // Everything drawn since the last time is now a complete frame
+    // for anyone reading the exported framebuffer
+    SharedFramebuffer* sharedFb = getSharedFramebuffer();
+    if (sharedFb) {
+      // A shadow framebuffer is normally only updated on demand
+      if (sharedFb == sharedShadowFramebuffer)
+        grabRegion(sharedFb->getPending());
+      sharedFb->publish();
+    }
+
     // Trigger timers and check when the next will expire
     int nextTimeout = Timer::checkTimeouts();
     if (nextTimeout > 0 && (*timeout == -1 || nextTimeout < *timeout))
@@ -495,7 +539,7 @@ void XserverDesktop::handleClipboardData(const char* data_)
 
 void XserverDesktop::grabRegion(const rfb::Region& region)
 {
-  if (shadowFramebuffer == NULL)
+  if ((shadowFramebuffer == NULL) && (sharedShadowFramebuffer == NULL))
     return;
 
   std::vector<rfb::Rect> rects;
@@ -520,6 +564,15 @@ void XserverDesktop::keyEvent(rdr::U32 keysym, rdr::U32 keycode, bool down)
   vncKeyboardEvent(keysym, keycode, down);
 }
 
+SharedFramebuffer* XserverDesktop::getSharedFramebuffer()
+{
+  int stride;
+
+  // Xvnc might have replaced the framebuffer as part of a resize, so
+  // we cannot cache this
+  return SharedFramebuffer::find(getBuffer(getRect(), &stride));
+}
+
 bool XserverDesktop::handleTimeout(Timer* t)
 {
   if (t == &queryConnectTimer) {
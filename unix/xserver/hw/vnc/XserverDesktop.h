@@ -44,6 +44,8 @@ namespace rfb {
 
 namespace network { class SocketListener; class Socket; class SocketServer; }
 
+class SharedFramebuffer;
+
 class XserverDesktop : public rfb::SDesktop, public rfb::FullFramePixelBuffer,
                        public rfb::Timer::Callback {
 public:
@@ -114,12 +116,15 @@ protected:
 
   virtual bool handleTimeout(rfb::Timer* t);
 
+  SharedFramebuffer* getSharedFramebuffer();
+
 private:
 
   int screenIndex;
   rfb::VNCServer* server;
   std::list<network::SocketListener*> listeners;
   rdr::U8* shadowFramebuffer;
+  SharedFramebuffer* sharedShadowFramebuffer;
 
   uint32_t queryConnectId;
   network::Socket* queryConnectSocket;
@@ -39,6 +39,7 @@
 #include <network/TcpSocket.h>
 #include <network/UnixSocket.h>
 
+#include "SharedFramebuffer.h"
 #include "XserverDesktop.h"
 #include "vncExtInit.h"
 #include "vncHooks.h"
@@ -478,6 +479,30 @@ void vncRefreshScreenLayout(int scrIdx)
   }
 }
 
+void* vncAllocSharedFramebuffer(int scrIdx, size_t size)
+{
+  SharedFramebuffer* fb;
+
+  fb = SharedFramebuffer::create(scrIdx, size);
+  if (fb == NULL)
+    return NULL;
+
+  return fb->getData();
+}
+
+int vncFreeSharedFramebuffer(void* ptr)
+{
+  SharedFramebuffer* fb;
+
+  fb = SharedFramebuffer::find(ptr);
+  if (fb == NULL)
+    return 0;
+
+  delete fb;
+
+  return 1;
+}
+
 int vncOverrideParam(const char *nameAndValue)
 {
   const char* equalSign = strchr(nameAndValue, '=');
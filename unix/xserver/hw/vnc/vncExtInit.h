@@ -87,6 +87,9 @@ void vncPreScreenResize(int scrIdx);
 void vncPostScreenResize(int scrIdx, int success, int width, int height);
 void vncRefreshScreenLayout(int scrIdx);
 
+void* vncAllocSharedFramebuffer(int scrIdx, size_t size);
+int vncFreeSharedFramebuffer(void* ptr);
+
 int vncOverrideParam(const char *nameAndValue);
 
 #ifdef __cplusplus
@@ -771,7 +771,7 @@ vfbAllocateSharedMemoryFramebuffer(vfbFramebufferInfoPtr pfb)
 
 
 static void *
-vfbAllocateFramebufferMemory(vfbFramebufferInfoPtr pfb)
+vfbAllocateFramebufferMemory(int scrnum, vfbFramebufferInfoPtr pfb)
 {
     if (pfb->pfbMemory != NULL)
         return pfb->pfbMemory; /* already done */
@@ -782,6 +782,11 @@ vfbAllocateFramebufferMemory(vfbFramebufferInfoPtr pfb)
     pfb->paddedWidth = pfb->paddedBytesWidth * 8 / pfb->bitsPerPixel;
     pfb->sizeInBytes = pfb->paddedBytesWidth * pfb->height;
 
+    /* An exported framebuffer takes precedence */
+    pfb->pfbMemory = vncAllocSharedFramebuffer(scrnum, pfb->sizeInBytes);
+    if (pfb->pfbMemory != NULL)
+        return pfb->pfbMemory;
+
     /* And allocate buffer */
     switch (fbmemtype) {
 #ifdef HAS_SHM
@@ -807,6 +812,11 @@ vfbFreeFramebufferMemory(vfbFramebufferInfoPtr pfb)
     if ((pfb == NULL) || (pfb->pfbMemory == NULL))
         return;
 
+    if (vncFreeSharedFramebuffer(pfb->pfbMemory)) {
+        pfb->pfbMemory = NULL;
+        return;
+    }
+
     switch (fbmemtype) {
 #ifdef HAS_SHM
     case SHARED_MEMORY_FB:
@@ -1064,7 +1074,7 @@ static Bool vncRandRScreenSetSize(ScreenPtr pScreen,
     fb.height = pScreen->height;
     fb.depth = pvfb->fb.depth;
 
-    pbits = vfbAllocateFramebufferMemory(&fb);
+    pbits = vfbAllocateFramebufferMemory(pScreen->myNum, &fb);
     if (!pbits) {
         /* Allocation failed. Restore old state */
         pScreen->width = oldwidth;
@@ -1458,7 +1468,7 @@ vfbScreenInit(ScreenPtr pScreen, int argc, char **argv)
     if (monitorResolution)
         dpi = monitorResolution;
 
-    pbits = vfbAllocateFramebufferMemory(&pvfb->fb);
+    pbits = vfbAllocateFramebufferMemory(index, &pvfb->fb);
     if (!pbits) return FALSE;
     vncFbptr[index] = pbits;
     vncFbstride[index] = pvfb->fb.paddedWidth;
@@ -27,6 +27,7 @@
 #include <unistd.h>
 #endif
 
+#include <rfb/ClientParams.h>
 #include <rfb/CMsgWriter.h>
 #include <rfb/CSecurity.h>
 #include <rfb/Hostname.h>
@@ -35,7 +36,9 @@
 #include <rfb/util.h>
 #include <rfb/screenTypes.h>
 #include <rfb/fenceTypes.h>
+#include <rfb/SharedMemory.h>
 #include <rfb/Timer.h>
+#include <rfb/UDPChannel.h>
 #include <network/TcpSocket.h>
 #ifndef WIN32
 #include <network/UnixSocket.h>
@@ -75,10 +78,25 @@ static const PixelFormat mediumColourPF(8, 8, false, true,
 // Time new bandwidth estimates are weighted against (in ms)
 static const unsigned bpsEstimateWindow = 1000;
 
+// Time spent processing messages before giving the UI a chance to
+// run, about a quarter of a frame at 60 Hz (ms)
+static const unsigned messageBatchTime = 4;
+
+// Frame intervals kept if nobody collects them
+static const size_t maxFrameIntervals = 1000;
+
+// How many times we repeat the UDP hello before giving up
+static const unsigned maxUDPHellos = 10;
+
+// Payloads of the fences we send to the server
+static const char fenceRoundTrip = 1;
+
 CConn::CConn(const char* vncServerName, network::Socket* socket=NULL)
-  : serverHost(0), serverPort(0), desktop(NULL),
+  : serverHost(0), serverPort(0), udpChannel(NULL), udpHellos(0),
+    desktop(NULL),
     updateCount(0), pixelCount(0),
-    lastServerEncoding((unsigned int)-1), bpsEstimate(20000000)
+    lastServerEncoding((unsigned int)-1), bpsEstimate(20000000),
+    roundTripPending(false), roundTripTime(-1), nextLatencyProbe(0)
 {
   setShared(::shared);
   sock = socket;
@@ -94,6 +112,10 @@ CConn::CConn(const char* vncServerName, network::Socket* socket=NULL)
   if (!noJpeg)
     setQualityLevel(::qualityLevel);
 
+  setServerScale(::serverScale);
+
+  setUDPTransport(::udpTransport);
+
   if(sock == NULL) {
     try {
 #ifndef WIN32
@@ -117,6 +139,12 @@ CConn::CConn(const char* vncServerName, network::Socket* socket=NULL)
     }
   }
 
+  // Servers on the same machine can give us the framebuffer directly
+  if (SharedMemory::isSupported(sock->getFd())) {
+    sock->inStream().setAcceptFds(true);
+    supportsSharedMemory = true;
+  }
+
   Fl::add_fd(sock->getFd(), FL_READ | FL_EXCEPT, socketEvent, this);
 
   setServerName(serverHost);
@@ -134,6 +162,14 @@ CConn::~CConn()
   OptionsDialog::removeCallback(handleOptions);
   Fl::remove_timeout(handleUpdateTimeout, this);
 
+  if (inputLatency.count() > 0) {
+    char summary[256];
+    inputLatency.print(summary, sizeof(summary));
+    vlog.info(_("Input latency (until first new change): %s"), summary);
+  }
+
+  closeUDPChannel();
+
   if (desktop)
     delete desktop;
 
@@ -145,13 +181,13 @@ CConn::~CConn()
 
 const char *CConn::connectionInfo()
 {
-  static char infoText[1024] = "";
+  static char infoText[2048] = "";
 
   char scratch[100];
   char pfStr[100];
 
   // Crude way of avoiding constant overflow checks
-  assert((sizeof(scratch) + 1) * 10 < sizeof(infoText));
+  assert((sizeof(scratch) + 1) * 11 < sizeof(infoText));
 
   infoText[0] = '\0';
 
@@ -210,6 +246,14 @@ const char *CConn::connectionInfo()
   strcat(infoText, scratch);
   strcat(infoText, "\n");
 
+  if (inputLatency.count() > 0) {
+    char summary[100];
+    inputLatency.print(summary, sizeof(summary));
+    snprintf(scratch, sizeof(scratch), _("Input latency (until first new change): %s"), summary);
+    strcat(infoText, scratch);
+    strcat(infoText, "\n");
+  }
+
   return infoText;
 }
 
@@ -228,11 +272,101 @@ unsigned CConn::getPosition()
   return sock->inStream().pos();
 }
 
+void CConn::getDecodeStats(int encoding, unsigned& rects,
+                           unsigned long long& time)
+{
+  getDecodeManager()->getDecodeStats(encoding, rects, time);
+}
+
+size_t CConn::getDecoderThreadCount()
+{
+  return getDecodeManager()->getThreadCount();
+}
+
+void CConn::sendRoundTripProbe()
+{
+  if (!server.supportsFence)
+    return;
+
+  // Only one at a time, or we'd just be measuring our own probes
+  if (roundTripPending)
+    return;
+
+  writer()->writeFence(fenceFlagRequest, sizeof(fenceRoundTrip),
+                       &fenceRoundTrip);
+
+  roundTripPending = true;
+  gettimeofday(&roundTripStart, NULL);
+}
+
+int CConn::getRoundTripTime()
+{
+  return roundTripTime;
+}
+
+void CConn::sendLatencyProbe()
+{
+  LatencyProbe probe;
+  rdr::U8 data[fenceLatencyProbeLen];
+
+  if (!measureInputLatency)
+    return;
+  if (!server.supportsFence)
+    return;
+
+  // The server drops probes that didn't result in any changes
+  while (!latencyProbes.empty() &&
+         (msSince(&latencyProbes.front().sent) > 2000))
+    latencyProbes.pop_front();
+
+  if (latencyProbes.size() >= 16)
+    latencyProbes.pop_front();
+
+  probe.id = nextLatencyProbe++;
+  gettimeofday(&probe.sent, NULL);
+  probe.answered = false;
+  latencyProbes.push_back(probe);
+
+  data[0] = (fenceLatencyProbe >> 24) & 0xff;
+  data[1] = (fenceLatencyProbe >> 16) & 0xff;
+  data[2] = (fenceLatencyProbe >> 8) & 0xff;
+  data[3] = fenceLatencyProbe & 0xff;
+  data[4] = (probe.id >> 24) & 0xff;
+  data[5] = (probe.id >> 16) & 0xff;
+  data[6] = (probe.id >> 8) & 0xff;
+  data[7] = probe.id & 0xff;
+
+  writer()->writeFence(fenceFlagRequest, sizeof(data), (const char*)data);
+}
+
+void CConn::frameDrawn()
+{
+  std::list<LatencyProbe>::iterator iter;
+
+  iter = latencyProbes.begin();
+  while (iter != latencyProbes.end()) {
+    if (!iter->answered) {
+      ++iter;
+      continue;
+    }
+
+    inputLatency.add(msSince(&iter->sent));
+    iter = latencyProbes.erase(iter);
+  }
+}
+
+void CConn::getFrameIntervals(std::vector<unsigned>* intervals)
+{
+  intervals->swap(frameIntervals);
+  frameIntervals.clear();
+}
+
 void CConn::socketEvent(FL_SOCKET fd, void *data)
 {
   CConn *cc;
   static bool recursing = false;
   int when;
+  struct timeval batchStart;
 
   assert(data);
   cc = (CConn*)data;
@@ -251,16 +385,22 @@ void CConn::socketEvent(FL_SOCKET fd, void *data)
 
     // processMsg() only processes one message, so we need to loop
     // until the buffers are empty or things will stall.
+    gettimeofday(&batchStart, NULL);
     while (cc->processMsg()) {
+      // Check if we need to stop reading and terminate
+      if (should_exit())
+        break;
 
       // Make sure that the FLTK handling and the timers gets some CPU
-      // time in case of back to back messages
-       Fl::check();
-       Timer::checkTimeouts();
+      // time in case of back to back messages. Doing so has a fixed
+      // cost per call, so we handle them in batches.
+      if (msSince(&batchStart) < messageBatchTime)
+        continue;
 
-       // Also check if we need to stop reading and terminate
-       if (should_exit())
-         break;
+      Fl::check();
+      Timer::checkTimeouts();
+
+      gettimeofday(&batchStart, NULL);
     }
 
     cc->sock->outStream().cork(false);
@@ -290,6 +430,34 @@ void CConn::socketEvent(FL_SOCKET fd, void *data)
   recursing = false;
 }
 
+void CConn::udpEvent(FL_SOCKET fd, void *data)
+{
+  CConn *cc;
+  rdr::U32 seq;
+  Rect r;
+  std::vector<rdr::U8> buffer;
+  bool changed;
+
+  assert(data);
+  cc = (CConn*)data;
+
+  changed = false;
+
+  try {
+    while (cc->udpChannel->readRect(&seq, &r, &buffer)) {
+      if (cc->handleDatagramRect(seq, r, &buffer[0], buffer.size()))
+        changed = true;
+    }
+  } catch (rdr::Exception& e) {
+    // The normal connection can carry on without it
+    vlog.error(_("UDP transport failed: %s"), e.str());
+    cc->closeUDPChannel();
+  }
+
+  if (changed && cc->desktop)
+    cc->desktop->updateWindow();
+}
+
 ////////////////////// CConnection callback methods //////////////////////
 
 // initDone() is called when the serverInit message has been received.  At
@@ -367,14 +535,25 @@ void CConn::framebufferUpdateStart()
 void CConn::framebufferUpdateEnd()
 {
   unsigned long long elapsed, bps, weight;
-  struct timeval now;
+  struct timeval decodeStart, now;
+
+  // This is where we wait for the decoders to catch up
+  gettimeofday(&decodeStart, NULL);
 
   CConnection::framebufferUpdateEnd();
 
   updateCount++;
 
-  // Calculate bandwidth everything managed to maintain during this update
   gettimeofday(&now, NULL);
+
+  // Time between updates, for the statistics
+  if (updateCount > 1) {
+    if (frameIntervals.size() < maxFrameIntervals)
+      frameIntervals.push_back(msBetween(&lastUpdateEnd, &now));
+  }
+  lastUpdateEnd = now;
+
+  // Calculate bandwidth everything managed to maintain during this update
   elapsed = (now.tv_sec - updateStartTime.tv_sec) * 1000000;
   elapsed += now.tv_usec - updateStartTime.tv_usec;
   if (elapsed == 0)
@@ -393,9 +572,23 @@ void CConn::framebufferUpdateEnd()
   Fl::remove_timeout(handleUpdateTimeout, this);
   desktop->updateWindow();
 
+  // The hello might have been lost, so repeat it until something
+  // arrives
+  if ((udpChannel != NULL) && !udpChannel->hasReceived() &&
+      (udpHellos < maxUDPHellos)) {
+    try {
+      udpChannel->sendHello();
+      udpHellos++;
+    } catch (rdr::Exception& e) {
+      vlog.error(_("UDP transport failed: %s"), e.str());
+      closeUDPChannel();
+    }
+  }
+
   // Compute new settings based on updated bandwidth values
   if (autoSelect)
-    autoSelectFormatAndEncoding();
+    autoSelectFormatAndEncoding(elapsed / 1000,
+                                msBetween(&decodeStart, &now));
 }
 
 // The rest of the callbacks are fairly self-explanatory...
@@ -447,6 +640,30 @@ void CConn::fence(rdr::U32 flags, unsigned len, const char data[])
     writer()->writeFence(flags, len, data);
     return;
   }
+
+  if ((len == 1) && (data[0] == fenceRoundTrip) && roundTripPending) {
+    roundTripTime = msSince(&roundTripStart);
+    roundTripPending = false;
+  }
+
+  // The update with the result of the input came right before this,
+  // so it will be on screen once the window has been redrawn
+  if (len == fenceLatencyProbeLen) {
+    rdr::U32 marker, id;
+    std::list<LatencyProbe>::iterator iter;
+
+    marker = ((rdr::U8)data[0] << 24) | ((rdr::U8)data[1] << 16) |
+             ((rdr::U8)data[2] << 8) | (rdr::U8)data[3];
+    id = ((rdr::U8)data[4] << 24) | ((rdr::U8)data[5] << 16) |
+         ((rdr::U8)data[6] << 8) | (rdr::U8)data[7];
+
+    if (marker == fenceLatencyProbe) {
+      for (iter = latencyProbes.begin(); iter != latencyProbes.end(); ++iter) {
+        if (iter->id == id)
+          iter->answered = true;
+      }
+    }
+  }
 }
 
 void CConn::setLEDState(unsigned int state)
@@ -456,6 +673,27 @@ void CConn::setLEDState(unsigned int state)
   desktop->setLEDState(state);
 }
 
+void CConn::udpOffer(int port, rdr::U32 token)
+{
+  if (udpChannel != NULL)
+    return;
+
+  vlog.info(_("Server offered UDP transport on port %d"), port);
+
+  udpChannel = new UDPChannel();
+  try {
+    udpChannel->connect(sock->getFd(), port, token);
+  } catch (rdr::Exception& e) {
+    vlog.error(_("Failed to set up UDP transport: %s"), e.str());
+    closeUDPChannel();
+    return;
+  }
+
+  udpHellos = 1;
+
+  Fl::add_fd(udpChannel->getFd(), FL_READ, udpEvent, this);
+}
+
 void CConn::handleClipboardRequest()
 {
   desktop->handleClipboardRequest();
@@ -479,44 +717,74 @@ void CConn::resizeFramebuffer()
   desktop->resizeFramebuffer(server.width(), server.height());
 }
 
+int CConn::receiveFd()
+{
+  return sock->inStream().takeFd();
+}
+
+void CConn::closeUDPChannel()
+{
+  if (udpChannel == NULL)
+    return;
+
+  if (udpChannel->getFd() != -1)
+    Fl::remove_fd(udpChannel->getFd());
+
+  vlog.info(_("UDP transport: %u rects received, %u incomplete"),
+            udpChannel->getReceivedRects(), udpChannel->getDroppedRects());
+
+  delete udpChannel;
+  udpChannel = NULL;
+}
+
 // autoSelectFormatAndEncoding() chooses the format and encoding appropriate
-// to the connection speed:
-//
-//   First we wait for at least one second of bandwidth measurement.
+// to the connection:
 //
-//   Above 16Mbps (i.e. LAN), we choose the second highest JPEG quality,
-//   which should be perceptually lossless.
+//   The QualityController turns the measured throughput into a JPEG
+//   quality and compression level, backing off further if updates are
+//   slow to arrive or slow to decode. It has enough hysteresis that we
+//   can simply apply whatever it returns.
 //
-//   If the bandwidth is below that, we choose a more lossy JPEG quality.
-//
-//   If the bandwidth drops below 256 Kbps, we switch to palette mode.
+//   If the bandwidth drops below about 256 Kbps, we switch to palette
+//   mode.
 //
 //   Note: The system here is fairly arbitrary and should be replaced
 //         with something more intelligent at the server end.
 //
-void CConn::autoSelectFormatAndEncoding()
+void CConn::autoSelectFormatAndEncoding(unsigned latency,
+                                        unsigned decodeTime)
 {
-  bool newFullColour = fullColour;
-  int newQualityLevel = ::qualityLevel;
+  struct timeval now;
 
   // Always use Tight
   setPreferredEncoding(encodingTight);
 
+  gettimeofday(&now, NULL);
+  if (!qualityController.update(now, bpsEstimate, latency, decodeTime))
+    return;
+
   // Select appropriate quality level
   if (!noJpeg) {
-    if (bpsEstimate > 16000000)
-      newQualityLevel = 8;
-    else
-      newQualityLevel = 6;
+    int newQualityLevel = qualityController.getQualityLevel();
+    int newFineQuality = qualityController.getFineQualityLevel();
 
-    if (newQualityLevel != ::qualityLevel) {
+    if (newFineQuality != getFineQualityLevel()) {
       vlog.info(_("Throughput %d kbit/s - changing to quality %d"),
-                (int)(bpsEstimate/1000), newQualityLevel);
+                (int)(bpsEstimate/1000), newFineQuality);
       ::qualityLevel.setParam(newQualityLevel);
-      setQualityLevel(newQualityLevel);
     }
+
+    // Servers that understand the fine quality setting will ignore the
+    // classical level
+    setQualityLevel(newQualityLevel);
+    setFineQualityLevel(newFineQuality,
+                        qualityController.getSubsampling());
   }
 
+  // Only pick a compression level if the user hasn't chosen one
+  if (!customCompressLevel)
+    setCompressLevel(qualityController.getCompressLevel());
+
   if (server.beforeVersion(3, 8)) {
     // Xvnc from TightVNC 1.2.9 sends out FramebufferUpdates with
     // cursors "asynchronously". If this happens in the middle of a
@@ -529,15 +797,14 @@ void CConn::autoSelectFormatAndEncoding()
   }
   
   // Select best color level
-  newFullColour = (bpsEstimate > 256000);
-  if (newFullColour != fullColour) {
-    if (newFullColour)
+  if (qualityController.getFullColour() != fullColour) {
+    if (qualityController.getFullColour())
       vlog.info(_("Throughput %d kbit/s - full color is now enabled"),
                 (int)(bpsEstimate/1000));
     else
       vlog.info(_("Throughput %d kbit/s - full color is now disabled"),
                 (int)(bpsEstimate/1000));
-    fullColour.setParam(newFullColour);
+    fullColour.setParam(qualityController.getFullColour());
     updatePixelFormat();
   } 
 }
@@ -590,6 +857,12 @@ void CConn::handleOptions(void *data)
   else
     self->setQualityLevel(-1);
 
+  // The auto logic starts over from whatever we have now
+  self->setFineQualityLevel(-1, subsampleUndefined);
+  self->qualityController.reset();
+
+  self->setServerScale(::serverScale);
+
   self->updatePixelFormat();
 }
 
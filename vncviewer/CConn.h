@@ -20,12 +20,19 @@
 #ifndef __CCONN_H__
 #define __CCONN_H__
 
+#include <list>
+#include <vector>
+
 #include <FL/Fl.H>
 
 #include <rfb/CConnection.h>
+#include <rfb/LatencyHistogram.h>
 #include <rdr/FdInStream.h>
 
+#include "QualityController.h"
+
 namespace network { class Socket; }
+namespace rfb { class UDPChannel; }
 
 class DesktopWindow;
 
@@ -41,8 +48,29 @@ public:
   unsigned getPixelCount();
   unsigned getPosition();
 
+  void getDecodeStats(int encoding, unsigned& rects,
+                      unsigned long long& time);
+  size_t getDecoderThreadCount();
+
+  // sendRoundTripProbe() sends a fence to the server to measure the
+  // round trip time, which getRoundTripTime() then returns (in ms, or
+  // -1 if unknown)
+  void sendRoundTripProbe();
+  int getRoundTripTime();
+
+  // sendLatencyProbe() should be called after input that should be
+  // measured, and frameDrawn() each time the window has been redrawn
+  void sendLatencyProbe();
+  void frameDrawn();
+
+  // getFrameIntervals() moves the time between the end of each
+  // framebuffer update (in ms) since the last call to the given vector
+  void getFrameIntervals(std::vector<unsigned>* intervals);
+
   // Callback when socket is ready (or broken)
   static void socketEvent(FL_SOCKET fd, void *data);
+  // Same for the UDP side channel
+  static void udpEvent(FL_SOCKET fd, void *data);
 
   // CConnection callback methods
   void initDone();
@@ -69,6 +97,8 @@ public:
 
   void setLEDState(unsigned int state);
 
+  void udpOffer(int port, rdr::U32 token);
+
   virtual void handleClipboardRequest();
   virtual void handleClipboardAnnounce(bool available);
   virtual void handleClipboardData(const char* data);
@@ -76,8 +106,11 @@ public:
 private:
 
   void resizeFramebuffer();
+  int receiveFd();
 
-  void autoSelectFormatAndEncoding();
+  void closeUDPChannel();
+
+  void autoSelectFormatAndEncoding(unsigned latency, unsigned decodeTime);
   void updatePixelFormat();
 
   static void handleOptions(void *data);
@@ -89,6 +122,9 @@ private:
   int serverPort;
   network::Socket* sock;
 
+  rfb::UDPChannel* udpChannel;
+  unsigned udpHellos;
+
   DesktopWindow *desktop;
 
   unsigned updateCount;
@@ -102,6 +138,24 @@ private:
   struct timeval updateStartTime;
   size_t updateStartPos;
   unsigned long long bpsEstimate;
+
+  bool roundTripPending;
+  struct timeval roundTripStart;
+  int roundTripTime;
+
+  struct timeval lastUpdateEnd;
+  std::vector<unsigned> frameIntervals;
+
+  struct LatencyProbe {
+    rdr::U32 id;
+    struct timeval sent;
+    bool answered;
+  };
+  rdr::U32 nextLatencyProbe;
+  std::list<LatencyProbe> latencyProbes;
+  rfb::LatencyHistogram inputLatency;
+
+  QualityController qualityController;
 };
 
 #endif
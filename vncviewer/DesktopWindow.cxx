@@ -22,12 +22,17 @@
 #endif
 
 #include <assert.h>
+#include <errno.h>
 #include <stdio.h>
 #include <string.h>
 #include <sys/time.h>
 
+#include <algorithm>
+
 #include <rfb/LogWriter.h>
 #include <rfb/CMsgWriter.h>
+#include <rfb/ClientParams.h>
+#include <rfb/Decoder.h>
 
 #include "DesktopWindow.h"
 #include "OptionsDialog.h"
@@ -74,12 +79,13 @@ static rfb::LogWriter vlog("DesktopWindow");
 DesktopWindow::DesktopWindow(int w, int h, const char *name,
                              const rfb::PixelFormat& serverPF,
                              CConn* cc_)
-  : Fl_Window(w, h), cc(cc_), offscreen(NULL), overlay(NULL),
+  : Fl_Window(w, h), cc(cc_), offscreen(NULL), offscreenValid(false),
+    overlay(NULL),
     firstUpdate(true),
     delayedFullscreen(false), delayedDesktopSize(false),
     keyboardGrabbed(false), mouseGrabbed(false),
     statsLastUpdates(0), statsLastPixels(0), statsLastPosition(0),
-    statsGraph(NULL)
+    drawTime(0), drawCount(0), statsFile(NULL), statsGraph(NULL)
 {
   Fl_Group* group;
 
@@ -189,9 +195,20 @@ DesktopWindow::DesktopWindow(int w, int h, const char *name,
     fullscreen_on();
   }
 
+  if (strlen(statsLog) != 0) {
+    statsFile = fopen(statsLog, "a");
+    if (statsFile == NULL)
+      vlog.error(_("Failed to open %s: %s"), (const char*)statsLog,
+                 strerror(errno));
+    else
+      writeStatsHeader();
+  }
+
   // Throughput graph for debugging
-  if (vlog.getLevel() >= LogWriter::LEVEL_DEBUG) {
+  if ((vlog.getLevel() >= LogWriter::LEVEL_DEBUG) || (statsFile != NULL)) {
     memset(&stats, 0, sizeof(stats));
+    memset(&statsLastRects, 0, sizeof(statsLastRects));
+    memset(&statsLastDecodeTime, 0, sizeof(statsLastDecodeTime));
     Fl::add_timeout(0, handleStatsTimeout, this);
   }
 
@@ -227,6 +244,9 @@ DesktopWindow::~DesktopWindow()
 
   delete statsGraph;
 
+  if (statsFile != NULL)
+    fclose(statsFile);
+
   // FLTK automatically deletes all child widgets, so we shouldn't touch
   // them ourselves here
 }
@@ -274,7 +294,9 @@ void DesktopWindow::resizeFramebuffer(int new_w, int new_h)
 {
   bool maximized;
 
-  if ((new_w == viewport->w()) && (new_h == viewport->h()))
+  // A scaled viewport rarely has the framebuffer's size
+  if (!scaleToWindow &&
+      (new_w == viewport->w()) && (new_h == viewport->h()))
     return;
 
   maximized = false;
@@ -314,8 +336,8 @@ void DesktopWindow::resizeFramebuffer(int new_w, int new_h)
 
   // If we're letting the viewport match the window perfectly, then
   // keep things that way for the new size, otherwise just keep things
-  // like they are.
-  if (!fullscreen_active() && !maximized) {
+  // like they are. A scaled viewport follows the window instead.
+  if (!scaleToWindow && !fullscreen_active() && !maximized) {
     if ((w() == viewport->w()) && (h() == viewport->h()))
       size(new_w, new_h);
     else {
@@ -327,7 +349,9 @@ void DesktopWindow::resizeFramebuffer(int new_w, int new_h)
     }
   }
 
-  viewport->size(new_w, new_h);
+  // repositionWidgets() figures out the size of a scaled viewport
+  if (!scaleToWindow)
+    viewport->size(new_w, new_h);
 
   repositionWidgets();
 }
@@ -341,12 +365,19 @@ void DesktopWindow::setCursor(int width, int height,
 }
 
 
-void DesktopWindow::setCursorPos(const rfb::Point& pos)
+void DesktopWindow::setCursorPos(const rfb::Point& fbPos)
 {
+  rfb::Point pos;
+
   if (!mouseGrabbed) {
     // Do nothing if we do not have the mouse captured.
     return;
   }
+
+  // The framebuffer might be scaled
+  pos.x = fbPos.x * viewport->w() / cc->server.width();
+  pos.y = fbPos.y * viewport->h() / cc->server.height();
+
 #if defined(WIN32)
   SetCursorPos(pos.x + x_root() + viewport->x(),
                pos.y + y_root() + viewport->y());
@@ -392,15 +423,22 @@ void DesktopWindow::draw()
 
   int X, Y, W, H;
 
+  struct timeval start, end;
+
+  gettimeofday(&start, NULL);
+
   // X11 needs an off screen buffer for compositing to avoid flicker,
   // and alpha blending doesn't work for windows on Win32
 #if !defined(__APPLE__)
 
-  // Adjust offscreen surface dimensions
+  // Adjust offscreen surface dimensions. It is fine for it to be larger
+  // than the window, so there is no need to recreate it when shrinking.
   if ((offscreen == NULL) ||
-      (offscreen->width() != w()) || (offscreen->height() != h())) {
+      (offscreen->width() < w()) || (offscreen->height() < h())) {
     delete offscreen;
     offscreen = new Surface(w(), h());
+    // Nothing useful in it yet
+    offscreenValid = false;
   }
 
 #endif
@@ -412,92 +450,103 @@ void DesktopWindow::draw()
   // Full redraw?
   redraw = (damage() & ~FL_DAMAGE_CHILD);
 
-  // Simplify the clip region to a simple rectangle in order to
-  // properly draw all the layers even if they only partially overlap
-  if (redraw)
-    X = Y = 0;
-  else
-    fl_clip_box(0, 0, W, H, X, Y, W, H);
-  fl_push_no_clip();
-  fl_push_clip(X, Y, W, H);
-
-  // Redraw background only on full redraws
-  if (redraw) {
-    if (offscreen)
-      offscreen->clear(40, 40, 40);
+  if (offscreen) {
+    rfb::Rect area;
+    rfb::Region changed, flushed;
+    std::vector<rfb::Rect> rects;
+    std::vector<rfb::Rect>::const_iterator iter;
+
+    area.setXYWH(0, 0, W, H);
+
+    // Every layer keeps track of what it has changed, so only those
+    // areas need to be composited again. Exposures are served straight
+    // from the offscreen surface.
+    changed = viewport->getChangedArea();
+    changed.assign_union(overlayDamage);
+    changed.assign_union(statsGraphDamage);
+
+    if (!offscreenValid ||
+        (damage() & ~(FL_DAMAGE_CHILD | FL_DAMAGE_EXPOSE)))
+      changed.reset(area);
     else
-      fl_rectf(0, 0, W, H, 40, 40, 40);
-  }
+      changed.assign_intersect(rfb::Region(area));
+
+    overlayDamage.clear();
+    statsGraphDamage.clear();
+
+    changed.get_rects(&rects);
+    for (iter = rects.begin(); iter != rects.end(); ++iter)
+      composite(*iter);
 
-  if (offscreen) {
-    viewport->draw(offscreen);
     viewport->clear_damage();
+    offscreenValid = true;
+
+    flushed = changed;
+    if (damage() & FL_DAMAGE_EXPOSE) {
+      fl_clip_box(0, 0, W, H, X, Y, W, H);
+      flushed.assign_union(rfb::Region(rfb::Rect(X, Y, X + W, Y + H)));
+    }
+
+    // Flush offscreen surface to screen
+    flushed.get_rects(&rects);
+    for (iter = rects.begin(); iter != rects.end(); ++iter) {
+      offscreen->draw(iter->tl.x, iter->tl.y, iter->tl.x, iter->tl.y,
+                      iter->width(), iter->height());
+    }
   } else {
+    bool layers;
+    rfb::Rect r;
+
+    // Simplify the clip region to a simple rectangle in order to
+    // properly draw all the layers even if they only partially overlap
     if (redraw)
-      draw_child(*viewport);
+      X = Y = 0;
     else
-      update_child(*viewport);
-  }
+      fl_clip_box(0, 0, W, H, X, Y, W, H);
+    fl_push_no_clip();
+    fl_push_clip(X, Y, W, H);
 
-  // Debug graph (if active)
-  if (statsGraph) {
-    int ox, oy, ow, oh;
+    // Anything under a changed layer has to be drawn again as well
+    layers = !overlayDamage.is_empty() || !statsGraphDamage.is_empty();
 
-    ox = X = w() - statsGraph->width() - 30;
-    oy = Y = h() - statsGraph->height() - 30;
-    ow = statsGraph->width();
-    oh = statsGraph->height();
+    overlayDamage.clear();
+    statsGraphDamage.clear();
 
-    fl_clip_box(ox, oy, ow, oh, ox, oy, ow, oh);
+    // Redraw background only on full redraws
+    if (redraw || layers)
+      fl_rectf(X, Y, W, H, 40, 40, 40);
 
-    if ((ow != 0) && (oh != 0)) {
-      if (offscreen)
-        statsGraph->blend(offscreen, ox - X, oy - Y, ox, oy, ow, oh, 204);
-      else
-        statsGraph->blend(ox - X, oy - Y, ox, oy, ow, oh, 204);
-    }
-  }
+    if (redraw || layers)
+      draw_child(*viewport);
+    else
+      update_child(*viewport);
 
-  // Overlay (if active)
-  if (overlay) {
-    int ox, oy, ow, oh;
-    int sx, sy, sw, sh;
+    // Debug graph (if active)
+    if (statsGraph) {
+      int ox, oy, ow, oh;
 
-    // Make sure it's properly seen by adjusting it relative to the
-    // primary screen rather than the entire window
-    if (fullscreen_active() && fullScreenAllMonitors) {
-      assert(Fl::screen_count() >= 1);
-      Fl::screen_xywh(sx, sy, sw, sh, 0);
-    } else {
-      sx = 0;
-      sy = 0;
-      sw = w();
+      r = statsGraphRect();
+      fl_clip_box(r.tl.x, r.tl.y, r.width(), r.height(), ox, oy, ow, oh);
+
+      if ((ow != 0) && (oh != 0))
+        statsGraph->blend(ox - r.tl.x, oy - r.tl.y, ox, oy, ow, oh, 204);
     }
 
-    ox = X = sx + (sw - overlay->width()) / 2;
-    oy = Y = sy + 50;
-    ow = overlay->width();
-    oh = overlay->height();
+    // Overlay (if active)
+    if (overlay) {
+      int ox, oy, ow, oh;
 
-    fl_clip_box(ox, oy, ow, oh, ox, oy, ow, oh);
+      r = overlayRect();
+      fl_clip_box(r.tl.x, r.tl.y, r.width(), r.height(), ox, oy, ow, oh);
 
-    if ((ow != 0) && (oh != 0)) {
-      if (offscreen)
-        overlay->blend(offscreen, ox - X, oy - Y, ox, oy, ow, oh, overlayAlpha);
-      else
-        overlay->blend(ox - X, oy - Y, ox, oy, ow, oh, overlayAlpha);
+      if ((ow != 0) && (oh != 0))
+        overlay->blend(ox - r.tl.x, oy - r.tl.y, ox, oy, ow, oh, overlayAlpha);
     }
-  }
 
-  // Flush offscreen surface to screen
-  if (offscreen) {
-    fl_clip_box(0, 0, w(), h(), X, Y, W, H);
-    offscreen->draw(X, Y, X, Y, W, H);
+    fl_pop_clip();
+    fl_pop_clip();
   }
 
-  fl_pop_clip();
-  fl_pop_clip();
-
   // Finally the scrollbars
 
   if (redraw) {
@@ -507,6 +556,98 @@ void DesktopWindow::draw()
     update_child(*hscroll);
     update_child(*vscroll);
   }
+
+  gettimeofday(&end, NULL);
+  drawTime += (end.tv_sec - start.tv_sec) * 1000000ULL +
+              (end.tv_usec - start.tv_usec);
+  drawCount++;
+
+  cc->frameDrawn();
+}
+
+// Draws all layers for a part of the window to the offscreen surface
+
+void DesktopWindow::composite(const rfb::Rect& r)
+{
+  rfb::Rect lr, vr;
+
+  // Background is only visible outside the viewport
+  vr.setXYWH(viewport->x(), viewport->y(), viewport->w(), viewport->h());
+  if (!r.enclosed_by(vr))
+    offscreen->fill(r.tl.x, r.tl.y, r.width(), r.height(), 40, 40, 40);
+
+  viewport->draw(offscreen, r.tl.x, r.tl.y, r.width(), r.height());
+
+  // Debug graph (if active)
+  if (statsGraph) {
+    lr = statsGraphRect();
+    vr = lr.intersect(r);
+    if (!vr.is_empty()) {
+      statsGraph->blend(offscreen, vr.tl.x - lr.tl.x, vr.tl.y - lr.tl.y,
+                        vr.tl.x, vr.tl.y, vr.width(), vr.height(), 204);
+    }
+  }
+
+  // Overlay (if active)
+  if (overlay) {
+    lr = overlayRect();
+    vr = lr.intersect(r);
+    if (!vr.is_empty()) {
+      overlay->blend(offscreen, vr.tl.x - lr.tl.x, vr.tl.y - lr.tl.y,
+                     vr.tl.x, vr.tl.y, vr.width(), vr.height(),
+                     overlayAlpha);
+    }
+  }
+}
+
+// Marks an area that a layer on top of the viewport has changed
+
+void DesktopWindow::damageLayer(rfb::Region* layer, const rfb::Rect& r)
+{
+  if (r.is_empty())
+    return;
+
+  layer->assign_union(rfb::Region(r));
+  damage(FL_DAMAGE_CHILD, r.tl.x, r.tl.y, r.width(), r.height());
+}
+
+rfb::Rect DesktopWindow::overlayRect()
+{
+  rfb::Rect r;
+  int sx, sy, sw, sh;
+
+  if (!overlay)
+    return r;
+
+  // Make sure it's properly seen by adjusting it relative to the
+  // primary screen rather than the entire window
+  if (fullscreen_active() && fullScreenAllMonitors) {
+    assert(Fl::screen_count() >= 1);
+    Fl::screen_xywh(sx, sy, sw, sh, 0);
+  } else {
+    sx = 0;
+    sy = 0;
+    sw = w();
+  }
+
+  r.setXYWH(sx + (sw - overlay->width()) / 2, sy + 50,
+            overlay->width(), overlay->height());
+
+  return r;
+}
+
+rfb::Rect DesktopWindow::statsGraphRect()
+{
+  rfb::Rect r;
+
+  if (!statsGraph)
+    return r;
+
+  r.setXYWH(w() - statsGraph->width() - 30,
+            h() - statsGraph->height() - 30,
+            statsGraph->width(), statsGraph->height());
+
+  return r;
 }
 
 
@@ -644,6 +785,7 @@ void DesktopWindow::setOverlay(const char* text, ...)
   unsigned char* a;
   const unsigned char* b;
 
+  damageLayer(&overlayDamage, overlayRect());
   delete overlay;
   Fl::remove_timeout(updateOverlay, this);
 
@@ -725,6 +867,8 @@ void DesktopWindow::updateOverlay(void *data)
 
   self = (DesktopWindow*)data;
 
+  self->damageLayer(&self->overlayDamage, self->overlayRect());
+
   elapsed = msSince(&self->overlayStart);
 
   if (elapsed < 500) {
@@ -740,8 +884,6 @@ void DesktopWindow::updateOverlay(void *data)
     delete self->overlay;
     self->overlay = NULL;
   }
-
-  self->damage(FL_DAMAGE_USER1);
 }
 
 
@@ -792,6 +934,17 @@ int DesktopWindow::handle(int event)
     }
     // Continue processing so that the viewport also gets mouse events
     break;
+
+  case FL_SHOW:
+  case FL_HIDE:
+    {
+      int ret;
+
+      // We get these when the window is minimized or restored
+      ret = Fl_Window::handle(event);
+      updateViewport();
+      return ret;
+    }
   }
 
   return Fl_Window::handle(event);
@@ -1249,6 +1402,31 @@ void DesktopWindow::repositionWidgets()
 {
   int new_x, new_y;
 
+  // Viewport size
+
+  if (scaleToWindow) {
+    int fb_w, fb_h, new_w, new_h;
+
+    fb_w = cc->server.width();
+    fb_h = cc->server.height();
+
+    // Fit the entire framebuffer in the window, keeping the aspect
+    // ratio
+    if (w() * fb_h < h() * fb_w) {
+      new_w = w();
+      new_h = __rfbmax(fb_h * w() / fb_w, 1);
+    } else {
+      new_w = __rfbmax(fb_w * h() / fb_h, 1);
+      new_h = h();
+    }
+
+    if ((new_w != viewport->w()) || (new_h != viewport->h()))
+      damage(FL_DAMAGE_SCROLL);
+
+    // Also needed if only the framebuffer has changed size
+    viewport->size(new_w, new_h);
+  }
+
   // Viewport position
 
   new_x = viewport->x();
@@ -1329,6 +1507,8 @@ void DesktopWindow::repositionWidgets()
                  0, viewport->h());
   hscroll->value(hscroll->clamp(hscroll->value()));
   vscroll->value(vscroll->clamp(vscroll->value()));
+
+  updateViewport();
 }
 
 void DesktopWindow::handleClose(Fl_Widget *wnd, void *data)
@@ -1386,6 +1566,43 @@ void DesktopWindow::scrollTo(int x, int y)
 
   viewport->position(x, y);
   damage(FL_DAMAGE_SCROLL);
+
+  updateViewport();
+}
+
+// updateViewport() tells the server which part of the framebuffer is
+// currently visible, so that it can prioritise that part
+
+void DesktopWindow::updateViewport()
+{
+  rfb::Rect rect;
+  int fb_w, fb_h;
+
+  // Nothing is visible when we are minimized
+  if (!visible_r()) {
+    cc->setViewport(rfb::Region());
+    return;
+  }
+
+  rect.setXYWH(0, 0,
+               w() - (vscroll->visible() ? vscroll->w() : 0),
+               h() - (hscroll->visible() ? hscroll->h() : 0));
+  rect = rect.intersect(rfb::Rect(viewport->x(), viewport->y(),
+                                  viewport->x() + viewport->w(),
+                                  viewport->y() + viewport->h()));
+  rect = rect.translate(rfb::Point(-viewport->x(), -viewport->y()));
+
+  // The viewport might be scaled, so round outwards
+  fb_w = cc->server.width();
+  fb_h = cc->server.height();
+  if ((viewport->w() != fb_w) || (viewport->h() != fb_h)) {
+    rect.tl.x = rect.tl.x * fb_w / viewport->w();
+    rect.tl.y = rect.tl.y * fb_h / viewport->h();
+    rect.br.x = (rect.br.x * fb_w + viewport->w() - 1) / viewport->w();
+    rect.br.y = (rect.br.y * fb_h + viewport->h() - 1) / viewport->h();
+  }
+
+  cc->setViewport(rfb::Region(rect));
 }
 
 void DesktopWindow::handleScroll(Fl_Widget *widget, void *data)
@@ -1445,6 +1662,84 @@ void DesktopWindow::handleEdgeScroll(void *data)
   Fl::repeat_timeout(EDGE_SCROLL_SECONDS_PER_FRAME, handleEdgeScroll, data);
 }
 
+// getEncodingInfo() describes the encoding settings we are currently
+// asking the server for
+void DesktopWindow::getEncodingInfo(char *buffer, size_t len)
+{
+  const char *subsampling;
+  size_t used;
+
+  switch (cc->getSubsampling()) {
+  case subsampleNone:
+    subsampling = "4:4:4";
+    break;
+  case subsampleGray:
+    subsampling = "gray";
+    break;
+  case subsample2X:
+    subsampling = "4:2:2";
+    break;
+  case subsample4X:
+    subsampling = "4:2:0";
+    break;
+  case subsample8X:
+    subsampling = "4:1:1";
+    break;
+  case subsample16X:
+    subsampling = "4:1:0";
+    break;
+  default:
+    subsampling = NULL;
+  }
+
+  if (cc->getFineQualityLevel() >= 0)
+    snprintf(buffer, len, "JPEG q%d", cc->getFineQualityLevel());
+  else if (cc->getQualityLevel() >= 0)
+    snprintf(buffer, len, "JPEG level %d", cc->getQualityLevel());
+  else
+    snprintf(buffer, len, "No JPEG");
+  used = strlen(buffer);
+
+  if (subsampling != NULL) {
+    snprintf(buffer + used, len - used, " %s", subsampling);
+    used = strlen(buffer);
+  }
+
+  if (cc->getCompressLevel() >= 0) {
+    snprintf(buffer + used, len - used, ", zlib %d",
+             cc->getCompressLevel());
+    used = strlen(buffer);
+  }
+
+  if (!fullColour)
+    snprintf(buffer + used, len - used, ", low colour");
+}
+
+// writeStatsHeader() writes the column names for the statistics log
+void DesktopWindow::writeStatsHeader()
+{
+  fprintf(statsFile, "time,updates_per_sec,pixels_per_sec,bits_per_sec,"
+                     "decode_busy_pct,draw_us,round_trip_ms,"
+                     "update_interval_p50_ms,update_interval_p95_ms,"
+                     "update_interval_p99_ms");
+  for (int i = 0; i <= encodingMax; i++) {
+    if (!Decoder::supported(i))
+      continue;
+    fprintf(statsFile, ",%s_rects,%s_decode_us",
+            encodingName(i), encodingName(i));
+  }
+  fprintf(statsFile, "\n");
+  fflush(statsFile);
+}
+
+static unsigned percentile(const std::vector<unsigned>& sorted,
+                           unsigned pct)
+{
+  if (sorted.empty())
+    return 0;
+  return sorted[__rfbmin(sorted.size() * pct / 100, sorted.size() - 1)];
+}
+
 void DesktopWindow::handleStatsTimeout(void *data)
 {
   DesktopWindow *self = (DesktopWindow*)data;
@@ -1454,10 +1749,23 @@ void DesktopWindow::handleStatsTimeout(void *data)
   unsigned updates, pixels, pos;
   unsigned elapsed;
 
-  const unsigned statsWidth = 200;
-  const unsigned statsHeight = 100;
+  unsigned rects[encodingMax+1];
+  unsigned long long decodeTime[encodingMax+1];
+  unsigned long long busyTime, maxTime;
+  int busiestEncoding;
+  unsigned busy;
+
+  unsigned drawUs;
+  int roundTrip;
+
+  std::vector<unsigned> intervals;
+  unsigned p50, p95, p99;
+
+  const unsigned statsWidth = 240;
+  const unsigned statsHeight = 150;
   const unsigned graphWidth = statsWidth - 10;
-  const unsigned graphHeight = statsHeight - 25;
+  const unsigned graphHeight = statsHeight - 75;
+  const unsigned lineHeight = 13;
 
   Fl_Image_Surface *surface;
   Fl_RGB_Image *image;
@@ -1485,6 +1793,72 @@ void DesktopWindow::handleStatsTimeout(void *data)
   self->statsLastPixels = pixels;
   self->statsLastPosition = pos;
 
+  // Decoding, per encoding and over all threads
+  busyTime = maxTime = 0;
+  busiestEncoding = -1;
+  for (i = 0;i <= (size_t)encodingMax;i++) {
+    unsigned totalRects;
+    unsigned long long totalTime;
+
+    if (!Decoder::supported(i)) {
+      rects[i] = 0;
+      decodeTime[i] = 0;
+      continue;
+    }
+
+    self->cc->getDecodeStats(i, totalRects, totalTime);
+    rects[i] = totalRects - self->statsLastRects[i];
+    decodeTime[i] = totalTime - self->statsLastDecodeTime[i];
+    self->statsLastRects[i] = totalRects;
+    self->statsLastDecodeTime[i] = totalTime;
+
+    busyTime += decodeTime[i];
+    if (decodeTime[i] > maxTime) {
+      maxTime = decodeTime[i];
+      busiestEncoding = i;
+    }
+  }
+  busy = busyTime * 100 / (elapsed * 1000ULL * self->cc->getDecoderThreadCount());
+
+  // Drawing to the screen
+  drawUs = 0;
+  if (self->drawCount != 0)
+    drawUs = self->drawTime / self->drawCount;
+  self->drawTime = 0;
+  self->drawCount = 0;
+
+  // Latency, measured by the previous probe
+  roundTrip = self->cc->getRoundTripTime();
+  self->cc->sendRoundTripProbe();
+
+  // Distribution of time between updates
+  self->cc->getFrameIntervals(&intervals);
+  std::sort(intervals.begin(), intervals.end());
+  p50 = percentile(intervals, 50);
+  p95 = percentile(intervals, 95);
+  p99 = percentile(intervals, 99);
+
+  if (self->statsFile != NULL) {
+    fprintf(self->statsFile, "%ld.%03ld,%u,%u,%u,%u,%u,%d,%u,%u,%u",
+            (long)self->statsLastTime.tv_sec,
+            (long)self->statsLastTime.tv_usec / 1000,
+            self->stats[statsCount-1].ups, self->stats[statsCount-1].pps,
+            self->stats[statsCount-1].bps * 8, busy, drawUs, roundTrip,
+            p50, p95, p99);
+    for (i = 0;i <= (size_t)encodingMax;i++) {
+      if (!Decoder::supported(i))
+        continue;
+      fprintf(self->statsFile, ",%u,%llu", rects[i], decodeTime[i]);
+    }
+    fprintf(self->statsFile, "\n");
+    fflush(self->statsFile);
+  }
+
+  if (vlog.getLevel() < LogWriter::LEVEL_DEBUG) {
+    Fl::repeat_timeout(0.5, handleStatsTimeout, data);
+    return;
+  }
+
 #if !defined(WIN32) && !defined(__APPLE__)
   // FLTK < 1.3.5 crashes if fl_gc is unset
   if (!fl_gc)
@@ -1554,6 +1928,37 @@ void DesktopWindow::handleStatsTimeout(void *data)
            buffer, sizeof(buffer), 3);
   fl_draw(buffer, 5 + (statsWidth-10)*2/3, statsHeight - 5);
 
+  fl_color(FL_WHITE);
+
+  self->getEncodingInfo(buffer, sizeof(buffer));
+  fl_draw(buffer, 5, statsHeight - 5 - lineHeight);
+
+  if (busiestEncoding == -1)
+    snprintf(buffer, sizeof(buffer), "Decode: idle");
+  else
+    snprintf(buffer, sizeof(buffer),
+             "Decode: %s %.2f ms/rect, %u%% of %d thread(s)",
+             encodingName(busiestEncoding),
+             (double)decodeTime[busiestEncoding] / rects[busiestEncoding] / 1000,
+             busy, (int)self->cc->getDecoderThreadCount());
+  fl_draw(buffer, 5, statsHeight - 5 - lineHeight * 2);
+
+  if (roundTrip < 0)
+    snprintf(buffer, sizeof(buffer), "Draw: %.2f ms, round trip: -",
+             (double)drawUs / 1000);
+  else
+    snprintf(buffer, sizeof(buffer), "Draw: %.2f ms, round trip: %d ms",
+             (double)drawUs / 1000, roundTrip);
+  fl_draw(buffer, 5, statsHeight - 5 - lineHeight * 3);
+
+  if (intervals.empty())
+    snprintf(buffer, sizeof(buffer), "Update interval: -");
+  else
+    snprintf(buffer, sizeof(buffer),
+             "Update interval: %u / %u / %u ms (p50/95/99)",
+             p50, p95, p99);
+  fl_draw(buffer, 5, statsHeight - 5 - lineHeight * 4);
+
   image = surface->image();
   delete surface;
 
@@ -1563,9 +1968,7 @@ void DesktopWindow::handleStatsTimeout(void *data)
   self->statsGraph = new Surface(image);
   delete image;
 
-  self->damage(FL_DAMAGE_CHILD, self->w() - statsWidth - 30,
-               self->h() - statsHeight - 30,
-               statsWidth, statsHeight);
+  self->damageLayer(&self->statsGraphDamage, self->statsGraphRect());
 
   Fl::repeat_timeout(0.5, handleStatsTimeout, data);
 }
@@ -22,10 +22,13 @@
 
 #include <map>
 
+#include <stdio.h>
 #include <sys/time.h>
 
 #include <rfb/Rect.h>
 #include <rfb/Pixel.h>
+#include <rfb/Region.h>
+#include <rfb/encodings.h>
 
 #include <FL/Fl_Window.H>
 
@@ -92,6 +95,11 @@ private:
   void setOverlay(const char *text, ...) __printf_attr(2, 3);
   static void updateOverlay(void *data);
 
+  void composite(const rfb::Rect& r);
+  void damageLayer(rfb::Region* layer, const rfb::Rect& r);
+  rfb::Rect overlayRect();
+  rfb::Rect statsGraphRect();
+
   static int fltkHandle(int event, Fl_Window *win);
 
   void grabKeyboard();
@@ -116,9 +124,12 @@ private:
   static void handleFullscreenTimeout(void *data);
 
   void scrollTo(int x, int y);
+  void updateViewport();
   static void handleScroll(Fl_Widget *wnd, void *data);
   static void handleEdgeScroll(void *data);
 
+  void getEncodingInfo(char *buffer, size_t len);
+  void writeStatsHeader();
   static void handleStatsTimeout(void *data);
 
 private:
@@ -126,9 +137,11 @@ private:
   Fl_Scrollbar *hscroll, *vscroll;
   Viewport *viewport;
   Surface *offscreen;
+  bool offscreenValid;
   Surface *overlay;
   unsigned char overlayAlpha;
   struct timeval overlayStart;
+  rfb::Region overlayDamage;
 
   bool firstUpdate;
   bool delayedFullscreen;
@@ -148,8 +161,17 @@ private:
   unsigned statsLastUpdates;
   unsigned statsLastPixels;
   unsigned statsLastPosition;
+  unsigned statsLastRects[rfb::encodingMax+1];
+  unsigned long long statsLastDecodeTime[rfb::encodingMax+1];
+
+  // Time spent in draw() since the last statistics update (in us)
+  unsigned long long drawTime;
+  unsigned drawCount;
+
+  FILE *statsFile;
 
   Surface *statsGraph;
+  rfb::Region statsGraphDamage;
 };
 
 #endif
@@ -17,6 +17,7 @@
  */
 
 #include <assert.h>
+#include <string.h>
 
 #if !defined(WIN32) && !defined(__APPLE__)
 #include <sys/ipc.h>
@@ -26,6 +27,7 @@
 #include <FL/Fl.H>
 #include <FL/x.H>
 
+#include <rfb/ImageScaler.h>
 #include <rfb/LogWriter.h>
 #include <rdr/Exception.h>
 
@@ -33,101 +35,360 @@
 
 static rfb::LogWriter vlog("PlatformPixelBuffer");
 
+// Every upload has a fixed cost, which we count as this many pixels
+// when deciding if it is cheaper to upload the bounding box of the
+// damage instead of each rect
+static const int uploadCost = 16384;
+
 PlatformPixelBuffer::PlatformPixelBuffer(int width, int height) :
   FullFramePixelBuffer(rfb::PixelFormat(32, 24, false, true,
                                         255, 255, 255, 16, 8, 0),
                        0, 0, NULL, 0),
-  Surface(width, height)
+  Surface(width, height), damage(width, height),
+  imageData(NULL), imageStride(0), sourceData(NULL), scaler(NULL),
+  displayDivisor(1),
+  damageCallback(NULL), damageCallbackData(NULL)
+#if !defined(WIN32) && !defined(__APPLE__)
+  , shmEventBase(0)
+#endif
+{
+  initImage();
+
+  // The decoders cannot write to an image that the X server might be
+  // reading, so they need a buffer of their own if we alternate
+  if (imageData == NULL) {
+    allocSource(width, height);
+    setBuffer(width, height, sourceData, width);
+  } else {
+    setBuffer(width, height, imageData, imageStride);
+  }
+}
+
+PlatformPixelBuffer::PlatformPixelBuffer(int width, int height,
+                                         int scaledWidth, int scaledHeight,
+                                         unsigned int filter) :
+  FullFramePixelBuffer(rfb::PixelFormat(32, 24, false, true,
+                                        255, 255, 255, 16, 8, 0),
+                       0, 0, NULL, 0),
+  Surface(scaledWidth, scaledHeight), damage(width, height),
+  imageData(NULL), imageStride(0), sourceData(NULL), scaler(NULL),
+  displayDivisor(1),
+  damageCallback(NULL), damageCallbackData(NULL)
 #if !defined(WIN32) && !defined(__APPLE__)
-  , shminfo(NULL), xim(NULL)
+  , shmEventBase(0)
 #endif
+{
+  initImage();
+
+  // The decoders write to a buffer of their own, which we then
+  // scale to the image
+  allocSource(width, height);
+
+  setBuffer(width, height, sourceData, width);
+
+  setupScaler(scaledWidth, scaledHeight, filter);
+}
+
+void PlatformPixelBuffer::setScaledSize(int scaledWidth, int scaledHeight,
+                                        unsigned int filter)
+{
+  assert(scaler);
+
+  // The pixel data stays, but everything else depends on the size of
+  // the Surface
+  freeImage();
+  Surface::dealloc();
+  Surface::w = scaledWidth;
+  Surface::h = scaledHeight;
+  Surface::alloc();
+  initImage();
+
+  delete scaler;
+  scaler = NULL;
+  setupScaler(scaledWidth, scaledHeight, filter);
+
+  // Everything has to be scaled again
+  damage.add(getRect());
+}
+
+void PlatformPixelBuffer::setupScaler(int scaledWidth, int scaledHeight,
+                                      unsigned int filter)
+{
+  vlog.debug("Scaling %dx%d to %dx%d", width(), height(),
+             scaledWidth, scaledHeight);
+
+  scaler = new rfb::ImageScaler(width(), height(),
+                                scaledWidth, scaledHeight, filter);
+
+  // The decoders can skip detail that will be lost in the scaling
+  displayDivisor = width() / scaledWidth;
+  if (height() / scaledHeight < displayDivisor)
+    displayDivisor = height() / scaledHeight;
+  if (displayDivisor < 1)
+    displayDivisor = 1;
+}
+
+void PlatformPixelBuffer::initImage()
 {
 #if !defined(WIN32) && !defined(__APPLE__)
-  if (!setupShm(width, height)) {
-    xim = XCreateImage(fl_display, CopyFromParent, 32,
-                       ZPixmap, 0, 0, width, height, 32, 0);
-    if (!xim)
+  shminfo[0] = shminfo[1] = NULL;
+  xim[0] = xim[1] = NULL;
+  shmBusy[0] = shmBusy[1] = false;
+
+  if (setupShm(Surface::width(), Surface::height())) {
+    // None of the images is guaranteed to have the latest pixels
+    imageData = NULL;
+    imageStride = xim[0]->bytes_per_line / (getPF().bpp/8);
+  } else {
+    xim[0] = XCreateImage(fl_display, CopyFromParent, 32,
+                          ZPixmap, 0, 0, Surface::width(), Surface::height(),
+                          32, 0);
+    if (!xim[0])
       throw rdr::Exception("XCreateImage");
 
-    xim->data = (char*)malloc(xim->bytes_per_line * xim->height);
-    if (!xim->data)
+    xim[0]->data = (char*)malloc(xim[0]->bytes_per_line * xim[0]->height);
+    if (!xim[0]->data)
       throw rdr::Exception("malloc");
 
     vlog.debug("Using standard XImage");
-  }
 
-  setBuffer(width, height, (rdr::U8*)xim->data,
-            xim->bytes_per_line / (getPF().bpp/8));
+    imageData = (rdr::U8*)xim[0]->data;
+    imageStride = xim[0]->bytes_per_line / (getPF().bpp/8);
+  }
 
   // On X11, the Pixmap backing this Surface is uninitialized.
   clear(0, 0, 0);
 #else
-  setBuffer(width, height, (rdr::U8*)Surface::data, width);
+  imageData = (rdr::U8*)Surface::data;
+  imageStride = Surface::width();
 #endif
 }
 
+void PlatformPixelBuffer::allocSource(int width, int height)
+{
+  size_t size;
+
+  size = (size_t)width * height * (getPF().bpp/8);
+  sourceData = new rdr::U8[size];
+  memset(sourceData, 0, size);
+}
+
 PlatformPixelBuffer::~PlatformPixelBuffer()
+{
+  freeImage();
+
+  delete scaler;
+  delete [] sourceData;
+}
+
+void PlatformPixelBuffer::freeImage()
 {
 #if !defined(WIN32) && !defined(__APPLE__)
-  if (shminfo) {
-    vlog.debug("Freeing shared memory XImage");
-    XShmDetach(fl_display, shminfo);
-    shmdt(shminfo->shmaddr);
-    shmctl(shminfo->shmid, IPC_RMID, 0);
-    delete shminfo;
-    shminfo = NULL;
+  if (shminfo[0]) {
+    shmBuffers.remove(this);
+    if (shmBuffers.empty())
+      Fl::remove_system_handler(handleSystemEvent);
+
+    // The X server might still be reading from the segments
+    if (shmBusy[0] || shmBusy[1])
+      XSync(fl_display, False);
+
+    vlog.debug("Freeing shared memory XImages");
+    for (int i = 0; i < 2; i++)
+      XShmDetach(fl_display, shminfo[i]);
+    freeShm();
   }
 
   // XDestroyImage() will free(xim->data) if appropriate
-  if (xim)
-    XDestroyImage(xim);
-  xim = NULL;
+  if (xim[0])
+    XDestroyImage(xim[0]);
+  xim[0] = NULL;
 #endif
 }
 
 void PlatformPixelBuffer::commitBufferRW(const rfb::Rect& r)
 {
   FullFramePixelBuffer::commitBufferRW(r);
-  mutex.lock();
-  damage.assign_union(rfb::Region(r));
-  mutex.unlock();
+  // Called from all decoder threads, so this must not serialise them
+  damage.add(r);
 }
 
-rfb::Rect PlatformPixelBuffer::getDamage(void)
+void PlatformPixelBuffer::setDamageCallback(void (*cb)(void*), void* data)
 {
-  rfb::Rect r;
+  damageCallback = cb;
+  damageCallbackData = data;
+}
 
-  mutex.lock();
-  r = damage.get_bounding_rect();
-  damage.clear();
-  mutex.unlock();
+rfb::Region PlatformPixelBuffer::getDamage(void)
+{
+  rfb::Region region;
+  std::vector<rfb::Rect> rects;
+  std::vector<rfb::Rect>::const_iterator iter;
+  rfb::Rect bounds;
+  int area;
 
 #if !defined(WIN32) && !defined(__APPLE__)
-  if (r.width() == 0 || r.height() == 0)
-    return r;
+  int segment;
+
+  // Fill whichever segment the X server isn't reading. If it is busy
+  // with both then the changes will be picked up once it is done.
+  segment = 0;
+  if (shminfo[0]) {
+    if (!shmBusy[0])
+      segment = 0;
+    else if (!shmBusy[1])
+      segment = 1;
+    else
+      return region;
+  }
+#endif
+
+  damage.drain(&region);
+
+  if (region.is_empty())
+    return region;
+
+  // Only the scaled image can be displayed
+  if (scaler)
+    region = getDestRegion(region);
+
+  region.get_rects(&rects);
+
+  // Is it cheaper to upload everything in one go?
+  bounds = region.get_bounding_rect();
+  area = 0;
+  for (iter = rects.begin(); iter != rects.end(); ++iter)
+    area += iter->area();
+  if ((bounds.area() - area) < (int)(rects.size() - 1) * uploadCost) {
+    region.reset(bounds);
+    rects.clear();
+    rects.push_back(bounds);
+  }
 
+#if !defined(WIN32) && !defined(__APPLE__)
   GC gc;
+  int stride;
+
+  stride = xim[segment]->bytes_per_line / (getPF().bpp/8);
 
   gc = XCreateGC(fl_display, pixmap, 0, NULL);
-  if (shminfo) {
-    XShmPutImage(fl_display, pixmap, gc, xim,
-                 r.tl.x, r.tl.y, r.tl.x, r.tl.y,
-                 r.width(), r.height(), False);
-    // Need to make sure the X server has finished reading the
-    // shared memory before we return
-    XSync(fl_display, False);
-  } else {
-    XPutImage(fl_display, pixmap, gc, xim,
-              r.tl.x, r.tl.y, r.tl.x, r.tl.y, r.width(), r.height());
+  for (iter = rects.begin(); iter != rects.end(); ++iter) {
+    if (shminfo[0]) {
+      updateImage(*iter, (rdr::U8*)xim[segment]->data, stride);
+      // The X server handles these in order, so we only need to hear
+      // back about the last one
+      XShmPutImage(fl_display, pixmap, gc, xim[segment],
+                   iter->tl.x, iter->tl.y, iter->tl.x, iter->tl.y,
+                   iter->width(), iter->height(),
+                   (iter + 1) == rects.end() ? True : False);
+    } else {
+      if (scaler)
+        updateImage(*iter, imageData, imageStride);
+      XPutImage(fl_display, pixmap, gc, xim[0],
+                iter->tl.x, iter->tl.y, iter->tl.x, iter->tl.y,
+                iter->width(), iter->height());
+    }
   }
   XFreeGC(fl_display, gc);
+
+  // No need to wait for the X server to read the segment. It will be
+  // done before it handles any later drawing from the pixmap, and we
+  // won't touch the segment again until it says it is done.
+  if (shminfo[0])
+    shmBusy[segment] = true;
+#else
+  if (scaler) {
+    for (iter = rects.begin(); iter != rects.end(); ++iter)
+      updateImage(*iter, imageData, imageStride);
+  }
 #endif
 
-  return r;
+  return region;
+}
+
+rfb::Region PlatformPixelBuffer::getDestRegion(const rfb::Region& region)
+{
+  rfb::Region scaled;
+  std::vector<rfb::Rect> rects;
+  std::vector<rfb::Rect>::const_iterator iter;
+
+  region.get_rects(&rects);
+  for (iter = rects.begin(); iter != rects.end(); ++iter)
+    scaled.assign_union(rfb::Region(scaler->getDestRect(*iter)));
+
+  return scaled;
+}
+
+void PlatformPixelBuffer::updateImage(const rfb::Rect& r,
+                                      rdr::U8* data, int stride)
+{
+  const rdr::U8* src;
+  rdr::U8* dst;
+  int bytesPerPixel;
+  int h;
+
+  if (scaler) {
+    scaler->scaleRect(r, sourceData, width(), data, stride);
+    return;
+  }
+
+  bytesPerPixel = getPF().bpp/8;
+
+  src = sourceData + (r.tl.y * width() + r.tl.x) * bytesPerPixel;
+  dst = data + (r.tl.y * stride + r.tl.x) * bytesPerPixel;
+
+  h = r.height();
+  while (h--) {
+    memcpy(dst, src, r.width() * bytesPerPixel);
+    src += width() * bytesPerPixel;
+    dst += stride * bytesPerPixel;
+  }
 }
 
 #if !defined(WIN32) && !defined(__APPLE__)
 
+std::list<PlatformPixelBuffer*> PlatformPixelBuffer::shmBuffers;
+
+int PlatformPixelBuffer::handleSystemEvent(void *event, void *data)
+{
+  XEvent *xevent;
+  XShmCompletionEvent *shmevent;
+  std::list<PlatformPixelBuffer*>::iterator iter;
+
+  xevent = (XEvent*)event;
+  assert(xevent);
+
+  for (iter = shmBuffers.begin(); iter != shmBuffers.end(); ++iter) {
+    PlatformPixelBuffer *self;
+
+    self = *iter;
+
+    if (xevent->type != self->shmEventBase + ShmCompletion)
+      continue;
+
+    shmevent = (XShmCompletionEvent*)xevent;
+
+    for (int i = 0; i < 2; i++) {
+      if (shmevent->shmseg != self->shminfo[i]->shmseg)
+        continue;
+
+      assert(self->shmBusy[i]);
+      self->shmBusy[i] = false;
+
+      // Only interesting if getDamage() has been holding things back
+      if (!self->shmBusy[1 - i])
+        return 1;
+
+      if (self->damage.pending() && (self->damageCallback != NULL))
+        self->damageCallback(self->damageCallbackData);
+
+      return 1;
+    }
+  }
+
+  return 0;
+}
+
 static bool caughtError;
 
 static int XShmAttachErrorHandler(Display *dpy, XErrorEvent *error)
@@ -150,34 +411,41 @@ bool PlatformPixelBuffer::setupShm(int width, int height)
   if (!XShmQueryVersion(fl_display, &major, &minor, &pixmaps))
     return false;
 
-  shminfo = new XShmSegmentInfo;
+  for (int i = 0; i < 2; i++) {
+    shminfo[i] = new XShmSegmentInfo;
+    shminfo[i]->shmaddr = (char*)-1;
 
-  xim = XShmCreateImage(fl_display, CopyFromParent, 32,
-                        ZPixmap, 0, shminfo, width, height);
-  if (!xim)
-    goto free_shminfo;
+    xim[i] = XShmCreateImage(fl_display, CopyFromParent, 32,
+                             ZPixmap, 0, shminfo[i], width, height);
+    if (!xim[i])
+      goto free_shm;
 
-  shminfo->shmid = shmget(IPC_PRIVATE,
-                          xim->bytes_per_line * xim->height,
-                          IPC_CREAT|0600);
-  if (shminfo->shmid == -1)
-    goto free_xim;
+    shminfo[i]->shmid = shmget(IPC_PRIVATE,
+                               xim[i]->bytes_per_line * xim[i]->height,
+                               IPC_CREAT|0600);
+    if (shminfo[i]->shmid == -1)
+      goto free_shm;
 
-  shminfo->shmaddr = xim->data = (char*)shmat(shminfo->shmid, 0, 0);
-  shmctl(shminfo->shmid, IPC_RMID, 0); // to avoid memory leakage
-  if (shminfo->shmaddr == (char *)-1)
-    goto free_xim;
+    shminfo[i]->shmaddr = xim[i]->data = (char*)shmat(shminfo[i]->shmid, 0, 0);
+    shmctl(shminfo[i]->shmid, IPC_RMID, 0); // to avoid memory leakage
+    if (shminfo[i]->shmaddr == (char *)-1)
+      goto free_shm;
 
-  shminfo->readOnly = True;
+    shminfo[i]->readOnly = True;
+  }
 
   // This is the only way we can detect that shared memory won't work
   // (e.g. because we're accessing a remote X11 server)
   caughtError = false;
   old_handler = XSetErrorHandler(XShmAttachErrorHandler);
 
-  if (!XShmAttach(fl_display, shminfo)) {
-    XSetErrorHandler(old_handler);
-    goto free_shmaddr;
+  for (int i = 0; i < 2; i++) {
+    if (!XShmAttach(fl_display, shminfo[i])) {
+      XSetErrorHandler(old_handler);
+      if (i == 1)
+        XShmDetach(fl_display, shminfo[0]);
+      goto free_shm;
+    }
   }
 
   XSync(fl_display, False);
@@ -185,24 +453,43 @@ bool PlatformPixelBuffer::setupShm(int width, int height)
   XSetErrorHandler(old_handler);
 
   if (caughtError)
-    goto free_shmaddr;
+    goto free_shm;
 
-  vlog.debug("Using shared memory XImage");
+  // We want to know when the X server is done with our uploads
+  shmEventBase = XShmGetEventBase(fl_display);
+  if (shmBuffers.empty())
+    Fl::add_system_handler(handleSystemEvent, NULL);
+  shmBuffers.push_back(this);
 
-  return true;
+  vlog.debug("Using shared memory XImages");
 
-free_shmaddr:
-  shmdt(shminfo->shmaddr);
+  return true;
 
-free_xim:
-  XDestroyImage(xim);
-  xim = NULL;
+free_shm:
+  freeShm();
 
-free_shminfo:
-  delete shminfo;
-  shminfo = NULL;
+  return false;
+}
 
-  return 0;
+void PlatformPixelBuffer::freeShm()
+{
+  for (int i = 0; i < 2; i++) {
+    if (shminfo[i] == NULL)
+      continue;
+
+    if (shminfo[i]->shmaddr != (char*)-1)
+      shmdt(shminfo[i]->shmaddr);
+
+    // The data is the shared memory, so it mustn't be freed here
+    if (xim[i]) {
+      xim[i]->data = NULL;
+      XDestroyImage(xim[i]);
+    }
+    xim[i] = NULL;
+
+    delete shminfo[i];
+    shminfo[i] = NULL;
+  }
 }
 
 #endif
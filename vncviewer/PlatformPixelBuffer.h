@@ -28,36 +28,91 @@
 
 #include <list>
 
-#include <os/Mutex.h>
-
 #include <rfb/PixelBuffer.h>
 #include <rfb/Region.h>
+#include <rfb/TileDamage.h>
+
+namespace rfb { class ImageScaler; }
 
 #include "Surface.h"
 
 class PlatformPixelBuffer: public rfb::FullFramePixelBuffer, public Surface {
 public:
   PlatformPixelBuffer(int width, int height);
+  // The pixel data is scaled to the size of the Surface before it is
+  // displayed
+  PlatformPixelBuffer(int width, int height,
+                      int scaledWidth, int scaledHeight,
+                      unsigned int filter);
   ~PlatformPixelBuffer();
 
   virtual void commitBufferRW(const rfb::Rect& r);
+  virtual int getDisplayDivisor() const { return displayDivisor; }
+
+  // setScaledSize() changes the size that the pixel data is scaled
+  // to, without losing the pixel data. Only valid for a scaled buffer.
+  void setScaledSize(int scaledWidth, int scaledHeight,
+                     unsigned int filter);
+  bool isScaled() const { return scaler != NULL; }
+
+  // getDamage() starts copying the changed areas to the Surface and
+  // returns the region that will be updated, in Surface coordinates. The copy might not be
+  // finished when this returns, but anything drawn from the Surface
+  // after this will include it.
+  rfb::Region getDamage(void);
 
-  rfb::Rect getDamage(void);
+  // The callback is called if getDamage() had to hold back some
+  // changes, and they can now be fetched
+  void setDamageCallback(void (*cb)(void*), void* data);
 
   using rfb::FullFramePixelBuffer::width;
   using rfb::FullFramePixelBuffer::height;
 
 protected:
-  os::Mutex mutex;
-  rfb::Region damage;
+  void initImage();
+  void freeImage();
+  void setupScaler(int scaledWidth, int scaledHeight, unsigned int filter);
+  void allocSource(int width, int height);
+  rfb::Region getDestRegion(const rfb::Region& region);
+  void updateImage(const rfb::Rect& r, rdr::U8* data, int stride);
+
+protected:
+  rfb::TileDamage damage;
+
+  // Where the Surface gets its pixels from, unless it alternates
+  // between several images
+  rdr::U8* imageData;
+  int imageStride;
+
+  // Where the decoders write, if that can't be the image itself
+  rdr::U8* sourceData;
+
+  rfb::ImageScaler* scaler;
+  int displayDivisor;
+
+  void (*damageCallback)(void*);
+  void* damageCallbackData;
 
 #if !defined(WIN32) && !defined(__APPLE__)
 protected:
   bool setupShm(int width, int height);
 
+  static int handleSystemEvent(void *event, void *data);
+
+  void freeShm();
+
 protected:
-  XShmSegmentInfo *shminfo;
-  XImage *xim;
+  // Two shared memory segments, so that one can be filled while the X
+  // server reads the other. Without shared memory only the first image
+  // is used.
+  XShmSegmentInfo *shminfo[2];
+  XImage *xim[2];
+
+  int shmEventBase;
+  // Segments the X server hasn't finished reading yet
+  bool shmBusy[2];
+
+  static std::list<PlatformPixelBuffer*> shmBuffers;
 #endif
 };
 
@@ -0,0 +1,177 @@
+/* Copyright (C) 2026 TigerVNC Team
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ * USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <math.h>
+
+#include <rfb/ClientParams.h>
+#include <rfb/util.h>
+
+#include "QualityController.h"
+
+// The JPEG quality used for each of the classical quality levels, as
+// defined by TightJPEGEncoder
+static const int levelQuality[10] = { 15, 29, 41, 42, 62, 77, 79, 86, 92, 100 };
+
+// Throughput that maps to quality 20 and how much each doubling of it
+// adds to the quality
+static const double baseBps = 512000;
+static const double qualityPerDoubling = 12;
+
+static const double minQuality = 10;
+static const double maxQuality = 95;
+
+// Updates slower than this (in ms) are considered laggy
+static const double targetLatency = 100;
+// Time (in ms) we can spend decoding each update before we ask the
+// server for something cheaper to decode
+static const double decodeBudget = 16;
+
+// Compression is only worth it if it saves more time than it costs, so
+// the level goes up one step each time the throughput halves from this
+static const double fastBps = 32000000;
+
+// Hysteresis
+static const double qualityDeadband = 8;
+static const double compressDeadband = 0.75;
+static const unsigned minChangeInterval = 1000; // ms
+static const unsigned long long fullColourOn = 320000;
+static const unsigned long long fullColourOff = 192000;
+
+QualityController::QualityController()
+{
+  reset();
+}
+
+void QualityController::reset()
+{
+  initialised = false;
+  avgLatency = 0;
+  avgDecodeTime = 0;
+  fullColour = true;
+  quality = -1;
+  subsampling = rfb::subsampleUndefined;
+  compressLevel = -1;
+}
+
+bool QualityController::update(const struct timeval& now,
+                               unsigned long long bps,
+                               unsigned latency, unsigned decodeTime)
+{
+  double score, compress;
+  bool decodeBound;
+  bool newFullColour;
+  int newQuality, newSubsampling, newCompressLevel;
+
+  if (bps == 0)
+    bps = 1;
+
+  // Single updates vary a lot, so look at the trend
+  if (!initialised) {
+    avgLatency = latency;
+    avgDecodeTime = decodeTime;
+  } else {
+    avgLatency += (latency - avgLatency) / 8;
+    avgDecodeTime += (decodeTime - avgDecodeTime) / 8;
+  }
+
+  if (initialised && (rfb::msBetween(&lastChange, &now) < minChangeInterval))
+    return false;
+
+  score = 20 + log(bps / baseBps) / log(2.0) * qualityPerDoubling;
+  score = __rfbmin(score, maxQuality);
+
+  if (avgLatency > targetLatency)
+    score -= 20 * __rfbmin(avgLatency / targetLatency - 1, 3.0);
+
+  decodeBound = avgDecodeTime > decodeBudget;
+  if (decodeBound)
+    score -= 10 * __rfbmin(avgDecodeTime / decodeBudget - 1, 3.0);
+
+  score = __rfbmax(score, minQuality);
+  score = __rfbmin(score, maxQuality);
+
+  compress = 1 + log(fastBps / bps) / log(2.0);
+  compress = __rfbmax(compress, 1.0);
+  compress = __rfbmin(compress, 9.0);
+
+  newFullColour = fullColour;
+  if (bps > fullColourOn)
+    newFullColour = true;
+  else if (bps < fullColourOff)
+    newFullColour = false;
+
+  newQuality = quality;
+  if (!initialised || (fabs(score - quality) >= qualityDeadband))
+    newQuality = (int)(score + 0.5);
+
+  newCompressLevel = compressLevel;
+  if (!initialised || (fabs(compress - compressLevel) > compressDeadband))
+    newCompressLevel = (int)(compress + 0.5);
+
+  // Chroma subsampling mostly saves bandwidth at low qualities, but it
+  // also makes things cheaper to decode
+  if (newQuality >= 80)
+    newSubsampling = rfb::subsampleNone;
+  else if (newQuality >= 50)
+    newSubsampling = rfb::subsample2X;
+  else
+    newSubsampling = rfb::subsample4X;
+  if (decodeBound) {
+    if (newSubsampling == rfb::subsampleNone)
+      newSubsampling = rfb::subsample2X;
+    else
+      newSubsampling = rfb::subsample4X;
+  }
+
+  initialised = true;
+
+  if ((newFullColour == fullColour) && (newQuality == quality) &&
+      (newSubsampling == subsampling) &&
+      (newCompressLevel == compressLevel))
+    return false;
+
+  fullColour = newFullColour;
+  quality = newQuality;
+  subsampling = newSubsampling;
+  compressLevel = newCompressLevel;
+
+  lastChange = now;
+
+  return true;
+}
+
+int QualityController::getQualityLevel() const
+{
+  int level;
+
+  if (quality < 0)
+    return -1;
+
+  // Servers that don't understand the fine quality setting get the
+  // closest classical level that doesn't exceed it
+  for (level = 9; level > 0; level--) {
+    if (levelQuality[level] <= quality)
+      break;
+  }
+
+  return level;
+}
@@ -0,0 +1,66 @@
+/* Copyright (C) 2026 TigerVNC Team
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ * USA.
+ */
+
+//
+// QualityController picks the encoding settings used when AutoSelect
+// is enabled. A quality score is derived from the measured throughput
+// and is then lowered if updates take too long to arrive or to
+// decode. New settings are only reported once the score has moved far
+// enough, and not too often, so that they don't flap back and forth.
+//
+
+#ifndef __QUALITYCONTROLLER_H__
+#define __QUALITYCONTROLLER_H__
+
+#include <sys/time.h>
+
+class QualityController {
+public:
+  QualityController();
+
+  // reset() forgets all settings and measurements
+  void reset();
+
+  // update() feeds the controller with the measurements from one
+  // framebuffer update. bps is the current throughput estimate,
+  // latency the time the update took from start to end and decodeTime
+  // how long we had to wait for the decoders, both in milliseconds.
+  // Returns true if any setting has changed.
+  bool update(const struct timeval& now, unsigned long long bps,
+              unsigned latency, unsigned decodeTime);
+
+  bool getFullColour() const { return fullColour; }
+  int getQualityLevel() const;
+  int getFineQualityLevel() const { return quality; }
+  int getSubsampling() const { return subsampling; }
+  int getCompressLevel() const { return compressLevel; }
+
+private:
+  bool initialised;
+  struct timeval lastChange;
+
+  double avgLatency;
+  double avgDecodeTime;
+
+  bool fullColour;
+  int quality;
+  int subsampling;
+  int compressLevel;
+};
+
+#endif
@@ -113,22 +113,29 @@ static CGContextRef make_bitmap(int width, int height, unsigned char* data)
 }
 
 void Surface::clear(unsigned char r, unsigned char g, unsigned char b, unsigned char a)
+{
+  fill(0, 0, width(), height(), r, g, b, a);
+}
+
+void Surface::fill(int x, int y, int w, int h,
+                   unsigned char r, unsigned char g, unsigned char b, unsigned char a)
 {
   unsigned char* out;
-  int x, y;
+  int tx, ty;
 
   r = (unsigned)r * a / 255;
   g = (unsigned)g * a / 255;
   b = (unsigned)b * a / 255;
 
-  out = data;
-  for (y = 0;y < width();y++) {
-    for (x = 0;x < height();x++) {
+  out = data + (y * width() + x) * 4;
+  for (ty = 0;ty < h;ty++) {
+    for (tx = 0;tx < w;tx++) {
       *out++ = b;
       *out++ = g;
       *out++ = r;
       *out++ = a;
     }
+    out += (width() - w) * 4;
   }
 }
 
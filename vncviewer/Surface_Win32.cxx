@@ -26,23 +26,30 @@
 #include "Surface.h"
 
 void Surface::clear(unsigned char r, unsigned char g, unsigned char b, unsigned char a)
+{
+  fill(0, 0, width(), height(), r, g, b, a);
+}
+
+void Surface::fill(int x, int y, int w, int h,
+                   unsigned char r, unsigned char g, unsigned char b, unsigned char a)
 {
   RGBQUAD* out;
-  int x, y;
+  int tx, ty;
 
   r = (unsigned)r * a / 255;
   g = (unsigned)g * a / 255;
   b = (unsigned)b * a / 255;
 
-  out = data;
-  for (y = 0;y < width();y++) {
-    for (x = 0;x < height();x++) {
+  out = data + y * width() + x;
+  for (ty = 0;ty < h;ty++) {
+    for (tx = 0;tx < w;tx++) {
       out->rgbRed = r;
       out->rgbGreen = g;
       out->rgbBlue = b;
       out->rgbReserved = a;
       out++;
     }
+    out += width() - w;
   }
 }
 
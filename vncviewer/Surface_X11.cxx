@@ -26,6 +26,12 @@
 #include "Surface.h"
 
 void Surface::clear(unsigned char r, unsigned char g, unsigned char b, unsigned char a)
+{
+  fill(0, 0, width(), height(), r, g, b, a);
+}
+
+void Surface::fill(int x, int y, int w, int h,
+                   unsigned char r, unsigned char g, unsigned char b, unsigned char a)
 {
   XRenderColor color;
 
@@ -35,7 +41,7 @@ void Surface::clear(unsigned char r, unsigned char g, unsigned char b, unsigned
   color.alpha = (unsigned)a * 65535 / 255;
 
   XRenderFillRectangle(fl_display, PictOpSrc, picture, &color,
-                       0, 0, width(), height());
+                       x, y, w, h);
 }
 
 void Surface::draw(int src_x, int src_y, int x, int y, int w, int h)
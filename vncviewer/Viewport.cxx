@@ -29,6 +29,7 @@
 #include <rfb/LogWriter.h>
 #include <rfb/Exception.h>
 #include <rfb/ledStates.h>
+#include <rfb/ScaleFilters.h>
 
 // FLTK can pull in the X11 headers on some systems
 #ifndef XK_VoidSymbol
@@ -168,6 +169,7 @@ Viewport::Viewport(int w, int h, const rfb::PixelFormat& serverPF, CConn* cc_)
 
   frameBuffer = new PlatformPixelBuffer(w, h);
   assert(frameBuffer);
+  frameBuffer->setDamageCallback(handleFramebufferDamage, this);
   cc->setFramebuffer(frameBuffer);
 
   contextMenu = new Fl_Menu_Button(0, 0, 0, 0);
@@ -227,10 +229,34 @@ const rfb::PixelFormat &Viewport::getPreferredPF()
 
 void Viewport::updateWindow()
 {
-  Rect r;
+  rfb::Region region;
+  std::vector<Rect> rects;
+  std::vector<Rect>::const_iterator iter;
+
+  region = frameBuffer->getDamage();
+
+  region.get_rects(&rects);
+  for (iter = rects.begin(); iter != rects.end(); ++iter) {
+    damage(FL_DAMAGE_USER1, iter->tl.x + x(), iter->tl.y + y(),
+           iter->width(), iter->height());
+  }
+
+  region.translate(Point(x(), y()));
+  changedArea.assign_union(region);
+}
+
+rfb::Region Viewport::getChangedArea()
+{
+  rfb::Region region;
+
+  region = changedArea;
+  changedArea.clear();
 
-  r = frameBuffer->getDamage();
-  damage(FL_DAMAGE_USER1, r.tl.x + x(), r.tl.y + y(), r.width(), r.height());
+  // FLTK might also want us redrawn for its own reasons
+  if (damage() & ~FL_DAMAGE_USER1)
+    region.assign_union(rfb::Region(Rect(x(), y(), x() + w(), y() + h())));
+
+  return region;
 }
 
 static const char * dotcursor_xpm[] = {
@@ -515,16 +541,17 @@ void Viewport::pushLEDState()
 }
 
 
-void Viewport::draw(Surface* dst)
+void Viewport::draw(Surface* dst, int X, int Y, int W, int H)
 {
-  int X, Y, W, H;
+  Rect r;
 
-  // Check what actually needs updating
-  fl_clip_box(x(), y(), w(), h(), X, Y, W, H);
-  if ((W == 0) || (H == 0))
+  r.setXYWH(X, Y, W, H);
+  r = r.intersect(Rect(x(), y(), x() + w(), y() + h()));
+  if (r.is_empty())
     return;
 
-  frameBuffer->draw(dst, X - x(), Y - y(), X, Y, W, H);
+  frameBuffer->draw(dst, r.tl.x - x(), r.tl.y - y(),
+                    r.tl.x, r.tl.y, r.width(), r.height());
 }
 
 
@@ -543,13 +570,46 @@ void Viewport::draw()
 
 void Viewport::resize(int x, int y, int w, int h)
 {
-  if ((w != frameBuffer->width()) || (h != frameBuffer->height())) {
-    vlog.debug("Resizing framebuffer from %dx%d to %dx%d",
-               frameBuffer->width(), frameBuffer->height(), w, h);
+  int fbWidth, fbHeight;
+
+  // The remote framebuffer gets scaled to our size if they differ
+  fbWidth = cc->server.width();
+  fbHeight = cc->server.height();
+
+  if ((fbWidth != frameBuffer->width()) ||
+      (fbHeight != frameBuffer->height()) ||
+      (w != frameBuffer->Surface::width()) ||
+      (h != frameBuffer->Surface::height())) {
+    int oldDivisor;
 
-    frameBuffer = new PlatformPixelBuffer(w, h);
+    vlog.debug("Resizing framebuffer from %dx%d to %dx%d",
+               frameBuffer->width(), frameBuffer->height(),
+               fbWidth, fbHeight);
+
+    oldDivisor = frameBuffer->getDisplayDivisor();
+
+    if ((w == fbWidth) && (h == fbHeight)) {
+      frameBuffer = new PlatformPixelBuffer(w, h);
+      frameBuffer->setDamageCallback(handleFramebufferDamage, this);
+      cc->setFramebuffer(frameBuffer);
+    } else if (frameBuffer->isScaled() &&
+               (fbWidth == frameBuffer->width()) &&
+               (fbHeight == frameBuffer->height())) {
+      // Only the window changed, which happens a lot while the user
+      // is resizing it, so keep the remote pixels where they are
+      frameBuffer->setScaledSize(w, h, getScalingFilter());
+      updateWindow();
+    } else {
+      frameBuffer = new PlatformPixelBuffer(fbWidth, fbHeight, w, h,
+                                            getScalingFilter());
+      frameBuffer->setDamageCallback(handleFramebufferDamage, this);
+      cc->setFramebuffer(frameBuffer);
+    }
     assert(frameBuffer);
-    cc->setFramebuffer(frameBuffer);
+
+    // The old contents might lack detail that we can now show
+    if (frameBuffer->getDisplayDivisor() < oldDivisor)
+      cc->refreshFramebuffer();
   }
 
   Fl_Widget::resize(x, y, w, h);
@@ -807,10 +867,38 @@ void Viewport::flushPendingClipboard()
 
 void Viewport::handlePointerEvent(const rfb::Point& pos, int buttonMask)
 {
-  filterPointerEvent(pos, buttonMask);
+  rfb::Point fbPos;
+
+  // The framebuffer might be scaled
+  fbPos.x = pos.x * frameBuffer->width() / w();
+  fbPos.y = pos.y * frameBuffer->height() / h();
+
+  filterPointerEvent(fbPos, buttonMask);
 }
 
 
+unsigned int Viewport::getScalingFilter()
+{
+  if (strcasecmp(scalingFilter, "Nearest") == 0)
+    return scaleFilterNearestNeighbor;
+  if (strcasecmp(scalingFilter, "Bicubic") == 0)
+    return scaleFilterBicubic;
+
+  if (strcasecmp(scalingFilter, "Bilinear") != 0)
+    vlog.error(_("Unknown scaling filter \"%s\""),
+               (const char*)scalingFilter);
+
+  return scaleFilterBilinear;
+}
+
+
+void Viewport::handleFramebufferDamage(void *data)
+{
+  Viewport *self = (Viewport *)data;
+
+  self->updateWindow();
+}
+
 void Viewport::handlePointerTimeout(void *data)
 {
   Viewport *self = (Viewport *)data;
@@ -890,6 +978,7 @@ void Viewport::handleKeyPress(int keyCode, rdr::U32 keySym)
       cc->writer()->writeKeyEvent(keySym, 0, true);
     else
       cc->writer()->writeKeyEvent(keySym, keyCode, true);
+    cc->sendLatencyProbe();
   } catch (rdr::Exception& e) {
     vlog.error("%s", e.str());
     exit_vncviewer(_("An unexpected error occurred when communicating "
@@ -23,6 +23,7 @@
 #include <map>
 
 #include <rfb/Rect.h>
+#include <rfb/Region.h>
 
 #include <FL/Fl_Widget.H>
 
@@ -54,7 +55,11 @@ public:
   // Change client LED state
   void setLEDState(unsigned int state);
 
-  void draw(Surface* dst);
+  // Areas that have changed since the last call, in the coordinates
+  // of the parent window
+  rfb::Region getChangedArea();
+
+  void draw(Surface* dst, int X, int Y, int W, int H);
 
   // Clipboard events
   void handleClipboardRequest();
@@ -89,6 +94,9 @@ private:
 
   static int handleSystemEvent(void *event, void *data);
 
+  static unsigned int getScalingFilter();
+  static void handleFramebufferDamage(void *data);
+
 #ifdef WIN32
   static void handleAltGrTimeout(void *data);
   void resolveAltGrDetection(bool isAltGrSequence);
@@ -107,6 +115,7 @@ private:
   CConn* cc;
 
   PlatformPixelBuffer* frameBuffer;
+  rfb::Region changedArea;
 
   rfb::Point lastPointerPos;
   int lastButtonMask;
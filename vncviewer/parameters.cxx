@@ -69,6 +69,14 @@ BoolParameter alertOnFatalError("AlertOnFatalError",
                                 "Give a dialog on connection problems rather "
                                 "than exiting immediately", true);
 
+BoolParameter measureInputLatency("MeasureInputLatency",
+                                  "Measure the time from key presses until "
+                                  "the result is on screen. (Does not work "
+                                  "with all servers)", false);
+StringParameter statsLog("StatsLog",
+                         "Append performance statistics to this file "
+                         "as CSV every half second", "");
+
 StringParameter passwordFile("PasswordFile",
                              "Password file for VNC authentication", "");
 AliasParameter passwd("passwd", "Alias for PasswordFile", &passwordFile);
@@ -117,6 +125,21 @@ BoolParameter remoteResize("RemoteResize",
                            "Dynamically resize the remote desktop size as "
                            "the size of the local client window changes. "
                            "(Does not work with all servers)", true);
+BoolParameter scaleToWindow("ScaleToWindow",
+                            "Scale the remote desktop to fit the local "
+                            "client window instead of showing scrollbars",
+                            false);
+StringParameter scalingFilter("ScalingFilter",
+                              "Filter used when scaling the remote desktop "
+                              "(Nearest, Bilinear or Bicubic)", "Bilinear");
+IntParameter serverScale("ServerScale",
+                         "Ask the server to scale the remote desktop down "
+                         "by this factor before sending it, 1 to 8. "
+                         "(Does not work with all servers)", 1, 1, 8);
+BoolParameter udpTransport("UDPTransport",
+                           "Allow the server to send lossy content as UDP "
+                           "datagrams next to the normal connection. "
+                           "(Does not work with all servers)", false);
 
 BoolParameter viewOnly("ViewOnly",
                        "Don't send any mouse or keyboard events to the server",
@@ -178,6 +201,10 @@ static VoidParameter* parameterArray[] = {
   &fullScreenAllMonitors,
   &desktopSize,
   &remoteResize,
+  &scaleToWindow,
+  &scalingFilter,
+  &serverScale,
+  &udpTransport,
   &viewOnly,
   &shared,
   &acceptClipboard,
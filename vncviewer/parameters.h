@@ -53,6 +53,10 @@ extern rfb::BoolParameter fullScreenAllMonitors;
 extern rfb::StringParameter desktopSize;
 extern rfb::StringParameter geometry;
 extern rfb::BoolParameter remoteResize;
+extern rfb::BoolParameter scaleToWindow;
+extern rfb::StringParameter scalingFilter;
+extern rfb::IntParameter serverScale;
+extern rfb::BoolParameter udpTransport;
 
 extern rfb::BoolParameter listenMode;
 
@@ -71,6 +75,8 @@ extern rfb::StringParameter menuKey;
 
 extern rfb::BoolParameter fullscreenSystemKeys;
 extern rfb::BoolParameter alertOnFatalError;
+extern rfb::BoolParameter measureInputLatency;
+extern rfb::StringParameter statsLog;
 
 #ifndef WIN32
 extern rfb::StringParameter via;
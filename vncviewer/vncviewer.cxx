@@ -401,6 +401,25 @@ static void usage(const char *programName)
   exit(1);
 }
 
+static bool
+isParamArg(const char *arg, VoidParameter *param)
+{
+  const char *equal;
+  size_t len;
+
+  while (*arg == '-')
+    arg++;
+
+  equal = strchr(arg, '=');
+  if (equal)
+    len = equal - arg;
+  else
+    len = strlen(arg);
+
+  return (strlen(param->getName()) == len) &&
+         (strncasecmp(arg, param->getName(), len) == 0);
+}
+
 static void
 potentiallyLoadConfigurationFile(char *vncServerName)
 {
@@ -557,6 +576,8 @@ int main(int argc, char** argv)
     vlog.error("%s", e.str());
   }
 
+  bool compressLevelGiven = false;
+
   for (int i = 1; i < argc;) {
     /* We need to resolve an ambiguity for booleans */
     if (argv[i][0] == '-' && i+1 < argc) {
@@ -579,6 +600,8 @@ int main(int argc, char** argv)
     }
 
     if (Configuration::setParam(argv[i])) {
+      if (isParamArg(argv[i], &compressLevel))
+        compressLevelGiven = true;
       i++;
       continue;
     }
@@ -586,6 +609,8 @@ int main(int argc, char** argv)
     if (argv[i][0] == '-') {
       if (i+1 < argc) {
         if (Configuration::setParam(&argv[i][1], argv[i+1])) {
+          if (isParamArg(argv[i], &compressLevel))
+            compressLevelGiven = true;
           i += 2;
           continue;
         }
@@ -599,6 +624,11 @@ int main(int argc, char** argv)
     i++;
   }
 
+  // Specifying a compression level implies that it should be used,
+  // rather than one picked automatically
+  if (compressLevelGiven)
+    customCompressLevel.setParam(true);
+
 #if !defined(WIN32) && !defined(__APPLE__)
   if (strcmp(display, "") != 0) {
     Fl::display(display);